@@ -82,11 +82,19 @@ void MBAACC_CG::copy_cells(const MBAACC_CG_Image *image,
 	int x = align->source_x / 0x10;
 	int y = align->source_y / 0x10;
 	int cell_n = (y * 0x10) + x;
-	Image *im = &m_image_table[align->source_image];
+	const Image *im = get_cells(align->source_image);
+	
+	if (!im) {
+		return;
+	}
 	
 	for (int a = 0; a < h; ++a) {
 		for (int b = 0 ; b < w; ++b) {
-			ImageCell *cell = &im->cell[cell_n + b];
+			if ((unsigned int)(cell_n + b) >= 0x100) {
+				continue;
+			}
+			
+			const ImageCell *cell = &im->cell[cell_n + b];
 			
 			if (cell->start == 0) {
 				continue;
@@ -100,7 +108,7 @@ void MBAACC_CG::copy_cells(const MBAACC_CG_Image *image,
 			
 			if (is_8bpp) {
 				// 8bpp -> 8bpp
-				unsigned char *src = ((unsigned char *)m_data) + cell->start + cell->offset;
+				const unsigned char *src = ((const unsigned char *)m_data) + cell->start + cell->offset;
 				int cellw = cell->width;
 				
 				dest += offset;
@@ -116,7 +124,7 @@ void MBAACC_CG::copy_cells(const MBAACC_CG_Image *image,
 			} else if (image->type_id == 4) {
 				// two pass: first 8bit palettized, second 8bit alpha
 				unsigned int *ldest = (unsigned int *)dest;
-				unsigned char *src = ((unsigned char *)m_data) + cell->start + cell->offset;
+				const unsigned char *src = ((const unsigned char *)m_data) + cell->start + cell->offset;
 				int cellw = cell->width;
 				
 				ldest += offset;
@@ -133,7 +141,7 @@ void MBAACC_CG::copy_cells(const MBAACC_CG_Image *image,
 				ldest = (unsigned int *)dest;
 				ldest += offset;
 				
-				src = ((unsigned char *)m_data) + cell->start + cell->offset;
+				src = ((const unsigned char *)m_data) + cell->start + cell->offset;
 				src += align->width * align->height;
 
 				for (int c = 0; c < 0x10; ++c) {
@@ -147,7 +155,7 @@ void MBAACC_CG::copy_cells(const MBAACC_CG_Image *image,
 			} else if (image->type_id == 1) {
 				// 32bpp bgr -> rgb
 				unsigned int *ldest = (unsigned int *)dest;
-				unsigned int *src = (unsigned int *)(m_data + cell->start + cell->offset);
+				const unsigned int *src = (const unsigned int *)(m_data + cell->start + cell->offset);
 				int cellw = cell->width;
 				
 				ldest += offset;
@@ -165,7 +173,7 @@ void MBAACC_CG::copy_cells(const MBAACC_CG_Image *image,
 			} else {
 				// palettized 8bpp -> 32bpp
 				unsigned int *ldest = (unsigned int *)dest;
-				unsigned char *src = ((unsigned char *)m_data) + cell->start + cell->offset;
+				const unsigned char *src = ((const unsigned char *)m_data) + cell->start + cell->offset;
 				int cellw = cell->width;
 				
 				ldest += offset;
@@ -186,7 +194,8 @@ void MBAACC_CG::copy_cells(const MBAACC_CG_Image *image,
 }
 			
 
-Texture *MBAACC_CG::draw_texture(unsigned int n, unsigned int *palette, bool to_pow2_flg, bool draw_8bpp) {
+bool MBAACC_CG::decode_image(unsigned int n, unsigned int *palette, bool to_pow2_flg, bool draw_8bpp,
+				MBAACC_DecodedImage *decoded) {
 	const MBAACC_CG_Image *image = get_image(n);
 	if (!image) {
 		return 0;
@@ -266,21 +275,72 @@ Texture *MBAACC_CG::draw_texture(unsigned int n, unsigned int *palette, bool to_
 		copy_cells(image, align, pixels, x1, y1, width, height, palette, is_8bpp);
 	}
 	
-	// finalize in texture
-	Texture *texture = new Texture();
+	decoded->pixels = pixels;
+	decoded->width = width;
+	decoded->height = height;
+	decoded->offset_x = image->bounds_x1*2;
+	decoded->offset_y = image->bounds_y1*2;
+	decoded->is_8bpp = is_8bpp;
 	
-	if (!texture->init(pixels, width, height, is_8bpp)) {
-		delete texture;
-		delete[] pixels;
-		texture = 0;
-	} else {
-		texture->offset(image->bounds_x1*2, image->bounds_y1*2);
+	return 1;
+}
+
+const MBAACC_DecodedImage *MBAACC_CG::get_decoded_image(unsigned int n, unsigned int *palette, bool to_pow2_flg) {
+	CacheKey key;
+	key.n = n;
+	key.palette = palette;
+	key.to_pow2 = to_pow2_flg;
+	
+	std::map<CacheKey, CacheList::iterator>::iterator it = m_cache_index.find(key);
+	
+	if (it != m_cache_index.end()) {
+		m_cache.splice(m_cache.begin(), m_cache, it->second);
+		
+		return &m_cache.front().image;
+	}
+	
+	CacheEntry entry;
+	entry.key = key;
+	
+	if (!decode_image(n, palette, to_pow2_flg, 0, &entry.image)) {
+		return 0;
 	}
+	
+	entry.size = entry.image.width * entry.image.height * 4;
+	
+	// make room for it, the newest one is always kept
+	trim_cache(entry.size < m_cache_budget ? m_cache_budget - entry.size : 0);
+	
+	m_cache.push_front(entry);
+	m_cache_index[key] = m_cache.begin();
+	m_cache_size += entry.size;
+	
+	return &m_cache.front().image;
+}
+
+void MBAACC_CG::trim_cache(unsigned int budget) {
+	while (!m_cache.empty() && m_cache_size > budget) {
+		CacheEntry &entry = m_cache.back();
+		
+		delete[] entry.image.pixels;
 		
-	return texture;
+		m_cache_size -= entry.size;
+		m_cache_index.erase(entry.key);
+		m_cache.pop_back();
+	}
+}
+
+void MBAACC_CG::flush_cache() {
+	trim_cache(0);
 }
 
-void MBAACC_CG::build_image_table() {
+void MBAACC_CG::set_cache_budget(unsigned int bytes) {
+	m_cache_budget = bytes;
+	
+	trim_cache(bytes);
+}
+
+void MBAACC_CG::index_cells() {
 	// Go through the entire align table and figure out
 	// how many images there are supposed to be.
 	int max_image = 0;
@@ -292,13 +352,11 @@ void MBAACC_CG::build_image_table() {
 	}
 	max_image += 1;
 	
-	// Create new image table and initialize it.
-	m_image_table = new Image[max_image];
 	m_image_count = max_image;
 	
-	memset(m_image_table, 0, sizeof(Image) * m_image_count);
-	
-	// Go through and initialize all the cells.
+	// Go through all the cells in the order the whole table used
+	// to be built, so later cells still replace earlier ones.
+	std::vector<CellSource> sources;
 	
 	for (unsigned int i = 0; i < 0x3000; ++i) {
 		const MBAACC_CG_Image *image = get_image(i);
@@ -311,7 +369,8 @@ void MBAACC_CG::build_image_table() {
 			continue;
 		}
 		
-		const MBAACC_CG_Alignment *align = &m_align[image->align_start];
+		unsigned int align_n = image->align_start;
+		const MBAACC_CG_Alignment *align = &m_align[align_n];
 		unsigned int address = ((const char *)image->data) - m_data;
 		
 		if (image->bpp == 32) {
@@ -322,50 +381,114 @@ void MBAACC_CG::build_image_table() {
 			}
 		}
 		
-		for (unsigned int j = 0; j < image->align_len; ++j, ++align) {
+		for (unsigned int j = 0; j < image->align_len; ++j, ++align, ++align_n) {
 			if (align->copy_flag != 0) {
 				continue;
 			}
 			
-			int w = align->width / 0x10;
-			int h = align->height / 0x10;
-			int x = align->source_x / 0x10;
-			int y = align->source_y / 0x10;
-			int cell_n = (y * 0x10) + x;
-			Image *im = &m_image_table[align->source_image];
-			
-			if (x + w >= 0x10) {
-				w = 0x10 - x;
-			}
-			if (y + h >= 0x10) {
-				h = 0x10 - y;
+			if (align->source_image >= 0) {
+				CellSource source;
+				
+				source.align = align_n;
+				source.address = address;
+				source.type_id = image->type_id;
+				source.bpp = image->bpp;
+				
+				sources.push_back(source);
 			}
 			
 			int mult = 1;
 			if (image->type_id == 1) {
 				mult = 4;
-			}
-			
-			for (int a = 0; a < h; ++a) {
-				ImageCell *cell = &im->cell[cell_n];
-				for (int b = 0; b < w; ++b, ++cell) {
-					cell->start = address;
-					cell->width = align->width;
-					cell->height = align->height;
-					cell->offset = (b * 0x10) + (a * align->width * 0x10) * mult;
-					cell->type_id = image->type_id;
-					cell->bpp = image->bpp;
-				}
-				cell_n += 0x10;
-			}
-			
-			if (image->type_id == 4) {
+			} else if (image->type_id == 4) {
 				mult = 2;
 			}
 			
 			address += align->width * align->height * mult;
 		}
 	}
+	
+	// group them by source image, keeping the order
+	m_cell_source_start.assign(m_image_count + 1, 0);
+	
+	for (unsigned int i = 0; i < sources.size(); ++i) {
+		m_cell_source_start[m_align[sources[i].align].source_image + 1] += 1;
+	}
+	
+	for (unsigned int i = 0; i < m_image_count; ++i) {
+		m_cell_source_start[i + 1] += m_cell_source_start[i];
+	}
+	
+	std::vector<unsigned int> next(m_cell_source_start.begin(), m_cell_source_start.end() - 1);
+	
+	m_cell_sources.resize(sources.size());
+	
+	for (unsigned int i = 0; i < sources.size(); ++i) {
+		m_cell_sources[next[m_align[sources[i].align].source_image]++] = sources[i];
+	}
+	
+	m_image_table.assign(m_image_count, (Image *)0);
+	m_table_size = 0;
+}
+
+const MBAACC_CG::Image *MBAACC_CG::get_cells(int n) {
+	if (n < 0 || (unsigned int)n >= m_image_count) {
+		return 0;
+	}
+	
+	if (m_image_table[n]) {
+		return m_image_table[n];
+	}
+	
+	Image *im = new Image;
+	
+	memset(im, 0, sizeof(Image));
+	
+	for (unsigned int i = m_cell_source_start[n]; i < m_cell_source_start[n + 1]; ++i) {
+		const CellSource *source = &m_cell_sources[i];
+		const MBAACC_CG_Alignment *align = &m_align[source->align];
+		
+		int w = align->width / 0x10;
+		int h = align->height / 0x10;
+		int x = align->source_x / 0x10;
+		int y = align->source_y / 0x10;
+		int cell_n = (y * 0x10) + x;
+		
+		if (x + w >= 0x10) {
+			w = 0x10 - x;
+		}
+		if (y + h >= 0x10) {
+			h = 0x10 - y;
+		}
+		
+		int mult = 1;
+		if (source->type_id == 1) {
+			mult = 4;
+		}
+		
+		for (int a = 0; a < h; ++a) {
+			for (int b = 0; b < w; ++b) {
+				if ((unsigned int)(cell_n + b) >= 0x100) {
+					continue;
+				}
+				
+				ImageCell *cell = &im->cell[cell_n + b];
+				
+				cell->start = source->address;
+				cell->width = align->width;
+				cell->height = align->height;
+				cell->offset = (b * 0x10) + (a * align->width * 0x10) * mult;
+				cell->type_id = source->type_id;
+				cell->bpp = source->bpp;
+			}
+			cell_n += 0x10;
+		}
+	}
+	
+	m_image_table[n] = im;
+	m_table_size += sizeof(Image);
+	
+	return im;
 }
 
 bool MBAACC_CG::load(MBAACC_Pack *pack, const char *name) {
@@ -373,33 +496,31 @@ bool MBAACC_CG::load(MBAACC_Pack *pack, const char *name) {
 		return 0;
 	}
 	
-	char *data;
+	const char *data;
 	unsigned int size;
 	
-	if (!pack->read_file(name, &data, &size)) {
+	// mapped in place, only the cells of the drawn images are looked at
+	data = pack->map_file(name, &size);
+	if (!data) {
 		return 0;
 	}
 	
 	// verify size and header
 	if (size < 0x4f30 || memcmp(data, "BMP Cutter3", 11)) {
-		delete[] data;
-		
 		return 0;
 	}
 	
 	// palette data.
 	// we always use external palettes, so skip this.
-	unsigned int *d = (unsigned int *)(data + 0x10);
+	const unsigned int *d = (const unsigned int *)(data + 0x10);
 	d += 1;		// has palette data?
 	d += 0x800;	// palette data - always included.
 	
 	// 'parse' header
-	unsigned int *indices = d + 12;
+	const unsigned int *indices = d + 12;
 	unsigned int image_count = d[3];
 	
-	if (image_count >= 2999) {
-		delete[] data;
-		
+	if (image_count >= 2999 || indices[3000] > size) {
 		return 0;
 	}
 	
@@ -407,8 +528,6 @@ bool MBAACC_CG::load(MBAACC_Pack *pack, const char *name) {
 	int align_count = (size - indices[3000]) / sizeof(MBAACC_CG_Alignment);
 	
 	if (align_count <= 0) {
-		delete[] data;
-		
 		return 0;
 	}
 	
@@ -425,8 +544,8 @@ bool MBAACC_CG::load(MBAACC_Pack *pack, const char *name) {
 	
 	// but wait, there's more!
 	// because of the compression added to AACC, we need to go create
-	// an image table for this crap.
-	build_image_table();
+	// an image table for this crap. it's filled in as images are drawn.
+	index_cells();
 	
 	// we're done, so finish up
 	
@@ -436,17 +555,20 @@ bool MBAACC_CG::load(MBAACC_Pack *pack, const char *name) {
 }
 
 void MBAACC_CG::free() {
-	if (m_data) {
-		delete[] m_data;
-	}
+	flush_cache();
+	
 	m_data = 0;
 	m_data_size = 0;
 	
-	if (m_image_table) {
-		delete[] m_image_table;
+	for (unsigned int i = 0; i < m_image_table.size(); ++i) {
+		delete m_image_table[i];
 	}
-	m_image_table = 0;
+	m_image_table.clear();
 	m_image_count = 0;
+	m_table_size = 0;
+	
+	m_cell_sources.clear();
+	m_cell_source_start.clear();
 	
 	m_indices = 0;
 	
@@ -466,9 +588,12 @@ MBAACC_CG::MBAACC_CG() {
 	
 	m_nimages = 0;
 	
-	m_image_table = 0;
 	m_image_count = 0;
+	m_table_size = 0;
 	
+	m_cache_size = 0;
+	m_cache_budget = MBAACC_CG_CACHE_BUDGET;
+
 	m_align = 0;
 	m_nalign = 0;
 	
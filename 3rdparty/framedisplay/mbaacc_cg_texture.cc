@@ -0,0 +1,45 @@
+// .CG textures
+//
+// Kept apart from mbaacc_cg.cc, so the decoding builds without GL.
+
+#include "mbaacc_framedisplay.h"
+
+#include <cstring>
+
+Texture *MBAACC_CG::draw_texture(unsigned int n, unsigned int *palette, bool to_pow2_flg, bool draw_8bpp) {
+	MBAACC_DecodedImage decoded;
+	
+	if (draw_8bpp) {
+		// only used for saving, so it skips the cache
+		if (!decode_image(n, palette, to_pow2_flg, 1, &decoded)) {
+			return 0;
+		}
+	} else {
+		const MBAACC_DecodedImage *cached = get_decoded_image(n, palette, to_pow2_flg);
+		
+		if (!cached) {
+			return 0;
+		}
+		
+		// the texture owns its pixels
+		unsigned int size = cached->width * cached->height * 4;
+		
+		decoded = *cached;
+		decoded.pixels = new unsigned char[size];
+		
+		memcpy(decoded.pixels, cached->pixels, size);
+	}
+	
+	// finalize in texture
+	Texture *texture = new Texture();
+	
+	if (!texture->init(decoded.pixels, decoded.width, decoded.height, decoded.is_8bpp)) {
+		delete texture;
+		delete[] decoded.pixels;
+		texture = 0;
+	} else {
+		texture->offset(decoded.offset_x, decoded.offset_y);
+	}
+	
+	return texture;
+}
@@ -215,6 +215,9 @@ void MBAACC_Character::flush_texture(void) {
 		
 		m_texture = 0;
 	}
+	
+	// the palettes were changed in place
+	m_cg.flush_cache();
 }
 
 void MBAACC_Character::render_frame_properties(bool detailed, int scr_width, int scr_height, int seq_id, int fr_id) {
@@ -369,19 +372,22 @@ bool MBAACC_Character::load(MBAACC_Pack *pack, const char *name, int sub_type) {
 		m_framedata.load_move_list(pack, filename);
 	}
 	
-	// read palettes
+	// read palettes, all into one block straight from the pack
 	m_palettes = new unsigned int *[36];
 	for (int i = 0; i < 36; ++i) {
 		m_palettes[i] = 0;
 	}
 	
 	sprintf(filename, "%s.pal", name);
-	char *data;
+	const char *data;
 	unsigned int size;
 	
-	if (pack->read_file(filename, &data, &size)) {
+	data = pack->map_file(filename, &size);
+	if (data && size >= 36 * 1024 + 4) {
+		m_palette_data = new unsigned int[36 * 256];
+		
 		for (int i = 0; i < 36; ++i) {
-			m_palettes[i] = new unsigned int[256];
+			m_palettes[i] = m_palette_data + (i * 256);
 			
 			memcpy(m_palettes[i], data + (i * 1024) + 4, 1024);
 			
@@ -420,7 +426,12 @@ void MBAACC_Character::set_palette(int n) {
 	}
 	
 	if (n != m_active_palette) {
-		flush_texture();
+		// sprites decoded with the other palette stay cached
+		if (m_texture) {
+			delete m_texture;
+			
+			m_texture = 0;
+		}
 		
 		m_active_palette = n;
 	}
@@ -706,18 +717,20 @@ void MBAACC_Character::free_frame_data() {
 	m_framedata.free();
 	
 	if (m_palettes) {
-		for (int i = 0; i < 36; ++i) {
-			if (m_palettes[i]) {
-				delete[] (unsigned char *)m_palettes[i];
-			}
-		}
-		
 		delete[] m_palettes;
 		
 		m_palettes = 0;
 	}
+	if (m_palette_data) {
+		delete[] m_palette_data;
+		
+		m_palette_data = 0;
+	}
 	m_active_palette = 0;
 	
+	// the next palettes can end up at the same addresses
+	m_cg.flush_cache();
+	
 	if (m_texture) {
 		delete m_texture;
 		m_texture = 0;
@@ -744,6 +757,7 @@ void MBAACC_Character::free() {
 
 MBAACC_Character::MBAACC_Character() {
 	m_palettes = 0;
+	m_palette_data = 0;
 	m_active_palette = 0;
 	
 	m_texture = 0;
@@ -344,10 +344,11 @@ bool MBAACC_FrameDisplay::init() {
 }
 
 void MBAACC_FrameDisplay::free() {
-	m_pack.close_pack();
-
+	// the graphics are mapped from the pack
 	m_character_data.free();
 
+	m_pack.close_pack();
+
 	m_character = -1;
 
 	m_subframe = 0;
@@ -4,6 +4,7 @@
 #include <string>
 #include <list>
 #include <map>
+#include <vector>
 
 #include "framedisplay.h"
 
@@ -13,14 +14,30 @@
 
 // ************************************************** mbaacc_cg.cpp
 
+// decoded sprites are kept until they take up this many bytes
+#define MBAACC_CG_CACHE_BUDGET		(64 * 1024 * 1024)
+
 struct MBAACC_CG_Image;
 struct MBAACC_CG_Alignment;
 
+struct MBAACC_DecodedImage {
+	unsigned char		*pixels;
+
+	int			width;
+	int			height;
+
+	int			offset_x;
+	int			offset_y;
+
+	bool			is_8bpp;
+};
+
 class MBAACC_CG {
 protected:
 	bool				m_loaded;
 
-	char				*m_data;
+	// mapped from the pack, so it's never freed here
+	const char			*m_data;
 	unsigned int			m_data_size;
 
 	const unsigned int		*m_indices;
@@ -43,8 +60,52 @@ protected:
 		ImageCell		cell[256];
 	};
 
-	Image				*m_image_table;
+	// where the cells of each source image come from, grouped by
+	// source image. the cell table of an image is only built when
+	// it's first drawn.
+	struct CellSource {
+		unsigned int		align;
+		unsigned int		address;
+		unsigned short		type_id;
+		unsigned short		bpp;
+	};
+
+	std::vector<CellSource>		m_cell_sources;
+	std::vector<unsigned int>	m_cell_source_start;
+
+	std::vector<Image *>		m_image_table;
 	unsigned int			m_image_count;
+	unsigned int			m_table_size;
+
+	// recently decoded sprites, most recently used first
+	struct CacheKey {
+		unsigned int		n;
+		const unsigned int	*palette;
+		bool			to_pow2;
+
+		bool operator<(const CacheKey &other) const {
+			if (n != other.n) {
+				return n < other.n;
+			}
+			if (palette != other.palette) {
+				return palette < other.palette;
+			}
+			return to_pow2 < other.to_pow2;
+		}
+	};
+
+	struct CacheEntry {
+		CacheKey		key;
+		MBAACC_DecodedImage	image;
+		unsigned int		size;
+	};
+
+	typedef std::list<CacheEntry>	CacheList;
+
+	CacheList			m_cache;
+	std::map<CacheKey, CacheList::iterator>	m_cache_index;
+	unsigned int			m_cache_size;
+	unsigned int			m_cache_budget;
 
 	void			copy_cells(
 					const MBAACC_CG_Image *image,
@@ -57,7 +118,11 @@ protected:
 					unsigned int *palette,
 					bool is_8bpp);
 
-	void			build_image_table();
+	void			index_cells();
+
+	const Image		*get_cells(int n);
+
+	void			trim_cache(unsigned int budget);
 
 	const MBAACC_CG_Image	*get_image(unsigned int n);
 public:
@@ -67,10 +132,29 @@ public:
 
 	const char		*get_filename(unsigned int n);
 
+	// the pixels are new and owned by the caller
+	bool			decode_image(unsigned int n,
+					unsigned int *palette, bool to_pow2,
+					bool draw_8bpp, MBAACC_DecodedImage *decoded);
+
+	// RGBA through the cache, valid until the next call or flush
+	const MBAACC_DecodedImage *get_decoded_image(unsigned int n,
+					unsigned int *palette, bool to_pow2);
+
+	// see mbaacc_cg_texture.cc
 	Texture			*draw_texture(unsigned int n,
 					unsigned int *palette, bool to_pow2,
 					bool draw_8bpp = 0);
 
+	// for when the palettes are changed in place
+	void			flush_cache();
+
+	void			set_cache_budget(unsigned int bytes);
+	unsigned int		get_cache_size() const { return m_cache_size; }
+
+	// bytes of cell tables built so far
+	unsigned int		get_table_size() const { return m_table_size; }
+
 	int			get_image_count();
 
 				MBAACC_CG();
@@ -236,6 +320,7 @@ protected:
 	MBAACC_CG	m_cg;
 
 	unsigned int	**m_palettes;
+	unsigned int	*m_palette_data;
 
 	int		m_active_palette;
 
@@ -4,8 +4,18 @@
 
 #include "mbaacc_pack.h"
 
+#include <cctype>
 #include <cstring>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 // decryption function. Only applies to first 4096 bytes of data.
 void decrapt(unsigned char *data, unsigned int size,
 		unsigned int xorkey, unsigned int xormod) {
@@ -32,8 +42,8 @@ void decrapt(unsigned char *data, unsigned int size,
 	}
 	
 	unsigned int *p = (unsigned int *)data;
-	size = (size + 3) / 4;
-	for (unsigned int i = 0; i < size; ++i) {
+	unsigned int words = size / 4;
+	for (unsigned int i = 0; i < words; ++i) {
 		*p++ ^= key_a.key;
 		
 		key_a.b.a += key_b;
@@ -41,17 +51,136 @@ void decrapt(unsigned char *data, unsigned int size,
 		key_a.b.c += key_b;
 		key_a.b.d += key_b;
 	}
+	
+	// the last few bytes on their own, since the data can be
+	// mapped and the next file starts right after it.
+	unsigned char *tail = (unsigned char *)p;
+	for (unsigned int i = 0; i < (size & 3); ++i) {
+		tail[i] ^= (key_a.key >> (i * 8)) & 0xff;
+	}
 }
 
-bool MBAACC_Pack::open_pack(const char *filename) {
-	if (m_file) {
+static std::string to_lower(const char *str, unsigned int max_len) {
+	std::string lower;
+	
+	for (unsigned int i = 0; i < max_len && str[i]; ++i) {
+		lower += (char)tolower((unsigned char)str[i]);
+	}
+	
+	return lower;
+}
+
+bool MBAACC_Pack::map_pack(const char *filename) {
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, 0,
+				OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (file == INVALID_HANDLE_VALUE) {
+		return 0;
+	}
+	
+	DWORD size = GetFileSize(file, 0);
+	
+	HANDLE mapping = 0;
+	if (size != INVALID_FILE_SIZE && size > 0) {
+		mapping = CreateFileMappingA(file, 0, PAGE_WRITECOPY, 0, 0, 0);
+	}
+	CloseHandle(file);
+	
+	if (!mapping) {
 		return 0;
 	}
 	
-	FILE *f;
+	// the view keeps the mapping open
+	void *map = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	CloseHandle(mapping);
+	
+	if (!map) {
+		return 0;
+	}
+#else
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		return 0;
+	}
 	
-	f = fopen(filename, "rb");
-	if (!f) {
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0 || st.st_size > 0xffffffffLL) {
+		close(fd);
+		return 0;
+	}
+	
+	unsigned int size = st.st_size;
+	
+	void *map = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	
+	if (map == MAP_FAILED) {
+		return 0;
+	}
+#endif
+	
+	m_map = (unsigned char *)map;
+	m_map_size = size;
+	
+	return 1;
+}
+
+void MBAACC_Pack::unmap_pack() {
+	if (!m_map) {
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile(m_map);
+#else
+	munmap(m_map, m_map_size);
+#endif
+	
+	m_map = 0;
+	m_map_size = 0;
+}
+
+bool MBAACC_Pack::build_data_index() {
+	// hacky, but it's in the middle so it doesn't matter.
+	unsigned int n = m_folder_index[m_data_folder_id].file_start_id;
+	
+	unsigned int folder = m_data_folder_id + 1;
+	unsigned int n_end;
+	
+	do {
+		if (folder >= m_folder_count) {
+			n_end = m_file_count;
+			break;
+		}
+		
+		n_end = m_folder_index[folder++].file_start_id;
+	} while (n_end == 0);
+	
+	if (n_end > (unsigned int)m_file_count) {
+		n_end = m_file_count;
+	}
+	
+	m_data_files.clear();
+	
+	for (; n < n_end; ++n) {
+		std::string name = to_lower((char *)m_file_index[n].filename,
+						sizeof(m_file_index[n].filename));
+		
+		// the first one wins, like the old linear search
+		m_data_files.insert(std::make_pair(name, n));
+	}
+	
+	m_decrypted.assign(m_file_count, false);
+	
+	return 1;
+}
+
+bool MBAACC_Pack::open_pack(const char *filename) {
+	if (m_map) {
+		return 0;
+	}
+	
+	if (!map_pack(filename)) {
 		return 0;
 	}
 	
@@ -66,25 +195,36 @@ bool MBAACC_Pack::open_pack(const char *filename) {
 		unsigned int unknown[3];
 	} header;
 	
-	if (fread(&header, sizeof(header), 1, f) <= 0) {
-		fclose(f);
+	if (m_map_size < sizeof(header)) {
+		unmap_pack();
 		return 0;
 	}
 	
+	memcpy(&header, m_map, sizeof(header));
+	
 	if (memcmp(header.string, "FilePacHeaderA", 14)) {
-		fclose(f);
+		unmap_pack();
 		return 0;
 	}
 	
 	if (header.folder_count > 10000 || header.file_count > 10000) {
-		fclose(f);
+		unmap_pack();
 		return 0;
 	}
 	
-	// read the folder/file index in
+	unsigned int folder_bytes = header.folder_count * sizeof(FolderIndex);
+	unsigned int file_bytes = header.file_count * sizeof(FileIndex);
+	
+	if (m_map_size - sizeof(header) < folder_bytes + file_bytes
+			|| header.table_size > m_map_size) {
+		unmap_pack();
+		return 0;
+	}
+	
+	// copy the folder/file index out, the names are decrypted in place
 	FolderIndex *folder_index = new FolderIndex[header.folder_count];
 	
-	fread(folder_index, header.folder_count, sizeof(FolderIndex), f);
+	memcpy(folder_index, m_map + sizeof(header), folder_bytes);
 	m_data_folder_id = 32768;
 	
 	for (unsigned int i = 0; i < header.folder_count; ++i) {
@@ -98,13 +238,13 @@ bool MBAACC_Pack::open_pack(const char *filename) {
 	if (m_data_folder_id == 32768) {
 		delete[] folder_index;
 		
-		fclose(f);
+		unmap_pack();
 		
 		return 0;
 	}
 	
 	FileIndex *file_index = new FileIndex[header.file_count];
-	fread(file_index, header.file_count, sizeof(FileIndex), f);
+	memcpy(file_index, m_map + sizeof(header) + folder_bytes, file_bytes);
 	
 	for (unsigned int i = 0; i < header.file_count; ++i) {
 		decrapt(file_index[i].filename, 32, header.xor_key, file_index[i].size);
@@ -116,19 +256,21 @@ bool MBAACC_Pack::open_pack(const char *filename) {
 	m_xor_key = header.xor_key;
 	
 	m_folder_index = folder_index;
+	m_folder_count = header.folder_count;
 	m_file_index = file_index;
-	m_file = f;
+	m_file_count = header.file_count;
+	
+	build_data_index();
 	
 	return 1;
 }
 
 void MBAACC_Pack::close_pack() {
-	if (!m_file) {
+	if (!m_map) {
 		return;
 	}
 	
-	fclose(m_file);
-	m_file = 0;
+	unmap_pack();
 	
 	if (m_folder_index) {
 		delete[] m_folder_index;
@@ -141,54 +283,68 @@ void MBAACC_Pack::close_pack() {
 		m_file_index = 0;
 	}
 	m_file_count = 0;
+	
+	m_data_files.clear();
+	m_decrypted.clear();
 }
 
-bool MBAACC_Pack::read_file(const char *filename, char **dest, unsigned int *dsize) {
-	// hacky, but it's in the middle so it doesn't matter.
-	unsigned int n = m_folder_index[m_data_folder_id].file_start_id;
+const char *MBAACC_Pack::map_file(const char *filename, unsigned int *dsize) {
+	if (!m_map) {
+		return 0;
+	}
 	
-	unsigned int folder = m_data_folder_id + 1;
-	unsigned int n_end;
+	std::map<std::string, unsigned int>::const_iterator it;
 	
-	do {
-		if (folder == m_folder_count) {
-			n_end = m_file_count;
-		} else {
-			n_end = m_folder_index[folder++].file_start_id;
-		}
-	} while (n_end == 0);
+	it = m_data_files.find(to_lower(filename, 0xffffffff));
+	if (it == m_data_files.end()) {
+		return 0;
+	}
 	
-	while (n < n_end) {
-		if (!strcasecmp((char *)m_file_index[n].filename, filename)) {
-			// Found it. Read it in.
-			unsigned char *data = new unsigned char[m_file_index[n].size + 3];
-			
-			fseek(m_file, m_data_start + m_file_index[n].pos, SEEK_SET);
-			
-			int count = fread(data, m_file_index[n].size, 1, m_file);
-			
-			if (count >= 1) {
-				decrapt(data, m_file_index[n].size, m_xor_key, 0x03);
-				
-				data[m_file_index[n].size] = '\0';
-				
-				*dest = (char *)data;
-				*dsize = m_file_index[n].size;
-				
-				return 1;
-			}
-			
-			return 0;
-		}
+	unsigned int n = it->second;
+	unsigned int pos = m_file_index[n].pos;
+	unsigned int size = m_file_index[n].size;
+	
+	if (pos > m_map_size - m_data_start || size > m_map_size - m_data_start - pos) {
+		return 0;
+	}
+	
+	unsigned char *data = m_map + m_data_start + pos;
+	
+	// only the pages of the header get copied
+	if (!m_decrypted[n]) {
+		decrapt(data, size, m_xor_key, 0x03);
 		
-		n += 1;
+		m_decrypted[n] = 1;
 	}
 	
-	return 0;
+	*dsize = size;
+	
+	return (const char *)data;
+}
+
+bool MBAACC_Pack::read_file(const char *filename, char **dest, unsigned int *dsize) {
+	unsigned int size;
+	const char *file = map_file(filename, &size);
+	
+	if (!file) {
+		return 0;
+	}
+	
+	unsigned char *data = new unsigned char[size + 3];
+	
+	memcpy(data, file, size);
+	
+	data[size] = '\0';
+	
+	*dest = (char *)data;
+	*dsize = size;
+	
+	return 1;
 }
 
 MBAACC_Pack::MBAACC_Pack() {
-	m_file = 0;
+	m_map = 0;
+	m_map_size = 0;
 	
 	m_folder_index = 0;
 	m_folder_count = 0;
@@ -3,9 +3,16 @@
 
 #include <cstdio>
 
+#include <map>
+#include <string>
+#include <vector>
+
 class MBAACC_Pack {
 private:
-	FILE		*m_file;
+	// the whole pack is mapped copy-on-write, so files can be
+	// decrypted in place without reading them into the heap.
+	unsigned char	*m_map;
+	unsigned int	m_map_size;
 	
 	struct FolderIndex {
 		unsigned int pos;
@@ -31,10 +38,23 @@ private:
 	
 	FileIndex	*m_file_index;
 	int		m_file_count;
+	
+	// files in the data folder by lower case name
+	std::map<std::string, unsigned int>	m_data_files;
+	
+	std::vector<bool>	m_decrypted;
+	
+	bool		map_pack(const char *filename);
+	void		unmap_pack();
+	
+	bool		build_data_index();
 public:
 	bool		open_pack(const char *filename);
 	void		close_pack();
 	
+	// returns the file in place, valid until the pack is closed.
+	const char	*map_file(const char *filename, unsigned int *size);
+	
 	bool		read_file(const char *filename, char **dest, unsigned int *size);
 	
 			MBAACC_Pack();
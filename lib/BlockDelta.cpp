@@ -0,0 +1,226 @@
+#include "BlockDelta.hpp"
+#include "Compression.hpp"
+#include "StringUtils.hpp"
+#include "Logger.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <unordered_map>
+
+using namespace std;
+
+
+const uint32_t BlockDelta::Download;
+
+
+string UpdateManifest::getHash ( const char *data, size_t size )
+{
+    static const char digits[] = "0123456789abcdef";
+
+    char md5[16];
+    getMD5 ( data, size, md5 );
+
+    string hash ( 2 * sizeof ( md5 ), '0' );
+
+    for ( size_t i = 0; i < sizeof ( md5 ); ++i )
+    {
+        hash [ 2 * i ] = digits [ ( unsigned char ) md5[i] >> 4 ];
+        hash [ 2 * i + 1 ] = digits [ md5[i] & 0xF ];
+    }
+
+    return hash;
+}
+
+UpdateManifest::File UpdateManifest::hashData ( const string& path, const string& data, uint32_t blockSize )
+{
+    ASSERT ( blockSize > 0 );
+
+    File file = { path, uint32_t ( data.size() ), blockSize, getHash ( data.data(), data.size() ), {} };
+
+    for ( size_t i = 0; i < data.size(); i += blockSize )
+        file.blockHashes.push_back ( getHash ( data.data() + i, min<size_t> ( blockSize, data.size() - i ) ) );
+
+    return file;
+}
+
+uint32_t UpdateManifest::getTotalSize() const
+{
+    uint32_t size = 0;
+
+    for ( const File& file : files )
+        size += file.size;
+
+    return size;
+}
+
+string UpdateManifest::str() const
+{
+    ostringstream ss;
+
+    for ( const File& file : files )
+    {
+        ss << "file " << file.size << ' ' << file.blockSize << ' ' << file.hash << ' ' << file.path << '\n';
+
+        for ( const string& hash : file.blockHashes )
+            ss << hash << '\n';
+    }
+
+    return ss.str();
+}
+
+bool UpdateManifest::parse ( const string& text )
+{
+    files.clear();
+
+    istringstream ss ( text );
+    string line;
+
+    while ( getline ( ss, line ) )
+    {
+        line = trimmed ( line );
+
+        if ( line.empty() )
+            continue;
+
+        File file = { "", 0, 0, "", {} };
+        istringstream ls ( line );
+        string type;
+
+        if ( !( ls >> type >> file.size >> file.blockSize >> file.hash ) || type != "file" || file.blockSize == 0
+                || file.hash.size() != 32 )
+        {
+            LOG ( "Invalid manifest line: '%s'", line );
+            files.clear();
+            return false;
+        }
+
+        getline ( ls, file.path );
+        file.path = trimmed ( file.path );
+
+        // Paths are relative to the app folder and can't leave it
+        if ( file.path.empty() || file.path[0] == '/' || file.path.find ( ".." ) != string::npos
+                || file.path.find ( ':' ) != string::npos || file.path.find ( '\\' ) != string::npos )
+        {
+            LOG ( "Invalid manifest path: '%s'", file.path );
+            files.clear();
+            return false;
+        }
+
+        const size_t numBlocks = ( size_t ( file.size ) + file.blockSize - 1 ) / file.blockSize;
+
+        for ( size_t i = 0; i < numBlocks; ++i )
+        {
+            if ( !getline ( ss, line ) || trimmed ( line ).size() != 32 )
+            {
+                LOG ( "Missing block hashes: '%s'", file.path );
+                files.clear();
+                return false;
+            }
+
+            file.blockHashes.push_back ( trimmed ( line ) );
+        }
+
+        files.push_back ( file );
+    }
+
+    return true;
+}
+
+void BlockDelta::compute ( const string& oldData, const UpdateManifest::File& newFile )
+{
+    _newFile = newFile;
+    _sources.clear();
+    ranges.clear();
+
+    _unchanged = ( oldData.size() == newFile.size
+                   && UpdateManifest::getHash ( oldData.data(), oldData.size() ) == newFile.hash );
+
+    // Blocks of the installed version by hash, a partial last block can only match the new version's last block
+    unordered_map<string, uint32_t> oldBlocks;
+
+    for ( size_t i = 0; i < oldData.size() && !_unchanged; i += newFile.blockSize )
+    {
+        const size_t size = min<size_t> ( newFile.blockSize, oldData.size() - i );
+        oldBlocks.insert ( { UpdateManifest::getHash ( oldData.data() + i, size ), uint32_t ( i ) } );
+    }
+
+    for ( size_t i = 0; i < newFile.blockHashes.size(); ++i )
+    {
+        const uint32_t start = i * newFile.blockSize;
+        const uint32_t end = min<uint32_t> ( newFile.size, start + newFile.blockSize );
+
+        if ( _unchanged )
+        {
+            _sources.push_back ( start );
+            continue;
+        }
+
+        const auto it = oldBlocks.find ( newFile.blockHashes[i] );
+
+        if ( it != oldBlocks.end() )
+        {
+            _sources.push_back ( it->second );
+            continue;
+        }
+
+        _sources.push_back ( Download );
+
+        if ( !ranges.empty() && ranges.back().end == start )
+            ranges.back().end = end;
+        else
+            ranges.push_back ( { start, end } );
+    }
+}
+
+uint32_t BlockDelta::getDownloadSize() const
+{
+    uint32_t size = 0;
+
+    for ( const Range& range : ranges )
+        size += range.end - range.start;
+
+    return size;
+}
+
+bool BlockDelta::apply ( const string& oldData, const string& downloaded, string& newData ) const
+{
+    if ( downloaded.size() != getDownloadSize() )
+    {
+        LOG ( "Wrong download size: %u; expected %u", downloaded.size(), getDownloadSize() );
+        return false;
+    }
+
+    newData.assign ( _newFile.size, '\0' );
+
+    size_t next = 0;
+
+    for ( size_t i = 0; i < _sources.size(); ++i )
+    {
+        const size_t start = i * _newFile.blockSize;
+        const size_t size = min<size_t> ( _newFile.blockSize, _newFile.size - start );
+
+        if ( _sources[i] == Download )
+        {
+            memcpy ( &newData[start], &downloaded[next], size );
+            next += size;
+        }
+        else if ( size_t ( _sources[i] ) + size <= oldData.size() )
+        {
+            memcpy ( &newData[start], &oldData[_sources[i]], size );
+        }
+        else
+        {
+            LOG ( "Installed file changed: '%s'", _newFile.path );
+            return false;
+        }
+    }
+
+    if ( UpdateManifest::getHash ( newData.data(), newData.size() ) != _newFile.hash )
+    {
+        LOG ( "Hash mismatch: '%s'", _newFile.path );
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// Size of the blocks that are compared between the installed and the new version of a file
+#define DELTA_BLOCK_SIZE ( 64 * 1024 )
+
+// Name of the manifest in each version's folder on the update server
+#define UPDATE_MANIFEST_FILE "manifest.txt"
+
+
+// Hashes of each file of a version and of each block of the files, so an update only downloads what changed
+class UpdateManifest
+{
+public:
+
+    struct File
+    {
+        // Path relative to the app folder, with '/' separators
+        std::string path;
+
+        uint32_t size, blockSize;
+
+        // Hex MD5 of the whole file and of each block
+        std::string hash;
+        std::vector<std::string> blockHashes;
+    };
+
+    std::vector<File> files;
+
+    // Hash the data of a file
+    static File hashData ( const std::string& path, const std::string& data, uint32_t blockSize = DELTA_BLOCK_SIZE );
+
+    // Hex MD5 of some data
+    static std::string getHash ( const char *data, size_t size );
+
+    // Total size of the files
+    uint32_t getTotalSize() const;
+
+    // Text format, one line per file, each followed by one line per block
+    std::string str() const;
+    bool parse ( const std::string& text );
+};
+
+
+// The blocks of the new version of a file that can be copied from the installed version, wherever they are in
+// it, and the byte ranges of the new version to download for the rest.
+class BlockDelta
+{
+public:
+
+    struct Range
+    {
+        uint32_t start, end;
+    };
+
+    // Ranges to download, adjacent blocks are merged
+    std::vector<Range> ranges;
+
+    // Compare the installed version of a file to the new version, the installed data is empty if it is missing
+    void compute ( const std::string& oldData, const UpdateManifest::File& newFile );
+
+    // True if the installed version is already the new version
+    bool isUnchanged() const { return _unchanged; }
+
+    // Total size of the ranges
+    uint32_t getDownloadSize() const;
+
+    // Build the new version from the installed version and the downloaded ranges concatenated in order.
+    // Returns false if the data doesn't match the new version's hash.
+    bool apply ( const std::string& oldData, const std::string& downloaded, std::string& newData ) const;
+
+private:
+
+    static const uint32_t Download = 0xFFFFFFFF;
+
+    UpdateManifest::File _newFile;
+
+    // Offset of each block of the new version in the installed version, or Download
+    std::vector<uint32_t> _sources;
+
+    bool _unchanged = false;
+};
@@ -2,6 +2,8 @@
 
 #include "Thread.hpp"
 
+#include <atomic>
+#include <cstdint>
 #include <list>
 #include <unordered_set>
 
@@ -287,3 +289,195 @@ private:
 
     mutable CondVar _cond;
 };
+
+
+// Bounded multi-producer multi-consumer ring queue. tryPush and tryPop are lock-free: each cell has a sequence number
+// that says whether it is ready to be written or read at the current position (Vyukov's bounded MPMC queue), so
+// producers and consumers only contend on claiming a position. The blocking push and pop only take the mutex when
+// they actually have to wait. N must be a power of 2.
+template<typename T, size_t N> class LockFreeQueue
+{
+    static_assert ( N >= 2 && ( N & ( N - 1 ) ) == 0, "N must be a power of 2" );
+
+public:
+
+    LockFreeQueue()
+    {
+        for ( size_t i = 0; i < N; ++i )
+            _cells[i].sequence.store ( i, std::memory_order_relaxed );
+    }
+
+    bool tryPush ( const T& t )
+    {
+        Cell *cell;
+        size_t pos = _head.load ( std::memory_order_relaxed );
+
+        for ( ;; )
+        {
+            cell = &_cells [ pos & ( N - 1 ) ];
+
+            const intptr_t diff = intptr_t ( cell->sequence.load ( std::memory_order_acquire ) ) - intptr_t ( pos );
+
+            if ( diff == 0 )
+            {
+                if ( _head.compare_exchange_weak ( pos, pos + 1, std::memory_order_relaxed ) )
+                    break;
+            }
+            else if ( diff < 0 )
+            {
+                return false;
+            }
+            else
+            {
+                pos = _head.load ( std::memory_order_relaxed );
+            }
+        }
+
+        cell->value = t;
+        cell->sequence.store ( pos + 1, std::memory_order_release );
+
+        wake ( _numPopWaiting, _notEmpty );
+        return true;
+    }
+
+    bool tryPop ( T& t )
+    {
+        Cell *cell;
+        size_t pos = _tail.load ( std::memory_order_relaxed );
+
+        for ( ;; )
+        {
+            cell = &_cells [ pos & ( N - 1 ) ];
+
+            const intptr_t diff = intptr_t ( cell->sequence.load ( std::memory_order_acquire ) ) - intptr_t ( pos + 1 );
+
+            if ( diff == 0 )
+            {
+                if ( _tail.compare_exchange_weak ( pos, pos + 1, std::memory_order_relaxed ) )
+                    break;
+            }
+            else if ( diff < 0 )
+            {
+                return false;
+            }
+            else
+            {
+                pos = _tail.load ( std::memory_order_relaxed );
+            }
+        }
+
+        // Reset the cell so it doesn't hold on to any resources
+        t = std::move ( cell->value );
+        cell->value = T();
+        cell->sequence.store ( pos + N, std::memory_order_release );
+
+        wake ( _numPushWaiting, _notFull );
+        return true;
+    }
+
+    void push ( const T& t )
+    {
+        waitFor ( _numPushWaiting, _notFull, -1, [&] { return tryPush ( t ); } );
+    }
+
+    bool push ( const T& t, long timeout )
+    {
+        return waitFor ( _numPushWaiting, _notFull, timeout, [&] { return tryPush ( t ); } );
+    }
+
+    T pop()
+    {
+        T t = T();
+        waitFor ( _numPopWaiting, _notEmpty, -1, [&] { return tryPop ( t ); } );
+        return t;
+    }
+
+    T pop ( long timeout, T placeholder )
+    {
+        waitFor ( _numPopWaiting, _notEmpty, timeout, [&] { return tryPop ( placeholder ); } );
+        return placeholder;
+    }
+
+    // Only a snapshot when other threads are pushing or popping
+    size_t size() const
+    {
+        const size_t tail = _tail.load ( std::memory_order_acquire );
+        const size_t head = _head.load ( std::memory_order_acquire );
+        return ( head > tail ? head - tail : 0 );
+    }
+
+    bool empty() const
+    {
+        return ( size() == 0 );
+    }
+
+    void clear()
+    {
+        T t;
+        while ( tryPop ( t ) );
+    }
+
+private:
+
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+
+        T value;
+    };
+
+    // Producers and consumers claim positions on separate cache lines
+    char _pad0[64];
+
+    std::atomic<size_t> _head { 0 };
+
+    char _pad1[64];
+
+    std::atomic<size_t> _tail { 0 };
+
+    char _pad2[64];
+
+    Cell _cells[N];
+
+    // Number of threads waiting for a push or pop to succeed
+    std::atomic<size_t> _numPushWaiting { 0 }, _numPopWaiting { 0 };
+
+    Mutex _mutex;
+
+    CondVar _notFull, _notEmpty;
+
+    // Wake a waiting thread, if any. The fence orders the push or pop before checking for waiters, and the waiter
+    // holds the mutex from its last try until it waits, so a wake up can't be missed.
+    void wake ( std::atomic<size_t>& numWaiting, CondVar& cond )
+    {
+        std::atomic_thread_fence ( std::memory_order_seq_cst );
+
+        if ( numWaiting.load ( std::memory_order_relaxed ) == 0 )
+            return;
+
+        LOCK ( _mutex );
+        cond.signal();
+    }
+
+    // Retry until tryFunc succeeds, or until timed out if timeout is not negative
+    template<typename F>
+    bool waitFor ( std::atomic<size_t>& numWaiting, CondVar& cond, long timeout, F tryFunc )
+    {
+        if ( tryFunc() )
+            return true;
+
+        LOCK ( _mutex );
+
+        ++numWaiting;
+        std::atomic_thread_fence ( std::memory_order_seq_cst );
+
+        bool done = false;
+        int ret = 0;
+
+        while ( !ret && ! ( done = tryFunc() ) )
+            ret = ( timeout < 0 ? cond.wait ( _mutex ) : cond.wait ( _mutex, timeout ) );
+
+        --numWaiting;
+        return done;
+    }
+};
@@ -0,0 +1,244 @@
+#include "ComboTrial.hpp"
+
+using namespace std;
+
+
+void CompiledCombo::compile ( const vector<uint32_t>& seqs, const vector<int>& hits, uint32_t crouchSeq )
+{
+    steps.clear();
+    steps.reserve ( seqs.size() );
+
+    for ( size_t i = 0; i < seqs.size(); ++i )
+    {
+        const uint32_t seq = seqs[i];
+        steps.push_back ( { seq, ( seq == 0 ? crouchSeq : seq ), ( i < hits.size() ? hits[i] : 0 ) } );
+    }
+}
+
+void ComboProgress::step ( const CompiledCombo& combo, const ComboFrame& frame )
+{
+    if ( combo.steps.empty() )
+        return;
+
+    const ComboStep& first = combo.steps[0];
+
+    if ( !drop )
+    {
+        if ( frame.seq == first.seq && frame.targetSeq != 0 && !start )
+        {
+            position = 1;
+            start = true;
+            hitcount = frame.hitcount;
+        }
+        else if ( start && position < combo.steps.size()
+                  && ( frame.seq == combo.steps[position].seq || frame.seq == combo.steps[position].altSeq
+                       || ( combo.steps[position].hit == 2 && frame.partnerSeq == combo.steps[position].seq ) )
+                  && ( combo.steps[position].hit != 1 || frame.hitcount > hitcount ) )
+        {
+            ++position;
+            hitcount = frame.hitcount;
+        }
+        else if ( frame.hitcount > hitcount )
+        {
+            hitcount = frame.hitcount;
+        }
+
+        if ( frame.targetSeq == 0 )
+        {
+            drop = true;
+            dropPos = position;
+            start = false;
+            hitcount = 0;
+        }
+    }
+    else if ( frame.seq == 0 && frame.targetSeq == 0 )
+    {
+        // Keep showing a completed combo until the next attempt
+        if ( position < combo.steps.size() )
+            position = 0;
+    }
+    else if ( frame.seq == first.seq && frame.targetSeq != 0 )
+    {
+        position = 1;
+        drop = false;
+        start = true;
+        hitcount = frame.hitcount;
+    }
+}
+
+static bool endsWithParen ( const string& text )
+{
+    return ( !text.empty() && text.back() == ')' );
+}
+
+// Width of the symbols dj. j. Add. tk. in the unscaled font
+static int getSymbolWidth ( const Token& token )
+{
+    switch ( token.text.empty() ? 0 : token.text[0] )
+    {
+        case 'd':
+            return 35 + 11;
+
+        case 'j':
+            return 30;
+
+        case 'A':
+            return 20 + 16 + 14 + 17;
+
+        case 't':
+            return 15 + 11 + 15;
+
+        default:
+            return 0;
+    }
+}
+
+// Number of characters of the symbols dj. j. Add. tk. in the scaled font
+static int getSymbolLength ( const Token& token )
+{
+    switch ( token.text.empty() ? 0 : token.text[0] )
+    {
+        case 'd':
+        case 't':
+            return 3;
+
+        case 'j':
+            return 2;
+
+        case 'A':
+            return 4;
+
+        default:
+            return 0;
+    }
+}
+
+int ComboLayout::getWrapWidth ( const Move& move, int buttonWidth )
+{
+    int width = 0;
+
+    for ( const Token& token : move.text )
+    {
+        if ( token.type == Button || token.type == Direction )
+            width += ( buttonWidth ? buttonWidth : 25 );
+        else if ( token.type == String && buttonWidth )
+            width += buttonWidth * int ( token.text.size() ) - ( endsWithParen ( token.text ) ? buttonWidth / 2 : 0 );
+        else if ( token.type == String )
+            width += 24 * int ( token.text.size() ) - ( endsWithParen ( token.text ) ? 20 : 0 );
+        else if ( token.type == Symbol && buttonWidth )
+            width += buttonWidth * getSymbolLength ( token );
+        else if ( token.type == Symbol )
+            width += getSymbolWidth ( token );
+    }
+
+    // The unscaled width also leaves room for the end of the backing
+    return width + COMBO_MOVE_RIGHT_OFFSET + ( buttonWidth ? 0 : 18 );
+}
+
+int ComboLayout::getDrawnWidth ( const Move& move, int buttonWidth )
+{
+    int width = 0;
+
+    for ( const Token& token : move.text )
+    {
+        if ( token.type == Button || token.type == Direction )
+        {
+            width += ( buttonWidth ? buttonWidth : 25 );
+        }
+        else if ( token.type == String && buttonWidth )
+        {
+            width += buttonWidth * int ( token.text.size() ) - ( endsWithParen ( token.text ) ? buttonWidth / 2 : 0 );
+        }
+        else if ( token.type == String )
+        {
+            // These are drawn one letter at a time with tighter spacing
+            if ( token.text == "Airbackdash" )
+                width += 24 * int ( token.text.size() ) - 20;
+            else if ( token.text == "Airdash" )
+                width += 24 * int ( token.text.size() ) - 8 - 8 - 10 - 10 - 11 - 8;
+            else
+                width += 24 * int ( token.text.size() ) - ( endsWithParen ( token.text ) ? 20 : 0 );
+        }
+        else if ( token.type == Symbol && buttonWidth )
+        {
+            width += buttonWidth * getSymbolLength ( token ) - buttonWidth / 2;
+        }
+        else if ( token.type == Symbol )
+        {
+            width += getSymbolWidth ( token );
+        }
+    }
+
+    return width;
+}
+
+bool ComboLayout::update ( uint32_t trialId, const vector<Move>& moves, uint32_t position, int dropPos, int scale,
+                           bool inputGuide )
+{
+    if ( _valid && trialId == _trialId && position == _position && dropPos == _dropPos && scale == _scale
+            && inputGuide == _inputGuide )
+    {
+        return false;
+    }
+
+    _valid = true;
+    _trialId = trialId;
+    _position = position;
+    _dropPos = dropPos;
+    _scale = scale;
+    _inputGuide = inputGuide;
+
+    entries.clear();
+
+    // Icon size used for wrapping and drawing, and the line height of each scale
+    static const int scales[][3] =
+    {
+        { 0, 0, 30 },
+        { 20, 20, 26 },
+        { 0, 0xc, 18 },
+    };
+
+    if ( scale < 0 || scale >= int ( sizeof ( scales ) / sizeof ( scales[0] ) ) )
+        return true;
+
+    const int wrapButtonWidth = scales[scale][0];
+    const int lineHeight = scales[scale][2];
+
+    buttonWidth = scales[scale][1];
+
+    entries.reserve ( moves.size() );
+
+    int x = COMBO_START_X;
+    int y = COMBO_START_Y + ( inputGuide ? COMBO_INPUT_GUIDE_HEIGHT : 0 );
+
+    for ( uint32_t i = 0; i < moves.size(); ++i )
+    {
+        const Move& move = moves[i];
+
+        MoveStatus status;
+
+        if ( i < position )
+            status = Done;
+        else if ( i == position )
+            status = Current;
+        else if ( int ( i ) == dropPos )
+            status = Failed;
+        else
+            status = Next;
+
+        if ( getWrapWidth ( move, wrapButtonWidth ) + x > COMBO_MAX_X )
+        {
+            y += lineHeight;
+            x = COMBO_START_X;
+        }
+
+        const int width = getDrawnWidth ( move, buttonWidth ) + COMBO_MOVE_RIGHT_OFFSET;
+
+        entries.push_back ( { i, status, x, y, width } );
+
+        // The backing has a 15 pixel start unless it's the first move, and a 4 pixel end unless it's the last
+        x += ( move.position != Start ? 15 : 0 ) + width + ( move.position != Ending ? 4 : 0 );
+    }
+
+    return true;
+}
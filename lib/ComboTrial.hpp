@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// Layout of the combo trial display on the 640x480 game screen
+#define COMBO_START_X               ( 20 )
+#define COMBO_START_Y               ( 20 )
+#define COMBO_INPUT_GUIDE_HEIGHT    ( 25 )
+#define COMBO_MAX_X                 ( 630 )
+
+// Padding after the contents of a move, before the end of its backing
+#define COMBO_MOVE_RIGHT_OFFSET     ( 7 )
+
+
+enum MovePosition {
+    Start,
+    Middle,
+    Ending
+};
+
+enum MoveStatus {
+    Next,
+    Current,
+    Done,
+    Failed
+};
+
+enum TokenTypes {
+    String,
+    Direction,
+    Button,
+    Symbol
+};
+
+struct Token {
+    std::string text;
+    TokenTypes type;
+    uint32_t width;
+};
+
+struct Move {
+    std::vector<Token> text;
+    MovePosition position;
+};
+
+
+// A step of a combo trial, the sequence to reach and whether it has to hit
+struct ComboStep
+{
+    // A crouching step (sequence 0) is also reached by the crouch transition sequence
+    uint32_t seq, altSeq;
+
+    // 0: any, 1: must add to the hit count, 2: the partner reaching the sequence also counts
+    int32_t hit;
+};
+
+// The steps of a trial's combo, compiled once when the trial is loaded
+struct CompiledCombo
+{
+    std::vector<ComboStep> steps;
+
+    void compile ( const std::vector<uint32_t>& seqs, const std::vector<int>& hits, uint32_t crouchSeq );
+};
+
+// The game state that the combo trial reads each frame
+struct ComboFrame
+{
+    // Sequence of the point character, its partner, and the opponent (0 once the combo dropped)
+    uint32_t seq, partnerSeq, targetSeq;
+
+    int hitcount;
+};
+
+// Progress through a combo trial
+struct ComboProgress
+{
+    uint32_t position = 0;
+
+    bool start = false, drop = false;
+
+    // Position where the last attempt dropped, or -1
+    int dropPos = -1;
+
+    // Hit count when the last step was reached
+    int hitcount = 0;
+
+    // Advance by one frame, this doesn't allocate
+    void step ( const CompiledCombo& combo, const ComboFrame& frame );
+
+    void reset() { *this = ComboProgress(); }
+};
+
+
+// Positions of the moves of a combo trial on screen, only rebuilt when the trial, its progress or the scale changes
+class ComboLayout
+{
+public:
+
+    struct Entry
+    {
+        // Index of the move in the trial
+        uint32_t move;
+
+        MoveStatus status;
+
+        int x, y;
+
+        // Width of the move's backing
+        int width;
+    };
+
+    std::vector<Entry> entries;
+
+    // Size of the button and arrow icons, 0 when unscaled
+    int buttonWidth = 0;
+
+    // Update the layout for the current trial, the trial id must change whenever the moves change.
+    // Returns true if the layout was rebuilt.
+    bool update ( uint32_t trialId, const std::vector<Move>& moves, uint32_t position, int dropPos, int scale,
+                  bool inputGuide );
+
+    // Force the next update to rebuild
+    void invalidate() { _valid = false; }
+
+    // Width used to decide where lines wrap
+    static int getWrapWidth ( const Move& move, int buttonWidth );
+
+    // Width of the contents of a move as drawn, without the padding
+    static int getDrawnWidth ( const Move& move, int buttonWidth );
+
+private:
+
+    bool _valid = false;
+
+    uint32_t _trialId = 0, _position = 0;
+
+    int _dropPos = -1, _scale = 0;
+
+    bool _inputGuide = false;
+};
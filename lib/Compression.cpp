@@ -6,6 +6,8 @@
 #include <md5.h>
 
 #include <cstring>
+#include <algorithm>
+#include <cstdint>
 
 using namespace std;
 
@@ -36,25 +38,42 @@ bool checkMD5 ( const string& str, const char md5[16] )
 }
 
 
+// The compressor state is a few hundred KB, so each thread keeps one instead of allocating it for every call like
+// mz_compress2 does. The flags are the same as mz_compress2, so is the output.
+static __thread tdefl_compressor *threadCompressor = 0;
+
 size_t compress ( const char *src, size_t srcLen, char *dst, size_t dstLen, int level )
 {
-    mz_ulong len = dstLen;
-    int rc = mz_compress2 ( ( unsigned char * ) dst, &len, ( unsigned char * ) src, srcLen, level );
-    if ( rc == MZ_OK )
-        return len;
+    if ( ! threadCompressor )
+        threadCompressor = new tdefl_compressor;
+
+    const mz_uint flags = TDEFL_COMPUTE_ADLER32 | tdefl_create_comp_flags_from_zip_params ( level,
+                                                                                           MZ_DEFAULT_WINDOW_BITS,
+                                                                                           MZ_DEFAULT_STRATEGY );
+
+    size_t inLen = srcLen, outLen = dstLen;
+
+    tdefl_status status = tdefl_init ( threadCompressor, 0, 0, flags );
 
-    LOG ( "[%d] %s; zlib error", rc, mz_error ( rc ) );
+    if ( status == TDEFL_STATUS_OKAY )
+        status = tdefl_compress ( threadCompressor, src, &inLen, dst, &outLen, TDEFL_FINISH );
+
+    // Not done means the output didn't fit
+    if ( status == TDEFL_STATUS_DONE && inLen == srcLen )
+        return outLen;
+
+    LOG ( "[%d] zlib error", status );
     return 0;
 }
 
 size_t uncompress ( const char *src, size_t srcLen, char *dst, size_t dstLen )
 {
-    mz_ulong len = dstLen;
-    int rc = mz_uncompress ( ( unsigned char * ) dst, &len, ( unsigned char * ) src, srcLen );
-    if ( rc == MZ_OK )
+    // Same as mz_uncompress, but with the decompressor on the stack instead of allocated
+    const size_t len = tinfl_decompress_mem_to_mem ( dst, dstLen, src, srcLen, TINFL_FLAG_PARSE_ZLIB_HEADER );
+    if ( len != TINFL_DECOMPRESS_MEM_TO_MEM_FAILED )
         return len;
 
-    LOG ( "[%d] %s; zlib error", rc, mz_error ( rc ) );
+    LOG ( "zlib error" );
     return 0;
 }
 
@@ -62,3 +81,210 @@ size_t compressBound ( size_t srcLen )
 {
     return mz_compressBound ( srcLen );
 }
+
+
+// Each sequence is a token byte with the literal length in the high nibble and the match length minus
+// LZ_MIN_MATCH in the low nibble, the literals, then a 16-bit little endian match offset. A nibble of 15 is
+// followed by bytes of 255 and a final byte less than 255, which are added to the length. The last sequence
+// has no match, and the last LZ_LAST_LITERALS bytes are always literals.
+#define LZ_MIN_MATCH        ( 4 )
+#define LZ_LAST_LITERALS    ( 8 )
+#define LZ_MAX_OFFSET       ( 0xFFFF )
+#define LZ_HASH_BITS        ( 13 )
+
+static inline uint32_t lzRead32 ( const char *p )
+{
+    uint32_t x;
+    memcpy ( &x, p, 4 );
+    return x;
+}
+
+static inline uint32_t lzHash ( uint32_t x )
+{
+    return ( x * 2654435761u ) >> ( 32 - LZ_HASH_BITS );
+}
+
+static inline char *lzWriteLength ( char *op, size_t len )
+{
+    for ( ; len >= 255; len -= 255 )
+        *op++ = ( char ) 255;
+
+    *op++ = ( char ) len;
+    return op;
+}
+
+static inline char *lzWriteSequence ( char *op, const char *literals, size_t numLiterals, size_t matchLen,
+                                      size_t offset )
+{
+    const size_t matchCode = ( matchLen ? matchLen - LZ_MIN_MATCH : 0 );
+
+    char *token = op++;
+    *token = ( char ) ( ( min<size_t> ( numLiterals, 15 ) << 4 ) | min<size_t> ( matchCode, 15 ) );
+
+    if ( numLiterals >= 15 )
+        op = lzWriteLength ( op, numLiterals - 15 );
+
+    memcpy ( op, literals, numLiterals );
+    op += numLiterals;
+
+    if ( !matchLen )
+        return op;
+
+    *op++ = ( char ) ( offset & 0xFF );
+    *op++ = ( char ) ( offset >> 8 );
+
+    if ( matchCode >= 15 )
+        op = lzWriteLength ( op, matchCode - 15 );
+
+    return op;
+}
+
+size_t lzCompressBound ( size_t srcLen )
+{
+    return srcLen + srcLen / 255 + 16;
+}
+
+size_t lzCompress ( const char *src, size_t srcLen, char *dst, size_t dstLen )
+{
+    if ( dstLen < lzCompressBound ( srcLen ) )
+        return 0;
+
+    uint32_t table[1 << LZ_HASH_BITS];
+    memset ( table, 0xFF, sizeof ( table ) );
+
+    const char *ip = src, *anchor = src;
+    const char *const end = src + srcLen;
+    const char *const matchLimit = ( srcLen > LZ_LAST_LITERALS ? end - LZ_LAST_LITERALS : src );
+    char *op = dst;
+
+    while ( ip + LZ_MIN_MATCH <= matchLimit )
+    {
+        const uint32_t seq = lzRead32 ( ip );
+        const uint32_t h = lzHash ( seq );
+        const uint32_t ref = table[h];
+        table[h] = ip - src;
+
+        if ( ref == 0xFFFFFFFF || ( size_t ) ( ip - src ) - ref > LZ_MAX_OFFSET || lzRead32 ( src + ref ) != seq )
+        {
+            // Search faster the longer there is no match, ie through incompressible data
+            ip += 1 + ( ( ip - anchor ) >> 5 );
+            continue;
+        }
+
+        const char *match = src + ref;
+        size_t matchLen = LZ_MIN_MATCH;
+
+        while ( ip + matchLen + 8 <= matchLimit )
+        {
+            uint64_t a, b;
+            memcpy ( &a, ip + matchLen, 8 );
+            memcpy ( &b, match + matchLen, 8 );
+
+            if ( a != b )
+                break;
+
+            matchLen += 8;
+        }
+
+        while ( ip + matchLen < matchLimit && ip[matchLen] == match[matchLen] )
+            ++matchLen;
+
+        op = lzWriteSequence ( op, anchor, ip - anchor, matchLen, ip - match );
+
+        ip += matchLen;
+        anchor = ip;
+    }
+
+    op = lzWriteSequence ( op, anchor, end - anchor, 0, 0 );
+
+    return op - dst;
+}
+
+size_t lzUncompress ( const char *src, size_t srcLen, char *dst, size_t dstLen )
+{
+    const uint8_t *ip = ( const uint8_t * ) src;
+    const uint8_t *const end = ip + srcLen;
+    char *op = dst;
+    char *const opEnd = dst + dstLen;
+
+    while ( ip < end )
+    {
+        const uint8_t token = *ip++;
+        size_t numLiterals = token >> 4;
+
+        if ( numLiterals == 15 )
+        {
+            uint8_t b;
+            do
+            {
+                if ( ip >= end )
+                    return 0;
+                b = *ip++;
+                numLiterals += b;
+            }
+            while ( b == 255 );
+        }
+
+        if ( ( size_t ) ( end - ip ) < numLiterals || ( size_t ) ( opEnd - op ) < numLiterals )
+            return 0;
+
+        if ( numLiterals <= 16 && end - ip >= 16 && opEnd - op >= 16 )
+        {
+            // Short literals are copied with fixed size copies, writing past them is fine when there is room
+            memcpy ( op, ip, 16 );
+        }
+        else
+        {
+            memcpy ( op, ip, numLiterals );
+        }
+
+        ip += numLiterals;
+        op += numLiterals;
+
+        // The last sequence has no match
+        if ( ip == end )
+            break;
+
+        if ( end - ip < 2 )
+            return 0;
+
+        const size_t offset = ip[0] | ( ip[1] << 8 );
+        ip += 2;
+
+        size_t matchLen = ( token & 15 ) + LZ_MIN_MATCH;
+
+        if ( ( token & 15 ) == 15 )
+        {
+            uint8_t b;
+            do
+            {
+                if ( ip >= end )
+                    return 0;
+                b = *ip++;
+                matchLen += b;
+            }
+            while ( b == 255 );
+        }
+
+        if ( offset == 0 || ( size_t ) ( op - dst ) < offset || ( size_t ) ( opEnd - op ) < matchLen )
+            return 0;
+
+        // A match closer than 8 bytes repeats with the period of the offset, so after the first few bytes it can be
+        // copied 8 bytes at a time from a multiple of the offset back, ie long runs of zeros
+        const size_t step = ( offset >= 8 ? offset : offset * ( ( 8 + offset - 1 ) / offset ) );
+        size_t i = 0;
+
+        for ( ; i < matchLen && i < step - offset; ++i )
+            op[i] = op[i - offset];
+
+        for ( ; i + 8 <= matchLen; i += 8 )
+            memcpy ( op + i, op + i - step, 8 );
+
+        for ( ; i < matchLen; ++i )
+            op[i] = op[i - offset];
+
+        op += matchLen;
+    }
+
+    return op - dst;
+}
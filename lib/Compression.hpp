@@ -14,3 +14,10 @@ bool checkMD5 ( const std::string& str, const char md5[16] );
 size_t compress ( const char *src, size_t srcLen, char *dst, size_t dstLen, int level = 9 );
 size_t uncompress ( const char *src, size_t srcLen, char *dst, size_t dstLen );
 size_t compressBound ( size_t srcLen );
+
+
+// Fast byte-aligned LZ77 compression, much faster than zlib but with a lower ratio.
+// Meant for data that is compressed and uncompressed often, ie game states.
+size_t lzCompress ( const char *src, size_t srcLen, char *dst, size_t dstLen );
+size_t lzUncompress ( const char *src, size_t srcLen, char *dst, size_t dstLen );
+size_t lzCompressBound ( size_t srcLen );
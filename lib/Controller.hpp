@@ -272,6 +272,9 @@ private:
     // Controller states
     uint32_t _prevState = 0, _state = 0;
 
+    // Last state pushed to ControllerManager::events
+    uint32_t _queuedState = 0;
+
     // Keyboard mappings
     KeyboardMappings _keyboardMappings;
 
@@ -0,0 +1,72 @@
+#include "ControllerEventQueue.hpp"
+
+#include <chrono>
+
+using namespace std;
+
+
+bool ControllerEventQueue::push ( const void *source, uint32_t state, uint64_t timestamp )
+{
+    const size_t head = _head.load ( memory_order_relaxed );
+
+    if ( head - _tail.load ( memory_order_acquire ) >= capacity )
+    {
+        _numDropped.fetch_add ( 1, memory_order_relaxed );
+        return false;
+    }
+
+    Event& event = _events [ head % capacity ];
+    event.source = source;
+    event.state = state;
+    event.timestamp = timestamp;
+
+    _head.store ( head + 1, memory_order_release );
+    return true;
+}
+
+void ControllerEventQueue::drain ( uint64_t deadline, uint64_t since )
+{
+    const size_t head = _head.load ( memory_order_acquire );
+
+    size_t tail = _tail.load ( memory_order_relaxed );
+
+    for ( ; tail != head; ++tail )
+    {
+        const Event& event = _events [ tail % capacity ];
+
+        if ( event.timestamp > deadline )
+            break;
+
+        Latch& latch = _latches[event.source];
+
+        if ( event.timestamp >= since )
+            latch.pressed |= ( event.state & ~latch.state );
+
+        latch.state = event.state;
+    }
+
+    _tail.store ( tail, memory_order_release );
+}
+
+uint32_t ControllerEventQueue::sample ( const void *source, uint32_t state, uint32_t latchMask )
+{
+    auto it = _latches.find ( source );
+
+    if ( it == _latches.end() )
+        return state;
+
+    const uint32_t sampled = state | ( it->second.pressed & latchMask );
+    it->second.pressed = 0;
+    return sampled;
+}
+
+void ControllerEventQueue::clear()
+{
+    for ( auto& kv : _latches )
+        kv.second.pressed = 0;
+}
+
+uint64_t ControllerEventQueue::now()
+{
+    return chrono::duration_cast<chrono::microseconds> ( chrono::steady_clock::now().time_since_epoch() ).count();
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+
+
+// Lock-free queue of timestamped controller state changes, pushed by the polling thread and drained by the frame
+// step. Draining up to a deadline lets the frame step sample the controllers as late as possible, and presses that
+// are released again before the next sample are latched so they are not lost.
+//
+// There must be only one producer at a time, ie ControllerManager::check which pushes under its mutex, and one
+// consumer thread. Sources are only compared by address, they are never dereferenced.
+class ControllerEventQueue
+{
+public:
+
+    struct Event
+    {
+        // The controller whose state changed
+        const void *source;
+
+        // The new controller state
+        uint32_t state;
+
+        // Time of the change in microseconds, see now()
+        uint64_t timestamp;
+    };
+
+    // Maximum number of events waiting to be drained, this is many frames of events at the polling rate
+    static const size_t capacity = 256;
+
+    // Push a state change, returns false if the queue is full, in which case the change is dropped
+    bool push ( const void *source, uint32_t state, uint64_t timestamp );
+
+    // Apply all the state changes up to and including the deadline, later changes are left for the next drain.
+    // Presses before the given time are not latched, ie stale events after the queue wasn't drained for a while.
+    void drain ( uint64_t deadline, uint64_t since = 0 );
+
+    // Sample the state of a source for this frame. This is the current state, plus any bits in latchMask that were
+    // pressed since the last sample, even if they have been released since.
+    uint32_t sample ( const void *source, uint32_t state, uint32_t latchMask );
+
+    // Forget all the latched presses, events waiting to be drained are kept
+    void clear();
+
+    // Number of events dropped because the queue was full
+    uint32_t getNumDropped() const { return _numDropped.load ( std::memory_order_relaxed ); }
+
+    // Get the current time in microseconds from a monotonic clock
+    static uint64_t now();
+
+private:
+
+    std::array<Event, capacity> _events;
+
+    // Index of the next event to push / pop, only written by the producer / consumer respectively
+    std::atomic<size_t> _head { 0 }, _tail { 0 };
+
+    std::atomic<uint32_t> _numDropped { 0 };
+
+    struct Latch
+    {
+        // Last state drained
+        uint32_t state = 0;
+
+        // Bits pressed since the last sample
+        uint32_t pressed = 0;
+    };
+
+    // Only used by the consumer
+    std::unordered_map<const void *, Latch> _latches;
+};
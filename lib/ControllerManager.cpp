@@ -124,6 +124,8 @@ bool ControllerManager::check()
             if ( GetKeyState ( keyboard._keyboardMappings.codes[i] ) & 0x80 )
                 keyboard._state |= ( 1u << i );
         }
+
+        queueState ( &keyboard );
     }
 
     DIJOYSTATE2 djs;
@@ -237,12 +239,26 @@ bool ControllerManager::check()
             controller->joystickButtonEvent ( button, value );
         }
 
+        queueState ( controller );
+
         ++it;
     }
 
     return true;
 }
 
+void ControllerManager::queueState ( Controller *controller )
+{
+    if ( controller->_state == controller->_queuedState )
+        return;
+
+    // The current state is still read directly, so a dropped event only loses a latched press.
+    // Events are also dropped when nothing drains the queue, ie outside the game.
+    events.push ( controller, controller->_state, ControllerEventQueue::now() );
+
+    controller->_queuedState = controller->_state;
+}
+
 static BOOL CALLBACK enumJoystickAxes ( const DIDEVICEOBJECTINSTANCE *ddoi, void *userPtr )
 {
     if ( ! ( ddoi->dwType & DIDFT_AXIS ) )
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Controller.hpp"
+#include "ControllerEventQueue.hpp"
 #include "JoystickDetector.hpp"
 #include "Guid.hpp"
 #include "Thread.hpp"
@@ -35,6 +36,9 @@ public:
     // Window handle to match for keyboard and joystick events
     void *windowHandle = 0;
 
+    // Timestamped controller state changes, pushed by check and drained by the frame step
+    ControllerEventQueue events;
+
     // Check for controller events, returns false if deinitialized
     bool check();
 
@@ -129,6 +133,9 @@ private:
 
     PollingThread pollingThread;
 
+    // Queue the controller state if it changed since it was last queued
+    void queueState ( Controller *controller );
+
     // Attach / detach a joystick
     void attachJoystick ( const Guid& guid, JoystickInfo& info );
     void detachJoystick ( const Guid& guid );
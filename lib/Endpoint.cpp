@@ -0,0 +1,108 @@
+#include "Endpoint.hpp"
+#include "StringUtils.hpp"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+#include <cstring>
+
+using namespace std;
+
+
+// Prefix of an IPv4-mapped IPv6 address, ::ffff:0:0/96
+static const uint8_t mappedPrefix[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF };
+
+
+Endpoint::Endpoint ( const sockaddr *sa )
+{
+    uint8_t bytes[16];
+
+    if ( sa->sa_family == AF_INET )
+    {
+        const sockaddr_in *in = ( const sockaddr_in * ) sa;
+
+        memcpy ( bytes, mappedPrefix, sizeof ( mappedPrefix ) );
+        memcpy ( bytes + sizeof ( mappedPrefix ), &in->sin_addr, 4 );
+        port = ntohs ( in->sin_port );
+        isV4 = true;
+    }
+    else if ( sa->sa_family == AF_INET6 )
+    {
+        const sockaddr_in6 *in6 = ( const sockaddr_in6 * ) sa;
+
+        memcpy ( bytes, &in6->sin6_addr, 16 );
+        port = ntohs ( in6->sin6_port );
+        isV4 = false;
+    }
+    else
+    {
+        return;
+    }
+
+    memcpy ( words, bytes, sizeof ( words ) );
+}
+
+Endpoint Endpoint::parse ( const string& addr, uint16_t port )
+{
+    addrinfo addrConf, *addrRes = 0;
+    memset ( &addrConf, 0, sizeof ( addrConf ) );
+
+    addrConf.ai_family = AF_UNSPEC;
+    addrConf.ai_flags = AI_NUMERICHOST;
+
+    if ( addr.empty() || getaddrinfo ( addr.c_str(), 0, &addrConf, &addrRes ) != 0 || !addrRes )
+        return Endpoint();
+
+    Endpoint endpoint ( addrRes->ai_addr );
+    endpoint.port = port;
+
+    freeaddrinfo ( addrRes );
+    return endpoint;
+}
+
+string Endpoint::getAddr() const
+{
+    uint8_t bytes[16];
+    memcpy ( bytes, words, sizeof ( bytes ) );
+
+    sockaddr_storage sas;
+    memset ( &sas, 0, sizeof ( sas ) );
+
+    socklen_t saLen;
+
+    if ( isV4 )
+    {
+        sockaddr_in *in = ( sockaddr_in * ) &sas;
+        in->sin_family = AF_INET;
+        memcpy ( &in->sin_addr, bytes + sizeof ( mappedPrefix ), 4 );
+        saLen = sizeof ( sockaddr_in );
+    }
+    else
+    {
+        sockaddr_in6 *in6 = ( sockaddr_in6 * ) &sas;
+        in6->sin6_family = AF_INET6;
+        memcpy ( &in6->sin6_addr, bytes, 16 );
+        saLen = sizeof ( sockaddr_in6 );
+    }
+
+    char addr[NI_MAXHOST];
+
+    if ( getnameinfo ( ( sockaddr * ) &sas, saLen, addr, sizeof ( addr ), 0, 0, NI_NUMERICHOST ) != 0 )
+        return "";
+
+    return addr;
+}
+
+string Endpoint::str() const
+{
+    if ( empty() )
+        return "";
+
+    return format ( "%s:%u", getAddr(), port );
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+
+struct sockaddr;
+
+
+// Fixed size binary form of an IP address with port, used to find the peer of each received UDP packet without
+// formatting its address. IPv4 addresses are stored as IPv4-mapped IPv6 addresses, so both fit the same key.
+struct Endpoint
+{
+    // Address bytes in network order, as two words for hashing and comparing
+    uint64_t words[2] = { 0, 0 };
+
+    uint16_t port = 0;
+
+    bool isV4 = true;
+
+    Endpoint() {}
+
+    explicit Endpoint ( const sockaddr *sa );
+
+    // Numeric addresses only, returns an empty endpoint if the address isn't one
+    static Endpoint parse ( const std::string& addr, uint16_t port );
+
+    bool empty() const
+    {
+        return ( !words[0] && !words[1] && !port );
+    }
+
+    // Numeric address without the port, only needed for display
+    std::string getAddr() const;
+
+    std::string str() const;
+};
+
+
+// Hash function
+namespace std
+{
+
+template<> struct hash<Endpoint>
+{
+    size_t operator() ( const Endpoint& a ) const
+    {
+        // Peers mostly differ in the last bytes of the address and the port, mix those into every bit
+        uint64_t h = ( a.words[0] * 0x9E3779B97F4A7C15ULL ) ^ a.words[1] ^ ( uint64_t ( a.port ) << 32 );
+        h *= 0xC2B2AE3D27D4EB4FULL;
+        h ^= ( h >> 29 );
+        return size_t ( h ^ ( h >> 32 ) );
+    }
+};
+
+} // namespace std
+
+
+// Comparison operators
+inline bool operator== ( const Endpoint& a, const Endpoint& b )
+{
+    return ( a.words[0] == b.words[0] && a.words[1] == b.words[1] && a.port == b.port && a.isV4 == b.isV4 );
+}
+
+inline bool operator!= ( const Endpoint& a, const Endpoint& b )
+{
+    return ! ( a == b );
+}
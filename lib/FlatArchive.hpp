@@ -0,0 +1,301 @@
+#pragma once
+
+#include "Enum.hpp"
+
+#include <cereal/details/helpers.hpp>
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+
+// Direct serialization with exactly the same bytes as cereal's binary archives, without the stream objects or the
+// per-field dispatch. The field list passed to save / load is the schema, and the templates below expand it into
+// plain copies at compile time. Values are copied as is like cereal does, ie little endian on x86.
+//
+// Layout:
+//   arithmetic types           as is
+//   enums                      as their underlying type
+//   ENUM types                 as their value, see Enum.hpp
+//   arrays and std::array      their elements, no size
+//   std::string, std::vector   a cereal::size_type count, then their elements
+//
+// Anything else, eg maps or classes with their own save / load, doesn't have a flat layout. Then save / load do
+// nothing and return false, so the caller can fall back to cereal.
+
+
+// True if the type has a flat layout
+template<typename T, typename Enable = void>
+struct FlatLayout : std::false_type {};
+
+template<typename T>
+struct FlatLayout<T, typename std::enable_if<std::is_arithmetic<T>::value || std::is_enum<T>::value>::type>
+    : std::true_type {};
+
+template<typename T>
+struct FlatLayout<T, typename std::enable_if<std::is_base_of<EnumBase, T>::value>::type> : std::true_type {};
+
+template<typename T, size_t N>
+struct FlatLayout<T[N]> : FlatLayout<T> {};
+
+template<typename T, size_t N>
+struct FlatLayout<std::array<T, N>> : FlatLayout<T> {};
+
+template<>
+struct FlatLayout<std::string> : std::true_type {};
+
+template<typename T, typename A>
+struct FlatLayout<std::vector<T, A>> : FlatLayout<T> {};
+
+// cereal writes each bool of a std::vector<bool> separately, which isn't worth a special case
+template<typename A>
+struct FlatLayout<std::vector<bool, A>> : std::false_type {};
+
+
+// True if all the types have a flat layout
+template<typename ... T>
+struct AllFlatLayout;
+
+template<>
+struct AllFlatLayout<> : std::true_type {};
+
+template<typename T, typename ... Rest>
+struct AllFlatLayout<T, Rest ...>
+    : std::integral_constant<bool, FlatLayout<T>::value && AllFlatLayout<Rest ...>::value> {};
+
+
+// Elements that can be copied as one block, the same as cereal's binary_data
+template<typename T>
+struct FlatBlock : std::integral_constant<bool, std::is_arithmetic<T>::value> {};
+
+
+class FlatWriter
+{
+public:
+
+    // Appends to this buffer
+    std::string& buffer;
+
+    FlatWriter ( std::string& buffer ) : buffer ( buffer ) {}
+
+    // Write all the fields, or write nothing and return false if any of them doesn't have a flat layout
+    template<typename ... T>
+    bool save ( const T& ... fields )
+    {
+        return saveAll ( AllFlatLayout<T ...>(), fields ... );
+    }
+
+    void writeBytes ( const void *bytes, size_t len )
+    {
+        buffer.append ( ( const char * ) bytes, len );
+    }
+
+private:
+
+    template<typename ... T>
+    bool saveAll ( std::false_type, const T& ... ) { return false; }
+
+    template<typename ... T>
+    bool saveAll ( std::true_type, const T& ... fields )
+    {
+        const int expand[] = { 0, ( write ( fields ), 0 ) ... };
+        ( void ) expand;
+        return true;
+    }
+
+    template<typename T>
+    typename std::enable_if<std::is_arithmetic<T>::value>::type write ( const T& value )
+    {
+        writeBytes ( &value, sizeof ( value ) );
+    }
+
+    template<typename T>
+    typename std::enable_if<std::is_enum<T>::value>::type write ( const T& value )
+    {
+        write ( static_cast<typename std::underlying_type<T>::type> ( value ) );
+    }
+
+    template<typename T>
+    typename std::enable_if<std::is_base_of<EnumBase, T>::value>::type write ( const T& value )
+    {
+        write ( value.value );
+    }
+
+    template<typename T>
+    void writeElements ( const T *elements, size_t count )
+    {
+        if ( FlatBlock<T>::value )
+        {
+            writeBytes ( elements, count * sizeof ( T ) );
+            return;
+        }
+
+        for ( size_t i = 0; i < count; ++i )
+            write ( elements[i] );
+    }
+
+    template<typename T, size_t N>
+    void write ( const T ( &array ) [N] )
+    {
+        writeElements ( &array[0], N );
+    }
+
+    template<typename T, size_t N>
+    void write ( const std::array<T, N>& array )
+    {
+        writeElements ( array.data(), N );
+    }
+
+    void write ( const std::string& str )
+    {
+        write ( static_cast<cereal::size_type> ( str.size() ) );
+        writeBytes ( str.data(), str.size() );
+    }
+
+    template<typename T, typename A>
+    void write ( const std::vector<T, A>& vector )
+    {
+        write ( static_cast<cereal::size_type> ( vector.size() ) );
+        writeElements ( vector.data(), vector.size() );
+    }
+};
+
+
+class FlatReader
+{
+public:
+
+    FlatReader ( const char *bytes, size_t len ) : _pos ( bytes ), _end ( bytes + len ) {}
+
+    // Read all the fields, or read nothing and return false if any of them doesn't have a flat layout.
+    // Returns true if the fields have a flat layout even if the data ran out, check failed() for that.
+    template<typename ... T>
+    bool load ( T& ... fields )
+    {
+        return loadAll ( AllFlatLayout<T ...>(), fields ... );
+    }
+
+    bool readBytes ( void *bytes, size_t len )
+    {
+        if ( _failed || len > remaining() )
+        {
+            _failed = true;
+            return false;
+        }
+
+        memcpy ( bytes, _pos, len );
+        _pos += len;
+        return true;
+    }
+
+    // True if the data ran out, or a size was larger than the remaining data
+    bool failed() const { return _failed; }
+
+    // Number of bytes left
+    size_t remaining() const { return _end - _pos; }
+
+private:
+
+    const char *_pos, *const _end;
+
+    bool _failed = false;
+
+    template<typename ... T>
+    bool loadAll ( std::false_type, T& ... ) { return false; }
+
+    template<typename ... T>
+    bool loadAll ( std::true_type, T& ... fields )
+    {
+        const int expand[] = { 0, ( read ( fields ), 0 ) ... };
+        ( void ) expand;
+        return true;
+    }
+
+    template<typename T>
+    typename std::enable_if<std::is_arithmetic<T>::value>::type read ( T& value )
+    {
+        readBytes ( &value, sizeof ( value ) );
+    }
+
+    template<typename T>
+    typename std::enable_if<std::is_enum<T>::value>::type read ( T& value )
+    {
+        typename std::underlying_type<T>::type raw = 0;
+        read ( raw );
+        value = static_cast<T> ( raw );
+    }
+
+    template<typename T>
+    typename std::enable_if<std::is_base_of<EnumBase, T>::value>::type read ( T& value )
+    {
+        read ( value.value );
+    }
+
+    template<typename T>
+    void readElements ( T *elements, size_t count )
+    {
+        if ( FlatBlock<T>::value )
+        {
+            readBytes ( elements, count * sizeof ( T ) );
+            return;
+        }
+
+        for ( size_t i = 0; i < count && !_failed; ++i )
+            read ( elements[i] );
+    }
+
+    // Read a count, failing if that many elements of at least minSize bytes can't be in the remaining data.
+    // This rejects bad sizes before allocating, where cereal would try to allocate first.
+    bool readCount ( size_t minSize, size_t& count )
+    {
+        cereal::size_type size = 0;
+        read ( size );
+
+        if ( _failed || uint64_t ( size ) * minSize > remaining() )
+        {
+            _failed = true;
+            return false;
+        }
+
+        count = size;
+        return true;
+    }
+
+    template<typename T, size_t N>
+    void read ( T ( &array ) [N] )
+    {
+        readElements ( &array[0], N );
+    }
+
+    template<typename T, size_t N>
+    void read ( std::array<T, N>& array )
+    {
+        readElements ( array.data(), N );
+    }
+
+    void read ( std::string& str )
+    {
+        size_t count;
+
+        if ( !readCount ( 1, count ) )
+            return;
+
+        str.assign ( _pos, count );
+        _pos += count;
+    }
+
+    template<typename T, typename A>
+    void read ( std::vector<T, A>& vector )
+    {
+        size_t count;
+
+        if ( !readCount ( FlatBlock<T>::value ? sizeof ( T ) : 1, count ) )
+            return;
+
+        vector.resize ( count );
+        readElements ( vector.data(), count );
+    }
+};
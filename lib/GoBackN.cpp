@@ -106,7 +106,8 @@ void GoBackN::sendViaGoBackN ( const MsgPtr& msg )
     else
     {
         msg->getAs<SerializableSequence>().setSequence ( _sendSequence + 1 );
-        string bytes = ::Protocol::encode ( msg );
+        ::Protocol::encode ( msg, _encodeBuffer );
+        const string& bytes = _encodeBuffer;
 
         if ( bytes.size() <= MTU )
         {
@@ -181,7 +182,7 @@ void GoBackN::recvFromSocket ( const MsgPtr& msg )
 
     if ( sequence != _recvSequence + 1 )
     {
-        owner->goBackNSendRaw ( this, MsgPtr ( new AckSequence ( _recvSequence ) ) );
+        owner->goBackNSendRaw ( this, makePooled<AckSequence> ( _recvSequence ) );
         return;
     }
 
@@ -189,7 +190,7 @@ void GoBackN::recvFromSocket ( const MsgPtr& msg )
 
     ++_recvSequence;
 
-    owner->goBackNSendRaw ( this, MsgPtr ( new AckSequence ( _recvSequence ) ) );
+    owner->goBackNSendRaw ( this, makePooled<AckSequence> ( _recvSequence ) );
 
     if ( msg->getMsgType() == MsgType::SplitMessage )
     {
@@ -14,6 +14,9 @@ struct AckSequence : public SerializableSequence
     AckSequence ( uint32_t sequence ) : SerializableSequence ( sequence ) {}
 
     EMPTY_MESSAGE_BOILERPLATE ( AckSequence )
+
+    bool saveFlat ( FlatWriter& writer ) const override { return true; }
+    bool loadFlat ( FlatReader& reader ) override { return true; }
 };
 
 
@@ -121,6 +124,9 @@ private:
     // Buffer for accumulating split messages
     std::string _recvBuffer;
 
+    // Reused for encoding every sent message to check its size
+    std::string _encodeBuffer;
+
     // The interval to send packets, should be non-zero
     uint64_t _interval = DEFAULT_SEND_INTERVAL;
 
@@ -0,0 +1,89 @@
+#include "Histogram.hpp"
+#include "StringUtils.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+
+const size_t Histogram::numSubBuckets;
+const size_t Histogram::numBuckets;
+const uint64_t Histogram::maxValue;
+
+
+void Histogram::merge ( const Histogram& other )
+{
+    for ( size_t i = 0; i < numBuckets; ++i )
+        _counts[i] += other._counts[i];
+
+    _count += other._count;
+    _sum += other._sum;
+    _min = min ( _min, other._min );
+    _max = max ( _max, other._max );
+}
+
+void Histogram::reset()
+{
+    _counts.fill ( 0 );
+    _count = _sum = _max = 0;
+    _min = UINT64_MAX;
+}
+
+Histogram Histogram::takeSnapshot()
+{
+    const Histogram snapshot = *this;
+    reset();
+    return snapshot;
+}
+
+uint64_t Histogram::getPercentile ( double percentile ) const
+{
+    if ( _count == 0 )
+        return 0;
+
+    // Rank of the sample at this percentile, starting from 1
+    const uint64_t rank = max ( uint64_t ( 1 ), uint64_t ( ceil ( min ( percentile, 100.0 ) / 100.0 * _count ) ) );
+
+    uint64_t seen = 0;
+
+    for ( size_t i = 0; i < numBuckets; ++i )
+    {
+        seen += _counts[i];
+
+        if ( seen >= rank )
+        {
+            const uint64_t middle = ( getBucketLow ( i ) + getBucketHigh ( i ) ) / 2;
+            return min ( _max, max ( _min, middle ) );
+        }
+    }
+
+    return _max;
+}
+
+string Histogram::str() const
+{
+    return format ( "n=%llu; mean=%.1f; p50=%llu; p95=%llu; p99=%llu; max=%llu",
+                    _count, getMean(), getPercentile ( 50 ), getPercentile ( 95 ), getPercentile ( 99 ), _max );
+}
+
+uint64_t Histogram::getBucketLow ( size_t index )
+{
+    if ( index < numSubBuckets )
+        return index;
+
+    const size_t shift = ( index - numSubBuckets ) / ( numSubBuckets / 2 ) + 1;
+    const uint64_t sub = ( index - numSubBuckets ) % ( numSubBuckets / 2 ) + numSubBuckets / 2;
+
+    return ( sub << shift );
+}
+
+uint64_t Histogram::getBucketHigh ( size_t index )
+{
+    if ( index < numSubBuckets )
+        return index;
+
+    const size_t shift = ( index - numSubBuckets ) / ( numSubBuckets / 2 ) + 1;
+
+    return getBucketLow ( index ) + ( 1ull << shift ) - 1;
+}
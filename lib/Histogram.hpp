@@ -0,0 +1,93 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+
+// Values below 2^HISTOGRAM_SUB_BUCKET_BITS are counted exactly, larger values share buckets that are
+// 2^-(HISTOGRAM_SUB_BUCKET_BITS-1) of their power of 2 wide, so values are recorded within ~3%
+#define HISTOGRAM_SUB_BUCKET_BITS   ( 6 )
+
+// Values at or above 2^HISTOGRAM_MAX_VALUE_BITS are counted in the last bucket
+#define HISTOGRAM_MAX_VALUE_BITS    ( 32 )
+
+
+// Fixed memory log-linear histogram, like HdrHistogram, for tracking tail latencies. Adding a sample is a few integer
+// operations and never allocates. Histograms can be copied as snapshots and merged, eg per interval or per peer.
+// Values are in whatever unit the caller uses, ie milliseconds for ping and frame times, nanoseconds for save / load.
+class Histogram
+{
+public:
+
+    static const size_t numSubBuckets = ( 1u << HISTOGRAM_SUB_BUCKET_BITS );
+
+    static const size_t numBuckets =
+        numSubBuckets + ( HISTOGRAM_MAX_VALUE_BITS - HISTOGRAM_SUB_BUCKET_BITS ) * ( numSubBuckets / 2 );
+
+    static const uint64_t maxValue = ( 1ull << HISTOGRAM_MAX_VALUE_BITS ) - 1;
+
+    Histogram() { reset(); }
+
+    void addSample ( uint64_t value )
+    {
+        ++_counts [ getBucketIndex ( value ) ];
+        ++_count;
+        _sum += value;
+
+        if ( value < _min )
+            _min = value;
+
+        if ( value > _max )
+            _max = value;
+    }
+
+    void merge ( const Histogram& other );
+
+    void reset();
+
+    // Return a copy and reset this histogram, for reporting each interval separately
+    Histogram takeSnapshot();
+
+    uint64_t getNumSamples() const { return _count; }
+
+    uint64_t getMin() const { return ( _count ? _min : 0 ); }
+
+    uint64_t getMax() const { return _max; }
+
+    double getMean() const { return ( _count ? double ( _sum ) / _count : 0.0 ); }
+
+    // Get the value at a percentile from 0 to 100. This is the middle of the bucket containing that sample,
+    // clamped to the min and max samples, so it is within half a bucket of the exact value.
+    uint64_t getPercentile ( double percentile ) const;
+
+    // Summary for the logs and the overlay, ie "n=3600; mean=1.2; p50=1; p95=3; p99=5; max=9"
+    std::string str() const;
+
+    // Bucket of a value, and the range of values counted in a bucket
+    static size_t getBucketIndex ( uint64_t value );
+    static uint64_t getBucketLow ( size_t index );
+    static uint64_t getBucketHigh ( size_t index );
+
+private:
+
+    std::array<uint32_t, numBuckets> _counts;
+
+    uint64_t _count, _sum, _min, _max;
+};
+
+
+inline size_t Histogram::getBucketIndex ( uint64_t value )
+{
+    if ( value < numSubBuckets )
+        return size_t ( value );
+
+    if ( value > maxValue )
+        value = maxValue;
+
+    // Each power of 2 above the exact range is split into numSubBuckets / 2 buckets
+    const uint32_t msb = 63 - __builtin_clzll ( value );
+    const uint32_t shift = msb - HISTOGRAM_SUB_BUCKET_BITS + 1;
+
+    return numSubBuckets + ( shift - 1 ) * ( numSubBuckets / 2 ) + size_t ( value >> shift ) - numSubBuckets / 2;
+}
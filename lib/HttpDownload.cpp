@@ -1,66 +1,243 @@
 #include "HttpDownload.hpp"
 #include "Logger.hpp"
 
+#include <cstdio>
+
 using namespace std;
 
 
-HttpDownload::HttpDownload ( Owner *owner, const string& url, const string& file )
+HttpDownload::HttpDownload ( Owner *owner, const string& url, const string& file, size_t maxSegments )
     : owner ( owner )
     , url ( url )
-    , file ( file ) {}
+    , file ( file )
+    , _segments ( url, maxSegments ) {}
+
+size_t HttpDownload::getSegment ( HttpGet *httpGet ) const
+{
+    for ( size_t i = 0; i < _requests.size(); ++i )
+        if ( _requests[i].httpGet.get() == httpGet )
+            return i;
+
+    return _requests.size();
+}
+
+void HttpDownload::startSegment ( size_t segment )
+{
+    ASSERT ( segment < _requests.size() );
+
+    uint32_t rangeStart, rangeEnd;
+    _segments.getRequest ( segment, rangeStart, rangeEnd );
+
+    LOG ( "Requesting segment %u: [%u, %u)", segment, rangeStart, rangeEnd );
+
+    _requests[segment].checked = false;
+    _requests[segment].httpGet.reset ( new HttpGet ( this, url, DEFAULT_GET_TIMEOUT, HttpGet::Incremental ) );
+    _requests[segment].httpGet->start ( rangeStart, rangeEnd );
+}
 
 void HttpDownload::httpResponse ( HttpGet *httpGet, int code, const string& data, uint32_t remainingBytes )
 {
-    ASSERT ( _httpGet.get() == httpGet );
+    const size_t segment = getSegment ( httpGet );
+
+    ASSERT ( segment < _requests.size() );
 
-    LOG ( "Received HTTP response (%d): [ %u bytes ]", code, data.size() );
+    LOG ( "Received HTTP response (%d) for segment %u: [ %u bytes ]", code, segment, data.size() );
 
-    if ( code != 200 )
+    if ( !_requests[segment].checked )
     {
-        httpFailed ( httpGet );
-        return;
+        _requests[segment].checked = true;
+
+        const bool wasStarted = _segments.isStarted();
+
+        switch ( _segments.handleHeader ( segment, httpGet->getHeader() ) )
+        {
+            case DownloadSegments::Continue:
+                break;
+
+            case DownloadSegments::Restart:
+                restart();
+                return;
+
+            default:
+                httpFailed ( httpGet );
+                return;
+        }
+
+        // The first response gave the size of the file, so request the other segments in parallel
+        if ( !wasStarted )
+        {
+            _requests.resize ( _segments.segments.size(), { 0, false } );
+
+            for ( size_t i = 1; i < _requests.size(); ++i )
+                startSegment ( i );
+        }
     }
 
-    _outputFile.write ( &data[0], data.size() );
+    uint32_t offset;
+    const uint32_t count = _segments.handleData ( segment, data.size(), offset );
+
+    if ( count )
+    {
+        _outputFile.seekp ( offset );
+        _outputFile.write ( &data[0], count );
+        _unsavedBytes += count;
+    }
 
-    if ( remainingBytes > 0 )
+    if ( !_outputFile.good() )
+    {
+        LOG ( "Failed to write: '%s'", file );
+        fail();
         return;
+    }
 
-    stop();
+    if ( _unsavedBytes >= PROGRESS_SAVE_INTERVAL )
+        saveProgress();
 
     if ( owner )
-        owner->downloadComplete ( this );
+        owner->downloadProgress ( this, _segments.getReceivedBytes(), _segments.totalSize );
+
+    if ( _segments.isComplete() )
+    {
+        finish();
+        return;
+    }
+
+    if ( _segments.segments[segment].isDone() )
+    {
+        _requests[segment].httpGet.reset();
+        return;
+    }
+
+    // The response ended before the end of the segment
+    if ( remainingBytes == 0 )
+        httpFailed ( httpGet );
 }
 
 void HttpDownload::httpFailed ( HttpGet *httpGet )
 {
-    ASSERT ( _httpGet.get() == httpGet );
+    const size_t segment = getSegment ( httpGet );
 
-    LOG ( "Download failed for: %s", httpGet->url );
+    ASSERT ( segment < _requests.size() );
 
-    stop();
+    LOG ( "Download failed for segment %u: %s", segment, httpGet->url );
+
+    if ( !_segments.handleFailure ( segment ) )
+    {
+        fail();
+        return;
+    }
+
+    saveProgress();
+    startSegment ( segment );
+}
+
+void HttpDownload::restart()
+{
+    if ( ++_restarts > MAX_DOWNLOAD_RESTARTS )
+    {
+        fail();
+        return;
+    }
+
+    LOG ( "Restarting download: '%s'", file );
+
+    _requests.clear();
+    _segments.reset();
+    _unsavedBytes = 0;
+
+    remove ( getProgressFile().c_str() );
+
+    _outputFile.close();
+    _outputFile.open ( file.c_str(), ios::in | ios::out | ios::binary | ios::trunc );
+
+    _requests.resize ( 1, { 0, false } );
+    startSegment ( 0 );
+}
+
+void HttpDownload::saveProgress()
+{
+    if ( !_segments.isStarted() || _segments.isComplete() )
+        return;
+
+    // The data must be written before the progress that refers to it
+    _outputFile.flush();
+
+    if ( !_segments.save ( getProgressFile() ) )
+        LOG ( "Failed to save progress: '%s'", getProgressFile() );
+
+    _unsavedBytes = 0;
+}
+
+void HttpDownload::finish()
+{
+    _requests.clear();
+    _outputFile.close();
+
+    remove ( getProgressFile().c_str() );
 
     if ( owner )
-        owner->downloadFailed ( this );
+        owner->downloadComplete ( this );
 }
 
-void HttpDownload::httpProgress ( HttpGet *httpGet, uint32_t receivedBytes, uint32_t totalBytes )
+void HttpDownload::fail()
 {
+    stop();
+
     if ( owner )
-        owner->downloadProgress ( this, receivedBytes, totalBytes );
+        owner->downloadFailed ( this );
 }
 
 void HttpDownload::start()
 {
-    _outputFile.open ( file.c_str(), ios::binary );
+    _requests.clear();
+    _restarts = 0;
+    _unsavedBytes = 0;
+
+    _outputFile.close();
+
+    // Resume from the saved progress if the partial file is still there
+    if ( _segments.load ( getProgressFile() ) )
+    {
+        _outputFile.open ( file.c_str(), ios::in | ios::out | ios::binary );
+
+        if ( _outputFile.good() )
+            LOG ( "Resuming download: %u / %u bytes", _segments.getReceivedBytes(), _segments.totalSize );
+        else
+            _segments.reset();
+    }
+    else
+    {
+        _segments.reset();
+    }
 
-    _httpGet.reset ( new HttpGet ( this, url, DEFAULT_GET_TIMEOUT, HttpGet::Incremental ) );
-    _httpGet->start();
+    if ( !_segments.isStarted() )
+    {
+        _outputFile.close();
+        _outputFile.clear();
+        _outputFile.open ( file.c_str(), ios::in | ios::out | ios::binary | ios::trunc );
+
+        _requests.resize ( 1, { 0, false } );
+        startSegment ( 0 );
+        return;
+    }
+
+    if ( _segments.isComplete() )
+    {
+        finish();
+        return;
+    }
+
+    _requests.resize ( _segments.segments.size(), { 0, false } );
+
+    for ( size_t i = 0; i < _requests.size(); ++i )
+        if ( !_segments.segments[i].isDone() )
+            startSegment ( i );
 }
 
 void HttpDownload::stop()
 {
-    _outputFile.close();
+    saveProgress();
 
-    _httpGet.reset();
+    _requests.clear();
+    _outputFile.close();
 }
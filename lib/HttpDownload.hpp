@@ -1,12 +1,25 @@
 #pragma once
 
 #include "HttpGet.hpp"
+#include "HttpRange.hpp"
 
 #include <string>
 #include <memory>
 #include <fstream>
+#include <vector>
 
 
+// Extension of the file that saves the progress of an interrupted download
+#define DOWNLOAD_PROGRESS_EXT ".part"
+
+// Number of bytes received between saving the progress
+#define PROGRESS_SAVE_INTERVAL ( 1024 * 1024 )
+
+// Number of times a download starts over because the file changed on the server
+#define MAX_DOWNLOAD_RESTARTS ( 2 )
+
+
+// Downloads a file as several byte ranges in parallel, resuming from the saved progress of an earlier attempt
 class HttpDownload : private HttpGet::Owner
 {
 public:
@@ -24,21 +37,50 @@ public:
 
     const std::string url, file;
 
-    HttpDownload ( Owner *owner, const std::string& url, const std::string& file );
+    HttpDownload ( Owner *owner, const std::string& url, const std::string& file,
+                   size_t maxSegments = DEFAULT_DOWNLOAD_SEGMENTS );
 
     void start();
 
+    // Stop downloading, the progress is kept so the next start resumes
     void stop();
 
 private:
 
-    std::ofstream _outputFile;
+    struct Request
+    {
+        std::shared_ptr<HttpGet> httpGet;
+
+        // True once the response header was checked
+        bool checked;
+    };
+
+    std::fstream _outputFile;
+
+    DownloadSegments _segments;
+
+    // One request per segment
+    std::vector<Request> _requests;
+
+    uint32_t _unsavedBytes = 0, _restarts = 0;
+
+    std::string getProgressFile() const { return file + DOWNLOAD_PROGRESS_EXT; }
+
+    size_t getSegment ( HttpGet *httpGet ) const;
+
+    void startSegment ( size_t segment );
+
+    void restart();
+
+    void saveProgress();
+
+    void finish();
 
-    std::shared_ptr<HttpGet> _httpGet;
+    void fail();
 
     void httpResponse ( HttpGet *httpGet, int code, const std::string& data, uint32_t remainingBytes ) override;
 
     void httpFailed ( HttpGet *httpGet ) override;
 
-    void httpProgress ( HttpGet *httpGet, uint32_t receivedBytes, uint32_t totalBytes ) override;
+    void httpProgress ( HttpGet *httpGet, uint32_t receivedBytes, uint32_t totalBytes ) override {}
 };
@@ -2,12 +2,8 @@
 #include "TcpSocket.hpp"
 #include "Exceptions.hpp"
 
-#include <sstream>
-
 using namespace std;
 
-#define USER_AGENT "Mozilla/4.0 (compatible; MSIE 8.0; Windows NT 6.1)"
-
 
 HttpGet::HttpGet ( Owner *owner, const string& url, uint64_t timeout, Mode mode )
     : owner ( owner )
@@ -36,9 +32,18 @@ HttpGet::HttpGet ( Owner *owner, const string& url, uint64_t timeout, Mode mode
     ASSERT ( _path.empty() == false );
 }
 
+void HttpGet::start ( uint32_t rangeStart, uint32_t rangeEnd )
+{
+    _hasRange = true;
+    _rangeStart = rangeStart;
+    _rangeEnd = rangeEnd;
+
+    start();
+}
+
 void HttpGet::start()
 {
-    _statusCode = -1;
+    _header = HttpResponseHeader();
     _headerBuffer.clear();
     _dataBuffer.clear();
     _remainingBytes = 0;
@@ -64,7 +69,8 @@ void HttpGet::socketConnected ( Socket *socket )
 {
     ASSERT ( _socket.get() == socket );
 
-    const string request = format ( "GET %s HTTP/1.1\r\nUser-Agent: %s\r\nHost: %s\r\n\r\n", _path, USER_AGENT, _host );
+    const string request = ( _hasRange ? formatHttpGet ( _host, _path, _rangeStart, _rangeEnd )
+                             : formatHttpGet ( _host, _path ) );
 
     LOG ( "Sending request:\n%s", request );
 
@@ -84,7 +90,7 @@ void HttpGet::socketDisconnected ( Socket *socket )
 {
     ASSERT ( _socket.get() == socket );
 
-    if ( _statusCode >= 0 && _remainingBytes == 0 )
+    if ( _header.statusCode >= 0 && _remainingBytes == 0 )
         return;
 
     _socket.reset();
@@ -98,7 +104,7 @@ void HttpGet::timerExpired ( Timer *timer )
 {
     ASSERT ( _timer.get() == timer );
 
-    if ( _statusCode >= 0 && _remainingBytes == 0 )
+    if ( _header.statusCode >= 0 && _remainingBytes == 0 )
         return;
 
     _socket.reset();
@@ -130,55 +136,39 @@ void HttpGet::parseResponse ( const string& data )
 
     LOG ( "Trying to parse response:\n%s", _headerBuffer );
 
-    stringstream ss ( _headerBuffer );
-    string header;
-
-    // Get the HTTP version header and status code
-    ss >> header >> _statusCode;
-
-    while ( getline ( ss, header ) )
-    {
-        // Stop if we reached the end of the headers
-        if ( header == "\r" )
-        {
-            _remainingBytes = _contentLength;
-
-            // Get the remaining response bytes from the header buffer
-            const size_t responseBytes = ss.rdbuf()->in_avail();
-
-            if ( responseBytes == 0 )
-            {
-                finalize();
-                return;
-            }
+    const size_t headerSize = _header.parse ( _headerBuffer );
 
-            string data ( responseBytes, '\0' );
-            ss.rdbuf()->sgetn ( &data[0], responseBytes );
+    // Wait for the rest of the headers
+    if ( headerSize == 0 )
+        return;
 
-            parseData ( data );
-            return;
-        }
+    LOG ( "statusCode=%d; contentLength=%u", _header.statusCode, _header.contentLength );
 
-        LOG ( "Header: '%s'", trimmed ( header ) );
+    if ( _header.hasRange )
+        LOG ( "range=[%u, %u); totalSize=%u", _header.rangeStart, _header.rangeEnd, _header.totalSize );
 
-        // Skip all the headers except Content-Length
-        if ( header.find ( "Content-Length:" ) == 0 )
-        {
-            stringstream ss ( header );
-            ss >> header >> _contentLength;
+    _remainingBytes = _header.contentLength;
 
-            LOG ( "contentLength=%u", _contentLength );
-            continue;
-        }
+    if ( _remainingBytes == 0 )
+    {
+        finalize();
+        return;
     }
+
+    // The rest of the buffer is the start of the response data
+    if ( _headerBuffer.size() > headerSize )
+        parseData ( _headerBuffer.substr ( headerSize ) );
 }
 
 void HttpGet::parseData ( const string& data )
 {
+    // Restart the timeout, so it only fails if the data stops
+    _timer->start ( timeout );
+
     _remainingBytes -= data.size();
 
-    if ( owner && _contentLength )
-        owner->httpProgress ( this, _contentLength - _remainingBytes, _contentLength );
+    if ( owner && _header.contentLength )
+        owner->httpProgress ( this, _header.contentLength - _remainingBytes, _header.contentLength );
 
     if ( mode == Buffered )
     {
@@ -193,7 +183,7 @@ void HttpGet::parseData ( const string& data )
         }
 
         if ( owner )
-            owner->httpResponse ( this, _statusCode, data, _remainingBytes );
+            owner->httpResponse ( this, _header.statusCode, data, _remainingBytes );
         return;
     }
     else
@@ -213,5 +203,5 @@ void HttpGet::finalize()
     _timer.reset();
 
     if ( owner )
-        owner->httpResponse ( this, _statusCode, _dataBuffer, 0 );
+        owner->httpResponse ( this, _header.statusCode, _dataBuffer, 0 );
 }
@@ -2,6 +2,7 @@
 
 #include "Socket.hpp"
 #include "Timer.hpp"
+#include "HttpRange.hpp"
 
 #include <string>
 
@@ -36,11 +37,16 @@ public:
 
     void start();
 
-    int getStatusCode() const { return _statusCode; }
+    // Only request the byte range [rangeStart, rangeEnd), rangeEnd can be HTTP_RANGE_END for the rest of the resource
+    void start ( uint32_t rangeStart, uint32_t rangeEnd );
+
+    int getStatusCode() const { return _header.statusCode; }
 
     const std::string& getResponse() const { return _dataBuffer; }
 
-    uint32_t getContentLength() const { return _contentLength; }
+    uint32_t getContentLength() const { return _header.contentLength; }
+
+    const HttpResponseHeader& getHeader() const { return _header; }
 
 private:
 
@@ -50,11 +56,15 @@ private:
 
     std::string _host, _path;
 
-    int _statusCode;
+    bool _hasRange = false;
+
+    uint32_t _rangeStart = 0, _rangeEnd = HTTP_RANGE_END;
+
+    HttpResponseHeader _header;
 
     std::string _headerBuffer, _dataBuffer;
 
-    uint32_t _contentLength, _remainingBytes;
+    uint32_t _remainingBytes = 0;
 
     void socketAccepted ( Socket *socket ) override {}
     void socketConnected ( Socket *socket ) override;
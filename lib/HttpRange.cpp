@@ -0,0 +1,295 @@
+#include "HttpRange.hpp"
+#include "StringUtils.hpp"
+#include "Logger.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+#define USER_AGENT "Mozilla/4.0 (compatible; MSIE 8.0; Windows NT 6.1)"
+
+
+string formatHttpGet ( const string& host, const string& path )
+{
+    return format ( "GET %s HTTP/1.1\r\nUser-Agent: %s\r\nHost: %s\r\n\r\n", path, USER_AGENT, host );
+}
+
+string formatHttpGet ( const string& host, const string& path, uint32_t start, uint32_t end )
+{
+    ASSERT ( start < end );
+
+    const string range = ( end == HTTP_RANGE_END ? format ( "%u-", start ) : format ( "%u-%u", start, end - 1 ) );
+
+    return format ( "GET %s HTTP/1.1\r\nUser-Agent: %s\r\nHost: %s\r\nRange: bytes=%s\r\n\r\n",
+                    path, USER_AGENT, host, range );
+}
+
+size_t HttpResponseHeader::parse ( const string& buffer )
+{
+    const size_t end = buffer.find ( "\r\n\r\n" );
+
+    if ( end == string::npos )
+        return 0;
+
+    *this = HttpResponseHeader();
+
+    istringstream ss ( buffer.substr ( 0, end ) );
+    string line, lastModified;
+
+    // Get the HTTP version header and status code
+    ss >> line >> statusCode;
+    getline ( ss, line );
+
+    while ( getline ( ss, line ) )
+    {
+        const size_t colon = line.find ( ':' );
+
+        if ( colon == string::npos )
+            continue;
+
+        const string name = lowerCase ( trimmed ( line.substr ( 0, colon ) ) );
+        const string value = trimmed ( line.substr ( colon + 1 ) );
+
+        if ( name == "content-length" )
+        {
+            contentLength = lexical_cast<uint32_t> ( value );
+        }
+        else if ( name == "content-range" )
+        {
+            unsigned first, last, total;
+
+            if ( sscanf ( value.c_str(), "bytes %u-%u/%u", &first, &last, &total ) == 3 && first <= last
+                    && last < total )
+            {
+                hasRange = true;
+                rangeStart = first;
+                rangeEnd = last + 1;
+                totalSize = total;
+            }
+        }
+        else if ( name == "etag" )
+        {
+            tag = value;
+        }
+        else if ( name == "last-modified" )
+        {
+            lastModified = value;
+        }
+    }
+
+    if ( tag.empty() )
+        tag = lastModified;
+
+    return end + 4;
+}
+
+DownloadSegments::DownloadSegments ( const string& url, size_t maxSegments, uint32_t minSegmentSize )
+    : url ( url )
+    , maxSegments ( max<size_t> ( 1, maxSegments ) )
+    , minSegmentSize ( max<uint32_t> ( 1, minSegmentSize ) ) {}
+
+void DownloadSegments::getRequest ( size_t segment, uint32_t& start, uint32_t& end ) const
+{
+    if ( !isStarted() )
+    {
+        ASSERT ( segment == 0 );
+
+        start = 0;
+        end = HTTP_RANGE_END;
+        return;
+    }
+
+    ASSERT ( segment < segments.size() );
+
+    start = segments[segment].getNext();
+    end = segments[segment].end;
+}
+
+DownloadSegments::Action DownloadSegments::handleHeader ( size_t segment, const HttpResponseHeader& header )
+{
+    if ( header.statusCode == 206 && header.hasRange )
+    {
+        if ( !isStarted() )
+        {
+            if ( segment != 0 || header.rangeStart != 0 )
+                return Fail;
+
+            totalSize = header.totalSize;
+            tag = header.tag;
+            split ( totalSize );
+
+            LOG ( "totalSize=%u; segments=%u; tag='%s'", totalSize, segments.size(), tag );
+            return Continue;
+        }
+
+        ASSERT ( segment < segments.size() );
+
+        if ( header.totalSize != totalSize || header.tag != tag )
+        {
+            LOG ( "File changed: totalSize=%u; tag='%s'", header.totalSize, header.tag );
+            reset();
+            return Restart;
+        }
+
+        return ( header.rangeStart == segments[segment].getNext() ? Continue : Fail );
+    }
+
+    if ( header.statusCode == 200 )
+    {
+        // The server ignored the range, so the whole file is downloaded in one segment, which can't resume
+        if ( segment != 0 || getReceivedBytes() > 0 || segments.size() > 1 )
+        {
+            LOG ( "Ranges not supported" );
+            reset();
+            return Restart;
+        }
+
+        totalSize = header.contentLength;
+        tag = header.tag;
+        segments.assign ( 1, { 0, totalSize, 0, 0 } );
+        return Continue;
+    }
+
+    return Fail;
+}
+
+uint32_t DownloadSegments::handleData ( size_t segment, uint32_t length, uint32_t& offset )
+{
+    ASSERT ( segment < segments.size() );
+
+    Segment& seg = segments[segment];
+
+    offset = seg.getNext();
+
+    const uint32_t count = min ( length, seg.end - seg.getNext() );
+
+    seg.received += count;
+
+    if ( count )
+        seg.failures = 0;
+
+    return count;
+}
+
+bool DownloadSegments::handleFailure ( size_t segment )
+{
+    if ( !isStarted() )
+        return ( ++_failures <= MAX_SEGMENT_RETRIES );
+
+    ASSERT ( segment < segments.size() );
+
+    return ( ++segments[segment].failures <= MAX_SEGMENT_RETRIES );
+}
+
+uint32_t DownloadSegments::getReceivedBytes() const
+{
+    uint32_t received = 0;
+
+    for ( const Segment& seg : segments )
+        received += seg.received;
+
+    return received;
+}
+
+bool DownloadSegments::isComplete() const
+{
+    if ( !isStarted() )
+        return false;
+
+    for ( const Segment& seg : segments )
+        if ( !seg.isDone() )
+            return false;
+
+    return true;
+}
+
+void DownloadSegments::reset()
+{
+    totalSize = 0;
+    tag.clear();
+    segments.clear();
+    _failures = 0;
+}
+
+void DownloadSegments::split ( uint32_t totalSize )
+{
+    const size_t count = max<size_t> ( 1, min<size_t> ( maxSegments, totalSize / minSegmentSize ) );
+    const uint32_t size = totalSize / count;
+
+    segments.clear();
+
+    for ( size_t i = 0; i < count; ++i )
+    {
+        const uint32_t end = ( i + 1 == count ? totalSize : uint32_t ( ( i + 1 ) * size ) );
+        segments.push_back ( { uint32_t ( i * size ), end, 0, 0 } );
+    }
+}
+
+bool DownloadSegments::save ( const string& file ) const
+{
+    ofstream out ( file.c_str() );
+
+    if ( !out.good() )
+        return false;
+
+    out << url << '\n' << tag << '\n' << totalSize << ' ' << segments.size() << '\n';
+
+    for ( const Segment& seg : segments )
+        out << seg.start << ' ' << seg.end << ' ' << seg.received << '\n';
+
+    out.close();
+    return out.good();
+}
+
+bool DownloadSegments::load ( const string& file )
+{
+    reset();
+
+    ifstream in ( file.c_str() );
+
+    if ( !in.good() )
+        return false;
+
+    string savedUrl, savedTag;
+    size_t count = 0;
+
+    getline ( in, savedUrl );
+    getline ( in, savedTag );
+
+    if ( savedUrl != url || !( in >> totalSize >> count ) || count == 0 || count > maxSegments )
+    {
+        reset();
+        return false;
+    }
+
+    // The segments must cover the whole file in order
+    uint32_t next = 0;
+
+    for ( size_t i = 0; i < count; ++i )
+    {
+        Segment seg = { 0, 0, 0, 0 };
+
+        if ( !( in >> seg.start >> seg.end >> seg.received ) || seg.start != next || seg.end < seg.start
+                || seg.received > seg.end - seg.start )
+        {
+            LOG ( "Ignoring invalid download progress: '%s'", file );
+            reset();
+            return false;
+        }
+
+        segments.push_back ( seg );
+        next = seg.end;
+    }
+
+    if ( next != totalSize )
+    {
+        reset();
+        return false;
+    }
+
+    tag = savedTag;
+    return true;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// End of an open ended range, ie the rest of the resource
+#define HTTP_RANGE_END ( 0xFFFFFFFFu )
+
+// Maximum number of segments of a download that are requested in parallel
+#define DEFAULT_DOWNLOAD_SEGMENTS ( 4 )
+
+// Files are only split into segments of at least this size
+#define MIN_SEGMENT_SIZE ( 256 * 1024 )
+
+// Number of times a segment is retried in a row before the download fails
+#define MAX_SEGMENT_RETRIES ( 5 )
+
+
+// Format a GET request for the whole resource, or only the byte range [start, end)
+std::string formatHttpGet ( const std::string& host, const std::string& path );
+std::string formatHttpGet ( const std::string& host, const std::string& path, uint32_t start, uint32_t end );
+
+
+struct HttpResponseHeader
+{
+    int statusCode = -1;
+
+    uint32_t contentLength = 0;
+
+    // Content-Range of a partial response: [rangeStart, rangeEnd) of totalSize bytes
+    bool hasRange = false;
+    uint32_t rangeStart = 0, rangeEnd = 0, totalSize = 0;
+
+    // ETag, or Last-Modified if there is no ETag, to check a partial download is for the same resource
+    std::string tag;
+
+    // Parse the headers at the start of the buffer, returns the size of the headers including the blank line,
+    // or 0 if the headers are incomplete.
+    size_t parse ( const std::string& buffer );
+};
+
+
+// Progress of a file that is downloaded as several byte ranges in parallel. The first request is open ended;
+// its response gives the size of the file, which is then split into segments. The progress can be saved next
+// to the file, so an interrupted download resumes each segment from where it stopped.
+class DownloadSegments
+{
+public:
+
+    struct Segment
+    {
+        // Byte range [start, end) of the file, and the number of bytes received from start
+        uint32_t start, end, received;
+
+        // Number of failed requests in a row
+        uint32_t failures;
+
+        uint32_t getNext() const { return start + received; }
+
+        bool isDone() const { return getNext() >= end; }
+    };
+
+    // What to do after a response header
+    enum Action : uint8_t { Continue, Restart, Fail };
+
+    const std::string url;
+
+    const size_t maxSegments;
+
+    const uint32_t minSegmentSize;
+
+    // Total size of the file and its tag, only valid once started
+    uint32_t totalSize = 0;
+    std::string tag;
+
+    std::vector<Segment> segments;
+
+    DownloadSegments ( const std::string& url, size_t maxSegments = DEFAULT_DOWNLOAD_SEGMENTS,
+                       uint32_t minSegmentSize = MIN_SEGMENT_SIZE );
+
+    // True once the size of the file is known
+    bool isStarted() const { return !segments.empty(); }
+
+    // Range to request for a segment, before starting there is only one open ended request
+    void getRequest ( size_t segment, uint32_t& start, uint32_t& end ) const;
+
+    // Check the response header for a segment. The first response splits the file into segments. Restart means the
+    // file changed or the server ignored the range, so the progress was discarded and the download starts over.
+    Action handleHeader ( size_t segment, const HttpResponseHeader& header );
+
+    // Data received for a segment, returns the number of bytes that belong to the segment, to be written at offset
+    uint32_t handleData ( size_t segment, uint32_t length, uint32_t& offset );
+
+    // A request for a segment failed, returns true if it should be retried
+    bool handleFailure ( size_t segment );
+
+    uint32_t getReceivedBytes() const;
+
+    bool isComplete() const;
+
+    // Discard all progress
+    void reset();
+
+    // Save / load the progress, loading fails if the progress is for another url
+    bool save ( const std::string& file ) const;
+    bool load ( const std::string& file );
+
+private:
+
+    // Failed requests in a row before starting
+    uint32_t _failures = 0;
+
+    void split ( uint32_t totalSize );
+};
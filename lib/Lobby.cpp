@@ -84,7 +84,10 @@ void Lobby::disconnect()
 void Lobby::socketConnected ( Socket *socket )
 {
     ASSERT ( _socket.get() == socket );
-    const string request = format ( "LIST,none" );
+
+    // Servers that don't support subscriptions treat this as a normal LIST
+    _feed.reset();
+    const string request = LOBBY_SUBSCRIBE_REQUEST;
     LOG ( "Sending request:\n%s", request );
 
     _timer.reset ( new Timer ( this ) );
@@ -115,12 +118,71 @@ void Lobby::socketRead ( Socket *socket, const char *bytes, size_t len, const Ip
 {
     LOG ( "Socket Read" );
     ASSERT ( _socket.get() == socket );
-    const string data ( bytes, len );
 
-    //_timer.reset();
+    // Subscribed messages are framed since pushes can arrive together, otherwise each read is one message
+    vector<string> messages;
+    if ( ! _feed.read ( bytes, len, messages ) ) {
+        handleMessage ( string ( bytes, len ) );
+        return;
+    }
+
+    for ( const string& message : messages )
+        handleMessage ( message );
+}
+
+void Lobby::resizeEntries ( size_t count )
+{
+    numEntries = count;
+
+    // Keep the usual table size, with an open slot to host in even when there are more hosts than that
+    const size_t numRows = max ( count + 1, size_t ( LOBBY_LIST_LIMIT ) );
+    entries.resize ( numRows );
+    ips.resize ( numRows );
+
+    for ( size_t i = count; i < numRows; ++i ) {
+        entries[i] = blankEntry;
+    }
+}
+
+void Lobby::updateEntries()
+{
+    entryMutex.lock();
+    resizeEntries ( _feed.entries.size() );
+    for ( size_t i = 0; i < _feed.entries.size(); ++i ) {
+        entries[i] = _feed.entries[i].name;
+        ips[i] = _feed.entries[i].address;
+    }
+    entryMutex.unlock();
+}
 
+void Lobby::handleMessage ( const string& data )
+{
     LOG( data );
 
+    // Changes pushed to subscribers, applied to the current hosts in place
+    const LobbyFeed::Result result = _feed.apply ( data );
+
+    if ( result != LobbyFeed::NotPush ) {
+        if ( result == LobbyFeed::Applied ) {
+            updateEntries();
+        } else if ( result == LobbyFeed::Resync ) {
+            LOG ( "Missed a lobby change after version %u, subscribing again", _feed.getVersion() );
+            const string request = LOBBY_SUBSCRIBE_REQUEST;
+            if ( ! _socket->send ( &request[0], request.size() ) ) {
+                LOG ( "Failed to send request!" );
+
+                if ( owner )
+                    owner->connectionFailed ( this );
+            }
+        }
+
+        if ( owner && !connectionSuccess ) {
+            connectionSuccess = true;
+            owner->unlock( this );
+        }
+        return;
+    }
+
     vector<string> rawdata = split( data, "\x1f" );
     string reqType = rawdata[0];
     if ( reqType == "LIST" ) {
@@ -135,23 +197,17 @@ void Lobby::socketRead ( Socket *socket, const char *bytes, size_t len, const Ip
                 ip.push_back(nameipaddr[1]);
             }
             entryMutex.lock();
-            numEntries = stoi( rawdata[1] );
+            resizeEntries ( names.size() );
             LOG( lines[0] );
             LOG( numEntries );
             for ( int i = 0; i < numEntries; ++i ){
                 entries[i] = names[i];
                 ips[i] = ip[i];
             }
-            for ( int i = numEntries; i < 20; ++i ) {
-                entries[i] = blankEntry;
-            }
             entryMutex.unlock();
         } else {
             entryMutex.lock();
-            numEntries = 0;
-            for ( int i = 0; i < 20; ++i ) {
-                entries[i] = blankEntry;
-            }
+            resizeEntries ( 0 );
             entryMutex.unlock();
         }
 
@@ -246,7 +302,8 @@ void Lobby::timerExpired ( Timer *timer )
     ASSERT ( _timer.get() == timer );
 
     string request;
-    if ( mode == DEFAULT_LOBBY ) {
+    if ( mode == DEFAULT_LOBBY && ! _feed.isFramed() ) {
+        // Only poll servers that don't push changes
         request = format ( "LIST,none" );
     } else if ( mode == CONCERTO_BROWSE ) {
         request = format ( "CLIST,none" );
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "ConsoleUi.hpp"
+#include "LobbyFeed.hpp"
 #include "Socket.hpp"
 #include "Timer.hpp"
 
@@ -89,6 +90,18 @@ private:
 
     bool hostResponse;
 
+    // Hosts pushed by the server when it supports subscriptions
+    LobbyFeed _feed;
+
+    // Handle a single message from the server
+    void handleMessage ( const std::string& data );
+
+    // Set the number of hosts and resize the default lobby table to fit, entryMutex must be locked
+    void resizeEntries ( size_t count );
+
+    // Copy the subscribed hosts into the default lobby table
+    void updateEntries();
+
     // Socket callbacks
     void socketAccepted ( Socket *socket ) override {}
     void socketConnected ( Socket *socket ) override;
@@ -0,0 +1,217 @@
+#include "LobbyFeed.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+
+#define FIELD_SEPARATOR     '\x1f'
+#define ADDRESS_SEPARATOR   '\x1e'
+
+#define SNAPSHOT_HEADER     "SNAP\x1f"
+
+
+// Split into fields in one pass, a snapshot can have thousands of them
+static void splitFields ( const string& message, vector<string>& fields )
+{
+    fields.clear();
+
+    size_t start = 0;
+
+    for ( ;; )
+    {
+        const size_t end = message.find ( FIELD_SEPARATOR, start );
+
+        if ( end == string::npos )
+            break;
+
+        fields.push_back ( message.substr ( start, end - start ) );
+        start = end + 1;
+    }
+
+    fields.push_back ( message.substr ( start ) );
+}
+
+static bool parseNumber ( const string& str, uint64_t& value )
+{
+    if ( str.empty() || str.size() > 19 )
+        return false;
+
+    value = 0;
+
+    for ( char c : str )
+    {
+        if ( c < '0' || c > '9' )
+            return false;
+
+        value = value * 10 + ( c - '0' );
+    }
+
+    return true;
+}
+
+static bool parseId ( const string& str, uint32_t& id )
+{
+    uint64_t value;
+
+    if ( !parseNumber ( str, value ) || value > UINT32_MAX )
+        return false;
+
+    id = uint32_t ( value );
+    return true;
+}
+
+static bool parseEntry ( const string& id, const string& line, LobbyFeed::Entry& entry )
+{
+    const size_t separator = line.find ( ADDRESS_SEPARATOR );
+
+    if ( separator == string::npos || !parseId ( id, entry.id ) )
+        return false;
+
+    entry.name = line.substr ( 0, separator );
+    entry.address = line.substr ( separator + 1 );
+    return true;
+}
+
+
+bool LobbyFeed::read ( const char *bytes, size_t len, vector<string>& messages )
+{
+    messages.clear();
+
+    _buffer.append ( bytes, len );
+
+    if ( !_framed )
+    {
+        // Servers without push support answer the subscribe request with a plain LIST
+        const size_t headerLength = strlen ( SNAPSHOT_HEADER );
+        const size_t length = min ( _buffer.size(), headerLength );
+
+        if ( _buffer.compare ( 0, length, SNAPSHOT_HEADER, length ) != 0 )
+        {
+            _buffer.clear();
+            return false;
+        }
+
+        if ( length < headerLength )
+            return true;
+
+        _framed = true;
+    }
+
+    size_t start = 0;
+
+    for ( ;; )
+    {
+        const size_t end = _buffer.find ( LOBBY_MESSAGE_END, start );
+
+        if ( end == string::npos )
+            break;
+
+        messages.push_back ( _buffer.substr ( start, end - start ) );
+        start = end + 1;
+    }
+
+    _buffer.erase ( 0, start );
+    return true;
+}
+
+vector<LobbyFeed::Entry>::iterator LobbyFeed::find ( uint32_t id )
+{
+    for ( auto it = entries.begin(); it != entries.end(); ++it )
+        if ( it->id == id )
+            return it;
+
+    return entries.end();
+}
+
+LobbyFeed::Result LobbyFeed::applySnapshot ( const vector<string>& fields )
+{
+    uint64_t version, count;
+
+    if ( fields.size() < 3 || !parseNumber ( fields[1], version ) || !parseNumber ( fields[2], count )
+            || count > fields.size() || fields.size() != 3 + 2 * count )
+    {
+        _synced = false;
+        return Resync;
+    }
+
+    entries.resize ( count );
+
+    for ( size_t i = 0; i < count; ++i )
+    {
+        if ( !parseEntry ( fields[3 + 2 * i], fields[4 + 2 * i], entries[i] ) )
+        {
+            entries.clear();
+            _synced = false;
+            return Resync;
+        }
+    }
+
+    _version = version;
+    _synced = true;
+    return Applied;
+}
+
+LobbyFeed::Result LobbyFeed::apply ( const string& message )
+{
+    vector<string> fields;
+    splitFields ( message, fields );
+
+    const string& type = fields[0];
+
+    if ( type == "SNAP" )
+        return applySnapshot ( fields );
+
+    if ( type != "JOIN" && type != "UPDATE" && type != "LEAVE" )
+        return NotPush;
+
+    if ( !_synced )
+        return Ignored;
+
+    uint64_t version;
+
+    if ( fields.size() < 2 || !parseNumber ( fields[1], version ) )
+    {
+        _synced = false;
+        return Resync;
+    }
+
+    // Pushed before the snapshot we have was taken
+    if ( version <= _version )
+        return Ignored;
+
+    Entry entry;
+
+    const bool valid = ( version == _version + 1 )
+                       && ( type == "LEAVE" ? ( fields.size() == 3 && parseId ( fields[2], entry.id ) )
+                                            : ( fields.size() == 4 && parseEntry ( fields[2], fields[3], entry ) ) );
+
+    auto it = ( valid ? find ( entry.id ) : entries.end() );
+
+    // Joining twice, or changing a host we don't know about, means we're out of sync too
+    if ( !valid || ( type == "JOIN" ) != ( it == entries.end() ) )
+    {
+        _synced = false;
+        return Resync;
+    }
+
+    // Hosting again moves the entry to the end, the same as on the server
+    if ( it != entries.end() )
+        entries.erase ( it );
+
+    if ( type != "LEAVE" )
+        entries.push_back ( entry );
+
+    _version = version;
+    return Applied;
+}
+
+void LobbyFeed::reset()
+{
+    entries.clear();
+    _buffer.clear();
+    _framed = false;
+    _synced = false;
+    _version = 0;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "LobbyList.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// Client side of a lobby subscription, see LobbyList for the protocol.
+//
+// Keeps the hosts from the last snapshot and applies each pushed change to them in place. A change that doesn't
+// follow on from the current version means one was missed, then the pushes are ignored until a new snapshot.
+class LobbyFeed
+{
+public:
+
+    struct Entry
+    {
+        uint32_t id;
+
+        // Name and status, as shown in the lobby
+        std::string name;
+
+        std::string address;
+    };
+
+    enum Result
+    {
+        // Not a subscription message
+        NotPush,
+
+        // Applied, the entries changed
+        Applied,
+
+        // Ignored, it's older than the current snapshot or we're waiting for a new one
+        Ignored,
+
+        // A change was missed, the client should subscribe again
+        Resync,
+    };
+
+    // Hosts in the order they were hosted
+    std::vector<Entry> entries;
+
+    // Split the data read from the server into messages, a partial message is kept until the rest arrives.
+    // Returns false if the server doesn't frame its messages, ie it answered the subscribe request with a LIST.
+    bool read ( const char *bytes, size_t len, std::vector<std::string>& messages );
+
+    // Apply a single message without the terminator
+    Result apply ( const std::string& message );
+
+    // Wait for a new snapshot, pushed changes are ignored until then
+    void resync() { _synced = false; }
+
+    // Forget everything, for a new connection
+    void reset();
+
+    bool isSynced() const { return _synced; }
+
+    // Whether the server frames its messages, known once the first snapshot starts arriving
+    bool isFramed() const { return _framed; }
+
+    uint64_t getVersion() const { return _version; }
+
+private:
+
+    bool _framed = false, _synced = false;
+
+    uint64_t _version = 0;
+
+    // Partial message from the last read
+    std::string _buffer;
+
+    std::vector<Entry>::iterator find ( uint32_t id );
+
+    Result applySnapshot ( const std::vector<std::string>& fields );
+};
@@ -0,0 +1,284 @@
+#include "LobbyList.hpp"
+
+#include <algorithm>
+
+using namespace std;
+
+
+#define LIST_HEADER         "LIST\x1f"
+#define SNAPSHOT_HEADER     "SNAP\x1f"
+#define FIELD_SEPARATOR     '\x1f'
+#define ADDRESS_SEPARATOR   '\x1e'
+
+static const string hostTrue = "HOST\x1f" "True";
+static const string hostFalse = "HOST\x1f" "False";
+
+// The Concerto lobbies and matchmaking are proxied to external services by the python server, this server doesn't
+static const string notSupported = "CERROR\x1fNot supported by this lobby server";
+
+// The same responses for subscribers, whose messages are all terminated
+static const string hostTrueMessage = hostTrue + LOBBY_MESSAGE_END;
+static const string hostFalseMessage = hostFalse + LOBBY_MESSAGE_END;
+static const string notSupportedMessage = notSupported + LOBBY_MESSAGE_END;
+
+static const unordered_set<string> unsupported =
+{
+    "CLIST", "CLOBBY", "CJOIN", "CCHAL", "CCREATE", "CPREACCEPT", "CACCEPT", "CEND", "MMSTART"
+};
+
+
+LobbyList::LobbyList ( size_t listLimit, size_t maxHosts ) : listLimit ( listLimit ), maxHosts ( maxHosts ) {}
+
+static bool isSeparator ( char c )
+{
+    return ( c == FIELD_SEPARATOR || c == ADDRESS_SEPARATOR || c == LOBBY_MESSAGE_END );
+}
+
+string LobbyList::formatEntry ( const string& name, const string& address )
+{
+    string line = name.empty() ? "Anonymous" : name;
+
+    // Drop the separators so a name can't break the framing
+    line.erase ( remove_if ( line.begin(), line.end(), isSeparator ), line.end() );
+
+    if ( line.size() > LOBBY_NAME_LENGTH )
+    {
+        size_t length = LOBBY_NAME_LENGTH;
+
+        // Don't cut a UTF-8 sequence in half
+        while ( length > 0 && ( line[length] & 0xC0 ) == 0x80 )
+            --length;
+
+        line.resize ( length );
+    }
+
+    if ( line.size() < LOBBY_NAME_LENGTH )
+        line.append ( LOBBY_NAME_LENGTH - line.size(), ' ' );
+
+    line += "|VRS|Waiting";
+    line += ADDRESS_SEPARATOR;
+
+    // The port part of the address comes from the request too
+    for ( char c : address )
+        if ( !isSeparator ( c ) )
+            line += c;
+
+    return line;
+}
+
+void LobbyList::changed ( const Entry& entry )
+{
+    if ( _numListed < listLimit || entry.sequence <= _lastListed )
+        _listChanged = true;
+}
+
+void LobbyList::remove ( list<Entry>::iterator it )
+{
+    changed ( *it );
+
+    _index.erase ( it->id );
+    _entries.erase ( it );
+}
+
+void LobbyList::leave ( list<Entry>::iterator it )
+{
+    const uint32_t id = it->id;
+
+    remove ( it );
+    push ( "LEAVE", id, 0 );
+}
+
+void LobbyList::push ( const char *type, uint32_t id, const string *line )
+{
+    ++_version;
+
+    if ( _subscribers.empty() )
+        return;
+
+    _pushes += type;
+    _pushes += FIELD_SEPARATOR;
+    _pushes += to_string ( _version );
+    _pushes += FIELD_SEPARATOR;
+    _pushes += to_string ( id );
+
+    if ( line )
+    {
+        _pushes += FIELD_SEPARATOR;
+        _pushes += *line;
+    }
+
+    _pushes += LOBBY_MESSAGE_END;
+}
+
+bool LobbyList::host ( uint32_t id, const string& name, const string& address, uint64_t now )
+{
+    auto it = _index.find ( id );
+
+    const bool update = ( it != _index.end() );
+
+    // Hosting again moves the entry to the end of the list
+    if ( update )
+        remove ( it->second );
+    else if ( maxHosts && _entries.size() >= maxHosts )
+        return false;
+
+    _entries.push_back ( { id, _nextSequence++, now, formatEntry ( name, address ) } );
+    _index[id] = prev ( _entries.end() );
+
+    changed ( _entries.back() );
+    push ( update ? "UPDATE" : "JOIN", id, &_entries.back().line );
+    return true;
+}
+
+bool LobbyList::unhost ( uint32_t id )
+{
+    auto it = _index.find ( id );
+
+    if ( it == _index.end() )
+        return false;
+
+    leave ( it->second );
+    return true;
+}
+
+size_t LobbyList::expire ( uint64_t now, uint64_t maxAge )
+{
+    size_t count = 0;
+
+    // Entries are in the order they were hosted, so the oldest are at the front
+    while ( !_entries.empty() && now - _entries.front().time > maxAge )
+    {
+        leave ( _entries.begin() );
+        ++count;
+    }
+
+    return count;
+}
+
+const string& LobbyList::getListResponse()
+{
+    if ( !_listChanged )
+        return _listResponse;
+
+    _numListed = min ( listLimit, _entries.size() );
+    _lastListed = 0;
+
+    _listResponse = LIST_HEADER + to_string ( _numListed ) + FIELD_SEPARATOR;
+
+    auto it = _entries.cbegin();
+
+    for ( size_t i = 0; i < _numListed; ++i, ++it )
+    {
+        if ( i > 0 )
+            _listResponse += FIELD_SEPARATOR;
+
+        _listResponse += it->line;
+        _lastListed = it->sequence;
+    }
+
+    _listChanged = false;
+    ++_numSnapshots;
+    return _listResponse;
+}
+
+bool LobbyList::subscribe ( uint32_t id )
+{
+    return _subscribers.insert ( id ).second;
+}
+
+bool LobbyList::unsubscribe ( uint32_t id )
+{
+    if ( !_subscribers.erase ( id ) )
+        return false;
+
+    if ( _subscribers.empty() )
+        _pushes.clear();
+
+    return true;
+}
+
+const string& LobbyList::getSnapshot()
+{
+    if ( _snapshotValid && _snapshotVersion == _version )
+        return _snapshot;
+
+    _snapshot = SNAPSHOT_HEADER + to_string ( _version ) + FIELD_SEPARATOR + to_string ( _entries.size() );
+
+    for ( const Entry& entry : _entries )
+    {
+        _snapshot += FIELD_SEPARATOR;
+        _snapshot += to_string ( entry.id );
+        _snapshot += FIELD_SEPARATOR;
+        _snapshot += entry.line;
+    }
+
+    _snapshot += LOBBY_MESSAGE_END;
+
+    _snapshotVersion = _version;
+    _snapshotValid = true;
+    return _snapshot;
+}
+
+bool LobbyList::handle ( uint32_t id, const string& peerAddr, const char *bytes, size_t len, uint64_t now,
+                         const string *& response )
+{
+    response = 0;
+
+    const string request ( bytes, len );
+
+    // Requests are "REQ,info", with exactly one comma like the python server expects
+    const size_t comma = request.find ( ',' );
+
+    if ( comma == string::npos || request.find ( ',', comma + 1 ) != string::npos )
+        return false;
+
+    const string req = request.substr ( 0, comma );
+    const string info = request.substr ( comma + 1 );
+
+    const bool subscribed = isSubscribed ( id );
+
+    if ( req == "LIST" )
+    {
+        // Subscribing again is how a client that missed a change gets a new snapshot
+        if ( subscribed || request == LOBBY_SUBSCRIBE_REQUEST )
+        {
+            subscribe ( id );
+            response = &getSnapshot();
+        }
+        else
+        {
+            response = &getListResponse();
+        }
+        return true;
+    }
+
+    if ( req == "HOST" )
+    {
+        // The info is "name|:port", the port is appended to the address the request came from
+        const size_t bar = info.find ( '|' );
+
+        if ( bar == string::npos || info.find ( '|', bar + 1 ) != string::npos )
+            return false;
+
+        const bool success = host ( id, info.substr ( 0, bar ), peerAddr + info.substr ( bar + 1 ), now );
+        if ( subscribed )
+            response = ( success ? &hostTrueMessage : &hostFalseMessage );
+        else
+            response = ( success ? &hostTrue : &hostFalse );
+        return true;
+    }
+
+    if ( req == "UNHOST" )
+    {
+        unhost ( id );
+        return true;
+    }
+
+    if ( unsupported.count ( req ) )
+    {
+        response = ( subscribed ? &notSupportedMessage : &notSupported );
+        return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+
+// Name field width and the default LIST limit, the client has a fixed size table with 20 rows of this width
+#define LOBBY_NAME_LENGTH       ( 43 )
+#define LOBBY_LIST_LIMIT        ( 20 )
+
+// Subscribing is a LIST request with "sub" as the info, so servers without push support just answer with a LIST
+#define LOBBY_SUBSCRIBE_REQUEST "LIST,sub"
+
+// Messages to subscribed clients are terminated, since pushed changes can arrive together in one read
+#define LOBBY_MESSAGE_END       '\x1d'
+
+
+// The lobby list of the native lobby server, speaks the same text protocol as scripts/lobbyserver.py and lib/Lobby.
+//
+// Each entry is serialized once when it is hosted, and the LIST response is a cached snapshot that is only rebuilt
+// when an entry within the listed range changes, so LIST requests are just a send of an existing string.
+//
+// Clients can also subscribe, then they get one full snapshot and every change after that is pushed to them:
+//
+//   SNAP <version> <count> [<id> <entry>]...
+//   JOIN <version> <id> <entry>
+//   UPDATE <version> <id> <entry>      Hosting again, the entry also moves to the end of the list
+//   LEAVE <version> <id>
+//
+// Fields are separated by \x1f and each message ends with LOBBY_MESSAGE_END. The version goes up by one with each
+// change, so a client that sees a gap knows it missed one and subscribes again for a new snapshot.
+class LobbyList
+{
+public:
+
+    // Maximum number of entries in a LIST response
+    const size_t listLimit;
+
+    // Maximum number of hosts, 0 for unlimited
+    const size_t maxHosts;
+
+    LobbyList ( size_t listLimit = LOBBY_LIST_LIMIT, size_t maxHosts = 0 );
+
+    // Add or replace the host for a client, returns false if the list is full
+    bool host ( uint32_t id, const std::string& name, const std::string& address, uint64_t now );
+
+    // Remove the host for a client, returns false if it wasn't hosting
+    bool unhost ( uint32_t id );
+
+    // Remove hosts older than maxAge, returns the number of hosts removed
+    size_t expire ( uint64_t now, uint64_t maxAge );
+
+    // Get the pre-serialized LIST response
+    const std::string& getListResponse();
+
+    // Add or remove a client that gets pushed changes, returns false if nothing changed
+    bool subscribe ( uint32_t id );
+    bool unsubscribe ( uint32_t id );
+
+    bool isSubscribed ( uint32_t id ) const { return _subscribers.count ( id ); }
+
+    // Get the pre-serialized snapshot of all the hosts for subscribers
+    const std::string& getSnapshot();
+
+    // Get the messages for the changes since they were last cleared, these should be sent to every subscriber
+    const std::string& getPushes() const { return _pushes; }
+
+    void clearPushes() { _pushes.clear(); }
+
+    // Handle a raw request from a client, returns false if the request is invalid and the client should be dropped.
+    // The response is set to a string owned by the list, or null if there is nothing to send back. It is only valid
+    // until the list is changed again.
+    bool handle ( uint32_t id, const std::string& peerAddr, const char *bytes, size_t len, uint64_t now,
+                  const std::string *& response );
+
+    // Get the number of hosts
+    size_t getNumHosts() const { return _entries.size(); }
+
+    // Get the number of subscribed clients
+    size_t getNumSubscribers() const { return _subscribers.size(); }
+
+    // Get the number of times the LIST response was rebuilt
+    uint32_t getNumSnapshots() const { return _numSnapshots; }
+
+    // Get the version, which goes up by one with each change
+    uint64_t getVersion() const { return _version; }
+
+    // Format a single entry of the LIST response
+    static std::string formatEntry ( const std::string& name, const std::string& address );
+
+private:
+
+    struct Entry
+    {
+        // Client that is hosting
+        uint32_t id;
+
+        // Order the entry was hosted in
+        uint64_t sequence;
+
+        // Time the entry was hosted, used for expiry
+        uint64_t time;
+
+        // Serialized entry
+        std::string line;
+    };
+
+    // Entries in the order they were hosted, which is also the order they are listed in
+    std::list<Entry> _entries;
+
+    std::unordered_map<uint32_t, std::list<Entry>::iterator> _index;
+
+    uint64_t _nextSequence = 0;
+
+    // Cached LIST response
+    std::string _listResponse;
+
+    // Number of entries in the cached response and the sequence of the last one
+    size_t _numListed = 0;
+    uint64_t _lastListed = 0;
+
+    bool _listChanged = true;
+
+    uint32_t _numSnapshots = 0;
+
+    uint64_t _version = 0;
+
+    std::unordered_set<uint32_t> _subscribers;
+
+    // Cached subscriber snapshot and the version it was built at
+    std::string _snapshot;
+    uint64_t _snapshotVersion = 0;
+    bool _snapshotValid = false;
+
+    // Messages to push to the subscribers
+    std::string _pushes;
+
+    // Flag the cached response to be rebuilt if the entry is in the listed range
+    void changed ( const Entry& entry );
+
+    void remove ( std::list<Entry>::iterator it );
+
+    // Remove an entry and push its removal
+    void leave ( std::list<Entry>::iterator it );
+
+    // Bump the version and push a change, the message is only built if someone is subscribed
+    void push ( const char *type, uint32_t id, const std::string *line );
+};
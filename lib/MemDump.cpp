@@ -8,10 +8,23 @@
 #include <sstream>
 #include <fstream>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 using namespace std;
 using namespace cereal;
 
 
+// "MDLY" in little endian
+static const uint32_t LayoutMagic = 0x594C444D;
+
+
 static bool compareMemDumpAddrs ( const MemDumpBase& a, const MemDumpBase& b )
 {
     return ( a.getAddr() < b.getAddr() );
@@ -78,6 +91,237 @@ vector<MemDumpPtr> MemDumpBase::concat ( const vector<MemDumpPtr>& a, const vect
     return ret;
 }
 
+// Get the offsets of the pointers in the dump of a memory dump, ie where saveDump writes them
+static void getPtrOffsets ( const MemDumpBase& mem, size_t& offset, vector<size_t>& ptrOffsets )
+{
+    const size_t start = offset;
+
+    offset += mem.size;
+
+    for ( const MemDumpPtr& ptr : mem.ptrs )
+    {
+        ptrOffsets.push_back ( start + ptr.srcOffset );
+        getPtrOffsets ( ptr, offset, ptrOffsets );
+    }
+}
+
+// Save / load the child pointers of memory at the given address, without building MemDumpPtr parents for each address
+static void saveChildDumps ( const char *parent, const vector<MemDumpPtr>& ptrs, char *&dump )
+{
+    for ( const MemDumpPtr& ptr : ptrs )
+    {
+        char *addr = 0;
+
+        if ( parent )
+        {
+            memcpy ( &addr, parent + ptr.srcOffset, sizeof ( addr ) );
+
+            if ( addr )
+                addr += ptr.dstOffset;
+        }
+
+        if ( addr )
+            copy ( addr, addr + ptr.size, dump );
+        else
+            memset ( dump, 0, ptr.size );
+
+        dump += ptr.size;
+
+        saveChildDumps ( addr, ptr.ptrs, dump );
+    }
+}
+
+static void loadChildDumps ( const char *parent, const vector<MemDumpPtr>& ptrs, const char *&dump )
+{
+    for ( const MemDumpPtr& ptr : ptrs )
+    {
+        char *addr = 0;
+
+        // The parent was already loaded, so this is the pointer value from the dump
+        if ( parent )
+        {
+            memcpy ( &addr, parent + ptr.srcOffset, sizeof ( addr ) );
+
+            if ( addr )
+                addr += ptr.dstOffset;
+        }
+
+        if ( addr )
+            copy ( dump, dump + ptr.size, addr );
+
+        dump += ptr.size;
+
+        loadChildDumps ( addr, ptr.ptrs, dump );
+    }
+}
+
+// Comparing the data with itself shifted by one byte uses the vectorized memcmp, which is much faster than a loop
+static bool isZero ( const char *data, size_t size )
+{
+    return ( size == 0 || ( data[0] == 0 && memcmp ( data, data + 1, size - 1 ) == 0 ) );
+}
+
+MemDumpSlots::MemDumpSlots ( void *addr, size_t slotSize, size_t count, size_t flagOffset, size_t flagSize,
+                             const vector<MemDumpPtr>& ptrs )
+    : addr ( ( char * ) addr ), slotSize ( slotSize ), count ( count )
+    , flagOffset ( flagOffset ), flagSize ( flagSize ), ptrs ( ptrs )
+{
+    ASSERT ( flagOffset + flagSize <= slotSize );
+
+    // Every slot has the same layout, so only one memory dump is built
+    const MemDump first ( this->addr, slotSize, ptrs );
+
+    _slotTotalSize = first.getTotalSize();
+
+    size_t offset = 0;
+    getPtrOffsets ( first, offset, _ptrOffsets );
+    sort ( _ptrOffsets.begin(), _ptrOffsets.end() );
+}
+
+bool MemDumpSlots::isSaved ( size_t i ) const
+{
+    const char *slot = addr + i * slotSize;
+
+    for ( size_t j = 0; j < flagSize; ++j )
+        if ( slot[flagOffset + j] )
+            return true;
+
+    return !isZero ( slot, slotSize );
+}
+
+size_t MemDumpSlots::getMaxDumpSize() const
+{
+    return ( ( count + 31 ) / 32 ) * 4 + count * _slotTotalSize;
+}
+
+void MemDumpSlots::saveDump ( vector<char>& dump, uint64_t *hash ) const
+{
+    const size_t start = dump.size();
+    const size_t numWords = ( count + 31 ) / 32;
+
+    vector<uint32_t> bitmap ( numWords );
+    size_t numUsed = 0;
+
+    for ( size_t i = 0; i < count; ++i )
+    {
+        if ( !isSaved ( i ) )
+            continue;
+
+        bitmap[i / 32] |= ( 1u << ( i % 32 ) );
+        ++numUsed;
+    }
+
+    dump.resize ( start + numWords * 4 + numUsed * _slotTotalSize );
+
+    char *ptr = &dump[start];
+
+    if ( numWords )
+    {
+        memcpy ( ptr, &bitmap[0], numWords * 4 );
+        ptr += numWords * 4;
+    }
+
+    for ( size_t i = 0; i < count; ++i )
+    {
+        if ( ! ( bitmap[i / 32] & ( 1u << ( i % 32 ) ) ) )
+            continue;
+
+        const char *slot = addr + i * slotSize;
+
+        copy ( slot, slot + slotSize, ptr );
+        ptr += slotSize;
+
+        saveChildDumps ( slot, ptrs, ptr );
+    }
+
+    ASSERT ( ptr == &dump[0] + dump.size() );
+
+    if ( !hash )
+        return;
+
+    // The slots were just written so they are still in cache, the pointer bytes are hashed as zero
+    MemDumpHasher hasher;
+    const char *saved = &dump[start];
+
+    hasher.feed ( saved, numWords * 4 );
+    saved += numWords * 4;
+
+    for ( size_t i = 0; i < numUsed; ++i, saved += _slotTotalSize )
+    {
+        size_t pos = 0;
+
+        for ( size_t offset : _ptrOffsets )
+        {
+            if ( offset < pos )
+                continue;
+
+            hasher.feed ( saved + pos, offset - pos );
+            hasher.feedZeros ( sizeof ( char * ) );
+            pos = offset + sizeof ( char * );
+        }
+
+        hasher.feed ( saved + pos, _slotTotalSize - pos );
+    }
+
+    *hash = hasher.finish();
+}
+
+void MemDumpSlots::loadDump ( const char *&dump ) const
+{
+    ASSERT ( dump != 0 );
+
+    const char *bitmap = dump;
+    dump += ( ( count + 31 ) / 32 ) * 4;
+
+    for ( size_t i = 0; i < count; ++i )
+    {
+        uint32_t word;
+        memcpy ( &word, bitmap + ( i / 32 ) * 4, 4 );
+
+        char *slot = addr + i * slotSize;
+
+        if ( ! ( word & ( 1u << ( i % 32 ) ) ) )
+        {
+            memset ( slot, 0, slotSize );
+            continue;
+        }
+
+        copy ( dump, dump + slotSize, slot );
+        dump += slotSize;
+
+        loadChildDumps ( slot, ptrs, dump );
+    }
+}
+
+size_t MemDumpSlots::countMismatchedSlots ( const char *&dump ) const
+{
+    ASSERT ( dump != 0 );
+
+    const char *bitmap = dump;
+    dump += ( ( count + 31 ) / 32 ) * 4;
+
+    size_t numMismatched = 0;
+
+    for ( size_t i = 0; i < count; ++i )
+    {
+        uint32_t word;
+        memcpy ( &word, bitmap + ( i / 32 ) * 4, 4 );
+
+        const char *slot = addr + i * slotSize;
+
+        if ( ! ( word & ( 1u << ( i % 32 ) ) ) )
+        {
+            numMismatched += !isZero ( slot, slotSize );
+            continue;
+        }
+
+        numMismatched += ( memcmp ( slot, dump, slotSize ) != 0 );
+        dump += _slotTotalSize;
+    }
+
+    return numMismatched;
+}
+
 void MemDumpList::update()
 {
     vector<MemDump> sortedVector = sorted ( addrs, compareMemDumpAddrs );
@@ -138,16 +382,28 @@ void MemDumpPtr::save ( BinaryOutputArchive& ar ) const
 
 void MemDump::save ( BinaryOutputArchive& ar ) const
 {
-    uint32_t val = ( uint32_t ) addr;
+    uint32_t val = ( uint32_t ) ( uintptr_t ) addr;
     ar ( val );
     MemDumpBase::save ( ar );
 }
 
+void MemDumpSlots::save ( BinaryOutputArchive& ar ) const
+{
+    uint32_t val = ( uint32_t ) ( uintptr_t ) addr;
+    ar ( val, slotSize, count, flagOffset, flagSize, ptrs.size() );
+    for ( const MemDumpPtr& ptr : ptrs )
+        ptr.save ( ar );
+}
+
 void MemDumpList::save ( BinaryOutputArchive& ar ) const
 {
     ar ( totalSize, addrs.size() );
     for ( const MemDump& mem : addrs )
         mem.save ( ar );
+
+    ar ( slots.size() );
+    for ( const MemDumpSlots& array : slots )
+        array.save ( ar );
 }
 
 static vector<MemDumpPtr> loadPtrs ( size_t count, BinaryInputArchive& ar )
@@ -181,9 +437,21 @@ void MemDumpList::load ( BinaryInputArchive& ar )
         ar ( addr, size, ptrsCount );
 
         if ( ptrsCount )
-            append ( { ( char * ) addr, size, loadPtrs ( ptrsCount, ar ) } );
+            append ( { ( char * ) ( uintptr_t ) addr, size, loadPtrs ( ptrsCount, ar ) } );
         else
-            append ( { ( char * ) addr, size } );
+            append ( { ( char * ) ( uintptr_t ) addr, size } );
+    }
+
+    ar ( count );
+
+    for ( size_t i = 0; i < count; ++i )
+    {
+        uint32_t addr;
+        size_t slotSize, slotCount, flagOffset, flagSize, ptrsCount;
+        ar ( addr, slotSize, slotCount, flagOffset, flagSize, ptrsCount );
+
+        append ( MemDumpSlots ( ( char * ) ( uintptr_t ) addr, slotSize, slotCount, flagOffset, flagSize,
+                                loadPtrs ( ptrsCount, ar ) ) );
     }
 }
 
@@ -287,3 +555,588 @@ bool MemDumpList::load ( const char *data, size_t size )
 
     return true;
 }
+
+void MemDumpPlan::compile ( const MemDumpList& list )
+{
+    clear();
+
+    // Mask of the pointer bytes in each word, by region and word offset
+    map<pair<uint32_t, size_t>, uint64_t> ptrWords;
+
+    for ( size_t i = 0; i < list.addrs.size(); ++i )
+    {
+        _compiledRegionOffsets.push_back ( totalSize );
+        compile ( list.addrs[i], NoParent, list.addrs[i].addr, 0, 0, i, ptrWords );
+    }
+
+    for ( const auto& kv : ptrWords )
+        _compiledPtrWords.push_back ( { kv.first.first, uint32_t ( kv.first.second ), kv.second } );
+
+    _ops.assign ( _compiledOps );
+    _regionOffsets.assign ( _compiledRegionOffsets );
+    _ptrWords.assign ( _compiledPtrWords );
+    _addrs.resize ( _ops.size() );
+
+    ASSERT ( totalSize == list.totalSize );
+
+    LOG ( "totalSize=%u; numOps=%u", ( uint32_t ) totalSize, ( uint32_t ) _ops.size() );
+}
+
+void MemDumpPlan::compile ( const MemDumpBase& mem, uint32_t parent, char *addr, size_t srcOffset, size_t dstOffset,
+                            uint32_t region, map<pair<uint32_t, size_t>, uint64_t>& ptrWords )
+{
+    ASSERT ( parent == NoParent || parent < _compiledOps.size() );
+
+    // The previous operation has no children yet, so it can be extended if this range directly follows it,
+    // ie the next fixed address, or the next range after the same pointer.
+    bool extend = false;
+
+    if ( !_compiledOps.empty() && _compiledOps.back().parent == parent && _compiledOps.back().region == region )
+    {
+        const Op& prev = _compiledOps.back();
+
+        if ( parent == NoParent )
+            extend = ( getAddr ( prev ) + prev.size == addr );
+        else
+            extend = ( prev.srcOffset == srcOffset && prev.dstOffset + prev.size == dstOffset );
+    }
+
+    // Child pointers are relative to the start of the extended operation
+    size_t childBase = 0;
+
+    if ( extend )
+    {
+        childBase = _compiledOps.back().size;
+        _compiledOps.back().size += mem.size;
+    }
+    else if ( mem.size > 0 || !mem.ptrs.empty() )
+    {
+        _compiledOps.push_back ( { parent, region, uint64_t ( uintptr_t ( addr ) ), uint32_t ( srcOffset ),
+                                   uint32_t ( dstOffset ), uint32_t ( totalSize ), uint32_t ( mem.size ) } );
+    }
+
+    totalSize += mem.size;
+
+    if ( mem.ptrs.empty() )
+        return;
+
+    const uint32_t index = _compiledOps.size() - 1;
+
+    for ( const MemDumpPtr& ptr : mem.ptrs )
+    {
+        // Position of the pointer bytes in the region, which may span two words
+        const size_t offset = _compiledOps[index].dumpOffset + childBase + ptr.srcOffset
+                              - _compiledRegionOffsets[region];
+
+        for ( size_t i = 0; i < sizeof ( char * ); ++i )
+            ptrWords[ { region, ( offset + i ) & ~size_t ( 7 ) } ] |= ( uint64_t ( 0xFF ) << ( 8 * ( ( offset + i ) & 7 ) ) );
+
+        compile ( ptr, index, 0, childBase + ptr.srcOffset, ptr.dstOffset, region, ptrWords );
+    }
+}
+
+void MemDumpPlan::clear()
+{
+    totalSize = 0;
+    _ops.assign ( 0, 0 );
+    _regionOffsets.assign ( 0, 0 );
+    _ptrWords.assign ( 0, 0 );
+    _compiledOps.clear();
+    _compiledRegionOffsets.clear();
+    _compiledPtrWords.clear();
+    _addrs.clear();
+}
+
+void MemDumpPlan::saveDump ( char *dump ) const
+{
+    saveDump<false> ( dump, 0 );
+}
+
+void MemDumpPlan::saveDump ( char *dump, uint64_t *regionHashes ) const
+{
+    ASSERT ( regionHashes != 0 );
+
+    saveDump<true> ( dump, regionHashes );
+}
+
+template<bool HASH>
+void MemDumpPlan::saveDump ( char *dump, uint64_t *regionHashes ) const
+{
+    ASSERT ( dump != 0 );
+    ASSERT ( _addrs.size() == _ops.size() );
+
+    // Current run of memory that is continuous in both the game and the dump
+    const char *runAddr = 0;
+    char *runDump = dump;
+    size_t runSize = 0;
+
+    // Current region being hashed, runs never cross regions so each region is hashed sequentially
+    uint32_t region = 0;
+    MemDumpHasher hasher;
+
+    if ( HASH )
+    {
+        const uint64_t emptyHash = MemDumpHasher().finish();
+
+        for ( size_t i = 0; i < _regionOffsets.size(); ++i )
+            regionHashes[i] = emptyHash;
+    }
+
+    for ( size_t i = 0; i < _ops.size(); ++i )
+    {
+        const Op& op = _ops[i];
+
+        char *addr = getAddr ( op );
+
+        if ( op.parent != NoParent )
+            addr = ( _addrs[op.parent] ? deref ( _addrs[op.parent], op ) : 0 );
+
+        _addrs[i] = addr;
+
+        if ( HASH && op.region != region )
+        {
+            if ( runSize )
+                hasher.feed ( runAddr, runSize, runDump );
+
+            runSize = 0;
+
+            finishRegion ( dump, region, hasher, regionHashes );
+
+            hasher = MemDumpHasher();
+            region = op.region;
+        }
+
+        if ( addr && runSize && addr == runAddr + runSize )
+        {
+            runSize += op.size;
+            continue;
+        }
+
+        if ( runSize )
+        {
+            if ( HASH )
+                hasher.feed ( runAddr, runSize, runDump );
+            else
+                memcpy ( runDump, runAddr, runSize );
+        }
+
+        if ( addr )
+        {
+            runAddr = addr;
+            runDump = dump + op.dumpOffset;
+            runSize = op.size;
+        }
+        else
+        {
+            memset ( dump + op.dumpOffset, 0, op.size );
+            runSize = 0;
+
+            if ( HASH )
+                hasher.feedZeros ( op.size );
+        }
+    }
+
+    if ( runSize )
+    {
+        if ( HASH )
+            hasher.feed ( runAddr, runSize, runDump );
+        else
+            memcpy ( runDump, runAddr, runSize );
+    }
+
+    if ( HASH && !_ops.empty() )
+        finishRegion ( dump, region, hasher, regionHashes );
+}
+
+void MemDumpPlan::finishRegion ( const char *dump, uint32_t region, MemDumpHasher& hasher,
+                                 uint64_t *regionHashes ) const
+{
+    ASSERT ( region < _regionOffsets.size() );
+
+    const char *regionDump = dump + _regionOffsets[region];
+    const size_t regionSize = hasher.size();
+
+    ASSERT ( _regionOffsets[region] + regionSize
+             == ( region + 1 < _regionOffsets.size() ? _regionOffsets[region + 1] : totalSize ) );
+
+    // Pointer values depend on where the game allocated memory, so the words containing them are re-hashed
+    // with the pointer bytes zeroed. The last word of a region may be partial.
+    auto it = lower_bound ( _ptrWords.begin(), _ptrWords.end(), region,
+                            [] ( const PtrWord& a, uint32_t b ) { return a.region < b; } );
+
+    for ( ; it != _ptrWords.end() && it->region == region; ++it )
+    {
+        uint64_t word = 0;
+        memcpy ( &word, regionDump + it->offset, min<size_t> ( 8, regionSize - it->offset ) );
+        hasher.replace ( it->offset, word, word & ~it->mask );
+    }
+
+    regionHashes[region] = hasher.finish();
+}
+
+void MemDumpPlan::loadDump ( const char *dump ) const
+{
+    ASSERT ( dump != 0 );
+    ASSERT ( _addrs.size() == _ops.size() );
+
+    char *runAddr = 0;
+    const char *runDump = dump;
+    size_t runSize = 0;
+
+    for ( size_t i = 0; i < _ops.size(); ++i )
+    {
+        const Op& op = _ops[i];
+
+        char *addr = getAddr ( op );
+
+        // Pointers are read from the dump, which has the same values the parent memory has after loading
+        if ( op.parent != NoParent )
+            addr = ( _addrs[op.parent] ? deref ( dump + _ops[op.parent].dumpOffset, op ) : 0 );
+
+        _addrs[i] = addr;
+
+        if ( addr && runSize && addr == runAddr + runSize )
+        {
+            runSize += op.size;
+            continue;
+        }
+
+        if ( runSize )
+            memcpy ( runAddr, runDump, runSize );
+
+        runAddr = addr;
+        runDump = dump + op.dumpOffset;
+        runSize = ( addr ? op.size : 0 );
+    }
+
+    if ( runSize )
+        memcpy ( runAddr, runDump, runSize );
+}
+
+void MemDumpLayout::compile ( const MemDumpList& list )
+{
+    clear();
+
+    plan.compile ( list );
+    totalSize = plan.totalSize;
+
+    for ( const MemDumpSlots& array : list.slots )
+        slots.push_back ( array );
+}
+
+void MemDumpLayout::clear()
+{
+    totalSize = 0;
+    plan.clear();
+    slots.clear();
+    unmap();
+}
+
+template<typename T>
+static void appendTable ( string& data, const T *table, size_t count )
+{
+    if ( count )
+        data.append ( ( const char * ) table, count * sizeof ( T ) );
+}
+
+void MemDumpLayout::savePtrs ( const vector<MemDumpPtr>& ptrs, vector<PtrRecord>& records )
+{
+    for ( const MemDumpPtr& ptr : ptrs )
+    {
+        records.push_back ( { uint32_t ( ptr.srcOffset ), uint32_t ( ptr.dstOffset ), uint32_t ( ptr.size ),
+                              uint32_t ( ptr.ptrs.size() ) } );
+        savePtrs ( ptr.ptrs, records );
+    }
+}
+
+string MemDumpLayout::save() const
+{
+    vector<SlotsRecord> slotRecords;
+    vector<PtrRecord> ptrRecords;
+
+    for ( const MemDumpSlots& array : slots )
+    {
+        slotRecords.push_back ( { uint64_t ( uintptr_t ( array.addr ) ), uint32_t ( array.slotSize ),
+                                  uint32_t ( array.count ), uint32_t ( array.flagOffset ), uint32_t ( array.flagSize ),
+                                  uint32_t ( array.ptrs.size() ), 0 } );
+        savePtrs ( array.ptrs, ptrRecords );
+    }
+
+    Header header;
+    memset ( &header, 0, sizeof ( header ) );
+
+    header.magic = LayoutMagic;
+    header.version = MEM_DUMP_LAYOUT_VERSION;
+    header.totalSize = totalSize;
+    header.numOps = plan._ops.size();
+    header.numRegions = plan._regionOffsets.size();
+    header.numPtrWords = plan._ptrWords.size();
+    header.numSlots = slotRecords.size();
+    header.numSlotPtrs = ptrRecords.size();
+
+    // Every table has a size that is a multiple of 8 bytes, except the region offsets which are last
+    string data ( sizeof ( header ), '\0' );
+    appendTable ( data, plan._ops.begin(), plan._ops.size() );
+    appendTable ( data, plan._ptrWords.begin(), plan._ptrWords.size() );
+    appendTable ( data, slotRecords.data(), slotRecords.size() );
+    appendTable ( data, ptrRecords.data(), ptrRecords.size() );
+    appendTable ( data, plan._regionOffsets.begin(), plan._regionOffsets.size() );
+
+    header.dataSize = data.size() - sizeof ( header );
+
+    MemDumpHasher hasher;
+    hasher.feed ( &data [ sizeof ( header ) ], header.dataSize );
+    header.checksum = hasher.finish();
+
+    memcpy ( &data[0], &header, sizeof ( header ) );
+    return data;
+}
+
+bool MemDumpLayout::save ( const string& filename ) const
+{
+    const string data = save();
+
+    ofstream fout ( filename.c_str(), ofstream::binary );
+    bool good = fout.good();
+    if ( good )
+        good = fout.write ( &data[0], data.size() ).good();
+    fout.close();
+    return good;
+}
+
+bool MemDumpLayout::load ( const char *data, size_t size )
+{
+    clear();
+
+    // The tables have 8 byte fields, and the data is used in place without copying
+    if ( uintptr_t ( data ) % 8 )
+    {
+        LOG ( "Layout data is not 8 byte aligned" );
+        return false;
+    }
+
+    if ( loadInPlace ( data, size ) )
+        return true;
+
+    clear();
+    return false;
+}
+
+bool MemDumpLayout::load ( const string& filename )
+{
+    clear();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA ( filename.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL, 0 );
+
+    if ( file == INVALID_HANDLE_VALUE )
+        return false;
+
+    LARGE_INTEGER size;
+    HANDLE mapping = 0;
+
+    if ( GetFileSizeEx ( file, &size ) && size.QuadPart > 0 )
+        mapping = CreateFileMappingA ( file, 0, PAGE_READONLY, 0, 0, 0 );
+
+    CloseHandle ( file );
+
+    if ( !mapping )
+        return false;
+
+    // The view keeps the mapping open
+    _mapping = MapViewOfFile ( mapping, FILE_MAP_READ, 0, 0, 0 );
+    _mappingSize = size.QuadPart;
+
+    CloseHandle ( mapping );
+#else
+    const int fd = open ( filename.c_str(), O_RDONLY );
+
+    if ( fd < 0 )
+        return false;
+
+    struct stat st;
+
+    if ( fstat ( fd, &st ) == 0 && st.st_size > 0 )
+    {
+        void *mapping = mmap ( 0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+
+        if ( mapping != MAP_FAILED )
+        {
+            _mapping = mapping;
+            _mappingSize = st.st_size;
+        }
+    }
+
+    close ( fd );
+#endif
+
+    if ( !_mapping )
+    {
+        _mappingSize = 0;
+        return false;
+    }
+
+    // Mappings are page aligned, so the tables are always used in place
+    if ( loadInPlace ( ( const char * ) _mapping, _mappingSize ) )
+        return true;
+
+    clear();
+    return false;
+}
+
+void MemDumpLayout::unmap()
+{
+    if ( !_mapping )
+        return;
+
+#ifdef _WIN32
+    UnmapViewOfFile ( _mapping );
+#else
+    munmap ( _mapping, _mappingSize );
+#endif
+
+    _mapping = 0;
+    _mappingSize = 0;
+}
+
+bool MemDumpLayout::loadInPlace ( const char *data, size_t size )
+{
+    typedef MemDumpPlan::Op Op;
+    typedef MemDumpPlan::PtrWord PtrWord;
+
+    Header header;
+
+    if ( size < sizeof ( header ) )
+    {
+        LOG ( "Layout too small: %u bytes", size );
+        return false;
+    }
+
+    memcpy ( &header, data, sizeof ( header ) );
+
+    if ( header.magic != LayoutMagic || header.version != MEM_DUMP_LAYOUT_VERSION )
+    {
+        LOG ( "Unsupported layout: magic=0x%08X; version=%u", header.magic, header.version );
+        return false;
+    }
+
+    const uint64_t expectedSize = uint64_t ( header.numOps ) * sizeof ( Op )
+                                  + uint64_t ( header.numPtrWords ) * sizeof ( PtrWord )
+                                  + uint64_t ( header.numSlots ) * sizeof ( SlotsRecord )
+                                  + uint64_t ( header.numSlotPtrs ) * sizeof ( PtrRecord )
+                                  + uint64_t ( header.numRegions ) * sizeof ( uint32_t );
+
+    if ( header.dataSize != size - sizeof ( header ) || header.dataSize != expectedSize )
+    {
+        LOG ( "Wrong layout size: dataSize=%u; expected %u", header.dataSize, ( uint32_t ) expectedSize );
+        return false;
+    }
+
+    MemDumpHasher hasher;
+    hasher.feed ( data + sizeof ( header ), header.dataSize );
+
+    if ( hasher.finish() != header.checksum )
+    {
+        LOG ( "Layout checksum mismatch" );
+        return false;
+    }
+
+    const Op *ops = ( const Op * ) ( data + sizeof ( header ) );
+    const PtrWord *ptrWords = ( const PtrWord * ) ( ops + header.numOps );
+    const SlotsRecord *slotRecords = ( const SlotsRecord * ) ( ptrWords + header.numPtrWords );
+    const PtrRecord *ptrRecords = ( const PtrRecord * ) ( slotRecords + header.numSlots );
+    const uint32_t *regionOffsets = ( const uint32_t * ) ( ptrRecords + header.numSlotPtrs );
+
+    // Check the tables, so a bad layout can't make the plan read or write outside the dump
+    for ( uint32_t i = 0; i < header.numRegions; ++i )
+    {
+        if ( regionOffsets[i] > header.totalSize || ( i && regionOffsets[i] < regionOffsets[i - 1] ) )
+            return false;
+    }
+
+    for ( uint32_t i = 0; i < header.numOps; ++i )
+    {
+        const Op& op = ops[i];
+
+        if ( op.region >= header.numRegions || uint64_t ( op.dumpOffset ) + op.size > header.totalSize )
+            return false;
+
+        if ( op.parent != MemDumpPlan::NoParent
+                && ( op.parent >= i || uint64_t ( op.srcOffset ) + sizeof ( char * ) > ops[op.parent].size ) )
+            return false;
+    }
+
+    for ( uint32_t i = 0; i < header.numPtrWords; ++i )
+    {
+        const PtrWord& word = ptrWords[i];
+
+        if ( word.region >= header.numRegions || ( i && word.region < ptrWords[i - 1].region ) )
+            return false;
+
+        const uint32_t regionEnd = ( word.region + 1 < header.numRegions ? regionOffsets[word.region + 1]
+                                     : header.totalSize );
+
+        if ( uint64_t ( regionOffsets[word.region] ) + word.offset >= regionEnd )
+            return false;
+    }
+
+    // Only the slot arrays are rebuilt
+    const PtrRecord *ptrRecordsEnd = ptrRecords + header.numSlotPtrs;
+
+    slots.reserve ( header.numSlots );
+
+    for ( uint32_t i = 0; i < header.numSlots; ++i )
+    {
+        const SlotsRecord& record = slotRecords[i];
+
+        if ( uint64_t ( record.flagOffset ) + record.flagSize > record.slotSize )
+            return false;
+
+        vector<MemDumpPtr> ptrs;
+
+        if ( !loadPtrs ( ptrRecords, ptrRecordsEnd, record.numPtrs, record.slotSize, ptrs ) )
+            return false;
+
+        slots.push_back ( MemDumpSlots ( ( char * ) ( uintptr_t ) record.addr, record.slotSize, record.count,
+                                         record.flagOffset, record.flagSize, ptrs ) );
+    }
+
+    if ( ptrRecords != ptrRecordsEnd )
+        return false;
+
+    totalSize = header.totalSize;
+
+    plan.totalSize = header.totalSize;
+    plan._ops.assign ( ops, header.numOps );
+    plan._regionOffsets.assign ( regionOffsets, header.numRegions );
+    plan._ptrWords.assign ( ptrWords, header.numPtrWords );
+    plan._addrs.resize ( header.numOps );
+    return true;
+}
+
+bool MemDumpLayout::loadPtrs ( const PtrRecord *&records, const PtrRecord *end, size_t count, size_t parentSize,
+                               vector<MemDumpPtr>& ptrs )
+{
+    ptrs.reserve ( count );
+
+    for ( size_t i = 0; i < count; ++i )
+    {
+        if ( records == end )
+            return false;
+
+        const PtrRecord record = *records++;
+
+        if ( uint64_t ( record.srcOffset ) + sizeof ( char * ) > parentSize )
+            return false;
+
+        vector<MemDumpPtr> children;
+
+        if ( !loadPtrs ( records, end, record.numPtrs, record.size, children ) )
+            return false;
+
+        ptrs.push_back ( MemDumpPtr ( record.srcOffset, record.dstOffset, record.size, children ) );
+    }
+
+    return true;
+}
@@ -6,11 +6,132 @@
 
 #include <vector>
 #include <string>
+#include <map>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
 
 
 class MemDumpPtr;
 
 
+// Streaming 64-bit hash of a region of a memory dump. Each 8 byte word is mixed with its position and summed,
+// so the result doesn't depend on how the region is split into copies, and single words can be swapped out later.
+class MemDumpHasher
+{
+public:
+
+    // Mix a word at the given position in the region
+    static uint64_t mix ( uint64_t word, uint64_t pos )
+    {
+        uint64_t x = word ^ ( pos * 0x9E3779B97F4A7C15ULL );
+        x *= 0xFF51AFD7ED558CCDULL;
+        x ^= x >> 32;
+        x *= 0xC4CEB9FE1A85EC53ULL;
+        return x ^ ( x >> 29 );
+    }
+
+    // Hash bytes, and copy them to dst if it isn't null
+    void feed ( const char *src, size_t len, char *dst = 0 )
+    {
+        // Finish the partial word first
+        if ( len && ( _pos & 7 ) )
+        {
+            const size_t n = std::min ( len, 8 - ( _pos & 7 ) );
+            feedPartial ( src, n, dst );
+            src += n;
+            len -= n;
+
+            if ( dst )
+                dst += n;
+        }
+
+        // Locals so the hash isn't reloaded after every write to dst
+        uint64_t hash = _hash;
+        size_t pos = _pos;
+
+        for ( ; len >= 8; len -= 8, src += 8, pos += 8 )
+        {
+            uint64_t word;
+            memcpy ( &word, src, 8 );
+
+            if ( dst )
+            {
+                memcpy ( dst, &word, 8 );
+                dst += 8;
+            }
+
+            hash += mix ( word, pos );
+        }
+
+        _hash = hash;
+        _pos = pos;
+
+        if ( len )
+            feedPartial ( src, len, dst );
+    }
+
+    // Hash zero bytes
+    void feedZeros ( size_t len )
+    {
+        static const char zeros[64] = { 0 };
+
+        for ( ; len > sizeof ( zeros ); len -= sizeof ( zeros ) )
+            feed ( zeros, sizeof ( zeros ) );
+
+        feed ( zeros, len );
+    }
+
+    // Replace a word that was already hashed, ie to mask out pointer values
+    void replace ( uint64_t pos, uint64_t oldWord, uint64_t newWord )
+    {
+        _hash += mix ( newWord, pos ) - mix ( oldWord, pos );
+    }
+
+    // Number of bytes hashed
+    size_t size() const
+    {
+        return _pos;
+    }
+
+    // Get the final hash, this doesn't reset the hasher
+    uint64_t finish() const
+    {
+        uint64_t hash = _hash;
+
+        if ( _pos & 7 )
+            hash += mix ( _pending, _pos & ~uint64_t ( 7 ) );
+
+        return mix ( hash, _pos );
+    }
+
+private:
+
+    uint64_t _hash = 0, _pending = 0;
+
+    size_t _pos = 0;
+
+    // Add less than a word without crossing a word boundary
+    void feedPartial ( const char *src, size_t len, char *dst )
+    {
+        uint64_t word = 0;
+        memcpy ( &word, src, len );
+
+        if ( dst )
+            memcpy ( dst, src, len );
+
+        _pending |= word << ( 8 * ( _pos & 7 ) );
+        _pos += len;
+
+        if ( ( _pos & 7 ) == 0 )
+        {
+            _hash += mix ( _pending, _pos - 8 );
+            _pending = 0;
+        }
+    }
+};
+
+
 class MemDumpBase
 {
 public:
@@ -81,7 +202,7 @@ public:
         if ( parent->getAddr() == 0 )
             return 0;
 
-        ASSERT ( srcOffset + 4 <= parent->size );
+        ASSERT ( srcOffset + sizeof ( char * ) <= parent->size );
 
         char *dstAddr = * ( char ** ) ( parent->getAddr() + srcOffset );
 
@@ -137,11 +258,11 @@ public:
 
     // Construct a memory dump with a memory range
     MemDump ( uint32_t start, uint32_t end )
-        : MemDumpBase ( end - start ), addr ( ( char * ) start ) {}
+        : MemDumpBase ( end - start ), addr ( ( char * ) ( uintptr_t ) start ) {}
 
     // Construct a memory dump with a memory range, with child pointers
     MemDump ( uint32_t start, uint32_t end, const std::vector<MemDumpPtr>& ptrs )
-        : MemDumpBase ( end - start, ptrs ), addr ( ( char * ) start ) {}
+        : MemDumpBase ( end - start, ptrs ), addr ( ( char * ) ( uintptr_t ) start ) {}
 
     // Copy constructor
     MemDump ( const MemDump& a )
@@ -162,6 +283,60 @@ public:
 };
 
 
+// An array of fixed size slots, where only the slots that have to be saved are saved along with a bitmap of them.
+// A slot is saved if any byte of its in use flag is non-zero, or else if any of its bytes are non-zero. The flag only
+// lets the slots in use skip that check, it can be empty if it isn't known. Slots that weren't saved are all zero, so
+// zeroing them when loading restores the same memory as a full copy, whether or not the game clears freed slots.
+class MemDumpSlots
+{
+public:
+
+    // The starting address of the array
+    char *const addr;
+
+    // Size and number of slots, and the location of the in use flag in each slot, flagSize can be 0
+    const size_t slotSize, count, flagOffset, flagSize;
+
+    // Child pointers of each slot
+    const std::vector<MemDumpPtr> ptrs;
+
+    // Construct a slot array, with child pointers relative to each slot
+    MemDumpSlots ( void *addr, size_t slotSize, size_t count, size_t flagOffset, size_t flagSize,
+                   const std::vector<MemDumpPtr>& ptrs = {} );
+
+    // Copy constructor
+    MemDumpSlots ( const MemDumpSlots& a )
+        : MemDumpSlots ( a.addr, a.slotSize, a.count, a.flagOffset, a.flagSize, a.ptrs ) {}
+
+    // True if the slot has to be saved, ie its in use flag is set or it isn't all zero
+    bool isSaved ( size_t i ) const;
+
+    // Size of the dump with every slot in use
+    size_t getMaxDumpSize() const;
+
+    // Append the bitmap and the saved slots to the dump. If hash isn't null, it is set to the hash of the bitmap
+    // and the saved slots, without their pointer values or the data they point to.
+    void saveDump ( std::vector<char>& dump, uint64_t *hash = 0 ) const;
+
+    // Load the saved slots from the dump, and zero the others
+    void loadDump ( const char *&dump ) const;
+
+    // Count the slots whose bytes don't match the dump, ie the slots that loading it wouldn't restore exactly
+    size_t countMismatchedSlots ( const char *&dump ) const;
+
+    // Serialization
+    void save ( cereal::BinaryOutputArchive& ar ) const;
+
+private:
+
+    // Size of each slot including child pointers
+    size_t _slotTotalSize = 0;
+
+    // Offsets of the pointers in the dump of each slot, sorted
+    std::vector<size_t> _ptrOffsets;
+};
+
+
 class MemDumpList
 {
 public:
@@ -172,11 +347,15 @@ public:
     // List of memory dumps
     std::vector<MemDump> addrs;
 
+    // List of slot arrays, these have a variable size so they are not included in totalSize
+    std::vector<MemDumpSlots> slots;
+
     // Clear all addresses
     void clear()
     {
         totalSize = 0;
         addrs.clear();
+        slots.clear();
     }
 
     // True only if addrs.empty()
@@ -211,6 +390,12 @@ public:
             append ( addr, addAddrOffset );
     }
 
+    // Append a slot array
+    void append ( const MemDumpSlots& array )
+    {
+        slots.push_back ( array );
+    }
+
     // Update the list of memory dumps: merge continuous address ranges, then compute total size
     void update();
 
@@ -221,3 +406,240 @@ public:
     bool load ( const std::string& filename );
     bool load ( const char *data, size_t size );
 };
+
+
+// A memory dump list compiled into a flat list of copy operations, in the same order and layout as MemDumpList.
+// Pointers are resolved once per save / load in a single pass, and copies of adjacent memory are coalesced.
+class MemDumpPlan
+{
+public:
+
+    // Total size of the dump, the same as MemDumpList::totalSize
+    size_t totalSize = 0;
+
+    MemDumpPlan() {}
+
+    // The tables can point into this plan's own storage, so it can't be copied
+    MemDumpPlan ( const MemDumpPlan& ) = delete;
+    MemDumpPlan& operator= ( const MemDumpPlan& ) = delete;
+
+    // Compile the plan from an updated memory dump list
+    void compile ( const MemDumpList& list );
+
+    // Clear the plan
+    void clear();
+
+    // True if there are no operations
+    bool empty() const
+    {
+        return _ops.empty();
+    }
+
+    // Number of operations after coalescing at compile time
+    size_t getNumOps() const
+    {
+        return _ops.size();
+    }
+
+    // Number of regions, ie the memory dumps in the compiled list, each including its child pointers
+    size_t getNumRegions() const
+    {
+        return _regionOffsets.size();
+    }
+
+    // Save / load the memory to / from a dump of totalSize bytes
+    void saveDump ( char *dump ) const;
+    void loadDump ( const char *dump ) const;
+
+    // Save the memory while hashing each region in the same pass, regionHashes must have getNumRegions() entries.
+    // Pointer values are masked out of the hashes, since they depend on where the game allocated memory.
+    void saveDump ( char *dump, uint64_t *regionHashes ) const;
+
+private:
+
+    static const uint32_t NoParent = 0xFFFFFFFF;
+
+    // The tables only have fixed size fields, so MemDumpLayout can store them as is and use them in place
+
+    struct Op
+    {
+        // Index of the parent operation, always before this one, or NoParent for a fixed address
+        uint32_t parent;
+
+        // Index of the top level memory dump
+        uint32_t region;
+
+        // The fixed address
+        uint64_t addr;
+
+        // Or the location of the pointer in the parent and the offset to add to its value
+        uint32_t srcOffset, dstOffset;
+
+        // Location and size of this operation in the dump
+        uint32_t dumpOffset, size;
+    };
+
+    // Word of a region that contains pointer bytes
+    struct PtrWord
+    {
+        uint32_t region;
+
+        // Offset of the word from the start of the region
+        uint32_t offset;
+
+        // Mask of the pointer bytes in the word
+        uint64_t mask;
+    };
+
+    // Read only view of a table, either in the compiled storage below or in a flat layout
+    template<typename T>
+    struct Table
+    {
+        const T *data = 0;
+        size_t count = 0;
+
+        void assign ( const T *data, size_t count ) { this->data = data; this->count = count; }
+        void assign ( const std::vector<T>& v ) { assign ( v.empty() ? 0 : &v[0], v.size() ); }
+
+        const T& operator[] ( size_t i ) const { return data[i]; }
+        const T *begin() const { return data; }
+        const T *end() const { return data + count; }
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+    };
+
+    // Operations in dump order, parents are always before their children
+    Table<Op> _ops;
+
+    // Start of each region in the dump
+    Table<uint32_t> _regionOffsets;
+
+    // Words containing pointers, sorted by region
+    Table<PtrWord> _ptrWords;
+
+    // Storage of the tables when compiled, empty when using a flat layout
+    std::vector<Op> _compiledOps;
+    std::vector<uint32_t> _compiledRegionOffsets;
+    std::vector<PtrWord> _compiledPtrWords;
+
+    // Resolved address of each operation, reused across calls
+    mutable std::vector<char *> _addrs;
+
+    void compile ( const MemDumpBase& mem, uint32_t parent, char *addr, size_t srcOffset, size_t dstOffset,
+                   uint32_t region, std::map<std::pair<uint32_t, size_t>, uint64_t>& ptrWords );
+
+    template<bool HASH>
+    void saveDump ( char *dump, uint64_t *regionHashes ) const;
+
+    void finishRegion ( const char *dump, uint32_t region, MemDumpHasher& hasher, uint64_t *regionHashes ) const;
+
+    static char *getAddr ( const Op& op )
+    {
+        return ( char * ) ( uintptr_t ) op.addr;
+    }
+
+    // Read the pointer of an operation from the parent's memory, then add the offset
+    static char *deref ( const char *parentData, const Op& op )
+    {
+        char *value;
+        memcpy ( &value, parentData + op.srcOffset, sizeof ( value ) );
+        return ( value ? value + op.dstOffset : 0 );
+    }
+
+    friend class MemDumpLayout;
+};
+
+
+// Version of the flat layout format, bump this whenever the tables change
+#define MEM_DUMP_LAYOUT_VERSION ( 1 )
+
+
+// A memory dump list compiled into a versioned flat binary layout, ie res/rollback.bin. A loaded layout is used in
+// place, the plan's tables point straight into the data, so loading only validates the header checksum and the
+// table bounds. Only the slot arrays are rebuilt, since they are small.
+class MemDumpLayout
+{
+public:
+
+    // Total size of the plan's dump
+    size_t totalSize = 0;
+
+    // Compiled memory dumps
+    MemDumpPlan plan;
+
+    // Slot arrays, these have a variable size so they are not included in totalSize
+    std::vector<MemDumpSlots> slots;
+
+    MemDumpLayout() {}
+
+    ~MemDumpLayout() { clear(); }
+
+    MemDumpLayout ( const MemDumpLayout& ) = delete;
+    MemDumpLayout& operator= ( const MemDumpLayout& ) = delete;
+
+    // Compile from an updated memory dump list
+    void compile ( const MemDumpList& list );
+
+    // Clear the layout and unmap any file
+    void clear();
+
+    // True only if there are no memory dumps
+    bool empty() const
+    {
+        return plan.empty();
+    }
+
+    // Get the flat layout
+    std::string save() const;
+    bool save ( const std::string& filename ) const;
+
+    // Use a flat layout in place, the data must be 8 byte aligned and stay valid until the layout is cleared
+    bool load ( const char *data, size_t size );
+
+    // Memory map a flat layout file and use it in place
+    bool load ( const std::string& filename );
+
+private:
+
+    struct Header
+    {
+        // "MDLY" and MEM_DUMP_LAYOUT_VERSION
+        uint32_t magic, version;
+
+        // MemDumpHasher hash of everything after the header
+        uint64_t checksum;
+
+        // Size of everything after the header
+        uint32_t dataSize;
+
+        uint32_t totalSize, numOps, numRegions, numPtrWords, numSlots, numSlotPtrs, reserved;
+    };
+
+    struct SlotsRecord
+    {
+        uint64_t addr;
+
+        uint32_t slotSize, count, flagOffset, flagSize;
+
+        // Number of child pointers of each slot
+        uint32_t numPtrs, reserved;
+    };
+
+    // Pointer records are stored depth first, each followed by its own child pointers
+    struct PtrRecord
+    {
+        uint32_t srcOffset, dstOffset, size, numPtrs;
+    };
+
+    // Memory mapped file
+    void *_mapping = 0;
+    size_t _mappingSize = 0;
+
+    bool loadInPlace ( const char *data, size_t size );
+
+    void unmap();
+
+    static void savePtrs ( const std::vector<MemDumpPtr>& ptrs, std::vector<PtrRecord>& records );
+    static bool loadPtrs ( const PtrRecord *&records, const PtrRecord *end, size_t count, size_t parentSize,
+                           std::vector<MemDumpPtr>& ptrs );
+};
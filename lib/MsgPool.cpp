@@ -0,0 +1,79 @@
+#include "MsgPool.hpp"
+
+#include <algorithm>
+#include <cstddef>
+
+using namespace std;
+
+
+// Blocks are aligned like operator new, which is enough for any message type
+static size_t alignedSize ( size_t size )
+{
+    const size_t align = alignof ( max_align_t );
+    return max ( align, ( size + align - 1 ) / align * align );
+}
+
+
+BlockPool::BlockPool ( size_t blockSize, size_t maxFree )
+    : blockSize ( alignedSize ( blockSize ) ), _maxFree ( maxFree )
+{
+    _free.reserve ( maxFree );
+}
+
+BlockPool::~BlockPool()
+{
+    for ( void *block : _free )
+        ::operator delete ( block );
+}
+
+void *BlockPool::allocate()
+{
+    {
+        SpinLock lock ( _lock );
+
+        if ( !_free.empty() )
+        {
+            void *block = _free.back();
+            _free.pop_back();
+            ++_numReused;
+            return block;
+        }
+
+        ++_numHeapAllocs;
+    }
+
+    return ::operator new ( blockSize );
+}
+
+void BlockPool::deallocate ( void *block )
+{
+    {
+        SpinLock lock ( _lock );
+
+        // The free list has reserved space for every block it keeps, so this never allocates
+        if ( _free.size() < _maxFree )
+        {
+            _free.push_back ( block );
+            return;
+        }
+    }
+
+    ::operator delete ( block );
+}
+
+void BlockPool::reserve ( size_t count )
+{
+    SpinLock lock ( _lock );
+
+    for ( count = min ( count, _maxFree ); _free.size() < count; )
+    {
+        _free.push_back ( ::operator new ( blockSize ) );
+        ++_numHeapAllocs;
+    }
+}
+
+size_t BlockPool::getNumFree() const
+{
+    SpinLock lock ( _lock );
+    return _free.size();
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+
+
+// Max number of free blocks kept by each pool, the rest are returned to the heap
+#define MSG_POOL_MAX_FREE ( 256 )
+
+
+// Free list of fixed size blocks. Blocks are recycled instead of returned to the heap, so allocating in a steady
+// state doesn't touch the heap. Blocks can be freed from any thread.
+class BlockPool
+{
+public:
+
+    // Size of each block
+    const size_t blockSize;
+
+    BlockPool ( size_t blockSize, size_t maxFree = MSG_POOL_MAX_FREE );
+    ~BlockPool();
+
+    void *allocate();
+    void deallocate ( void *block );
+
+    // Allocate free blocks up front
+    void reserve ( size_t count );
+
+    // Number of blocks allocated from the heap, and the number of allocations served from the free list
+    size_t getNumHeapAllocs() const { return _numHeapAllocs; }
+    size_t getNumReused() const { return _numReused; }
+
+    // Number of free blocks
+    size_t getNumFree() const;
+
+private:
+
+    const size_t _maxFree;
+
+    // Spin lock, since it is only held for a push or pop and is rarely contended
+    mutable std::atomic_flag _lock = ATOMIC_FLAG_INIT;
+
+    class SpinLock
+    {
+    public:
+
+        SpinLock ( std::atomic_flag& lock ) : _lock ( lock )
+        {
+            while ( _lock.test_and_set ( std::memory_order_acquire ) );
+        }
+
+        ~SpinLock()
+        {
+            _lock.clear ( std::memory_order_release );
+        }
+
+    private:
+
+        std::atomic_flag& _lock;
+    };
+
+    std::vector<void *> _free;
+
+    size_t _numHeapAllocs = 0, _numReused = 0;
+};
+
+
+// Allocator for std::allocate_shared, each type it is rebound to has its own pool of blocks that fit that type
+template<typename T>
+class PoolAllocator
+{
+public:
+
+    typedef T value_type;
+
+    PoolAllocator() {}
+
+    template<typename U>
+    PoolAllocator ( const PoolAllocator<U>& ) {}
+
+    template<typename U>
+    struct rebind { typedef PoolAllocator<U> other; };
+
+    // The pool for this type, it lives until exit since blocks may be freed by other static destructors
+    static BlockPool& getPool()
+    {
+        static BlockPool *pool = new BlockPool ( sizeof ( T ) );
+        return *pool;
+    }
+
+    T *allocate ( size_t n )
+    {
+        if ( n == 1 )
+            return static_cast<T *> ( getPool().allocate() );
+
+        return static_cast<T *> ( ::operator new ( n * sizeof ( T ) ) );
+    }
+
+    void deallocate ( T *p, size_t n )
+    {
+        if ( n == 1 )
+            getPool().deallocate ( p );
+        else
+            ::operator delete ( p );
+    }
+
+    template<typename U>
+    bool operator== ( const PoolAllocator<U>& ) const { return true; }
+
+    template<typename U>
+    bool operator!= ( const PoolAllocator<U>& ) const { return false; }
+};
+
+
+// Construct a message from its type's pool. The object and the shared_ptr control block are one pooled block,
+// so creating and releasing frequently sent messages doesn't allocate once the pool is warm. Protocol::encode and
+// decode reuse their buffers too, so sending and receiving a flat message doesn't allocate either.
+template<typename T, typename ... A>
+inline std::shared_ptr<T> makePooled ( A&& ... args )
+{
+    return std::allocate_shared<T> ( PoolAllocator<T>(), std::forward<A> ( args )... );
+}
@@ -51,6 +51,7 @@ void Pinger::reset()
     stop();
 
     _stats.reset();
+    _rtt.reset();
     _packetLoss = 0;
 }
 
@@ -66,11 +67,13 @@ void Pinger::gotPong ( const MsgPtr& ping )
         if ( now < ping->getAs<Ping>().timestamp )
             return;
 
-        const uint64_t latency = ( now - ping->getAs<Ping>().timestamp ) / 2;
+        const uint64_t rtt = now - ping->getAs<Ping>().timestamp;
+        const uint64_t latency = rtt / 2;
 
         LOG ( "latency=%llu ms", latency );
 
         _stats.addSample ( latency );
+        _rtt.addSample ( rtt );
     }
     else
     {
@@ -89,6 +92,8 @@ void Pinger::timerExpired ( Timer *timer )
 
         _packetLoss = 100 * ( numPings - _stats.getNumSamples() ) / numPings;
 
+        LOG ( "rtt: %s ms", _rtt.str() );
+
         if ( owner )
             owner->pingerCompleted ( this, _stats, _packetLoss );
 
@@ -3,6 +3,7 @@
 #include "Timer.hpp"
 #include "Protocol.hpp"
 #include "Statistics.hpp"
+#include "Histogram.hpp"
 
 
 struct Ping : public SerializableMessage
@@ -48,6 +49,9 @@ public:
 
     const Statistics& getStats() const { return _stats; }
 
+    // Round trip times in milliseconds, for the percentiles
+    const Histogram& getRttHistogram() const { return _rtt; }
+
     uint8_t getPacketLoss() const { return _packetLoss; }
 
     bool isPinging() const { return _pinging; }
@@ -60,6 +64,8 @@ private:
 
     Statistics _stats;
 
+    Histogram _rtt;
+
     uint8_t _packetLoss = 0;
 
     bool _pinging = false;
@@ -0,0 +1,152 @@
+#include "Profiler.hpp"
+#include "StringUtils.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+
+using namespace std;
+
+
+// Buffer of the current thread, set when the thread first records
+static __thread void *threadBuffer = 0;
+
+static const char *phaseNames[] =
+{
+    "Rollback",
+    "LoadState",
+    "RerunStep",
+    "FrameStep",
+    "SaveState",
+    "RerunSounds",
+    "Inputs",
+};
+
+static_assert ( sizeof ( phaseNames ) / sizeof ( phaseNames[0] ) == size_t ( ProfilePhase::NumPhases ),
+                "Missing phase names" );
+
+
+void Profiler::record ( ProfilePhase phase, uint64_t start, uint64_t end, uint32_t frame, uint16_t depth )
+{
+    if ( !isEnabled() )
+        return;
+
+    ThreadBuffer *buffer = getThreadBuffer();
+
+    // Only this thread writes to its buffer, so just publish the new count after writing
+    const size_t count = buffer->count.load ( memory_order_relaxed );
+
+    buffer->records [ count % PROFILER_BUFFER_SIZE ] = { start, end, frame, depth, phase, buffer->thread };
+    buffer->count.store ( count + 1, memory_order_release );
+}
+
+Profiler::ThreadBuffer *Profiler::getThreadBuffer()
+{
+    if ( threadBuffer )
+        return static_cast<ThreadBuffer *> ( threadBuffer );
+
+    ThreadBuffer *buffer = new ThreadBuffer();
+    buffer->records.resize ( PROFILER_BUFFER_SIZE );
+
+    LOCK ( _mutex );
+
+    buffer->thread = uint8_t ( _buffers.size() );
+    _buffers.emplace_back ( buffer );
+
+    threadBuffer = buffer;
+    return buffer;
+}
+
+vector<Profiler::Record> Profiler::getRecords() const
+{
+    vector<Record> records;
+
+    LOCK ( _mutex );
+
+    for ( const auto& buffer : _buffers )
+    {
+        const size_t count = buffer->count.load ( memory_order_acquire );
+        const size_t first = ( count > PROFILER_BUFFER_SIZE ? count - PROFILER_BUFFER_SIZE : 0 );
+
+        for ( size_t i = first; i < count; ++i )
+            records.push_back ( buffer->records [ i % PROFILER_BUFFER_SIZE ] );
+    }
+
+    return records;
+}
+
+void Profiler::clear()
+{
+    LOCK ( _mutex );
+
+    for ( const auto& buffer : _buffers )
+        buffer->count.store ( 0, memory_order_release );
+}
+
+Profiler::PhaseHistograms Profiler::aggregate ( const vector<Record>& records )
+{
+    PhaseHistograms histograms;
+
+    for ( const Record& record : records )
+    {
+        if ( record.phase < ProfilePhase::NumPhases && record.end >= record.start )
+            histograms [ size_t ( record.phase ) ].addSample ( record.end - record.start );
+    }
+
+    return histograms;
+}
+
+string Profiler::getChromeTrace ( const vector<Record>& records )
+{
+    // Timestamps are relative to the first record, in microseconds
+    uint64_t origin = UINT64_MAX;
+
+    for ( const Record& record : records )
+        origin = min ( origin, record.start );
+
+    string json = "{\"traceEvents\":[";
+
+    for ( size_t i = 0; i < records.size(); ++i )
+    {
+        const Record& record = records[i];
+
+        json += format ( "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+                         "\"args\":{\"frame\":%u,\"depth\":%u}}",
+                         ( i ? "," : "" ), getPhaseName ( record.phase ), record.thread,
+                         ( record.start - origin ) / 1000.0, ( record.end - record.start ) / 1000.0,
+                         record.frame, record.depth );
+    }
+
+    json += "\n],\"displayTimeUnit\":\"ns\"}\n";
+    return json;
+}
+
+bool Profiler::writeChromeTrace ( const vector<Record>& records, const string& file )
+{
+    ofstream fout ( file.c_str(), ios::binary );
+
+    if ( !fout.good() )
+        return false;
+
+    fout << getChromeTrace ( records );
+    return fout.good();
+}
+
+const char *Profiler::getPhaseName ( ProfilePhase phase )
+{
+    if ( phase < ProfilePhase::NumPhases )
+        return phaseNames [ size_t ( phase ) ];
+
+    return "Unknown";
+}
+
+uint64_t Profiler::now()
+{
+    return chrono::duration_cast<chrono::nanoseconds> ( chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+Profiler& Profiler::get()
+{
+    static Profiler instance;
+    return instance;
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include "Thread.hpp"
+#include "Histogram.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+// Number of records kept per thread, older records are overwritten
+#define PROFILER_BUFFER_SIZE ( 32 * 1024 )
+
+
+// Phases of the frame step and rollback that are profiled
+enum class ProfilePhase : uint8_t
+{
+    // Whole rollback, from loading the state until re-running back to the current frame
+    Rollback,
+
+    // Loading the rollback state
+    LoadState,
+
+    // Our frame step while re-running, the game's own simulation is the rest of the rollback
+    RerunStep,
+
+    // Our frame step while running normally
+    FrameStep,
+
+    // Saving a rollback state
+    SaveState,
+
+    // Saving and restoring sound effects while re-running
+    RerunSounds,
+
+    // Looking up and writing the game inputs
+    Inputs,
+
+    NumPhases
+};
+
+
+// Low overhead profiler, each thread records (phase, start, end, frame, depth) into its own ring buffer without
+// locking. When disabled, a scope only checks a flag, and building with DISABLE_PROFILER removes the scopes entirely.
+// The records can be aggregated into per phase histograms and written as a Chrome trace, which can be opened in
+// chrome://tracing or https://ui.perfetto.dev.
+class Profiler
+{
+public:
+
+    struct Record
+    {
+        // Nanoseconds, see now()
+        uint64_t start, end;
+
+        uint32_t frame;
+
+        // Rollback depth in frames
+        uint16_t depth;
+
+        ProfilePhase phase;
+
+        // Index of the recording thread
+        uint8_t thread;
+    };
+
+    typedef std::array<Histogram, size_t ( ProfilePhase::NumPhases )> PhaseHistograms;
+
+    void enable() { _enabled.store ( true, std::memory_order_relaxed ); }
+
+    void disable() { _enabled.store ( false, std::memory_order_relaxed ); }
+
+    bool isEnabled() const { return _enabled.load ( std::memory_order_relaxed ); }
+
+    // Record a phase on the calling thread, does nothing if disabled
+    void record ( ProfilePhase phase, uint64_t start, uint64_t end, uint32_t frame = 0, uint16_t depth = 0 );
+
+    // Copy the records of all threads, oldest first for each thread.
+    // Records of threads that are still recording may be torn, so only use them when those threads are idle.
+    std::vector<Record> getRecords() const;
+
+    // Discard all records
+    void clear();
+
+    // Durations of each phase in nanoseconds
+    static PhaseHistograms aggregate ( const std::vector<Record>& records );
+
+    // Chrome trace event JSON
+    static std::string getChromeTrace ( const std::vector<Record>& records );
+    static bool writeChromeTrace ( const std::vector<Record>& records, const std::string& file );
+
+    static const char *getPhaseName ( ProfilePhase phase );
+
+    // Monotonic time in nanoseconds
+    static uint64_t now();
+
+    // Get the singleton instance
+    static Profiler& get();
+
+private:
+
+    struct ThreadBuffer
+    {
+        std::vector<Record> records;
+
+        // Total number of records written, the newest is at ( count - 1 ) % PROFILER_BUFFER_SIZE
+        std::atomic<size_t> count { 0 };
+
+        uint8_t thread = 0;
+    };
+
+    std::atomic<bool> _enabled { false };
+
+    // Buffers of every thread that recorded, these are never freed so the threads can keep a pointer
+    std::vector<std::unique_ptr<ThreadBuffer>> _buffers;
+
+    mutable Mutex _mutex;
+
+    Profiler() {}
+
+    ThreadBuffer *getThreadBuffer();
+};
+
+
+// Records the lifetime of a scope as one phase
+class ProfileScope
+{
+public:
+
+    ProfileScope ( ProfilePhase phase, uint32_t frame = 0, uint16_t depth = 0 )
+        : _start ( Profiler::get().isEnabled() ? Profiler::now() : 0 ), _frame ( frame ), _depth ( depth )
+        , _phase ( phase ) {}
+
+    ~ProfileScope()
+    {
+        if ( _start )
+            Profiler::get().record ( _phase, _start, Profiler::now(), _frame, _depth );
+    }
+
+private:
+
+    const uint64_t _start;
+
+    const uint32_t _frame;
+
+    const uint16_t _depth;
+
+    const ProfilePhase _phase;
+};
+
+
+#ifdef DISABLE_PROFILER
+
+#define PROFILE_SCOPE(...)
+
+#else
+
+#define PROFILE_SCOPE_NAME(LINE) profileScope ## LINE
+#define PROFILE_SCOPE_LINE(LINE, ...) ProfileScope PROFILE_SCOPE_NAME ( LINE ) ( __VA_ARGS__ )
+
+// Profile the rest of the current scope, arguments are the same as ProfileScope
+#define PROFILE_SCOPE(...) PROFILE_SCOPE_LINE ( __LINE__, __VA_ARGS__ )
+
+#endif // DISABLE_PROFILER
@@ -1,10 +1,13 @@
 #include "Protocol.hpp"
-#include "Protocol.include.hpp"
-#include "Protocol.inlineimpl.hpp"
 #include "Compression.hpp"
 #include "Logger.hpp"
 #include "Enum.hpp"
 
+#include <cereal/types/array.hpp>
+
+#include <cstring>
+#include <stdexcept>
+
 using namespace std;
 using namespace cereal;
 
@@ -42,19 +45,48 @@ Not compressed:
 
 
 // Encode with compression
-string encodeStageTwo ( const MsgPtr& msg, const string& msgData );
+void encodeStageTwo ( const Serializable& msg, const string& msgData, string& buffer );
 
 // Result of the decode
 ENUM ( DecodeResult, Failed, NotCompressed, Compressed );
 
 // Decode with compression. Must manually update the value of consumed if the data was not compressed.
-DecodeResult decodeStageTwo ( const char *bytes, size_t len, size_t& consumed, MsgType& type, string& msgData );
+// msgData points into bytes if the data was not compressed, otherwise into the buffer.
+DecodeResult decodeStageTwo ( const char *bytes, size_t len, size_t& consumed, MsgType& type,
+                              const char *& msgData, size_t& msgSize, string& buffer );
+
+
+// Per thread buffer for the message data, so encoding and decoding doesn't allocate once it's large enough.
+// Messages that encode or decode other messages while saving or loading, eg GoBackN, get a temporary one.
+static __thread string *threadBuffer = 0;
+
+class ScratchBuffer
+{
+public:
+
+    string& data;
+
+    ScratchBuffer() : data ( threadBuffer ? *threadBuffer : *new string() )
+    {
+        threadBuffer = 0;
+        data.clear();
+    }
+
+    ~ScratchBuffer()
+    {
+        if ( threadBuffer )
+            delete &data;
+        else
+            threadBuffer = &data;
+    }
+};
 
 
 string Protocol::encode ( const Serializable& message )
 {
-    MsgPtr msg ( const_cast<Serializable *> ( &message ), ignoreMsgPtr );
-    return encode ( msg );
+    string buffer;
+    encode ( message, buffer );
+    return buffer;
 }
 
 string Protocol::encode ( Serializable *message )
@@ -63,7 +95,7 @@ string Protocol::encode ( Serializable *message )
         return "";
 
     MsgPtr msg ( message );
-    return encode ( msg );
+    return encode ( *msg );
 }
 
 string Protocol::encode ( const MsgPtr& msg )
@@ -71,36 +103,61 @@ string Protocol::encode ( const MsgPtr& msg )
     if ( ! msg.get() )
         return "";
 
-    ostringstream ss ( stringstream::binary );
-    BinaryOutputArchive archive ( ss );
+    return encode ( *msg );
+}
+
+void Protocol::encode ( const MsgPtr& msg, string& buffer )
+{
+    if ( ! msg.get() )
+    {
+        buffer.clear();
+        return;
+    }
+
+    encode ( *msg, buffer );
+}
 
-    // Encode base message data
-    msg->saveBase ( archive );
+void Protocol::encode ( const Serializable& msg, string& buffer )
+{
+    ScratchBuffer scratch;
+    string& data = scratch.data;
+    FlatWriter writer ( data );
 
-    // Encode actual message data
-    msg->save ( archive );
+    // Encode base and actual message data directly if the message has a flat layout, otherwise use cereal
+    msg.saveBaseFlat ( writer );
+
+    if ( ! msg.saveFlat ( writer ) )
+    {
+        ostringstream ss ( stringstream::binary );
+        BinaryOutputArchive archive ( ss );
+
+        msg.saveBase ( archive );
+        msg.save ( archive );
+
+        data = ss.str();
+    }
 
 #ifndef DISABLE_UPDATE_HASH
     // Update the hash
-    if ( msg->_hashValid )
+    if ( msg._hashValid )
     {
-        getMD5 ( ss.str(), &msg->_hash[0] );
-        msg->_hashValid = false;
+        getMD5 ( data, &msg._hash[0] );
+        msg._hashValid = false;
 
 #ifdef LOG_PROTOCOL
-        LOG ( "%s", msg->getMsgType() );
-        if ( ss.str().size() <= 256 )
-            LOG ( "data=[ %s ]", formatAsHex ( ss.str() ) );
-        LOG ( "hash=[ %s ]", formatAsHex ( msg->_hash, msg->_hash.size() ) );
+        LOG ( "%s", msg.getMsgType() );
+        if ( data.size() <= 256 )
+            LOG ( "data=[ %s ]", formatAsHex ( data ) );
+        LOG ( "hash=[ %s ]", formatAsHex ( msg._hash, msg._hash.size() ) );
 #endif
     }
 #endif // NOT DISABLE_UPDATE_HASH
 
     // Encode hash at the end of message data
-    archive ( msg->_hash );
+    writer.writeBytes ( &msg._hash[0], msg._hash.size() );
 
     // Encode with compression
-    return encodeStageTwo ( msg, ss.str() );
+    encodeStageTwo ( msg, data, buffer );
 }
 
 MsgPtr Protocol::decode ( const char *bytes, size_t len, size_t& consumed )
@@ -114,10 +171,14 @@ MsgPtr Protocol::decode ( const char *bytes, size_t len, size_t& consumed )
     }
 
     MsgType type;
-    string data;
+    const char *data = 0;
+    size_t dataSize = 0;
+
+    // Only used if the data was compressed
+    ScratchBuffer scratch;
 
     // Decode with compression
-    DecodeResult result = decodeStageTwo ( bytes, len, consumed, type, data );
+    DecodeResult result = decodeStageTwo ( bytes, len, consumed, type, data, dataSize, scratch.data );
 
 #ifdef LOG_PROTOCOL
     LOG ( "decodeStageTwo: result=%s", result );
@@ -130,33 +191,57 @@ MsgPtr Protocol::decode ( const char *bytes, size_t len, size_t& consumed )
     }
 
 #ifdef LOG_PROTOCOL
-    if ( data.size() <= 256 )
-        LOG ( "decodeStageTwo: data=[ %s ]", formatAsHex ( data ) );
+    if ( dataSize <= 256 )
+        LOG ( "decodeStageTwo: data=[ %s ]", formatAsHex ( data, dataSize ) );
 #endif
 
-    istringstream ss ( data, stringstream::binary );
-    BinaryInputArchive archive ( ss );
+    // Unread bytes at the end of the message data
+    size_t remaining = 0;
 
     try
     {
         // Construct the correct message type
-        switch ( type )
+        msg = create ( type );
+
+        if ( ! msg.get() )
         {
-#include "Protocol.switchdecode.hpp"
+            consumed = 0;
+            return NullMsg;
+        }
+
+        FlatReader reader ( data, dataSize );
+
+        // Decode base and actual message data directly if the message has a flat layout, otherwise use cereal
+        msg->loadBaseFlat ( reader );
 
-            default:
-                consumed = 0;
-                return NullMsg;
+        if ( msg->loadFlat ( reader ) )
+        {
+            // Decode hash at end of message data
+            reader.readBytes ( &msg->_hash[0], msg->_hash.size() );
+
+            // Invalid data is dropped below, same as when cereal throws
+            if ( reader.failed() )
+                throw length_error ( "Not enough message data" );
+
+            remaining = reader.remaining();
         }
+        else
+        {
+            istringstream ss ( string ( data, dataSize ), stringstream::binary );
+            BinaryInputArchive archive ( ss );
+
+            // Decode base message data
+            msg->loadBase ( archive );
 
-        // Decode base message data
-        msg->loadBase ( archive );
+            // Decode actual message data
+            msg->load ( archive );
 
-        // Decode actual message data
-        msg->load ( archive );
+            // Decode hash at end of message data
+            archive ( msg->_hash );
+
+            remaining = ss.rdbuf()->in_avail();
+        }
 
-        // Decode hash at end of message data
-        archive ( msg->_hash );
         msg->_hashValid = false;
     }
     catch ( const cereal::Exception& exc )
@@ -187,29 +272,26 @@ MsgPtr Protocol::decode ( const char *bytes, size_t len, size_t& consumed )
         return NullMsg;
     }
 
-    size_t dataSize = data.size();
-
     // decodeStageTwo does not update the value of consumed if the data was not compressed
     if ( result == DecodeResult::NotCompressed )
     {
         // Check for unread bytes
-        size_t remaining = ss.rdbuf()->in_avail();
         ASSERT ( len >= remaining );
         consumed = ( len - remaining );
-        dataSize = ( data.size() - remaining );
+        dataSize -= remaining;
     }
 
 #ifndef DISABLE_UPDATE_HASH
     // Check if the hash is correct
-    if ( ! checkMD5 ( &data[0], dataSize - msg->_hash.size(), &msg->_hash[0] ) )
+    if ( ! checkMD5 ( data, dataSize - msg->_hash.size(), &msg->_hash[0] ) )
     {
 #ifdef LOG_PROTOCOL
         LOG ( "hash check failed for %s", type );
-        LOG ( "data=[ %s ]", formatAsHex ( &data[0], dataSize - msg->_hash.size() ) );
+        LOG ( "data=[ %s ]", formatAsHex ( data, dataSize - msg->_hash.size() ) );
         LOG ( "hash    =[ %s ]", formatAsHex ( msg->_hash, msg->_hash.size() ) );
 
         char hash[msg->_hash.size()];
-        gethash ( &data[0], dataSize - msg->_hash.size(), hash );
+        gethash ( data, dataSize - msg->_hash.size(), hash );
 
         LOG ( "expected=[ %s ]", formatAsHex ( hash, msg->_hash.size() ) );
 #endif
@@ -220,96 +302,83 @@ MsgPtr Protocol::decode ( const char *bytes, size_t len, size_t& consumed )
     return msg;
 }
 
-string encodeStageTwo ( const MsgPtr& msg, const string& msgData )
+void encodeStageTwo ( const Serializable& msg, const string& msgData, string& buffer )
 {
-    ostringstream ss ( stringstream::binary );
-    BinaryOutputArchive archive ( ss );
+    // The header is written directly, with the same bytes as cereal's binary archive
+    buffer.clear();
+
+    FlatWriter writer ( buffer );
 
     // Encode message type first without compression
-    archive ( msg->getMsgType() );
+    writer.save ( msg.getMsgType() );
 
     // Compress message data if needed
-    if ( msg->compressionLevel )
+    if ( msg.compressionLevel )
     {
-        string buffer ( compressBound ( msgData.size() ), ( char ) 0 );
-        size_t size = compress ( &msgData[0], msgData.size(), &buffer[0], buffer.size(), msg->compressionLevel );
-        buffer.resize ( size );
+        const uint32_t uncompressedSize = msgData.size();
+        writer.save ( msg.compressionLevel, uncompressedSize, cereal::size_type ( 0 ) );
+
+        // Compress directly after the header, then fill in the compressed size
+        const size_t headerSize = buffer.size();
+        buffer.resize ( headerSize + compressBound ( msgData.size() ) );
+
+        const cereal::size_type size = compress ( &msgData[0], msgData.size(), &buffer[headerSize],
+                                                  buffer.size() - headerSize, msg.compressionLevel );
 
         // Only use compressed message data if actually smaller after the overhead
 #ifndef FORCE_COMPRESSION
-        if ( sizeof ( msgData.size() ) + sizeof ( buffer.size() ) + buffer.size() < msgData.size() )
+        if ( size && sizeof ( uncompressedSize ) + sizeof ( size ) + size < msgData.size() )
 #endif
         {
-            archive ( msg->compressionLevel );
-            archive ( msgData.size() );         // uncompressed size
-            archive ( buffer );                 // compressed size + compressed data
-            return ss.str();
+            memcpy ( &buffer[headerSize - sizeof ( size )], &size, sizeof ( size ) );
+            buffer.resize ( headerSize + size );
+            return;
         }
 
         // Otherwise update compression level so we don't try to compress this again
-        msg->compressionLevel = 0;
+        msg.compressionLevel = 0;
+        buffer.resize ( sizeof ( MsgType ) );
     }
 
     // uncompressed data does not include uncompressedSize or any other sizes
-    archive ( msg->compressionLevel );
-    return ss.str() + msgData;
+    writer.save ( msg.compressionLevel );
+    buffer += msgData;
 }
 
-DecodeResult decodeStageTwo ( const char *bytes, size_t len, size_t& consumed, MsgType& type, string& msgData )
+DecodeResult decodeStageTwo ( const char *bytes, size_t len, size_t& consumed, MsgType& type,
+                              const char *& msgData, size_t& msgSize, string& buffer )
 {
-    istringstream ss ( string ( bytes, len ), stringstream::binary );
-    BinaryInputArchive archive ( ss );
+    FlatReader reader ( bytes, len );
 
-    uint8_t compressionLevel;
-    uint32_t uncompressedSize;
+    uint8_t compressionLevel = 0;
+    uint32_t uncompressedSize = 0;
+    cereal::size_type compressedSize = 0;
 
-    try
-    {
-        // Decode message type first before decompression
-        archive ( type );
-        archive ( compressionLevel );
+    // Decode message type first before decompression
+    reader.load ( type, compressionLevel );
 
-        // Only compressed data includes uncompressedSize + a compressed data buffer
-        if ( compressionLevel )
-        {
-            archive ( uncompressedSize );       // uncompressed size
-            archive ( msgData );                // compressed size + compressed data
-        }
-    }
-    catch ( const cereal::Exception& exc )
-    {
-#ifdef LOG_PROTOCOL
-        LOG ( "cereal::Exception: '%s'", type, exc.what() );
-#endif
-        consumed = 0;
-        return DecodeResult::Failed;
-    }
-    catch ( const std::exception& exc )
-    {
-#ifdef LOG_PROTOCOL
-        LOG ( "std::exception: '%s'", type, exc.what() );
-#endif
-        consumed = 0;
-        return DecodeResult::Failed;
-    }
-    catch ( ... )
+    // Only compressed data includes uncompressedSize + a compressed data buffer
+    if ( compressionLevel )
+        reader.load ( uncompressedSize, compressedSize );
+
+    if ( reader.failed() || compressedSize > reader.remaining() )
     {
 #ifdef LOG_PROTOCOL
-        LOG ( "Unknown exception!" );
+        LOG ( "Not enough message data" );
 #endif
         consumed = 0;
         return DecodeResult::Failed;
     }
 
     // Get remaining bytes
-    size_t remaining = ss.rdbuf()->in_avail();
-    ASSERT ( len >= remaining );
+    size_t remaining = reader.remaining();
+    const char *const start = bytes + ( len - remaining );
 
     // Decompress message data if needed
     if ( compressionLevel )
     {
-        string buffer ( uncompressedSize, ( char ) 0 );
-        size_t size = uncompress ( &msgData[0], msgData.size(), &buffer[0], buffer.size() );
+        buffer.resize ( uncompressedSize );
+        size_t size = uncompress ( start, compressedSize, &buffer[0], buffer.size() );
 
         if ( size != uncompressedSize )
         {
@@ -318,14 +387,15 @@ DecodeResult decodeStageTwo ( const char *bytes, size_t len, size_t& consumed, M
         }
 
         // Update consumed bytes
-        consumed = len - remaining;
-        msgData = buffer;
+        consumed = len - remaining + compressedSize;
+        msgData = &buffer[0];
+        msgSize = buffer.size();
         return DecodeResult::Compressed;
     }
 
     // Get remaining bytes
-    msgData.resize ( remaining );
-    ss.rdbuf()->sgetn ( &msgData[0], remaining );
+    msgData = start;
+    msgSize = remaining;
     return DecodeResult::NotCompressed;
 }
 
@@ -1,9 +1,12 @@
 #pragma once
 
 #include "Enum.hpp"
+#include "FlatArchive.hpp"
+#include "MsgPool.hpp"
 
 #include <cereal/archives/binary.hpp>
 
+#include <array>
 #include <string>
 #include <memory>
 #include <iostream>
@@ -23,7 +26,9 @@
 #define PROTOCOL_MESSAGE_BOILERPLATE(NAME, ...)                                                             \
     EMPTY_MESSAGE_BOILERPLATE(NAME)                                                                         \
     void save ( cereal::BinaryOutputArchive& ar ) const override { ar ( __VA_ARGS__ ); }                    \
-    void load ( cereal::BinaryInputArchive& ar ) override { ar ( __VA_ARGS__ ); }
+    void load ( cereal::BinaryInputArchive& ar ) override { ar ( __VA_ARGS__ ); }                          \
+    bool saveFlat ( FlatWriter& writer ) const override { return writer.save ( __VA_ARGS__ ); }            \
+    bool loadFlat ( FlatReader& reader ) override { return reader.load ( __VA_ARGS__ ); }
 
 #define CEREAL_CLASS_BOILERPLATE(...)                                                                       \
     void save ( cereal::BinaryOutputArchive& ar ) const { ar ( __VA_ARGS__ ); }                             \
@@ -68,10 +73,18 @@ public:
     static std::string encode ( Serializable *message );
     static std::string encode ( const MsgPtr& msg );
 
+    // Encode a message into the buffer, replacing its contents. This doesn't allocate once the buffer is large enough,
+    // so the sockets keep one buffer for all their messages.
+    static void encode ( const Serializable& message, std::string& buffer );
+    static void encode ( const MsgPtr& msg, std::string& buffer );
+
     // Decode a series of bytes into a message, consumed indicates the number of bytes read.
     // This returns null if the message failed to decode, NOTE consumed will still be updated.
     static MsgPtr decode ( const char *bytes, size_t len, size_t& consumed );
 
+    // Construct an empty message of the given type, or null if the type is unknown, see ProtocolCreate.cpp
+    static MsgPtr create ( MsgType type );
+
     static bool checkMsgType ( MsgType type )
     {
         return ( type > MsgType::FirstType && type < MsgType::LastType );
@@ -99,6 +112,11 @@ public:
     virtual void save ( cereal::BinaryOutputArchive& ar ) const {}
     virtual void load ( cereal::BinaryInputArchive& ar ) {}
 
+    // Serialize to and deserialize from the same bytes without cereal, see FlatArchive.hpp.
+    // Returns false if this message doesn't have a flat layout, then the cereal methods are used instead.
+    virtual bool saveFlat ( FlatWriter& writer ) const { return false; }
+    virtual bool loadFlat ( FlatReader& reader ) { return false; }
+
     // Cast this to another another type
     template<typename T> T& getAs() { return *static_cast<T *> ( this ); }
     template<typename T> const T& getAs() const { return *static_cast<const T *> ( this ); }
@@ -123,6 +141,8 @@ private:
     // Serialize and deserialize the base type
     virtual void saveBase ( cereal::BinaryOutputArchive& ar ) const {}
     virtual void loadBase ( cereal::BinaryInputArchive& ar ) {}
+    virtual void saveBaseFlat ( FlatWriter& writer ) const {}
+    virtual void loadBaseFlat ( FlatReader& reader ) {}
 
     friend struct Protocol;
     friend struct SerializableMessage;
@@ -174,4 +194,6 @@ private:
 
     void saveBase ( cereal::BinaryOutputArchive& ar ) const override { ar ( _sequence ); };
     void loadBase ( cereal::BinaryInputArchive& ar ) override { ar ( _sequence ); };
+    void saveBaseFlat ( FlatWriter& writer ) const override { writer.save ( _sequence ); };
+    void loadBaseFlat ( FlatReader& reader ) override { reader.load ( _sequence ); };
 };
@@ -0,0 +1,22 @@
+#include "Protocol.hpp"
+#include "Protocol.include.hpp"
+#include "Protocol.inlineimpl.hpp"
+
+using namespace std;
+
+
+// The generated message type registry is kept apart from the encoding, since it needs every message type
+MsgPtr Protocol::create ( MsgType type )
+{
+    MsgPtr msg;
+
+    switch ( type )
+    {
+#include "Protocol.switchdecode.hpp"
+
+        default:
+            break;
+    }
+
+    return msg;
+}
@@ -0,0 +1,417 @@
+#include "RelayProber.hpp"
+#include "Thread.hpp"
+#include "Logger.hpp"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+
+using namespace std;
+
+
+// The prober is also built natively for the host tests, so it uses plain BSD sockets instead of lib/Socket
+#ifdef _WIN32
+typedef int socklen_t;
+#define CLOSE_SOCKET(FD) closesocket ( FD )
+#else
+typedef int SOCKET;
+#define INVALID_SOCKET ( -1 )
+#define CLOSE_SOCKET(FD) close ( FD )
+#endif
+
+#define NONCE(INDEX, SEQUENCE)  ( ( uint32_t ( INDEX ) << 16 ) | uint32_t ( SEQUENCE ) )
+#define INDEX_OF(NONCE)         ( ( NONCE ) >> 16 )
+#define SEQUENCE_OF(NONCE)      ( ( NONCE ) & 0xFFFF )
+
+// Maximum time to block in select, so newly resolved relays start being probed promptly
+#define MAX_WAIT                ( 5 )
+
+
+// Monotonic time in milliseconds
+static double now()
+{
+    return chrono::duration_cast<chrono::microseconds> (
+               chrono::steady_clock::now().time_since_epoch() ).count() / 1000.0;
+}
+
+namespace
+{
+
+struct Target
+{
+    // Written by the resolver thread, protected by the mutex
+    bool resolving = true;
+    bool resolved = false;
+    sockaddr_in addr;
+
+    // Only used by the probing thread
+    double nextSend = 0;
+    vector<double> sendTimes;
+    vector<bool> answered;
+    double totalRtt = 0;
+};
+
+class ResolverThread : public Thread
+{
+public:
+
+    ResolverThread ( const string& relay, Target& target, Mutex& mutex )
+        : _relay ( relay ), _target ( target ), _mutex ( mutex ) {}
+
+    void run() override
+    {
+        sockaddr_in addr;
+        memset ( &addr, 0, sizeof ( addr ) );
+
+        const bool resolved = resolve ( addr );
+
+        Lock lock ( _mutex );
+        _target.resolving = false;
+        _target.resolved = resolved;
+        _target.addr = addr;
+    }
+
+private:
+
+    const string _relay;
+
+    Target& _target;
+
+    Mutex& _mutex;
+
+    bool resolve ( sockaddr_in& result ) const
+    {
+        const size_t colon = _relay.rfind ( ':' );
+
+        if ( colon == string::npos || colon == 0 || colon + 1 == _relay.size() )
+            return false;
+
+        addrinfo hints, *res = 0;
+        memset ( &hints, 0, sizeof ( hints ) );
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+
+        // This is the blocking part, which is why each relay gets its own thread
+        if ( getaddrinfo ( _relay.substr ( 0, colon ).c_str(), _relay.substr ( colon + 1 ).c_str(), &hints, &res )
+                || !res )
+        {
+            return false;
+        }
+
+        memcpy ( &result, res->ai_addr, sizeof ( result ) );
+        freeaddrinfo ( res );
+        return true;
+    }
+};
+
+} // namespace
+
+
+uint64_t RelayProber::Result::getConnectTimeout() const
+{
+    if ( !isReachable() )
+        return 0;
+
+    return max ( uint64_t ( RELAY_MIN_TIMEOUT ), uint64_t ( rtt * RELAY_RTT_TIMEOUT_SCALE ) );
+}
+
+vector<RelayProber::Result> RelayProber::probe ( const vector<string>& relays ) const
+{
+    vector<Result> results;
+
+    for ( const string& relay : relays )
+        results.push_back ( Result ( relay ) );
+
+    if ( relays.empty() || relays.size() > 0xFFFF || numProbes == 0 || numProbes > 0xFFFF )
+        return results;
+
+#ifdef _WIN32
+    WSADATA wsaData;
+
+    if ( WSAStartup ( MAKEWORD ( 2, 2 ), &wsaData ) != 0 )
+        return results;
+#endif
+
+    const SOCKET fd = socket ( AF_INET, SOCK_DGRAM, IPPROTO_UDP );
+
+    if ( fd == INVALID_SOCKET )
+    {
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        return results;
+    }
+
+#ifdef _WIN32
+    u_long nonBlocking = 1;
+    ioctlsocket ( fd, FIONBIO, &nonBlocking );
+#else
+    fcntl ( fd, F_SETFL, fcntl ( fd, F_GETFL ) | O_NONBLOCK );
+#endif
+
+    Mutex mutex;
+    vector<Target> targets ( relays.size() );
+    vector<shared_ptr<ResolverThread>> resolvers;
+
+    for ( size_t i = 0; i < relays.size(); ++i )
+    {
+        targets[i].sendTimes.resize ( numProbes );
+        targets[i].answered.resize ( numProbes );
+
+        resolvers.push_back ( make_shared<ResolverThread> ( relays[i], targets[i], mutex ) );
+        resolvers.back()->start();
+    }
+
+    const double deadline = now() + timeout;
+
+    for ( ;; )
+    {
+        double t = now();
+
+        if ( t >= deadline )
+            break;
+
+        double wakeup = min ( deadline, t + MAX_WAIT );
+        bool done = true;
+
+        for ( size_t i = 0; i < targets.size(); ++i )
+        {
+            Target& target = targets[i];
+            Result& result = results[i];
+
+            bool resolving, resolved;
+            {
+                Lock lock ( mutex );
+                resolving = target.resolving;
+                resolved = target.resolved;
+            }
+
+            if ( resolving )
+            {
+                done = false;
+                continue;
+            }
+
+            if ( !resolved )
+                continue;
+
+            if ( result.resolved.empty() )
+            {
+                char host[NI_MAXHOST];
+
+                if ( getnameinfo ( ( sockaddr * ) &target.addr, sizeof ( target.addr ), host, sizeof ( host ),
+                                   0, 0, NI_NUMERICHOST ) == 0 )
+                {
+                    result.resolved = format ( "%s:%u", host, ntohs ( target.addr.sin_port ) );
+                }
+            }
+
+            if ( result.sent < numProbes )
+            {
+                done = false;
+
+                if ( t >= target.nextSend )
+                {
+                    char buffer[RELAY_PING_SIZE];
+                    const uint32_t nonce = NONCE ( i, result.sent );
+                    memcpy ( buffer, RELAY_PING_HEADER, 4 );
+                    memcpy ( &buffer[4], &nonce, sizeof ( nonce ) );
+
+                    sendto ( fd, buffer, sizeof ( buffer ), 0, ( sockaddr * ) &target.addr, sizeof ( target.addr ) );
+
+                    target.sendTimes[result.sent++] = t;
+                    target.nextSend = t + probeInterval;
+                }
+
+                wakeup = min ( wakeup, target.nextSend );
+            }
+            else if ( result.received < result.sent )
+            {
+                // Waiting for the remaining replies
+                done = false;
+            }
+        }
+
+        if ( done )
+            break;
+
+        // Wait for replies until the next probe is due
+        fd_set readFds;
+        FD_ZERO ( &readFds );
+        FD_SET ( fd, &readFds );
+
+        const double wait = max ( 0.0, wakeup - now() );
+
+        timeval tv;
+        tv.tv_sec = long ( wait / 1000 );
+        tv.tv_usec = long ( wait * 1000 ) % 1000000;
+
+        if ( select ( int ( fd ) + 1, &readFds, 0, 0, &tv ) <= 0 )
+            continue;
+
+        for ( ;; )
+        {
+            char buffer[64];
+            sockaddr_in from;
+            socklen_t fromLen = sizeof ( from );
+
+            const int len = recvfrom ( fd, buffer, sizeof ( buffer ), 0, ( sockaddr * ) &from, &fromLen );
+
+            if ( len < 0 )
+                break;
+
+            t = now();
+
+            if ( len != RELAY_PING_SIZE || memcmp ( buffer, RELAY_PING_HEADER, 4 ) )
+                continue;
+
+            uint32_t nonce;
+            memcpy ( &nonce, &buffer[4], sizeof ( nonce ) );
+
+            const size_t index = INDEX_OF ( nonce ), sequence = SEQUENCE_OF ( nonce );
+
+            if ( index >= targets.size() || sequence >= results[index].sent || targets[index].answered[sequence] )
+                continue;
+
+            targets[index].answered[sequence] = true;
+            targets[index].totalRtt += t - targets[index].sendTimes[sequence];
+            ++results[index].received;
+        }
+    }
+
+    CLOSE_SOCKET ( fd );
+
+    // Relays that were still resolving at the timeout are left unreachable, joining can take as long as the OS
+    // takes to give up resolving.
+    for ( const auto& resolver : resolvers )
+        resolver->join();
+
+#ifdef _WIN32
+    WSACleanup();
+#endif
+
+    for ( size_t i = 0; i < results.size(); ++i )
+    {
+        if ( results[i].received )
+            results[i].rtt = targets[i].totalRtt / results[i].received;
+
+        LOG ( "relay=%s; resolved=%s; sent=%u; received=%u; rtt=%.1f ms",
+              results[i].relay, results[i].resolved, results[i].sent, results[i].received, results[i].rtt );
+    }
+
+    return results;
+}
+
+void RelayProber::rank ( vector<Result>& results )
+{
+    stable_sort ( results.begin(), results.end(), [] ( const Result& a, const Result& b )
+    {
+        if ( a.isReachable() != b.isReachable() )
+            return a.isReachable();
+
+        if ( !a.isReachable() )
+            return false;
+
+        return a.getScore() < b.getScore();
+    } );
+}
+
+vector<RelayProber::Result> RelayProber::order ( const vector<string>& relays, const vector<Result>& cached )
+{
+    vector<Result> reachable, unknown, unreachable;
+
+    for ( const string& relay : relays )
+    {
+        auto it = find_if ( cached.begin(), cached.end(), [&] ( const Result& r ) { return r.relay == relay; } );
+
+        if ( it == cached.end() )
+        {
+            unknown.push_back ( Result ( relay ) );
+            continue;
+        }
+
+        // Only the ranking is reused, the address may have changed since
+        Result result = *it;
+        result.resolved.clear();
+
+        if ( result.isReachable() )
+            reachable.push_back ( result );
+        else
+            unreachable.push_back ( result );
+    }
+
+    rank ( reachable );
+
+    reachable.insert ( reachable.end(), unknown.begin(), unknown.end() );
+    reachable.insert ( reachable.end(), unreachable.begin(), unreachable.end() );
+    return reachable;
+}
+
+bool RelayProber::save ( const string& file, const vector<Result>& results )
+{
+    ofstream out ( file.c_str() );
+
+    if ( !out.good() )
+        return false;
+
+    for ( const Result& result : results )
+    {
+        out << result.relay << ' ' << ( result.resolved.empty() ? "-" : result.resolved ) << ' '
+            << result.sent << ' ' << result.received << ' ' << result.rtt << '\n';
+    }
+
+    out.close();
+    return out.good();
+}
+
+bool RelayProber::load ( const string& file, vector<Result>& results )
+{
+    results.clear();
+
+    ifstream in ( file.c_str() );
+
+    if ( !in.good() )
+        return false;
+
+    string line;
+
+    while ( getline ( in, line ) )
+    {
+        if ( line.empty() )
+            continue;
+
+        Result result;
+        istringstream ss ( line );
+
+        if ( !( ss >> result.relay >> result.resolved >> result.sent >> result.received >> result.rtt )
+                || result.received > result.sent || result.rtt < 0 )
+        {
+            LOG ( "Ignoring invalid relay cache: '%s'", file );
+            results.clear();
+            return false;
+        }
+
+        if ( result.resolved == "-" )
+            result.resolved.clear();
+
+        results.push_back ( result );
+    }
+
+    return true;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// Probe packet sent over UDP to the relay server port, echoed back as is by the relay. It is "Ping" followed by
+// a uint32_t nonce, so it can't be mistaken for UdpData which is exactly 5 bytes.
+#define RELAY_PING_HEADER       "Ping"
+#define RELAY_PING_SIZE         ( 8 )
+
+// Score penalty in milliseconds for 100% packet loss
+#define RELAY_LOSS_PENALTY      ( 500.0 )
+
+// Connect timeout for relays that answered probes is this many times their RTT, but no less than the minimum
+#define RELAY_RTT_TIMEOUT_SCALE ( 8 )
+#define RELAY_MIN_TIMEOUT       ( 1000 )
+
+
+// Resolves and probes all the relay servers concurrently, so that a slow or dead relay doesn't stall the others,
+// then ranks them by measured RTT and packet loss.
+class RelayProber
+{
+public:
+
+    struct Result
+    {
+        // Relay address as listed, eg "host:port"
+        std::string relay;
+
+        // Numeric "ip:port" the relay resolved to, empty if it didn't resolve
+        std::string resolved;
+
+        // Probes sent and answered
+        uint32_t sent = 0, received = 0;
+
+        // Average round trip time of the answered probes in milliseconds
+        double rtt = 0;
+
+        Result() {}
+        Result ( const std::string& relay ) : relay ( relay ) {}
+
+        bool isReachable() const { return received > 0; }
+
+        double getLoss() const { return sent ? 1.0 - double ( received ) / sent : 1.0; }
+
+        // Lower is better, only meaningful if reachable
+        double getScore() const { return rtt + getLoss() * RELAY_LOSS_PENALTY; }
+
+        // Connect timeout in milliseconds to fail over quickly, or 0 to use the default
+        uint64_t getConnectTimeout() const;
+
+        // Address to connect to, the resolved one if available so it doesn't have to be resolved again
+        const std::string& getAddress() const { return resolved.empty() ? relay : resolved; }
+    };
+
+    // Number of probes sent to each relay
+    uint32_t numProbes = 5;
+
+    // Milliseconds between probes to the same relay
+    uint64_t probeInterval = 20;
+
+    // Maximum time in milliseconds for resolving and probing everything
+    uint64_t timeout = 1000;
+
+    // Resolve and probe all the relays, blocks until every probe is answered or the timeout.
+    // The results are in the same order as the relays.
+    std::vector<Result> probe ( const std::vector<std::string>& relays ) const;
+
+    // Sort results best first, unreachable relays go last in their original order
+    static void rank ( std::vector<Result>& results );
+
+    // Order the relays using the results of an earlier probe. Relays without results go after the reachable ones,
+    // but before the unreachable ones, since they may well be fine.
+    static std::vector<Result> order ( const std::vector<std::string>& relays, const std::vector<Result>& cached );
+
+    // Save / load results to keep the ranking across sessions
+    static bool save ( const std::string& file, const std::vector<Result>& results );
+    static bool load ( const std::string& file, std::vector<Result>& results );
+};
@@ -1,6 +1,7 @@
 #include "SmartSocket.hpp"
 #include "TcpSocket.hpp"
 #include "UdpSocket.hpp"
+#include "EventManager.hpp"
 #include "Logger.hpp"
 
 #include <ws2tcpip.h>
@@ -13,17 +14,43 @@ using namespace std;
 
 #define SEND_INTERVAL ( 50 )
 
-static vector<IpAddrPort> loadRelays() {
-    std::ifstream infile(RELAY_LIST);
-    std::string str;
-    vector<IpAddrPort> relays;
-    while (std::getline(infile, str)) {
-        relays.push_back(str);
+#define RELAY_CACHE "relay_cache.txt"
+
+static vector<string> loadRelays()
+{
+    ifstream infile ( RELAY_LIST );
+    string str;
+    vector<string> relays;
+
+    while ( getline ( infile, str ) )
+    {
+        if ( !str.empty() )
+            relays.push_back ( str );
     }
-	return relays;
+
+    return relays;
 }
 
-static const vector<IpAddrPort> relayServers = loadRelays();
+// Relay servers ranked best first, also accessed from the probing thread
+static Mutex relayMutex;
+static vector<RelayProber::Result> rankedRelays;
+static bool relaysLoaded = false;
+
+static vector<RelayProber::Result> getRelays()
+{
+    LOCK ( relayMutex );
+
+    if ( !relaysLoaded )
+    {
+        vector<RelayProber::Result> cached;
+        RelayProber::load ( RELAY_CACHE, cached );
+
+        rankedRelays = RelayProber::order ( loadRelays(), cached );
+        relaysLoaded = true;
+    }
+
+    return rankedRelays;
+}
 
 /* Tunnel protocol
 
@@ -147,8 +174,8 @@ SmartSocket::SmartSocket ( Owner *owner, uint16_t port, Socket::Protocol protoco
 
     _state = State::Listening;
 
-    _vpsAddress = relayServers.cbegin();
-    _vpsSocket = TcpSocket::connect ( this, *_vpsAddress, true ); // Raw socket
+    _relays = getRelays();
+    connectRelay ( 0 );
 
     try
     {
@@ -180,10 +207,11 @@ SmartSocket::SmartSocket ( Owner *owner, const IpAddrPort& address, Socket::Prot
 
     _state = State::Connecting;
 
+    _relays = getRelays();
+
     if ( forceTun )
     {
-        _vpsAddress = relayServers.cbegin();
-        _vpsSocket = TcpSocket::connect ( this, *_vpsAddress, true );
+        connectRelay ( 0 );
         return;
     }
 
@@ -276,8 +304,7 @@ void SmartSocket::socketDisconnected ( Socket *socket )
 
         _directSocket.reset();
 
-        _vpsAddress = relayServers.cbegin();
-        _vpsSocket = TcpSocket::connect ( this, *_vpsAddress, true ); // Raw socket
+        connectRelay ( 0 );
 
         if ( owner )
             ( ( SmartSocket::Owner * ) owner )->smartSocketSwitchedToUDP ( this );
@@ -297,18 +324,11 @@ void SmartSocket::socketDisconnected ( Socket *socket )
     {
         LOG_SMART_SOCKET ( this, "vpsSocket disconnected" );
 
-        ASSERT ( _vpsAddress != relayServers.cend() );
-
-        ++_vpsAddress;
+        // Fail over to the next best relay
+        _connectTimer.reset();
 
-        if ( _vpsAddress != relayServers.cend() )
-        {
-            _connectTimer.reset();
-            _vpsSocket = TcpSocket::connect ( this, *_vpsAddress, true ); // Raw socket
+        if ( connectRelay ( _relayIndex + 1 ) )
             return;
-        }
-
-        _vpsSocket.reset();
 
         if ( isConnected() || isServer() )
             return;
@@ -399,9 +419,9 @@ void SmartSocket::timerExpired ( Timer *timer )
                 const TunnelClient& tunClient = kv.second;
                 const UdpData data ( isClient(), tunClient.matchId );
 
-                ASSERT ( _vpsAddress != relayServers.cend() );
+                ASSERT ( _relayIndex < _relays.size() );
 
-                _tunSocket->send ( data.buffer, sizeof ( data.buffer ), *_vpsAddress );
+                _tunSocket->send ( data.buffer, sizeof ( data.buffer ), _vpsAddress );
 
                 if ( ! tunClient.address.empty() )
                     _tunSocket->send ( NullMsg, tunClient.address );
@@ -411,9 +431,9 @@ void SmartSocket::timerExpired ( Timer *timer )
         {
             const UdpData data ( isClient(), _matchId );
 
-            ASSERT ( _vpsAddress != relayServers.cend() );
+            ASSERT ( _relayIndex < _relays.size() );
 
-            _tunSocket->send ( data.buffer, sizeof ( data.buffer ), *_vpsAddress );
+            _tunSocket->send ( data.buffer, sizeof ( data.buffer ), _vpsAddress );
 
             if ( ! _tunAddress.empty() )
                 _tunSocket->send ( NullMsg, _tunAddress );
@@ -452,6 +472,27 @@ void SmartSocket::timerExpired ( Timer *timer )
     }
 }
 
+bool SmartSocket::connectRelay ( size_t index )
+{
+    _relayIndex = index;
+
+    if ( _relayIndex >= _relays.size() )
+    {
+        _vpsSocket.reset();
+        return false;
+    }
+
+    const RelayProber::Result& relay = _relays[_relayIndex];
+    const uint64_t timeout = relay.getConnectTimeout();
+
+    LOG_SMART_SOCKET ( this, "Connecting to relay %s (%s); rtt=%.1f ms; loss=%.2f",
+                       relay.relay, relay.getAddress(), relay.rtt, relay.getLoss() );
+
+    _vpsAddress = relay.getAddress();
+    _vpsSocket = TcpSocket::connect ( this, _vpsAddress, true, timeout ? timeout : DEFAULT_CONNECT_TIMEOUT ); // Raw
+    return true;
+}
+
 void SmartSocket::gotMatch ( uint32_t matchId )
 {
     ASSERT ( matchId != 0 );
@@ -470,9 +511,9 @@ void SmartSocket::gotMatch ( uint32_t matchId )
     {
         _matchId = matchId;
 
-        ASSERT ( _vpsAddress != relayServers.cend() );
+        ASSERT ( _relayIndex < _relays.size() );
 
-        _tunSocket = UdpSocket::bind ( this, *_vpsAddress );
+        _tunSocket = UdpSocket::bind ( this, _vpsAddress );
     }
 
     if ( _sendTimer )
@@ -514,6 +555,31 @@ void SmartSocket::gotTunInfo ( uint32_t matchId, const IpAddrPort& address )
     }
 }
 
+void SmartSocket::probeRelays()
+{
+    struct ProbeThread : public Thread
+    {
+        void run() override
+        {
+            vector<string> relays;
+
+            for ( const RelayProber::Result& relay : getRelays() )
+                relays.push_back ( relay.relay );
+
+            vector<RelayProber::Result> results = RelayProber().probe ( relays );
+            RelayProber::rank ( results );
+            RelayProber::save ( RELAY_CACHE, results );
+
+            LOCK ( relayMutex );
+            rankedRelays = results;
+        }
+    };
+
+    ThreadPtr thread ( new ProbeThread() );
+    thread->start();
+    EventManager::get().addThread ( thread );
+}
+
 SocketPtr SmartSocket::listenTCP ( Owner *owner, uint16_t port )
 {
     return SocketPtr ( new SmartSocket ( owner, port, Socket::Protocol::TCP ) );
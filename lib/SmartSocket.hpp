@@ -2,6 +2,7 @@
 
 #include "Socket.hpp"
 #include "Timer.hpp"
+#include "RelayProber.hpp"
 
 #include <unordered_map>
 
@@ -31,6 +32,10 @@ public:
     static SocketPtr connectTCP ( Owner *owner, const IpAddrPort& address, bool forceTunnel = false );
     static SocketPtr connectUDP ( Owner *owner, const IpAddrPort& address, bool forceTunnel = false );
 
+    // Resolve and probe the relay servers in the background, so later sockets try the best relay first.
+    // Until this finishes, the relays are ordered by the results cached from the last session.
+    static void probeRelays();
+
     // Destructor
     ~SmartSocket() override;
 
@@ -69,8 +74,12 @@ private:
     // Socket that connects to the notification and tunnel server
     SocketPtr _vpsSocket;
 
-    // Current tunnel server to try
-    std::vector<IpAddrPort>::const_iterator _vpsAddress;
+    // Tunnel servers ranked best first when this socket was created
+    std::vector<RelayProber::Result> _relays;
+
+    // Index of the current tunnel server to try, and its address
+    size_t _relayIndex = 0;
+    IpAddrPort _vpsAddress;
 
     // Timeout for UDP tunnel match
     TimerPtr _connectTimer;
@@ -119,6 +128,9 @@ private:
     // Timer callback
     void timerExpired ( Timer *timer ) override;
 
+    // Connect to the tunnel server at the given index, returns false if there are no more servers to try
+    bool connectRelay ( size_t index );
+
     // Got a match from the tunnel server
     void gotMatch ( uint32_t matchId );
 
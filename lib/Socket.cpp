@@ -325,7 +325,7 @@ int Socket::recv ( char *buffer, size_t& len )
     return 0;
 }
 
-int Socket::recvfrom ( char *buffer, size_t& len, IpAddrPort& address )
+int Socket::recvfrom ( char *buffer, size_t& len, Endpoint& endpoint )
 {
     ASSERT ( isUDP() == true );
     ASSERT ( _fd != 0 );
@@ -339,10 +339,26 @@ int Socket::recvfrom ( char *buffer, size_t& len, IpAddrPort& address )
         return WSAGetLastError();
 
     len = recvBytes;
-    address = ( sockaddr * ) &sas;
+    endpoint = Endpoint ( ( sockaddr * ) &sas );
     return 0;
 }
 
+const IpAddrPort& Socket::getSenderAddress ( const Endpoint& endpoint )
+{
+    const auto it = _senderAddresses.find ( endpoint );
+
+    if ( it != _senderAddresses.end() )
+        return it->second;
+
+    if ( _senderAddresses.size() >= MAX_SENDER_ADDRESSES )
+        _senderAddresses.clear();
+
+    IpAddrPort address ( endpoint.getAddr(), endpoint.port );
+    address.isV4 = endpoint.isV4;
+
+    return ( _senderAddresses[endpoint] = address );
+}
+
 void Socket::resetBuffer()
 {
     _readBuffer.reserve ( READ_BUFFER_SIZE );
@@ -377,13 +393,12 @@ void Socket::socketRead()
     char *bufferStart = &_readBuffer[_readPos];
     size_t bufferLen = _readBuffer.size() - _readPos;
 
-    IpAddrPort address = getRemoteAddress();
     int error = 0;
 
     if ( isTCP() )
         error = Socket::recv ( bufferStart, bufferLen );
     else
-        error = Socket::recvfrom ( bufferStart, bufferLen, address );
+        error = Socket::recvfrom ( bufferStart, bufferLen, _readEndpoint );
 
     if ( error )
     {
@@ -409,6 +424,9 @@ void Socket::socketRead()
         return;
     }
 
+    // Copied since the callbacks below can free this socket
+    const IpAddrPort address = ( isTCP() ? getRemoteAddress() : getSenderAddress ( _readEndpoint ) );
+
 #ifndef RELEASE
     // Simulated packet loss
     if ( rand() % 100 < _packetLoss )
@@ -1,15 +1,20 @@
 #pragma once
 
 #include "IpAddrPort.hpp"
+#include "Endpoint.hpp"
 #include "GoBackN.hpp"
 #include "Enum.hpp"
 
 #include <vector>
 #include <memory>
+#include <unordered_map>
 
 
 #define DEFAULT_CONNECT_TIMEOUT ( 5000 )
 
+// Limit on the formatted UDP sender addresses kept, the cache is cleared when it's full
+#define MAX_SENDER_ADDRESSES ( 4096 )
+
 
 #define LOG_SOCKET(SOCKET, FORMAT, ...)                                                                             \
     LOG ( "%s socket=%08x; fd=%08x; state=%s; address='%s'; isRaw=%u; " FORMAT,                                     \
@@ -155,6 +160,9 @@ protected:
     // Initial connect timeout
     uint64_t _connectTimeout = DEFAULT_CONNECT_TIMEOUT;
 
+    // Binary address of the UDP packet being read, valid during socketRead ( msg, address )
+    Endpoint _readEndpoint;
+
     // Packet loss percentage for testing purposes
     uint8_t _packetLoss = 0;
 
@@ -186,7 +194,14 @@ protected:
 
     // Read raw bytes directly, 0 on success, otherwise returns the socket error code
     int recv ( char *buffer, size_t& len );
-    int recvfrom ( char *buffer, size_t& len, IpAddrPort& address );
+    int recvfrom ( char *buffer, size_t& len, Endpoint& endpoint );
+
+private:
+
+    // Formatted addresses of recent UDP senders, so each sender's address is only formatted once
+    std::unordered_map<Endpoint, IpAddrPort> _senderAddresses;
+
+    const IpAddrPort& getSenderAddress ( const Endpoint& endpoint );
 };
 
 
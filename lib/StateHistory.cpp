@@ -0,0 +1,330 @@
+#include "StateHistory.hpp"
+#include "Compression.hpp"
+#include "Logger.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+
+StateHistory::StateHistory ( size_t budget, uint32_t keyframeInterval )
+    : budget ( budget ), keyframeInterval ( max ( keyframeInterval, 1u ) )
+{
+    // The first state is a keyframe
+    _numDeltas = this->keyframeInterval;
+}
+
+StateHistory::~StateHistory()
+{
+    LOCK ( _mutex );
+
+    // The task stops after the state it's compressing, and must be done before this is destroyed
+    _stopping = true;
+
+    while ( _scheduled )
+        _cond.wait ( _mutex );
+}
+
+vector<char> StateHistory::getBuffer()
+{
+    LOCK ( _mutex );
+
+    if ( _freeBuffers.empty() )
+        return vector<char>();
+
+    vector<char> buffer;
+    buffer.swap ( _freeBuffers.back() );
+    _freeBuffers.pop_back();
+    buffer.clear();
+    return buffer;
+}
+
+void StateHistory::push ( uint64_t id, vector<char>&& state )
+{
+    {
+        LOCK ( _mutex );
+
+        if ( _lastId != UINT64_MAX && id <= _lastId )
+        {
+            LOG ( "Ignoring state %llu older than %llu", ( unsigned long long ) id, ( unsigned long long ) _lastId );
+            _freeBuffers.push_back ( move ( state ) );
+            return;
+        }
+
+        _lastId = id;
+        _queue.push_back ( Pending() );
+        _queue.back().id = id;
+        _queue.back().data = move ( state );
+
+        // The running task picks up this state too
+        if ( _scheduled )
+            return;
+
+        _scheduled = true;
+    }
+
+    // Submit without the lock, since this blocks while the pool's queue is full
+    WorkerPool::get().submit ( [this]() { compressQueued(); } );
+}
+
+bool StateHistory::restore ( uint64_t id, vector<char>& state, uint64_t& restoredId )
+{
+    LOCK ( _mutex );
+
+    // States that are not compressed yet are the newest
+    for ( auto it = _queue.rbegin(); it != _queue.rend(); ++it )
+    {
+        if ( it->id > id )
+            continue;
+
+        state = it->data;
+        restoredId = it->id;
+        return true;
+    }
+
+    if ( _compressing && _current.id <= id )
+    {
+        state = _current.data;
+        restoredId = _current.id;
+        return true;
+    }
+
+    auto it = upper_bound ( _entries.begin(), _entries.end(), id,
+                            [] ( uint64_t id, const Entry& entry ) { return id < entry.id; } );
+
+    if ( it == _entries.begin() )
+        return false;
+
+    const Entry& entry = * ( --it );
+
+    state.resize ( entry.size );
+
+    if ( entry.id == entry.keyId )
+    {
+        if ( entry.size && lzUncompress ( &entry.data[0], entry.data.size(), &state[0], entry.size ) != entry.size )
+            return false;
+
+        restoredId = entry.id;
+        return true;
+    }
+
+    if ( _restoreKeyId != entry.keyId )
+    {
+        // The keyframe is the newest keyframe at or before this entry
+        auto kt = it;
+
+        while ( kt->id != entry.keyId )
+        {
+            ASSERT ( kt != _entries.begin() );
+            --kt;
+        }
+
+        _restoreKeyId = UINT64_MAX;
+        _restoreKeyframe.resize ( kt->size );
+
+        if ( kt->size && lzUncompress ( &kt->data[0], kt->data.size(), &_restoreKeyframe[0], kt->size ) != kt->size )
+            return false;
+
+        _restoreKeyId = kt->id;
+    }
+
+    if ( entry.size && lzUncompress ( &entry.data[0], entry.data.size(), &state[0], entry.size ) != entry.size )
+        return false;
+
+    applyDelta ( _restoreKeyframe, &state[0], state.size(), &state[0] );
+
+    restoredId = entry.id;
+    return true;
+}
+
+void StateHistory::discardAfter ( uint64_t id )
+{
+    LOCK ( _mutex );
+
+    // Every queued, compressing or compressed state is at most the last id, so otherwise nothing is newer than id
+    if ( _lastId == UINT64_MAX || _lastId <= id )
+        return;
+
+    while ( !_queue.empty() && _queue.back().id > id )
+    {
+        _freeBuffers.push_back ( move ( _queue.back().data ) );
+        _queue.pop_back();
+    }
+
+    while ( !_entries.empty() && _entries.back().id > id )
+    {
+        _uncompressedSize -= _entries.back().size;
+        _compressedSize -= _entries.back().data.size();
+        _entries.pop_back();
+    }
+
+    _lastId = id;
+
+    if ( _restoreKeyId != UINT64_MAX && _restoreKeyId > id )
+        _restoreKeyId = UINT64_MAX;
+
+    _discardFrom = min ( _discardFrom, id + 1 );
+}
+
+void StateHistory::clear()
+{
+    LOCK ( _mutex );
+
+    for ( Pending& pending : _queue )
+        _freeBuffers.push_back ( move ( pending.data ) );
+
+    _queue.clear();
+    _entries.clear();
+    _uncompressedSize = _compressedSize = 0;
+    _lastId = UINT64_MAX;
+    _restoreKeyId = UINT64_MAX;
+
+    _discardFrom = 0;
+}
+
+void StateHistory::flush()
+{
+    LOCK ( _mutex );
+
+    while ( _scheduled )
+        _cond.wait ( _mutex );
+}
+
+size_t StateHistory::getNumStates() const
+{
+    LOCK ( _mutex );
+    return _entries.size();
+}
+
+size_t StateHistory::getUncompressedSize() const
+{
+    LOCK ( _mutex );
+    return _uncompressedSize;
+}
+
+size_t StateHistory::getCompressedSize() const
+{
+    LOCK ( _mutex );
+    return _compressedSize;
+}
+
+void StateHistory::compressQueued()
+{
+    Lock lock ( _mutex );
+
+    while ( !_stopping && !_queue.empty() )
+    {
+        _current = move ( _queue.front() );
+        _queue.pop_front();
+        _compressing = true;
+
+        // Start a new keyframe only if the current one was discarded
+        if ( _keyId >= _discardFrom )
+            _numDeltas = keyframeInterval;
+
+        _discardFrom = UINT64_MAX;
+
+        Entry entry;
+
+        _mutex.unlock();
+        compressCurrent ( entry );
+        _mutex.lock();
+
+        // Skip the state if it was discarded while compressing, the next state then checks the keyframe
+        if ( _current.id < _discardFrom )
+        {
+            _uncompressedSize += entry.size;
+            _compressedSize += entry.data.size();
+            _entries.push_back ( move ( entry ) );
+            evict();
+        }
+
+        _freeBuffers.push_back ( move ( _current.data ) );
+        _compressing = false;
+    }
+
+    _scheduled = false;
+    _cond.broadcast();
+}
+
+void StateHistory::compressCurrent ( Entry& entry )
+{
+    const vector<char>& state = _current.data;
+
+    const bool isKeyframe = ( _numDeltas + 1 >= keyframeInterval );
+
+    const char *src = state.data();
+
+    if ( isKeyframe )
+    {
+        _keyframe = state;
+        _keyId = _current.id;
+        _numDeltas = 0;
+    }
+    else
+    {
+        _delta.resize ( state.size() );
+        applyDelta ( _keyframe, state.data(), state.size(), _delta.data() );
+        src = _delta.data();
+        ++_numDeltas;
+    }
+
+    _compressed.resize ( lzCompressBound ( state.size() ) );
+
+    size_t size = 0;
+
+    if ( !state.empty() )
+    {
+        size = lzCompress ( src, state.size(), &_compressed[0], _compressed.size() );
+        ASSERT ( size > 0 );
+    }
+
+    entry.id = _current.id;
+    entry.keyId = _keyId;
+    entry.size = state.size();
+    entry.data.assign ( _compressed.data(), size );
+}
+
+void StateHistory::evict()
+{
+    // Drop the oldest keyframe and its deltas, but always keep the newest keyframe
+    while ( _compressedSize > budget && !_entries.empty() && _entries.front().keyId != _entries.back().keyId )
+    {
+        const uint64_t keyId = _entries.front().keyId;
+
+        while ( !_entries.empty() && _entries.front().keyId == keyId )
+        {
+            _uncompressedSize -= _entries.front().size;
+            _compressedSize -= _entries.front().data.size();
+            _entries.pop_front();
+        }
+
+        if ( _restoreKeyId == keyId )
+            _restoreKeyId = UINT64_MAX;
+    }
+}
+
+void StateHistory::applyDelta ( const vector<char>& keyframe, const char *src, size_t size, char *dst )
+{
+    const size_t common = min ( size, keyframe.size() );
+    const char *key = keyframe.data();
+
+    size_t i = 0;
+
+    for ( ; i + 8 <= common; i += 8 )
+    {
+        uint64_t a, b;
+        memcpy ( &a, src + i, 8 );
+        memcpy ( &b, key + i, 8 );
+        a ^= b;
+        memcpy ( dst + i, &a, 8 );
+    }
+
+    for ( ; i < common; ++i )
+        dst[i] = src[i] ^ key[i];
+
+    // Bytes past the end of the keyframe are stored as is
+    if ( dst != src && size > common )
+        memcpy ( dst + common, src + common, size - common );
+}
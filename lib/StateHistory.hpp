@@ -0,0 +1,117 @@
+#pragma once
+
+#include "Thread.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+
+// Compressed history of states older than the rollback states, for long rewinds in training mode and replays.
+// States are XOR delta encoded against the last keyframe, then compressed on the shared WorkerPool. Restoring any
+// state takes at most two decompressions. The oldest keyframe and its deltas are dropped to stay within budget.
+class StateHistory
+{
+public:
+
+    // Memory budget of the compressed states in bytes
+    const size_t budget;
+
+    // Number of states per keyframe, including the keyframe
+    const uint32_t keyframeInterval;
+
+    StateHistory ( size_t budget, uint32_t keyframeInterval = 60 );
+    ~StateHistory();
+
+    // Get an empty buffer to fill with a state, buffers are recycled after compression
+    std::vector<char> getBuffer();
+
+    // Queue a state to be compressed, ids must be increasing, older ids are ignored
+    void push ( uint64_t id, std::vector<char>&& state );
+
+    // Restore the newest state with an id less than or equal to the given id, returns false if there is none
+    bool restore ( uint64_t id, std::vector<char>& state, uint64_t& restoredId );
+
+    // Discard all states newer than the given id, ie after restoring an older state
+    void discardAfter ( uint64_t id );
+
+    // Discard all states
+    void clear();
+
+    // Block until all queued states are compressed
+    void flush();
+
+    // Number of compressed states, and the total size of these states before and after compression
+    size_t getNumStates() const;
+    size_t getUncompressedSize() const;
+    size_t getCompressedSize() const;
+
+private:
+
+    struct Entry
+    {
+        uint64_t id = 0, keyId = 0;
+
+        // Size of the state before compression
+        size_t size = 0;
+
+        // Compressed state, or compressed delta if id != keyId
+        std::string data;
+    };
+
+    struct Pending
+    {
+        uint64_t id = 0;
+
+        std::vector<char> data;
+    };
+
+    mutable Mutex _mutex;
+
+    CondVar _cond;
+
+    bool _stopping = false;
+
+    // A task that compresses the queued states is submitted to the WorkerPool, at most one at a time so the states
+    // are compressed in order, guarded by _mutex
+    bool _scheduled = false;
+
+    // Compressed states in order, guarded by _mutex
+    std::deque<Entry> _entries;
+
+    // States waiting to be compressed in order, and the state being compressed, guarded by _mutex
+    std::deque<Pending> _queue;
+    Pending _current;
+    bool _compressing = false;
+
+    // States with this id or newer were discarded since the compression task last checked, UINT64_MAX if none were.
+    // The task starts a new keyframe if its keyframe was discarded, and drops the state it's compressing if that was.
+    uint64_t _discardFrom = UINT64_MAX;
+
+    // Last id pushed
+    uint64_t _lastId = UINT64_MAX;
+
+    size_t _uncompressedSize = 0, _compressedSize = 0;
+
+    std::vector<std::vector<char>> _freeBuffers;
+
+    // Only used by the compression task: the last keyframe and how many states are delta encoded against it
+    std::vector<char> _keyframe, _delta, _compressed;
+    uint64_t _keyId = 0;
+    uint32_t _numDeltas = 0;
+
+    // Only used when restoring: the last decompressed keyframe
+    std::vector<char> _restoreKeyframe;
+    uint64_t _restoreKeyId = UINT64_MAX;
+
+    // Compress the queued states until there are none left, runs on the WorkerPool
+    void compressQueued();
+
+    // Compress the current state without holding the lock
+    void compressCurrent ( Entry& entry );
+
+    void evict();
+
+    static void applyDelta ( const std::vector<char>& keyframe, const char *src, size_t size, char *dst );
+};
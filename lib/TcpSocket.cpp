@@ -128,7 +128,8 @@ bool TcpSocket::send ( SerializableSequence *message, const IpAddrPort& address
 
 bool TcpSocket::send ( const MsgPtr& msg, const IpAddrPort& address )
 {
-    const string buffer = ::Protocol::encode ( msg );
+    ::Protocol::encode ( msg, _encodeBuffer );
+    const string& buffer = _encodeBuffer;
 
     LOG ( "Encoded '%s' to [ %u bytes ]", msg, buffer.size() );
 
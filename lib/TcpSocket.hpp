@@ -47,6 +47,9 @@ private:
     // Timeout for initial connect
     TimerPtr _connectTimer;
 
+    // Reused for encoding every sent message
+    std::string _encodeBuffer;
+
     // Timer callback
     void timerExpired ( Timer *timer ) override;
 
@@ -1,4 +1,14 @@
 #include "Thread.hpp"
+#include "BlockingQueue.hpp"
+
+using namespace std;
+
+
+// Max number of queued tasks in a WorkerPool
+#define WORKER_POOL_QUEUE_SIZE ( 256 )
+
+// Number of threads in the shared WorkerPool
+#define WORKER_POOL_NUM_THREADS ( 2 )
 
 
 void *Thread::func ( void *ptr )
@@ -34,3 +44,68 @@ void Thread::release()
     LOCK ( _mutex );
     _running = false;
 }
+
+
+class WorkerPool::TaskQueue : public LockFreeQueue<Task, WORKER_POOL_QUEUE_SIZE> {};
+
+WorkerPool::WorkerPool ( size_t numThreads ) : _tasks ( new TaskQueue() )
+{
+    for ( size_t i = 0; i < numThreads; ++i )
+    {
+        _workers.emplace_back ( new Worker ( *this ) );
+        _workers.back()->start();
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    // An empty task stops one worker
+    for ( size_t i = 0; i < _workers.size(); ++i )
+        _tasks->push ( Task() );
+
+    for ( const auto& worker : _workers )
+        worker->join();
+}
+
+void WorkerPool::submit ( const Task& task )
+{
+    if ( !task )
+        return;
+
+    ++_pending;
+    _tasks->push ( task );
+}
+
+void WorkerPool::wait()
+{
+    LOCK ( _mutex );
+
+    while ( _pending > 0 )
+        _idle.wait ( _mutex );
+}
+
+WorkerPool& WorkerPool::get()
+{
+    // Never destroyed, since joining threads during static destruction can deadlock in a DLL
+    static WorkerPool *pool = new WorkerPool ( WORKER_POOL_NUM_THREADS );
+    return *pool;
+}
+
+void WorkerPool::Worker::run()
+{
+    for ( ;; )
+    {
+        const Task task = pool._tasks->pop();
+
+        if ( !task )
+            break;
+
+        task();
+
+        if ( --pool._pending == 0 )
+        {
+            Lock lock ( pool._mutex );
+            pool._idle.broadcast();
+        }
+    }
+}
@@ -3,7 +3,10 @@
 #include <sys/time.h>
 #include <pthread.h>
 
+#include <atomic>
+#include <functional>
 #include <memory>
+#include <vector>
 
 
 inline timespec gettimeoffset ( long milliseconds )
@@ -159,3 +162,52 @@ typedef std::shared_ptr<Thread> ThreadPtr;
         NAME ( CONTEXT& context ) : context ( context ) {}      \
         void run() override;                                    \
     } //
+
+
+// Shared set of worker threads for background tasks like file I/O and compression, instead of a dedicated thread
+// per task. Tasks are queued in a LockFreeQueue and run concurrently across the workers.
+class WorkerPool
+{
+public:
+
+    typedef std::function<void()> Task;
+
+    WorkerPool ( size_t numThreads );
+
+    // Finishes the queued tasks before stopping the workers
+    ~WorkerPool();
+
+    // Queue a task, blocks while the queue is full
+    void submit ( const Task& task );
+
+    // Block until all the submitted tasks are finished
+    void wait();
+
+    size_t getNumThreads() const { return _workers.size(); }
+
+    // Get the shared pool
+    static WorkerPool& get();
+
+private:
+
+    class TaskQueue;
+
+    class Worker : public Thread
+    {
+    public:
+        WorkerPool& pool;
+        Worker ( WorkerPool& pool ) : pool ( pool ) {}
+        void run() override;
+    };
+
+    std::unique_ptr<TaskQueue> _tasks;
+
+    std::vector<std::unique_ptr<Worker>> _workers;
+
+    // Number of submitted tasks that have not finished yet
+    std::atomic<size_t> _pending { 0 };
+
+    Mutex _mutex;
+
+    CondVar _idle;
+};
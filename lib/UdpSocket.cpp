@@ -92,8 +92,10 @@ UdpSocket::UdpSocket ( Socket::Owner *owner, const SocketShareData& data )
 
             for ( const auto& kv : data.childSockets )
             {
-                UdpSocket *socket = new UdpSocket ( ChildSocket, this, kv.first, kv.second );
-                _childSockets.insert ( make_pair ( socket->address, SocketPtr ( socket ) ) );
+                const Endpoint endpoint = Endpoint::parse ( kv.first.addr, kv.first.port );
+
+                UdpSocket *socket = new UdpSocket ( ChildSocket, this, kv.first, endpoint, kv.second );
+                _childSockets.insert ( make_pair ( endpoint, SocketPtr ( socket ) ) );
 
                 LOG ( "child: address='%s'; keepAlive=%d", socket->address, socket->_keepAlive );
                 socket->_gbn.logSendList();
@@ -107,20 +109,23 @@ UdpSocket::UdpSocket ( Socket::Owner *owner, const SocketShareData& data )
     SocketManager::get().add ( this );
 }
 
-UdpSocket::UdpSocket ( ChildSocketEnum, UdpSocket *parentSocket, const IpAddrPort& address )
+UdpSocket::UdpSocket ( ChildSocketEnum, UdpSocket *parentSocket, const IpAddrPort& address, const Endpoint& endpoint )
     : Socket ( 0, address, Protocol::UDP, parentSocket->_isRaw )
     , _type ( Type::Child )
     , _gbn ( this, parentSocket->getSendInterval(), parentSocket->_connectTimeout )
     , _parentSocket ( parentSocket )
+    , _endpoint ( endpoint )
 {
     _state = State::Connecting;
 }
 
-UdpSocket::UdpSocket ( ChildSocketEnum, UdpSocket *parentSocket, const IpAddrPort& address, const GoBackN& state )
+UdpSocket::UdpSocket ( ChildSocketEnum, UdpSocket *parentSocket, const IpAddrPort& address, const Endpoint& endpoint,
+                       const GoBackN& state )
     : Socket ( 0, address, Protocol::UDP, parentSocket->_isRaw )
     , _type ( Type::Child )
     , _gbn ( this, state )
     , _parentSocket ( parentSocket )
+    , _endpoint ( endpoint )
 {
     _state = State::Connected;
 }
@@ -168,7 +173,7 @@ void UdpSocket::disconnect()
     // Check and remove child from parent
     if ( _parentSocket != 0 )
     {
-        _parentSocket->_childSockets.erase ( getRemoteAddress() );
+        _parentSocket->_childSockets.erase ( _endpoint );
         _parentSocket = 0;
     }
 }
@@ -271,7 +276,8 @@ bool UdpSocket::sendRaw ( const MsgPtr& msg, const IpAddrPort& address )
     }
 #endif // NOT RELEASE
 
-    const string buffer = ::Protocol::encode ( msg );
+    ::Protocol::encode ( msg, _encodeBuffer );
+    const string& buffer = _encodeBuffer;
 
     LOG ( "Encoded '%s' to [ %u bytes ]", msg, buffer.size() );
 
@@ -316,8 +322,8 @@ void UdpSocket::goBackNRecvMsg ( GoBackN *gbn, const MsgPtr& msg )
     // this is so the GoBackN state resides in the child socket.
     if ( isChild() )
     {
-        ASSERT ( _parentSocket->_childSockets.find ( getRemoteAddress() ) != _parentSocket->_childSockets.end() );
-        ASSERT ( _parentSocket->_childSockets[getRemoteAddress()].get() == this );
+        ASSERT ( _parentSocket->_childSockets.find ( _endpoint ) != _parentSocket->_childSockets.end() );
+        ASSERT ( _parentSocket->_childSockets[_endpoint].get() == this );
 
         switch ( msg->getMsgType() )
         {
@@ -337,7 +343,7 @@ void UdpSocket::goBackNRecvMsg ( GoBackN *gbn, const MsgPtr& msg )
 
                             LOG_UDP_SOCKET ( this, "socketAccepted" );
 
-                            _parentSocket->_acceptedSocket = _parentSocket->_childSockets[getRemoteAddress()];
+                            _parentSocket->_acceptedSocket = _parentSocket->_childSockets[_endpoint];
 
                             _gbn.setKeepAlive ( _keepAlive );
 
@@ -472,7 +478,7 @@ void UdpSocket::socketReadAddressed ( const MsgPtr& msg, const IpAddrPort& addre
 {
     UdpSocket *socket;
 
-    const auto it = _childSockets.find ( address );
+    const auto it = _childSockets.find ( _readEndpoint );
     if ( it != _childSockets.end() )
     {
         // Get the existing child socket
@@ -483,8 +489,8 @@ void UdpSocket::socketReadAddressed ( const MsgPtr& msg, const IpAddrPort& addre
               && msg->getAs<UdpControl>().value == UdpControl::ConnectRequest )
     {
         // Only a connect request is allowed to open a new child socket
-        socket = new UdpSocket ( ChildSocket, this, address );
-        _childSockets.insert ( make_pair ( address, SocketPtr ( socket ) ) );
+        socket = new UdpSocket ( ChildSocket, this, address, _readEndpoint );
+        _childSockets.insert ( make_pair ( _readEndpoint, SocketPtr ( socket ) ) );
     }
     else
     {
@@ -531,10 +537,10 @@ MsgPtr UdpSocket::share ( int processId )
 
             for ( const auto& kv : _childSockets )
             {
-                LOG ( "child: address='%s'; keepAlive=%d", kv.first, kv.second->getAsUDP()._keepAlive );
+                LOG ( "child: address='%s'; keepAlive=%d", kv.second->address, kv.second->getAsUDP()._keepAlive );
                 kv.second->getAsUDP()._gbn.logSendList();
 
-                data->getAs<SocketShareData>().childSockets[kv.first] = kv.second->getAsUDP()._gbn;
+                data->getAs<SocketShareData>().childSockets[kv.second->address] = kv.second->getAsUDP()._gbn;
                 kv.second->getAsUDP()._gbn.reset(); // Reset to stop the GoBackN timers from firing
             }
             break;
@@ -59,8 +59,8 @@ public:
     // If this is a connection-based UDP socket
     bool isConnectionBased() const { return ( _type == Type::Client || _type == Type::Child ); }
 
-    // Get the map of address to child socket
-    std::unordered_map<IpAddrPort, SocketPtr>& getChildSockets() { return _childSockets; }
+    // Get the map of binary address to child socket
+    std::unordered_map<Endpoint, SocketPtr>& getChildSockets() { return _childSockets; }
 
     // Get the data needed to share this socket with another process.
     // Child UDP sockets CANNOT be shared, the parent SocketShareData contains all the child sockets.
@@ -111,12 +111,18 @@ private:
     // Parent socket
     UdpSocket *_parentSocket = 0;
 
-    // Child sockets
-    std::unordered_map<IpAddrPort, SocketPtr> _childSockets;
+    // Child sockets, keyed by the binary address of the packets received from them
+    std::unordered_map<Endpoint, SocketPtr> _childSockets;
+
+    // Key of this child socket in the parent
+    Endpoint _endpoint;
 
     // Currently accepted socket
     SocketPtr _acceptedSocket;
 
+    // Reused for encoding every sent message
+    std::string _encodeBuffer;
+
     // Socket read event callback
     void socketRead ( const MsgPtr& msg, const IpAddrPort& address ) override;
 
@@ -126,7 +132,7 @@ private:
     void goBackNRecvMsg ( GoBackN *gbn, const MsgPtr& msg ) override;
     void goBackNTimeout ( GoBackN *gbn ) override;
 
-    // Callback into the correctly addressed socket
+    // Callback into the child socket addressed by _readEndpoint
     void socketReadAddressed ( const MsgPtr& msg, const IpAddrPort& address );
 
     // Send a protocol message directly, not over GoBackN
@@ -143,8 +149,9 @@ private:
     UdpSocket ( Socket::Owner *owner, const SocketShareData& data );
 
     // Construct a child socket from the parent socket
-    UdpSocket ( ChildSocketEnum, UdpSocket *parentSocket, const IpAddrPort& address );
+    UdpSocket ( ChildSocketEnum, UdpSocket *parentSocket, const IpAddrPort& address, const Endpoint& endpoint );
 
     // Construct a child socket from GoBackN state
-    UdpSocket ( ChildSocketEnum, UdpSocket *parentSocket, const IpAddrPort& address, const GoBackN& state );
+    UdpSocket ( ChildSocketEnum, UdpSocket *parentSocket, const IpAddrPort& address, const Endpoint& endpoint,
+                const GoBackN& state );
 };
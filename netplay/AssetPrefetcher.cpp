@@ -0,0 +1,241 @@
+#include "AssetPrefetcher.hpp"
+#include "Logger.hpp"
+
+#include <sys/stat.h>
+#include <dirent.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+
+using namespace std;
+
+
+#define TRIAL_FILE_SUFFIX ".txt"
+
+
+static bool readFile ( const string& path, string& data )
+{
+    FILE *file = fopen ( path.c_str(), "rb" );
+
+    if ( !file )
+        return false;
+
+    data.clear();
+
+    char buffer[4096];
+    size_t len;
+
+    while ( ( len = fread ( buffer, 1, sizeof ( buffer ), file ) ) > 0 )
+        data.append ( buffer, len );
+
+    const bool success = !ferror ( file );
+    fclose ( file );
+    return success;
+}
+
+static void loadTrialFiles ( const string& folder, AssetPrefetcher::TrialFiles& files )
+{
+    DIR *dir = opendir ( folder.c_str() );
+
+    if ( !dir )
+        return;
+
+    vector<string> names;
+
+    while ( dirent *entry = readdir ( dir ) )
+    {
+        const string name = entry->d_name;
+        const size_t suffixLen = sizeof ( TRIAL_FILE_SUFFIX ) - 1;
+
+        if ( name.size() <= suffixLen || name.compare ( name.size() - suffixLen, suffixLen, TRIAL_FILE_SUFFIX ) != 0 )
+            continue;
+
+        struct stat st;
+
+        if ( stat ( ( folder + "/" + name ).c_str(), &st ) != 0 || !S_ISREG ( st.st_mode ) )
+            continue;
+
+        names.push_back ( name );
+    }
+
+    closedir ( dir );
+
+    // Same order as listing the folder with FindFirstFile on NTFS, which compares the names in upper case
+    sort ( names.begin(), names.end(), [] ( const string& a, const string& b )
+    {
+        return lexicographical_compare ( a.begin(), a.end(), b.begin(), b.end(), [] ( char x, char y )
+        {
+            return toupper ( ( unsigned char ) x ) < toupper ( ( unsigned char ) y );
+        } );
+    } );
+
+    for ( const string& name : names )
+    {
+        files.push_back ( { name, "" } );
+
+        if ( !readFile ( folder + "/" + name, files.back().data ) )
+        {
+            LOG ( "Failed to read '%s/%s'", folder, name );
+            files.pop_back();
+        }
+    }
+}
+
+
+AssetPrefetcher::AssetPrefetcher()
+{
+    for ( auto& slot : _palettes )
+        slot = 0;
+
+    for ( auto& slot : _trials )
+        slot = 0;
+
+    for ( auto& queued : _queued )
+        queued = false;
+}
+
+AssetPrefetcher::~AssetPrefetcher()
+{
+    stop();
+
+    for ( auto& slot : _palettes )
+        delete slot.exchange ( 0 );
+
+    for ( auto& slot : _trials )
+        delete slot.exchange ( 0 );
+}
+
+void AssetPrefetcher::prefetch ( uint32_t chara, const char *charaName, uint32_t moon )
+{
+    if ( chara >= NUM_CHARAS || moon >= NUM_MOONS || !charaName || !charaName[0] )
+        return;
+
+    const size_t index = moon * NUM_CHARAS + chara;
+
+    if ( _palettes[chara].load ( memory_order_acquire ) && _trials[index].load ( memory_order_acquire ) )
+        return;
+
+    if ( _queued[index].exchange ( true ) )
+        return;
+
+    LOG ( "chara=[%u]%s; moon=%u", chara, charaName, moon );
+
+    Job job;
+    job.chara = chara;
+    job.moon = moon;
+    job.charaName = charaName;
+
+    {
+        LOCK ( _mutex );
+        ++_pending;
+        _jobs.push_back ( job );
+
+        // The running task picks up this load too
+        if ( _scheduled )
+            return;
+
+        _scheduled = true;
+    }
+
+    // Submit without the lock, since this blocks while the pool's queue is full
+    WorkerPool::get().submit ( [this]() { runJobs(); } );
+}
+
+unique_ptr<AssetPrefetcher::Palettes> AssetPrefetcher::takePalettes ( uint32_t chara )
+{
+    if ( chara >= NUM_CHARAS )
+        return 0;
+
+    return unique_ptr<Palettes> ( _palettes[chara].exchange ( 0, memory_order_acquire ) );
+}
+
+unique_ptr<AssetPrefetcher::TrialFiles> AssetPrefetcher::takeTrials ( uint32_t chara, uint32_t moon )
+{
+    if ( chara >= NUM_CHARAS || moon >= NUM_MOONS )
+        return 0;
+
+    return unique_ptr<TrialFiles> ( _trials[moon * NUM_CHARAS + chara].exchange ( 0, memory_order_acquire ) );
+}
+
+void AssetPrefetcher::flush()
+{
+    LOCK ( _mutex );
+
+    while ( _pending > 0 || _scheduled )
+        _idle.wait ( _mutex );
+}
+
+void AssetPrefetcher::stop()
+{
+    // The task must be done before this is destroyed
+    flush();
+}
+
+string AssetPrefetcher::getTrialFolder ( const string& trialsFolder, const string& charaName, uint32_t moon )
+{
+    static const char MoonLetters[NUM_MOONS] = { 'C', 'F', 'H' };
+
+    string folder = trialsFolder;
+
+    if ( moon < NUM_MOONS )
+        folder += MoonLetters[moon];
+
+    return folder + "-" + charaName;
+}
+
+AssetPrefetcher& AssetPrefetcher::get()
+{
+    static AssetPrefetcher instance;
+    return instance;
+}
+
+void AssetPrefetcher::runJobs()
+{
+    Lock lock ( _mutex );
+
+    while ( !_jobs.empty() )
+    {
+        vector<Job> jobs;
+        jobs.swap ( _jobs );
+
+        _mutex.unlock();
+
+        for ( const Job& job : jobs )
+            runJob ( job );
+
+        _mutex.lock();
+    }
+
+    _scheduled = false;
+    _idle.broadcast();
+}
+
+void AssetPrefetcher::runJob ( const Job& job )
+{
+    const size_t index = job.moon * NUM_CHARAS + job.chara;
+
+    // Only one task runs at a time and only it publishes, so an empty slot can't be filled concurrently
+    if ( !_palettes[job.chara].load ( memory_order_acquire ) )
+    {
+        unique_ptr<Palettes> palettes ( new Palettes() );
+        palettes->loaded = palettes->palMan.loadOverrides ( palettesFolder, job.charaName );
+
+        delete _palettes[job.chara].exchange ( palettes.release(), memory_order_release );
+    }
+
+    if ( !_trials[index].load ( memory_order_acquire ) )
+    {
+        unique_ptr<TrialFiles> trials ( new TrialFiles() );
+        loadTrialFiles ( getTrialFolder ( trialsFolder, job.charaName, job.moon ), *trials );
+
+        delete _trials[index].exchange ( trials.release(), memory_order_release );
+    }
+
+    _queued[index] = false;
+
+    LOCK ( _mutex );
+
+    if ( --_pending == 0 )
+        _idle.broadcast();
+}
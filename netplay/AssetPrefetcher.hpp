@@ -0,0 +1,105 @@
+#pragma once
+
+#include "Thread.hpp"
+#include "PaletteManager.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+#define NUM_CHARAS  ( 256 )
+#define NUM_MOONS   ( 3 )
+
+
+// Loads palettes and trial files on the shared WorkerPool while the cursors move during character select,
+// so the game thread doesn't touch the disk when the game actually requests them during Loading.
+// Results are handed over through per-character atomic slots, so taking them never blocks.
+class AssetPrefetcher
+{
+public:
+
+    // Palette overrides of one character, loaded before the original colors are known
+    struct Palettes
+    {
+        // False if there is no palettes file for this character
+        bool loaded = false;
+
+        PaletteManager palMan;
+    };
+
+    // Contents of one trial file
+    struct TrialFile
+    {
+        std::string name, data;
+    };
+
+    typedef std::vector<TrialFile> TrialFiles;
+
+    // Folders to load from, ie ProcessManager::appDir + PALETTES_FOLDER and "cccaster/trials/".
+    // These must be set before the first prefetch.
+    std::string palettesFolder, trialsFolder;
+
+    AssetPrefetcher();
+    ~AssetPrefetcher();
+
+    // Queue loading the assets of a character, cheap enough to call every frame.
+    // Does nothing if the assets are already loaded or queued.
+    void prefetch ( uint32_t chara, const char *charaName, uint32_t moon );
+
+    // Take ownership of the loaded assets, returns null if they are not ready yet.
+    // Taking the assets clears the slot, so the next prefetch reloads them from disk.
+    std::unique_ptr<Palettes> takePalettes ( uint32_t chara );
+    std::unique_ptr<TrialFiles> takeTrials ( uint32_t chara, uint32_t moon );
+
+    // Block until all queued loads are finished
+    void flush();
+
+    // Finish the queued loads, after this nothing runs on the WorkerPool until the next prefetch
+    void stop();
+
+    // Get the trials folder of a character, ie "cccaster/trials/C-Akiha"
+    static std::string getTrialFolder ( const std::string& trialsFolder, const std::string& charaName, uint32_t moon );
+
+    // Get the singleton instance
+    static AssetPrefetcher& get();
+
+private:
+
+    struct Job
+    {
+        uint32_t chara = 0;
+
+        uint32_t moon = 0;
+
+        std::string charaName;
+    };
+
+    // Queued loads, guarded by _mutex
+    std::vector<Job> _jobs;
+
+    // A task that runs the queued loads is submitted to the WorkerPool, at most one at a time, guarded by _mutex
+    bool _scheduled = false;
+
+    // Loaded assets waiting to be taken, indexed by chara and by moon * NUM_CHARAS + chara
+    std::array<std::atomic<Palettes *>, NUM_CHARAS> _palettes;
+    std::array<std::atomic<TrialFiles *>, NUM_CHARAS * NUM_MOONS> _trials;
+
+    // Set while a load is queued or running, indexed by moon * NUM_CHARAS + chara
+    std::array<std::atomic<bool>, NUM_CHARAS * NUM_MOONS> _queued;
+
+    // Number of queued loads that have not finished yet
+    size_t _pending = 0;
+
+    Mutex _mutex;
+
+    CondVar _idle;
+
+    // Run the queued loads until there are none left, runs on the WorkerPool
+    void runJobs();
+
+    void runJob ( const Job& job );
+};
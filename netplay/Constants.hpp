@@ -1,9 +1,11 @@
 #pragma once
 
 #include <cstdint>
+#include <climits>
 #include <iostream>
 
 #include "Controller.hpp"
+#include "IndexedFrame.hpp"
 
 
 // Number of frames of inputs to send per message
@@ -19,6 +21,19 @@
 #define NUM_ROLLBACK_STATES         ( 256 )
 #endif
 
+// Memory budget of compressed states older than the rollback states, these are only kept in training mode and
+// replays, for long rewinds
+#define ROLLBACK_HISTORY_BUDGET     ( 64 * 1024 * 1024 )
+
+// Number of compressed states per keyframe, restoring a state decompresses at most its keyframe and itself
+#define ROLLBACK_HISTORY_KEYFRAMES  ( 60 )
+
+// Replay keyframes for seeking are saved next to the replay file with this suffix
+#define REPLAY_INDEX_SUFFIX         ".index"
+
+// Number of frames to seek back / forward in replays
+#define REPLAY_SEEK_FRAMES          ( 10 * 60 )
+
 
 // Game constants and addresses are prefixed CC
 #define CC_VERSION                  "1.4.0"
@@ -242,19 +257,6 @@
 #define CC_SHOW_ATTACK_DISPLAY      ( ( int * )      0x5595B8 )
 #define CC_SHOW_INPUT_DISPLAY       ( ( int * )      0x5585F8 )
 
-union IndexedFrame
-{
-    struct { uint32_t frame, index; } parts;
-    uint64_t value;
-};
-
-const IndexedFrame MaxIndexedFrame = {{ UINT_MAX, UINT_MAX }};
-
-inline std::ostream& operator<< ( std::ostream& os, const IndexedFrame& indexedFrame )
-{
-    return ( os << indexedFrame.parts.index << ':' << indexedFrame.parts.frame );
-}
-
 
 inline const char *gameModeStr ( uint32_t gameMode )
 {
@@ -0,0 +1,189 @@
+#include "DesyncDetector.hpp"
+#include "Logger.hpp"
+
+#include <algorithm>
+
+using namespace std;
+
+
+// Maximum number of states waiting to be confirmed or compared, older ones are dropped
+#define MAX_PENDING_STATES ( 600 )
+
+
+template<typename T>
+static void trimOldest ( map<uint64_t, T>& states )
+{
+    while ( states.size() > MAX_PENDING_STATES )
+        states.erase ( states.begin() );
+}
+
+
+uint64_t DesyncDetector::combine ( const vector<uint64_t>& regionHashes )
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+
+    for ( uint64_t regionHash : regionHashes )
+    {
+        hash ^= regionHash;
+        hash *= 0x100000001B3ULL;
+        hash ^= hash >> 29;
+    }
+
+    return hash;
+}
+
+void DesyncDetector::record ( uint64_t indexedFrame, const vector<uint64_t>& regionHashes )
+{
+    _recorded[indexedFrame] = regionHashes;
+
+    trimOldest ( _recorded );
+}
+
+void DesyncDetector::rewind ( uint64_t indexedFrame )
+{
+    _recorded.erase ( _recorded.upper_bound ( indexedFrame ), _recorded.end() );
+}
+
+void DesyncDetector::confirm ( uint64_t indexedFrame, uint64_t rollbackFrame )
+{
+    // The state at the rollback frame itself is kept when rewinding, so it can be confirmed
+    const auto end = _recorded.upper_bound ( min ( indexedFrame, rollbackFrame ) );
+
+    if ( end == _recorded.begin() )
+        return;
+
+    for ( auto it = _recorded.begin(); it != end; ++it )
+    {
+        _outgoingFrames.push_back ( it->first );
+        _outgoingHashes.push_back ( combine ( it->second ) );
+        _confirmed[it->first].swap ( it->second );
+    }
+
+    _recorded.erase ( _recorded.begin(), end );
+
+    trimOldest ( _confirmed );
+
+    compare();
+}
+
+bool DesyncDetector::popOutgoing ( vector<uint64_t>& frames, vector<uint64_t>& hashes )
+{
+    if ( _outgoingFrames.empty() )
+        return false;
+
+    frames.clear();
+    hashes.clear();
+    frames.swap ( _outgoingFrames );
+    hashes.swap ( _outgoingHashes );
+    return true;
+}
+
+bool DesyncDetector::popOutgoingRegions ( uint64_t& indexedFrame, vector<uint64_t>& regionHashes )
+{
+    if ( !_desynced || _regionsSent )
+        return false;
+
+    indexedFrame = _divergentFrame;
+    regionHashes = _divergentRegions;
+    _regionsSent = true;
+    return true;
+}
+
+void DesyncDetector::receive ( const vector<uint64_t>& frames, const vector<uint64_t>& hashes )
+{
+    if ( frames.size() != hashes.size() )
+    {
+        LOG ( "Invalid state hashes: %u frames, %u hashes", ( uint32_t ) frames.size(), ( uint32_t ) hashes.size() );
+        return;
+    }
+
+    for ( size_t i = 0; i < frames.size(); ++i )
+        _remote[frames[i]] = hashes[i];
+
+    trimOldest ( _remote );
+
+    compare();
+}
+
+void DesyncDetector::receiveRegions ( uint64_t indexedFrame, const vector<uint64_t>& regionHashes )
+{
+    _remoteRegionsFrame = indexedFrame;
+    _remoteRegions = regionHashes;
+
+    localise();
+}
+
+void DesyncDetector::clear()
+{
+    Owner *owner = this->owner;
+    *this = DesyncDetector();
+    this->owner = owner;
+}
+
+void DesyncDetector::compare()
+{
+    // Both sides confirm frames in order, so a frame older than the other side's oldest will never be matched
+    while ( !_desynced && !_confirmed.empty() && !_remote.empty() )
+    {
+        const auto local = _confirmed.begin();
+        const auto remote = _remote.begin();
+
+        if ( local->first < remote->first )
+        {
+            _confirmed.erase ( local );
+            continue;
+        }
+
+        if ( remote->first < local->first )
+        {
+            _remote.erase ( remote );
+            continue;
+        }
+
+        if ( combine ( local->second ) != remote->second )
+        {
+            _desynced = true;
+            _divergentFrame = local->first;
+            _divergentRegions.swap ( local->second );
+
+            LOG ( "Desync at [%u:%u]: local=%016llx; remote=%016llx",
+                  ( uint32_t ) ( _divergentFrame >> 32 ), ( uint32_t ) _divergentFrame,
+                  ( unsigned long long ) combine ( _divergentRegions ), ( unsigned long long ) remote->second );
+
+            _confirmed.clear();
+            _remote.clear();
+
+            localise();
+            return;
+        }
+
+        _confirmed.erase ( local );
+        _remote.erase ( remote );
+    }
+}
+
+void DesyncDetector::localise()
+{
+    if ( !_desynced || _reported || _remoteRegionsFrame != _divergentFrame )
+        return;
+
+    _reported = true;
+
+    if ( _remoteRegions.size() == _divergentRegions.size() )
+    {
+        for ( size_t i = 0; i < _divergentRegions.size(); ++i )
+        {
+            if ( _divergentRegions[i] == _remoteRegions[i] )
+                continue;
+
+            _divergentRegion = i;
+            break;
+        }
+    }
+
+    LOG ( "Desync at [%u:%u]: region=%d",
+          ( uint32_t ) ( _divergentFrame >> 32 ), ( uint32_t ) _divergentFrame, _divergentRegion );
+
+    if ( owner )
+        owner->desyncDetected ( this, _divergentFrame, _divergentRegion );
+}
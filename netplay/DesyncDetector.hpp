@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+
+// Compares full state hashes of confirmed frames with the remote, to find the first frame where the game states
+// diverged, and which MemDump region differs. Hashes are computed by DllRollbackManager when saving each state.
+// Frames are identified by IndexedFrame::value, so this doesn't depend on the netplay headers.
+class DesyncDetector
+{
+public:
+
+    struct Owner
+    {
+        // Called once when the states first diverge. The region is the index of the first region that differs,
+        // or -1 if the regions don't match up, ie the remote has a different memory layout.
+        virtual void desyncDetected ( DesyncDetector *detector, uint64_t indexedFrame, int region ) = 0;
+    };
+
+    Owner *owner = 0;
+
+    // Combine the region hashes into the hash of the whole state
+    static uint64_t combine ( const std::vector<uint64_t>& regionHashes );
+
+    // Record the region hashes of the state saved at the start of a frame
+    void record ( uint64_t indexedFrame, const std::vector<uint64_t>& regionHashes );
+
+    // Forget the states recorded after the given frame, ie after rolling back to it
+    void rewind ( uint64_t indexedFrame );
+
+    // Confirm the states recorded up to and including the given frame, ie once the remote inputs are known.
+    // States after a pending rollback frame were simulated with mispredicted inputs, so they are never confirmed.
+    void confirm ( uint64_t indexedFrame, uint64_t rollbackFrame = UINT64_MAX );
+
+    // Take the confirmed frames and their hashes to send to the remote, returns false if there are none
+    bool popOutgoing ( std::vector<uint64_t>& frames, std::vector<uint64_t>& hashes );
+
+    // Take the region hashes of the divergent frame to send to the remote, returns false if there are none
+    bool popOutgoingRegions ( uint64_t& indexedFrame, std::vector<uint64_t>& regionHashes );
+
+    // Receive confirmed frames and their hashes from the remote
+    void receive ( const std::vector<uint64_t>& frames, const std::vector<uint64_t>& hashes );
+
+    // Receive the region hashes of the divergent frame from the remote
+    void receiveRegions ( uint64_t indexedFrame, const std::vector<uint64_t>& regionHashes );
+
+    // True once a divergent frame has been found
+    bool isDesynced() const { return _desynced; }
+
+    // Get the first divergent frame, and the first region that differs, -1 if not known yet
+    uint64_t getDivergentFrame() const { return _divergentFrame; }
+    int getDivergentRegion() const { return _divergentRegion; }
+
+    // Clear all state
+    void clear();
+
+private:
+
+    // Recorded states that may still be rolled back, indexed by IndexedFrame::value
+    std::map<uint64_t, std::vector<uint64_t>> _recorded;
+
+    // Confirmed states waiting to be compared with the remote
+    std::map<uint64_t, std::vector<uint64_t>> _confirmed;
+
+    // Confirmed frames and hashes waiting to be sent
+    std::vector<uint64_t> _outgoingFrames, _outgoingHashes;
+
+    // Remote hashes waiting to be compared
+    std::map<uint64_t, uint64_t> _remote;
+
+    // Region hashes of the divergent frame
+    std::vector<uint64_t> _divergentRegions;
+
+    // Remote region hashes that arrived before the divergent frame was found locally
+    std::vector<uint64_t> _remoteRegions;
+
+    uint64_t _divergentFrame = UINT64_MAX, _remoteRegionsFrame = UINT64_MAX;
+
+    int _divergentRegion = -1;
+
+    bool _desynced = false, _regionsSent = false, _reported = false;
+
+    void compare();
+
+    void localise();
+};
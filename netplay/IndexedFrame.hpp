@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+#include <climits>
+#include <iostream>
+
+
+union IndexedFrame
+{
+    struct { uint32_t frame, index; } parts;
+    uint64_t value;
+};
+
+const IndexedFrame MaxIndexedFrame = {{ UINT_MAX, UINT_MAX }};
+
+inline std::ostream& operator<< ( std::ostream& os, const IndexedFrame& indexedFrame )
+{
+    return ( os << indexedFrame.parts.index << ':' << indexedFrame.parts.frame );
+}
@@ -1,6 +1,6 @@
 #pragma once
 
-#include "Constants.hpp"
+#include "IndexedFrame.hpp"
 #include "Logger.hpp"
 
 #include <vector>
@@ -412,6 +412,42 @@ struct SyncHash : public SerializableSequence
         ar ( buffer );
         memcpy ( &chara[1], buffer, sizeof ( CharaHash ) );
     }
+
+    bool saveFlat ( FlatWriter& writer ) const override
+    {
+        writer.save ( indexedFrame.value, hash, roundTimer, realTimer, cameraX, cameraY );
+        writer.writeBytes ( &chara[0], sizeof ( CharaHash ) );
+        writer.writeBytes ( &chara[1], sizeof ( CharaHash ) );
+        return true;
+    }
+
+    bool loadFlat ( FlatReader& reader ) override
+    {
+        reader.load ( indexedFrame.value, hash, roundTimer, realTimer, cameraX, cameraY );
+        reader.readBytes ( &chara[0], sizeof ( CharaHash ) );
+        reader.readBytes ( &chara[1], sizeof ( CharaHash ) );
+        return true;
+    }
+};
+
+
+struct StateHashes : public SerializableSequence
+{
+    // Indexed frames and full state hashes of confirmed frames, in order
+    std::vector<uint64_t> frames, hashes;
+
+    // Per region hashes of the first divergent frame, empty unless a desync was detected
+    IndexedFrame regionsFrame = {{ 0, 0 }};
+
+    std::vector<uint64_t> regionHashes;
+
+    std::string str() const override
+    {
+        return format ( "StateHashes[%u,%s,%u]",
+                        ( uint32_t ) frames.size(), regionsFrame, ( uint32_t ) regionHashes.size() );
+    }
+
+    PROTOCOL_MESSAGE_BOILERPLATE ( StateHashes, frames, hashes, regionsFrame.value, regionHashes )
 };
 
 
@@ -2,6 +2,10 @@
 #include "StringUtils.hpp"
 #include "Algorithms.hpp"
 
+#include <sys/stat.h>
+
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 
@@ -10,6 +14,51 @@ using namespace std;
 
 #define PALETTES_FILE_SUFFIX "_palettes.txt"
 
+#define PALETTES_CACHE_SUFFIX "_palettes.cache"
+
+#define PALETTES_CACHE_MAGIC "CCPC"
+
+#define PALETTES_CACHE_VERSION ( 1 )
+
+
+// 4 colors at a time, GCC generates SIMD code for this when the target supports it, otherwise plain 32-bit ops
+typedef uint32_t Color4 __attribute__ ( ( vector_size ( 16 ) ) );
+
+// Expanded lane masks for each combination of 4 mask bits
+static const Color4 LaneMasks[16] =
+{
+#define LANE(B) ( ( B ) ? 0xFFFFFFFFu : 0u )
+#define LANES(N) { LANE ( N & 1 ), LANE ( N & 2 ), LANE ( N & 4 ), LANE ( N & 8 ) }
+    LANES ( 0 ), LANES ( 1 ), LANES ( 2 ), LANES ( 3 ), LANES ( 4 ), LANES ( 5 ), LANES ( 6 ), LANES ( 7 ),
+    LANES ( 8 ), LANES ( 9 ), LANES ( 10 ), LANES ( 11 ), LANES ( 12 ), LANES ( 13 ), LANES ( 14 ), LANES ( 15 ),
+#undef LANES
+#undef LANE
+};
+
+// Masked blend of one palette: keep the alpha of the destination, and use either the override or original color
+static void blendPalette ( uint32_t *dst, const uint32_t *overrides, const uint32_t *originals, const uint32_t *mask )
+{
+    const Color4 alpha = { 0xFF000000u, 0xFF000000u, 0xFF000000u, 0xFF000000u };
+    const Color4 byteMask = { 0xFFu, 0xFFu, 0xFFu, 0xFFu };
+    const Color4 greenMask = { 0xFF00u, 0xFF00u, 0xFF00u, 0xFF00u };
+
+    for ( uint32_t j = 0; j < NUM_COLORS; j += 4 )
+    {
+        Color4 d, o, g;
+        memcpy ( &d, dst + j, sizeof ( d ) );
+        memcpy ( &o, overrides + j, sizeof ( o ) );
+        memcpy ( &g, originals + j, sizeof ( g ) );
+
+        const Color4 select = LaneMasks [ ( mask[j / 32] >> ( j % 32 ) ) & 0xF ];
+        const Color4 c = ( o & select ) | ( g & ~select );
+
+        // SWAP_R_AND_B, without the alpha byte
+        d = ( d & alpha ) | ( ( c & byteMask ) << 16 ) | ( c & greenMask ) | ( ( c >> 16 ) & byteMask );
+
+        memcpy ( dst + j, &d, sizeof ( d ) );
+    }
+}
+
 
 uint32_t PaletteManager::computeHighlightColor ( uint32_t color )
 {
@@ -40,21 +89,15 @@ void PaletteManager::cache ( const uint32_t **allPaletteData )
     {
         for ( uint32_t j = 0; j < _originals[i].size(); ++j )
         {
-            _originals[i][j] = SWAP_R_AND_B ( allPaletteData[i][j] );
+            _originals[i][j] = 0xFFFFFF & SWAP_R_AND_B ( allPaletteData[i][j] );
         }
     }
 }
 
 void PaletteManager::apply ( uint32_t **allPaletteData ) const
 {
-    for ( uint32_t i = 0; i < _originals.size(); ++i )
-    {
-        for ( uint32_t j = 0; j < _originals[i].size(); ++j )
-        {
-            allPaletteData[i][j] = ( allPaletteData[i][j] & 0xFF000000 )
-                                   | ( 0xFFFFFF & SWAP_R_AND_B ( get ( i, j ) ) );
-        }
-    }
+    for ( uint32_t i = 0; i < NUM_PALETTES; ++i )
+        apply ( i, allPaletteData[i] );
 }
 
 void PaletteManager::cache ( const uint32_t *allPaletteData )
@@ -63,30 +106,24 @@ void PaletteManager::cache ( const uint32_t *allPaletteData )
     {
         for ( uint32_t j = 0; j < _originals[i].size(); ++j )
         {
-            _originals[i][j] = SWAP_R_AND_B ( allPaletteData [ i * 256 + j ] );
+            _originals[i][j] = 0xFFFFFF & SWAP_R_AND_B ( allPaletteData [ i * NUM_COLORS + j ] );
         }
     }
 }
 
 void PaletteManager::apply ( uint32_t *allPaletteData ) const
 {
-    for ( uint32_t i = 0; i < 36; ++i )
-    {
-        for ( uint32_t j = 0; j < 256; ++j )
-        {
-            allPaletteData [ i * 256 + j ] = ( allPaletteData [ i * 256 + j ] & 0xFF000000 )
-                                             | ( 0xFFFFFF & SWAP_R_AND_B ( get ( i, j ) ) );
-        }
-    }
+    for ( uint32_t i = 0; i < NUM_PALETTES; ++i )
+        apply ( i, allPaletteData + i * NUM_COLORS );
 }
 
 void PaletteManager::apply ( uint32_t paletteNumber, uint32_t *singlePaletteData ) const
 {
-    for ( uint32_t j = 0; j < 256; ++j )
-    {
-        singlePaletteData[j] = ( singlePaletteData [j] & 0xFF000000 )
-                               | ( 0xFFFFFF & SWAP_R_AND_B ( get ( paletteNumber, j ) ) );
-    }
+    if ( paletteNumber >= NUM_PALETTES )
+        return;
+
+    blendPalette ( singlePaletteData, &_overrides[paletteNumber][0], &_originals[paletteNumber][0],
+                   &_masks[paletteNumber][0] );
 }
 
 uint32_t PaletteManager::getOriginal ( uint32_t paletteNumber, uint32_t colorNumber ) const
@@ -96,22 +133,19 @@ uint32_t PaletteManager::getOriginal ( uint32_t paletteNumber, uint32_t colorNum
 
 uint32_t PaletteManager::get ( uint32_t paletteNumber, uint32_t colorNumber ) const
 {
-    const auto it = _palettes.find ( paletteNumber );
-
-    if ( it != _palettes.end() )
-    {
-        const auto jt = it->second.find ( colorNumber );
-
-        if ( jt != it->second.end() )
-            return 0xFFFFFF & jt->second;
-    }
+    if ( paletteNumber < NUM_PALETTES && colorNumber < NUM_COLORS && isSet ( paletteNumber, colorNumber ) )
+        return _overrides[paletteNumber][colorNumber];
 
     return getOriginal ( paletteNumber, colorNumber );
 }
 
 void PaletteManager::set ( uint32_t paletteNumber, uint32_t colorNumber, uint32_t color )
 {
-    _palettes[paletteNumber][colorNumber] = 0xFFFFFF & color;
+    if ( paletteNumber >= NUM_PALETTES || colorNumber >= NUM_COLORS )
+        return;
+
+    _overrides[paletteNumber][colorNumber] = 0xFFFFFF & color;
+    _masks[paletteNumber][colorNumber / 32] |= ( 1u << ( colorNumber % 32 ) );
 
 #ifndef DISABLE_SERIALIZATION
     invalidate();
@@ -120,15 +154,8 @@ void PaletteManager::set ( uint32_t paletteNumber, uint32_t colorNumber, uint32_
 
 void PaletteManager::clear ( uint32_t paletteNumber, uint32_t colorNumber )
 {
-    const auto it = _palettes.find ( paletteNumber );
-
-    if ( it != _palettes.end() )
-    {
-        it->second.erase ( colorNumber );
-
-        if ( it->second.empty() )
-            clear ( paletteNumber );
-    }
+    if ( paletteNumber < NUM_PALETTES && colorNumber < NUM_COLORS )
+        _masks[paletteNumber][colorNumber / 32] &= ~ ( 1u << ( colorNumber % 32 ) );
 
 #ifndef DISABLE_SERIALIZATION
     invalidate();
@@ -137,7 +164,8 @@ void PaletteManager::clear ( uint32_t paletteNumber, uint32_t colorNumber )
 
 void PaletteManager::clear ( uint32_t paletteNumber )
 {
-    _palettes.erase ( paletteNumber );
+    if ( paletteNumber < NUM_PALETTES )
+        _masks[paletteNumber].fill ( 0 );
 
 #ifndef DISABLE_SERIALIZATION
     invalidate();
@@ -146,7 +174,8 @@ void PaletteManager::clear ( uint32_t paletteNumber )
 
 void PaletteManager::clear()
 {
-    _palettes.clear();
+    for ( ColorMask& mask : _masks )
+        mask.fill ( 0 );
 
 #ifndef DISABLE_SERIALIZATION
     invalidate();
@@ -155,48 +184,76 @@ void PaletteManager::clear()
 
 bool PaletteManager::empty() const
 {
-    return _palettes.empty();
+    for ( const ColorMask& mask : _masks )
+        for ( uint32_t bits : mask )
+            if ( bits )
+                return false;
+
+    return true;
 }
 
 void PaletteManager::optimize()
 {
-    for ( uint32_t i = 0; i < 36; ++i )
+    for ( uint32_t i = 0; i < NUM_PALETTES; ++i )
     {
-        const auto it = _palettes.find ( i );
+        for ( uint32_t j = 0; j < NUM_COLORS; ++j )
+        {
+            if ( isSet ( i, j ) && _overrides[i][j] == _originals[i][j] )
+                _masks[i][j / 32] &= ~ ( 1u << ( j % 32 ) );
+        }
+    }
 
-        if ( it == _palettes.end() )
-            continue;
+#ifndef DISABLE_SERIALIZATION
+    invalidate();
+#endif
+}
 
-        for ( uint32_t j = 0; j < 256; ++j )
-        {
-            const auto jt = it->second.find ( j );
+map<uint32_t, map<uint32_t, uint32_t>> PaletteManager::getSparse() const
+{
+    map<uint32_t, map<uint32_t, uint32_t>> palettes;
 
-            if ( jt == it->second.end() )
-                continue;
+    for ( uint32_t i = 0; i < NUM_PALETTES; ++i )
+        for ( uint32_t j = 0; j < NUM_COLORS; ++j )
+            if ( isSet ( i, j ) )
+                palettes[i][j] = _overrides[i][j];
 
-            if ( ( 0xFFFFFF & jt->second ) != ( 0xFFFFFF & _originals[i][j] ) )
-                continue;
+    return palettes;
+}
 
-            it->second.erase ( j );
+void PaletteManager::setSparse ( const map<uint32_t, map<uint32_t, uint32_t>>& palettes )
+{
+    clear();
 
-            if ( it->second.empty() )
-            {
-                _palettes.erase ( i );
-                break;
-            }
-        }
-    }
+    for ( const auto& palette : palettes )
+        for ( const auto& kv : palette.second )
+            set ( palette.first, kv.first, kv.second );
+}
 
 #ifndef DISABLE_SERIALIZATION
-    invalidate();
-#endif
+
+// Same wire format as the old sparse map
+void PaletteManager::save ( cereal::BinaryOutputArchive& ar ) const
+{
+    ar ( getSparse() );
+}
+
+void PaletteManager::load ( cereal::BinaryInputArchive& ar )
+{
+    map<uint32_t, map<uint32_t, uint32_t>> palettes;
+    ar ( palettes );
+    setSparse ( palettes );
 }
 
+#endif // NOT DISABLE_SERIALIZATION
+
 bool PaletteManager::save ( const string& folder, const string& charaName )
 {
     optimize();
 
-    ofstream fout ( ( folder + charaName + PALETTES_FILE_SUFFIX ).c_str() );
+    const string file = folder + charaName + PALETTES_FILE_SUFFIX;
+    const string cacheFile = folder + charaName + PALETTES_CACHE_SUFFIX;
+
+    ofstream fout ( file.c_str() );
     bool good = fout.good();
 
     if ( good )
@@ -211,7 +268,9 @@ bool PaletteManager::save ( const string& folder, const string& charaName )
         fout << "# Lines starting with # are ignored"                << endl;
         fout << "#"                                                  << endl;
 
-        for ( auto it = _palettes.cbegin(); it != _palettes.cend(); ++it )
+        const auto palettes = getSparse();
+
+        for ( auto it = palettes.cbegin(); it != palettes.cend(); ++it )
         {
             fout << format ( "\n### Color %02d start ###\n", it->first + 1 ) << endl;
 
@@ -229,12 +288,21 @@ bool PaletteManager::save ( const string& folder, const string& charaName )
     }
 
     fout.close();
+
+    // Rewrite the cache for the new text file, since a save within the same second keeps the same mtime
+    struct stat st;
+
+    if ( good && stat ( file.c_str(), &st ) == 0 )
+        saveCache ( cacheFile, st.st_size, st.st_mtime );
+    else
+        remove ( cacheFile.c_str() );
+
     return good;
 }
 
-bool PaletteManager::load ( const string& folder, const string& charaName )
+bool PaletteManager::loadText ( const string& file )
 {
-    ifstream fin ( ( folder + charaName + PALETTES_FILE_SUFFIX ).c_str() );
+    ifstream fin ( file.c_str() );
     bool good = fin.good();
 
     if ( good )
@@ -264,16 +332,108 @@ bool PaletteManager::load ( const string& folder, const string& charaName )
             stringstream ss ( parts[1].substr ( 1 ) );
             ss >> hex >> color;
 
-            _palettes[paletteNumber][colorNumber] = color;
+            set ( paletteNumber, colorNumber, color );
         }
+    }
 
-        optimize();
+    fin.close();
+    return good;
+}
 
-#ifndef DISABLE_SERIALIZATION
-        invalidate();
-#endif
+bool PaletteManager::loadCache ( const string& file, uint64_t size, uint64_t mtime )
+{
+    FILE *fp = fopen ( file.c_str(), "rb" );
+
+    if ( !fp )
+        return false;
+
+    char magic[4];
+    uint32_t version;
+    uint64_t cachedSize, cachedTime;
+    array<ColorMask, NUM_PALETTES> masks;
+
+    bool good = ( fread ( magic, sizeof ( magic ), 1, fp ) == 1 )
+                && ( fread ( &version, sizeof ( version ), 1, fp ) == 1 )
+                && ( fread ( &cachedSize, sizeof ( cachedSize ), 1, fp ) == 1 )
+                && ( fread ( &cachedTime, sizeof ( cachedTime ), 1, fp ) == 1 )
+                && !memcmp ( magic, PALETTES_CACHE_MAGIC, sizeof ( magic ) )
+                && version == PALETTES_CACHE_VERSION
+                && cachedSize == size
+                && cachedTime == mtime
+                && ( fread ( &masks, sizeof ( masks ), 1, fp ) == 1 );
+
+    // Only the palettes with overrides are stored
+    for ( uint32_t i = 0; good && i < NUM_PALETTES; ++i )
+    {
+        _masks[i] = masks[i];
+
+        if ( masks[i] != ColorMask() )
+            good = ( fread ( &_overrides[i][0], sizeof ( _overrides[i] ), 1, fp ) == 1 );
     }
 
-    fin.close();
+    fclose ( fp );
+
+    if ( !good )
+        clear();
+
     return good;
 }
+
+void PaletteManager::saveCache ( const string& file, uint64_t size, uint64_t mtime ) const
+{
+    FILE *fp = fopen ( file.c_str(), "wb" );
+
+    if ( !fp )
+        return;
+
+    const uint32_t version = PALETTES_CACHE_VERSION;
+
+    bool good = ( fwrite ( PALETTES_CACHE_MAGIC, 4, 1, fp ) == 1 )
+                && ( fwrite ( &version, sizeof ( version ), 1, fp ) == 1 )
+                && ( fwrite ( &size, sizeof ( size ), 1, fp ) == 1 )
+                && ( fwrite ( &mtime, sizeof ( mtime ), 1, fp ) == 1 )
+                && ( fwrite ( &_masks, sizeof ( _masks ), 1, fp ) == 1 );
+
+    for ( uint32_t i = 0; good && i < NUM_PALETTES; ++i )
+    {
+        if ( _masks[i] != ColorMask() )
+            good = ( fwrite ( &_overrides[i][0], sizeof ( _overrides[i] ), 1, fp ) == 1 );
+    }
+
+    fclose ( fp );
+
+    if ( !good )
+        remove ( file.c_str() );
+}
+
+bool PaletteManager::load ( const string& folder, const string& charaName )
+{
+    if ( !loadOverrides ( folder, charaName ) )
+        return false;
+
+    optimize();
+    return true;
+}
+
+bool PaletteManager::loadOverrides ( const string& folder, const string& charaName )
+{
+    const string file = folder + charaName + PALETTES_FILE_SUFFIX;
+    const string cacheFile = folder + charaName + PALETTES_CACHE_SUFFIX;
+
+    struct stat st;
+
+    if ( stat ( file.c_str(), &st ) != 0 )
+        return false;
+
+    clear();
+
+    if ( !loadCache ( cacheFile, st.st_size, st.st_mtime ) )
+    {
+        if ( !loadText ( file ) )
+            return false;
+
+        saveCache ( cacheFile, st.st_size, st.st_mtime );
+    }
+
+    return true;
+}
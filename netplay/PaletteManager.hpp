@@ -11,6 +11,10 @@
 #include <string>
 
 
+#define NUM_PALETTES    ( 36 )
+#define NUM_COLORS      ( 256 )
+
+
 #define COLOR_RGB(R, G, B) \
     ( 0xFFFFFF & ( ( ( 0xFF & ( R ) ) << 16 ) | ( ( 0xFF & ( G ) ) << 8 ) | ( 0xFF & ( B ) ) ) )
 
@@ -48,15 +52,40 @@ public:
     bool save ( const std::string& folder, const std::string& charaName );
     bool load ( const std::string& folder, const std::string& charaName );
 
+    // Load only the overridden colors, this doesn't need the original colors so it can run before cache.
+    // Call optimize after cache to drop the overrides that are the same as the original colors.
+    bool loadOverrides ( const std::string& folder, const std::string& charaName );
+    void optimize();
+
 #ifndef DISABLE_SERIALIZATION
-    PROTOCOL_MESSAGE_BOILERPLATE ( PaletteManager, _palettes )
+    DECLARE_MESSAGE_BOILERPLATE ( PaletteManager )
 #endif
 
 private:
 
-    std::map<uint32_t, std::map<uint32_t, uint32_t>> _palettes;
+    // Bit mask of overridden colors per palette, bit j of word j / 32
+    typedef std::array<uint32_t, NUM_COLORS / 32> ColorMask;
 
-    std::array<std::array<uint32_t, 256>, 36> _originals;
+    std::array<ColorMask, NUM_PALETTES> _masks = {{}};
 
-    void optimize();
+    // Override colors, only valid where the mask bit is set
+    std::array<std::array<uint32_t, NUM_COLORS>, NUM_PALETTES> _overrides = {{}};
+
+    std::array<std::array<uint32_t, NUM_COLORS>, NUM_PALETTES> _originals;
+
+    bool isSet ( uint32_t paletteNumber, uint32_t colorNumber ) const
+    {
+        return ( _masks[paletteNumber][colorNumber / 32] >> ( colorNumber % 32 ) ) & 1;
+    }
+
+    // Parse the text palettes file
+    bool loadText ( const std::string& file );
+
+    // Binary cache of the parsed palettes file, keyed by the size and modification time of the text file
+    bool loadCache ( const std::string& file, uint64_t size, uint64_t mtime );
+    void saveCache ( const std::string& file, uint64_t size, uint64_t mtime ) const;
+
+    // Convert to / from the sparse format used for serialization
+    std::map<uint32_t, std::map<uint32_t, uint32_t>> getSparse() const;
+    void setSparse ( const std::map<uint32_t, std::map<uint32_t, uint32_t>>& palettes );
 };
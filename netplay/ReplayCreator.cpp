@@ -12,117 +12,189 @@
 #include <map>
 using namespace std;
 
-void ReplayCreator::dump(ReplayCreator::ReplayFile rf, char* fname) {
-    ofstream outfile;
-    outfile.open(fname, ios::binary | ios::out);
-    //cout << "dumping" << endl;
-    outfile.write((char*)&rf, 0x60);
-    //cout << rf.numRounds << endl;
-    for (int j=0; j < rf.numRounds; ++j) {
-      //cout << j << endl;
-      ReplayCreator::Round round = rf.rounds[j];
-      outfile.write((char*)&round, 0x8C);
-      outfile.write((char*)&round.lenp1Inputs, 4);
-      for (int i = 0; i < round.lenp1Inputs; ++i) {
-        ReplayCreator::Input in = round.p1Inputs[i];
-        outfile.write((char*)&round.p1Inputs[i], 6);
-      }
-      outfile.write((char*)&round.lenp2Inputs, 4);
-      for (int i = 0; i < round.lenp2Inputs; ++i) {
-        outfile.write((char*)&round.p2Inputs[i], 6);
-      }
-      outfile.write((char*)&round.lenp3Inputs, 4);
-      for (int i = 0; i < round.lenp3Inputs; ++i) {
-          outfile.write((char*)&round.p3Inputs[i], 6);
-      }
-      outfile.write((char*)&round.lenp4Inputs, 4);
-      for (int i = 0; i < round.lenp4Inputs; ++i) {
-          outfile.write((char*)&round.p4Inputs[i], 6);
-      }
-      outfile.write((char*)&round.lenRng, 4);
-      for (int i = 0; i < round.lenRng; ++i) {
-        outfile.write((char*)&round.rngstates[i], 4);
-      }
-      outfile.write((char*)&round.nine, 4*36);
+static_assert ( sizeof ( ReplayCreator::Input ) == REPLAY_INPUT_SIZE, "Input must match the .rep layout" );
+
+namespace
+{
+
+// Bounds checked cursor over an in-memory .rep file
+struct ReplayReader
+{
+    const char *data;
+    size_t len;
+    size_t pos;
+
+    bool read ( void *dst, size_t n )
+    {
+        if ( n > len - pos )
+            return false;
+
+        memcpy ( dst, data + pos, n );
+        pos += n;
+        return true;
     }
-    outfile.close();
+
+    template<typename T>
+    bool readArray ( int count, vector<T>& dst )
+    {
+        if ( count < 0 || size_t ( count ) > ( len - pos ) / sizeof ( T ) )
+            return false;
+
+        dst.resize ( count );
+
+        if ( count > 0 )
+            memcpy ( &dst[0], data + pos, count * sizeof ( T ) );
+
+        pos += count * sizeof ( T );
+        return true;
+    }
+};
+
+template<typename T>
+inline void appendArray ( string& out, int count, const vector<T>& src )
+{
+    out.append ( ( const char * ) &count, 4 );
+
+    // The length field is authoritative, same as the game's own writer
+    const size_t n = min ( size_t ( max ( count, 0 ) ), src.size() );
+
+    if ( n > 0 )
+        out.append ( ( const char * ) &src[0], n * sizeof ( T ) );
+
+    if ( n < size_t ( max ( count, 0 ) ) )
+        out.append ( ( count - n ) * sizeof ( T ), '\0' );
 }
 
-void ReplayCreator::load(ReplayCreator::ReplayFile* rf, char* fname) {
-    ifstream infile;
-    infile.open(fname, ios::binary | ios::in);
-    infile.read((char*)rf, 0x60);
-    //cout << formatAsHex((void*) rf, 0x60) << endl;
-    //cout << endl;
-    for (int j=0; j < rf->numRounds; ++j) {
-      ReplayCreator::Round roundObj;
-      ReplayCreator::Round* round = &roundObj;
-      infile.read((char*)round, 0x8C);
-      //cout << formatAsHex((void*) round, 0x8c) << endl;
-      infile.read((char*)&(round->lenp1Inputs), 4);
-      //printf("Player1\n");
-      //printf("%d %d\n", round->lenp1Inputs, round->lenp2Inputs);
-      ReplayCreator::Input in;
-      for (int i = 0; i < round->lenp1Inputs; ++i) {
-        infile.read((char*)&in, 6);
-        round->p1Inputs.push_back(in);
-      }
-      infile.read((char*)&(round->lenp2Inputs), 4);
-      //printf("Player2\n");
-      //printf("%d %d\n", round->lenp1Inputs, round->lenp2Inputs);
-      for (int i = 0; i < round->lenp2Inputs; ++i) {
-        infile.read((char*)&in, 6);
-        //cout << formatAsHex((void*) &in, 6) << endl;
-        //cout << "preprint" << endl;
-        //printInput2(in);
-        //cout << "postprint" << endl;
-        round->p2Inputs.push_back(in);
-      }
-      // A copy of p1/p2's inputs, with some directions changed. May or not appear.
-      // Don't know why this exists either, doesn't seem to do anything
-      // Probably something to do with controllers
-      infile.read((char*)&(round->lenp3Inputs), 4);
-      //cout << formatAsHex((void*) &(round->lenp3Inputs), 4) << endl;
-      //printf("Player3\n");
-      //printf("%d\n", round->lenp3Inputs);
-      for (int i = 0; i < round->lenp3Inputs; ++i) {
-          infile.read((char*)&in, 6);
-          //cout << formatAsHex((void*) &in, 6) << endl;
-          //cout << "preprint" << endl;
-          //printInput2(in);
-          //cout << "postprint" << endl;
-          round->p3Inputs.push_back(in);
-      }
-      infile.read((char*)&(round->lenp4Inputs), 4);
-      //printf("Player4\n");
-      //printf("%d\n", round->lenp4Inputs);
-      for (int i = 0; i < round->lenp4Inputs; ++i) {
-          infile.read((char*)&in, 6);
-          //cout << formatAsHex((void*) &in, 6) << endl;
-          //cout << "preprint" << endl;
-          //printInput2(in);
-          //cout << "postprint" << endl;
-          round->p4Inputs.push_back(in);
-      }
-
-      infile.read((char*)&(round->lenRng), 4);
-      int tmp;
-      for (int i = 0; i < round->lenRng; ++i) {
-        infile.read((char*)&tmp, 4);
-        //cout << formatAsHex((void*) &tmp, 4) << endl;
-        round->rngstates.push_back(tmp);
-      }
-      infile.read((char*)&(round->nine), 144);
-      //cout << formatAsHex((void*) round->nine, 144) << endl;
-      //cout << "aa" << endl;
-      rf->rounds.push_back(roundObj);
+} // namespace
+
+void ReplayCreator::dumpToBuffer( const ReplayFile& rf, string& out )
+{
+    size_t size = REPLAY_HEADER_SIZE;
+
+    for ( int j = 0; j < rf.numRounds && j < ( int ) rf.rounds.size(); ++j )
+    {
+        const Round& round = rf.rounds[j];
+
+        size += REPLAY_ROUND_HEAD_SIZE + REPLAY_ROUND_TAIL_SIZE + 5 * 4;
+        size += REPLAY_INPUT_SIZE * ( max ( round.lenp1Inputs, 0 ) + max ( round.lenp2Inputs, 0 )
+                                      + max ( round.lenp3Inputs, 0 ) + max ( round.lenp4Inputs, 0 ) );
+        size += 4 * max ( round.lenRng, 0 );
+    }
+
+    out.clear();
+    out.reserve ( size );
+    out.append ( ( const char * ) &rf, REPLAY_HEADER_SIZE );
+
+    for ( int j = 0; j < rf.numRounds && j < ( int ) rf.rounds.size(); ++j )
+    {
+        const Round& round = rf.rounds[j];
+
+        out.append ( ( const char * ) &round, REPLAY_ROUND_HEAD_SIZE );
+        appendArray ( out, round.lenp1Inputs, round.p1Inputs );
+        appendArray ( out, round.lenp2Inputs, round.p2Inputs );
+        appendArray ( out, round.lenp3Inputs, round.p3Inputs );
+        appendArray ( out, round.lenp4Inputs, round.p4Inputs );
+        appendArray ( out, round.lenRng, round.rngstates );
+        out.append ( round.nine, REPLAY_ROUND_TAIL_SIZE );
     }
 }
-void ReplayCreator::fixReplay(ReplayCreator::ReplayFile* rf, char* fname, MoveData* prior) {
-    //cout << "fix replay" << endl;
-    LOG( "asdf" );
+
+void ReplayCreator::dump( const ReplayFile& rf, const char* fname )
+{
+    string buffer;
+    dumpToBuffer ( rf, buffer );
+
+    FILE *file = fopen ( fname, "wb" );
+
+    if ( !file )
+    {
+        LOG ( "Failed to open '%s'", fname );
+        return;
+    }
+
+    if ( fwrite ( &buffer[0], 1, buffer.size(), file ) != buffer.size() )
+        LOG ( "Failed to write '%s'", fname );
+
+    fclose ( file );
+}
+
+bool ReplayCreator::loadFromBuffer( ReplayFile* rf, const char* data, size_t len )
+{
+    ReplayReader reader = { data, len, 0 };
+
+    if ( !reader.read ( rf, REPLAY_HEADER_SIZE ) )
+        return false;
+
+    // Each round is at least its fixed sized parts, so this bounds the reservation
+    const size_t minRoundSize = REPLAY_ROUND_HEAD_SIZE + REPLAY_ROUND_TAIL_SIZE + 5 * 4;
+
+    if ( rf->numRounds < 0 || size_t ( rf->numRounds ) > ( len - reader.pos ) / minRoundSize )
+        return false;
+
+    rf->rounds.clear();
+    rf->rounds.resize ( rf->numRounds );
+
+    for ( Round& round : rf->rounds )
+    {
+        if ( !reader.read ( &round, REPLAY_ROUND_HEAD_SIZE )
+                || !reader.read ( &round.lenp1Inputs, 4 )
+                || !reader.readArray ( round.lenp1Inputs, round.p1Inputs )
+                || !reader.read ( &round.lenp2Inputs, 4 )
+                || !reader.readArray ( round.lenp2Inputs, round.p2Inputs )
+                // A copy of p1/p2's inputs, with some directions changed. May or not appear.
+                || !reader.read ( &round.lenp3Inputs, 4 )
+                || !reader.readArray ( round.lenp3Inputs, round.p3Inputs )
+                || !reader.read ( &round.lenp4Inputs, 4 )
+                || !reader.readArray ( round.lenp4Inputs, round.p4Inputs )
+                || !reader.read ( &round.lenRng, 4 )
+                || !reader.readArray ( round.lenRng, round.rngstates )
+                || !reader.read ( round.nine, REPLAY_ROUND_TAIL_SIZE ) )
+        {
+            LOG ( "Truncated replay at offset %u of %u", ( uint32_t ) reader.pos, ( uint32_t ) len );
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool ReplayCreator::load( ReplayFile* rf, const char* fname )
+{
+    FILE *file = fopen ( fname, "rb" );
+
+    if ( !file )
+    {
+        LOG ( "Failed to open '%s'", fname );
+        return false;
+    }
+
+    string buffer;
+
+    if ( fseek ( file, 0, SEEK_END ) == 0 )
+    {
+        const long size = ftell ( file );
+
+        if ( size > 0 )
+        {
+            buffer.resize ( size );
+            fseek ( file, 0, SEEK_SET );
+            buffer.resize ( fread ( &buffer[0], 1, size, file ) );
+        }
+    }
+
+    fclose ( file );
+
+    return loadFromBuffer ( rf, buffer.data(), buffer.size() );
+}
+
+void ReplayCreator::fixReplay(ReplayCreator::ReplayFile* rf, const char* fname, MoveData* prior) {
     ifstream infile;
     infile.open(fname);
+    fixReplay(rf, infile, prior);
+}
+
+void ReplayCreator::fixReplay(ReplayCreator::ReplayFile* rf, istream& infile, MoveData* prior) {
+    //cout << "fix replay" << endl;
     string line;
     getline(infile,line);
     //cout << line << endl;
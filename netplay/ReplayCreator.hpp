@@ -10,6 +10,12 @@
 #include <string>
 #include "Logger.hpp"
 
+// Sizes of the fixed parts of the .rep format
+#define REPLAY_HEADER_SIZE      0x60
+#define REPLAY_ROUND_HEAD_SIZE  0x8C
+#define REPLAY_ROUND_TAIL_SIZE  0x90
+#define REPLAY_INPUT_SIZE       6
+
 #define BUTTON_UP(BEFORE,AFTER) uint8_t (~((~BEFORE)|AFTER))
 #define BUTTON_DOWN(BEFORE,AFTER) uint8_t (~((~AFTER)|BEFORE))
 
@@ -129,9 +135,14 @@ public:
       bool last = true;
     };
 
-    void dump( ReplayFile rf, char* fname );
-    void load( ReplayFile* rf, char* fname );
-    void fixReplay( ReplayFile* rf, char* fname, MoveData* prior );
+    void dump( const ReplayFile& rf, const char* fname );
+    bool load( ReplayFile* rf, const char* fname );
+
+    // Parse / serialize a whole .rep file in one pass over a contiguous buffer
+    bool loadFromBuffer( ReplayFile* rf, const char* data, size_t len );
+    void dumpToBuffer( const ReplayFile& rf, std::string& out );
+    void fixReplay( ReplayFile* rf, const char* fname, MoveData* prior );
+    void fixReplay( ReplayFile* rf, std::istream& infile, MoveData* prior );
     uint8_t getButton( unsigned int x );
     uint8_t getDirection( unsigned int x );
     std::string getDirIcon( uint8_t x );
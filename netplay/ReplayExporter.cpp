@@ -0,0 +1,278 @@
+#include "ReplayExporter.hpp"
+#include "ReplayCreator.hpp"
+#include "Compression.hpp"
+#include "Logger.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <map>
+
+using namespace std;
+
+
+#define RAW_CONTAINER_MAGIC "CCRZ"
+
+
+static const char HexDigits[] = "0123456789abcdef";
+
+static inline void appendHex4 ( string& out, uint16_t value )
+{
+    out += HexDigits[ ( value >> 12 ) & 0xF ];
+    out += HexDigits[ ( value >> 8 ) & 0xF ];
+    out += HexDigits[ ( value >> 4 ) & 0xF ];
+    out += HexDigits[ value & 0xF ];
+}
+
+static bool writeFile ( const string& path, const string& data, const char *mode )
+{
+    FILE *file = fopen ( path.c_str(), mode );
+
+    if ( !file )
+    {
+        LOG ( "Failed to open '%s'", path );
+        return false;
+    }
+
+    const bool success = ( fwrite ( data.data(), 1, data.size(), file ) == data.size() );
+    fclose ( file );
+
+    if ( !success )
+        LOG ( "Failed to write '%s'", path );
+
+    return success;
+}
+
+
+ReplayExporter::ReplayExporter() {}
+
+ReplayExporter::~ReplayExporter()
+{
+    stop();
+}
+
+void ReplayExporter::queue ( const JobPtr& job )
+{
+    {
+        LOCK ( _mutex );
+        ++_pending;
+        _jobs.push_back ( job );
+
+        // The running task picks up this job too
+        if ( _scheduled )
+            return;
+
+        _scheduled = true;
+    }
+
+    // Submit without the lock, since this blocks while the pool's queue is full
+    WorkerPool::get().submit ( [this]() { runJobs(); } );
+}
+
+void ReplayExporter::exportInputs ( const shared_ptr<const InputsSnapshot>& snapshot )
+{
+    JobPtr job ( new Job() );
+    job->inputs = snapshot;
+    queue ( job );
+}
+
+void ReplayExporter::exportResult ( const string& resultsPath, const string& line )
+{
+    JobPtr job ( new Job() );
+    job->resultsPath = resultsPath;
+    job->resultLine = line;
+    queue ( job );
+}
+
+bool ReplayExporter::popCompleted ( Status& status )
+{
+    return _completed.tryPop ( status );
+}
+
+void ReplayExporter::flush()
+{
+    LOCK ( _mutex );
+
+    while ( _pending > 0 || _scheduled )
+        _idle.wait ( _mutex );
+}
+
+void ReplayExporter::stop()
+{
+    // The task must be done before this is destroyed
+    flush();
+}
+
+void ReplayExporter::finished ( size_t count )
+{
+    LOCK ( _mutex );
+
+    _pending -= count;
+
+    if ( _pending == 0 )
+        _idle.broadcast();
+}
+
+void ReplayExporter::completed ( const Status& status )
+{
+    if ( _completed.tryPush ( status ) )
+        return;
+
+    ++_numDropped;
+    LOG ( "Dropped export status: success=%u; path='%s'", status.success, status.path );
+}
+
+void ReplayExporter::runJobs()
+{
+    Lock lock ( _mutex );
+
+    while ( !_jobs.empty() )
+    {
+        // Take everything that is queued right now, so that consecutive results can be written together
+        vector<JobPtr> batch;
+        batch.swap ( _jobs );
+
+        _mutex.unlock();
+
+        vector<JobPtr> results;
+
+        for ( const JobPtr& job : batch )
+        {
+            if ( !job->inputs )
+            {
+                results.push_back ( job );
+                continue;
+            }
+
+            runResultsJobs ( results );
+            runInputsJob ( *job->inputs );
+            finished ( 1 );
+        }
+
+        runResultsJobs ( results );
+
+        _mutex.lock();
+    }
+
+    _scheduled = false;
+    _idle.broadcast();
+}
+
+void ReplayExporter::runResultsJobs ( vector<JobPtr>& jobs )
+{
+    if ( jobs.empty() )
+        return;
+
+    // Group by path, keeping the order of lines per file
+    map<string, string> files;
+
+    for ( const JobPtr& job : jobs )
+        files[job->resultsPath] += job->resultLine + "\n";
+
+    for ( const auto& kv : files )
+    {
+        const bool success = writeFile ( kv.first, kv.second, "a" );
+        completed ( { Status::Results, success, kv.first } );
+    }
+
+    const size_t count = jobs.size();
+    jobs.clear();
+    finished ( count );
+}
+
+void ReplayExporter::runInputsJob ( const InputsSnapshot& snapshot )
+{
+    string text;
+    formatRawInputs ( snapshot, text );
+
+    bool success;
+
+    if ( compressRaw )
+    {
+        string packed;
+        success = packRawInputs ( text, packed ) && writeFile ( snapshot.rawPath + ".z", packed, "wb" );
+    }
+    else
+    {
+        success = writeFile ( snapshot.rawPath, text, "wb" );
+    }
+
+    if ( snapshot.replayPath.empty() || snapshot.fixedReplayPath.empty() )
+    {
+        completed ( { Status::Inputs, success, snapshot.rawPath } );
+        return;
+    }
+
+    ReplayCreator creator;
+    ReplayCreator::ReplayFile replay;
+
+    if ( !creator.load ( &replay, snapshot.replayPath.c_str() ) || replay.rounds.size() < snapshot.rounds.size() )
+    {
+        LOG ( "Failed to load replay '%s'", snapshot.replayPath );
+        completed ( { Status::Inputs, false, snapshot.fixedReplayPath } );
+        return;
+    }
+
+    istringstream ss ( text );
+    creator.fixReplay ( &replay, ss, 0 );
+    creator.dump ( replay, snapshot.fixedReplayPath.c_str() );
+
+    completed ( { Status::Inputs, success, snapshot.fixedReplayPath } );
+}
+
+void ReplayExporter::formatRawInputs ( const InputsSnapshot& snapshot, string& out )
+{
+    size_t size = 16;
+    for ( const auto& round : snapshot.rounds )
+        size += 16 + round.size() * 10;
+
+    out.clear();
+    out.reserve ( size );
+    out += format ( snapshot.rounds.size() ) + "\n";
+
+    for ( const auto& round : snapshot.rounds )
+    {
+        out += format ( round.size() ) + "\n";
+
+        for ( const auto& inputs : round )
+        {
+            appendHex4 ( out, inputs.first );
+            out += ' ';
+            appendHex4 ( out, inputs.second );
+            out += '\n';
+        }
+    }
+}
+
+bool ReplayExporter::packRawInputs ( const string& text, string& out )
+{
+    const uint32_t size = text.size();
+
+    out.assign ( RAW_CONTAINER_MAGIC, 4 );
+    out.append ( ( const char * ) &size, 4 );
+    out.resize ( 8 + compressBound ( size ) );
+
+    const size_t len = compress ( text.data(), text.size(), &out[8], out.size() - 8 );
+
+    if ( len == 0 && size > 0 )
+        return false;
+
+    out.resize ( 8 + len );
+    return true;
+}
+
+bool ReplayExporter::unpackRawInputs ( const string& data, string& text )
+{
+    if ( data.size() < 8 || data.compare ( 0, 4, RAW_CONTAINER_MAGIC ) != 0 )
+        return false;
+
+    uint32_t size;
+    memcpy ( &size, &data[4], 4 );
+
+    text.resize ( size );
+
+    if ( size == 0 )
+        return true;
+
+    return ( uncompress ( &data[8], data.size() - 8, &text[0], size ) == size );
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "Thread.hpp"
+#include "BlockingQueue.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+// Writes replay inputs and match results on the shared WorkerPool, so the game thread never touches the disk.
+// The game thread only takes an immutable snapshot of the data, which is then owned by the worker.
+class ReplayExporter
+{
+public:
+
+    // Immutable snapshot of the inputs of one match
+    struct InputsSnapshot
+    {
+        // Output path of the raw inputs file, ie "ReplayVS/AAAxBBB_yymmdd-HHMMSS.repraw"
+        std::string rawPath;
+
+        // The game's saved replay to fix, and the output path of the fixed replay, these can be empty
+        std::string replayPath, fixedReplayPath;
+
+        // Inputs for each in-game round, as pairs of P1 / P2 inputs per frame
+        std::vector<std::vector<std::pair<uint16_t, uint16_t>>> rounds;
+    };
+
+    // Result of a finished export job
+    struct Status
+    {
+        enum Type : uint8_t { Inputs, Results } type;
+
+        bool success;
+
+        // Path of the main file written by the job
+        std::string path;
+    };
+
+    // Write the raw inputs as a zlib compressed container instead of plain text
+    bool compressRaw = false;
+
+    ReplayExporter();
+    ~ReplayExporter();
+
+    // Queue an inputs export, the snapshot must not be modified after this call
+    void exportInputs ( const std::shared_ptr<const InputsSnapshot>& snapshot );
+
+    // Queue a line to be appended to the results file, consecutive lines are written in a single batch
+    void exportResult ( const std::string& resultsPath, const std::string& line );
+
+    // Pop the status of a finished job, returns false if there are none. Can be called from any thread.
+    bool popCompleted ( Status& status );
+
+    // Number of statuses dropped because too many were waiting to be popped
+    size_t getNumDropped() const { return _numDropped; }
+
+    // Block until all queued jobs are finished
+    void flush();
+
+    // Finish the queued jobs, after this nothing runs on the WorkerPool until the next job is queued
+    void stop();
+
+    // Format the raw inputs text, the same format that ReplayCreator::fixReplay reads
+    static void formatRawInputs ( const InputsSnapshot& snapshot, std::string& out );
+
+    // Compressed raw inputs container: magic, uncompressed size, then the zlib compressed text
+    static bool packRawInputs ( const std::string& text, std::string& out );
+    static bool unpackRawInputs ( const std::string& data, std::string& text );
+
+private:
+
+    struct Job
+    {
+        std::shared_ptr<const InputsSnapshot> inputs;
+
+        std::string resultsPath, resultLine;
+    };
+
+    typedef std::shared_ptr<Job> JobPtr;
+
+    // Queued jobs, guarded by _mutex
+    std::vector<JobPtr> _jobs;
+
+    // A task that runs the queued jobs is submitted to the WorkerPool, at most one at a time so the jobs run in
+    // order, guarded by _mutex
+    bool _scheduled = false;
+
+    // Picked up by the game thread at state transitions, so taking a status never locks. Statuses are dropped when
+    // it's full, so the jobs never wait for the game thread.
+    LockFreeQueue<Status, 256> _completed;
+
+    std::atomic<size_t> _numDropped { 0 };
+
+    // Number of queued jobs that have not finished yet
+    size_t _pending = 0;
+
+    Mutex _mutex;
+
+    CondVar _idle;
+
+    void queue ( const JobPtr& job );
+
+    // Run the queued jobs until there are none left, runs on the WorkerPool
+    void runJobs();
+
+    void runInputsJob ( const InputsSnapshot& snapshot );
+
+    void runResultsJobs ( std::vector<JobPtr>& jobs );
+
+    void finished ( size_t count );
+
+    void completed ( const Status& status );
+};
@@ -0,0 +1,186 @@
+#include "ReplayIndex.hpp"
+#include "Compression.hpp"
+#include "Logger.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+
+#define REPLAY_INDEX_MAGIC "CCRI"
+
+#define REPLAY_INDEX_VERSION ( 1 )
+
+// Same layout as IndexedFrame::value
+#define INDEX_OF(INDEXED_FRAME) ( uint32_t ( ( INDEXED_FRAME ) >> 32 ) )
+#define FRAME_OF(INDEXED_FRAME) ( uint32_t ( INDEXED_FRAME ) )
+
+
+ReplayIndex::ReplayIndex ( uint32_t interval ) : interval ( max ( interval, 1u ) ) {}
+
+void ReplayIndex::clear ( uint32_t layout )
+{
+    _keyframes.clear();
+    _layout = layout;
+}
+
+map<uint64_t, ReplayIndex::Keyframe>::const_iterator ReplayIndex::find ( uint64_t indexedFrame ) const
+{
+    auto it = _keyframes.upper_bound ( indexedFrame );
+
+    if ( it == _keyframes.begin() )
+        return _keyframes.end();
+
+    --it;
+
+    if ( INDEX_OF ( it->first ) != INDEX_OF ( indexedFrame ) )
+        return _keyframes.end();
+
+    return it;
+}
+
+bool ReplayIndex::shouldRecord ( uint64_t indexedFrame ) const
+{
+    auto it = find ( indexedFrame );
+
+    if ( it == _keyframes.end() )
+        return true;
+
+    return ( FRAME_OF ( indexedFrame ) - FRAME_OF ( it->first ) >= interval );
+}
+
+void ReplayIndex::record ( uint64_t indexedFrame, const vector<char>& state )
+{
+    if ( _keyframes.count ( indexedFrame ) )
+        return;
+
+    Keyframe& keyframe = _keyframes[indexedFrame];
+    keyframe.size = state.size();
+
+    if ( state.empty() )
+        return;
+
+    keyframe.data.resize ( lzCompressBound ( state.size() ) );
+    keyframe.data.resize ( lzCompress ( &state[0], state.size(), &keyframe.data[0], keyframe.data.size() ) );
+}
+
+ReplayIndex::Seek ReplayIndex::plan ( uint64_t current, uint64_t target, uint64_t& keyframe ) const
+{
+    auto it = find ( target );
+
+    const bool canPlayForward = ( current <= target );
+
+    if ( it == _keyframes.end() )
+        return ( canPlayForward ? SeekForward : SeekImpossible );
+
+    // Only restore if the keyframe is closer to the target than the current frame
+    if ( canPlayForward && INDEX_OF ( current ) == INDEX_OF ( target ) && it->first <= current )
+        return SeekForward;
+
+    keyframe = it->first;
+    return SeekRestore;
+}
+
+bool ReplayIndex::restore ( uint64_t keyframe, vector<char>& state ) const
+{
+    auto it = _keyframes.find ( keyframe );
+
+    if ( it == _keyframes.end() )
+        return false;
+
+    state.resize ( it->second.size );
+
+    if ( state.empty() )
+        return true;
+
+    return ( lzUncompress ( it->second.data.data(), it->second.data.size(), &state[0], state.size() )
+             == state.size() );
+}
+
+bool ReplayIndex::save ( const string& file ) const
+{
+    FILE *fp = fopen ( file.c_str(), "wb" );
+
+    if ( !fp )
+        return false;
+
+    const uint32_t version = REPLAY_INDEX_VERSION;
+    const uint32_t count = _keyframes.size();
+
+    bool good = ( fwrite ( REPLAY_INDEX_MAGIC, 4, 1, fp ) == 1 )
+                && ( fwrite ( &version, sizeof ( version ), 1, fp ) == 1 )
+                && ( fwrite ( &_layout, sizeof ( _layout ), 1, fp ) == 1 )
+                && ( fwrite ( &count, sizeof ( count ), 1, fp ) == 1 );
+
+    for ( auto it = _keyframes.begin(); good && it != _keyframes.end(); ++it )
+    {
+        const uint32_t compressedSize = it->second.data.size();
+
+        good = ( fwrite ( &it->first, sizeof ( it->first ), 1, fp ) == 1 )
+               && ( fwrite ( &it->second.size, sizeof ( it->second.size ), 1, fp ) == 1 )
+               && ( fwrite ( &compressedSize, sizeof ( compressedSize ), 1, fp ) == 1 )
+               && ( compressedSize == 0 || fwrite ( it->second.data.data(), compressedSize, 1, fp ) == 1 );
+    }
+
+    fclose ( fp );
+
+    if ( !good )
+        remove ( file.c_str() );
+
+    return good;
+}
+
+bool ReplayIndex::load ( const string& file, uint32_t layout )
+{
+    clear ( layout );
+
+    FILE *fp = fopen ( file.c_str(), "rb" );
+
+    if ( !fp )
+        return false;
+
+    char magic[4];
+    uint32_t version, fileLayout, count;
+
+    bool good = ( fread ( magic, sizeof ( magic ), 1, fp ) == 1 )
+                && ( fread ( &version, sizeof ( version ), 1, fp ) == 1 )
+                && ( fread ( &fileLayout, sizeof ( fileLayout ), 1, fp ) == 1 )
+                && ( fread ( &count, sizeof ( count ), 1, fp ) == 1 )
+                && !memcmp ( magic, REPLAY_INDEX_MAGIC, sizeof ( magic ) )
+                && version == REPLAY_INDEX_VERSION
+                && fileLayout == layout;
+
+    for ( uint32_t i = 0; good && i < count; ++i )
+    {
+        uint64_t indexedFrame;
+        uint32_t compressedSize;
+        Keyframe keyframe;
+
+        good = ( fread ( &indexedFrame, sizeof ( indexedFrame ), 1, fp ) == 1 )
+               && ( fread ( &keyframe.size, sizeof ( keyframe.size ), 1, fp ) == 1 )
+               && ( fread ( &compressedSize, sizeof ( compressedSize ), 1, fp ) == 1 )
+               && compressedSize <= lzCompressBound ( keyframe.size );
+
+        if ( !good )
+            break;
+
+        keyframe.data.resize ( compressedSize );
+
+        if ( compressedSize )
+            good = ( fread ( &keyframe.data[0], compressedSize, 1, fp ) == 1 );
+
+        _keyframes[indexedFrame] = move ( keyframe );
+    }
+
+    fclose ( fp );
+
+    if ( !good )
+    {
+        LOG ( "Ignoring invalid replay index: '%s'", file );
+        clear ( layout );
+    }
+
+    return good;
+}
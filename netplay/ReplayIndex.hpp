@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+
+// Sidecar index of full game states saved periodically during replay playback, so seeking to any frame costs at
+// most one keyframe restore plus the frames re-simulated after it. The index is built lazily while playing, and can
+// be saved next to the replay file. Frames are identified by IndexedFrame::value, so this doesn't depend on the
+// netplay headers. States depend on the rollback memory layout, so the index is tagged with a layout id.
+class ReplayIndex
+{
+public:
+
+    enum Seek
+    {
+        // Play forward from the current frame
+        SeekForward,
+
+        // Restore the keyframe then play forward from it
+        SeekRestore,
+
+        // No keyframe at or before the target
+        SeekImpossible,
+    };
+
+    // Number of frames between keyframes
+    const uint32_t interval;
+
+    ReplayIndex ( uint32_t interval = 300 );
+
+    // Discard all keyframes and use the given layout id
+    void clear ( uint32_t layout );
+
+    // True if a keyframe should be recorded at this frame
+    bool shouldRecord ( uint64_t indexedFrame ) const;
+
+    // Record the state at this frame as a keyframe, ignored if there is already one
+    void record ( uint64_t indexedFrame, const std::vector<char>& state );
+
+    // Decide how to get from the current frame to the target, keyframes are only used within the same index.
+    // Returns SeekRestore with the keyframe to restore if that is fewer frames to re-simulate than playing forward.
+    Seek plan ( uint64_t current, uint64_t target, uint64_t& keyframe ) const;
+
+    // Uncompress the state of a keyframe, returns false if there is no such keyframe
+    bool restore ( uint64_t keyframe, std::vector<char>& state ) const;
+
+    // Save / load the sidecar file, loading fails if the layout doesn't match
+    bool save ( const std::string& file ) const;
+    bool load ( const std::string& file, uint32_t layout );
+
+    size_t getNumKeyframes() const { return _keyframes.size(); }
+
+    uint32_t getLayout() const { return _layout; }
+
+private:
+
+    struct Keyframe
+    {
+        // Size of the state before compression
+        uint32_t size = 0;
+
+        std::string data;
+    };
+
+    std::map<uint64_t, Keyframe> _keyframes;
+
+    uint32_t _layout = 0;
+
+    // Get the newest keyframe at or before the given frame in the same index, or end()
+    std::map<uint64_t, Keyframe>::const_iterator find ( uint64_t indexedFrame ) const;
+};
@@ -0,0 +1,166 @@
+#pragma once
+
+#include "IndexedFrame.hpp"
+#include "Logger.hpp"
+
+#include <list>
+#include <memory>
+#include <stack>
+#include <vector>
+
+
+// Saved rollback states in chronological order, stored in a fixed pool of equally sized raw byte buffers, plus a
+// buffer per state for the slot arrays, which have a variable size. DllRollbackManager and the host rollback
+// simulator both use this, so they evict and search states the same way.
+//
+// T is the saved state type, it needs these members, the pool sets the buffers:
+//   IndexedFrame indexedFrame;
+//   char *rawBytes;
+//   std::vector<char> *slotBytes;
+template<typename T>
+class RollbackStates
+{
+public:
+
+    // Allocate the pool for the given number of states of the given size, and free all the states.
+    // The pool is kept if it already has the same size.
+    void allocate ( size_t numStates, size_t stateSize )
+    {
+        if ( !_memoryPool || numStates != _slotsPool.size() || stateSize != _stateSize )
+        {
+            _memoryPool.reset ( new char[numStates * stateSize] );
+            _slotsPool.resize ( numStates );
+            _stateSize = stateSize;
+        }
+
+        clear();
+    }
+
+    // Free the pool, including the capacity of the slot array buffers
+    void deallocate()
+    {
+        _memoryPool.reset();
+        std::vector<std::vector<char>>().swap ( _slotsPool );
+        _stateSize = 0;
+
+        while ( !_freeStack.empty() )
+            _freeStack.pop();
+
+        _states.clear();
+    }
+
+    // Free all the states, the pool is kept
+    void clear()
+    {
+        while ( !_freeStack.empty() )
+            _freeStack.pop();
+
+        for ( size_t i = 0; i < _slotsPool.size(); ++i )
+            _freeStack.push ( i );
+
+        _states.clear();
+    }
+
+    bool isAllocated() const { return ( bool ) _memoryPool; }
+
+    bool empty() const { return _states.empty(); }
+
+    const T& front() const { return _states.front(); }
+    const T& back() const { return _states.back(); }
+
+    // The state that the next push evicts to free a buffer, or null if there is a free buffer.
+    // This is the oldest state, unless it's at or before the last confirmed frame. Then it's the base that any
+    // rollback goes back to at most, so it's kept, and the next oldest state is evicted instead.
+    const T *getEvicted ( uint32_t confirmedFrame ) const
+    {
+        if ( !_freeStack.empty() )
+            return 0;
+
+        ASSERT ( _states.empty() == false );
+
+        if ( _states.size() >= 2 && _states.front().indexedFrame.parts.frame <= confirmedFrame )
+            return & ( * ++_states.begin() );
+
+        return &_states.front();
+    }
+
+    // Add the newest state, evicting a state if needed, see getEvicted. Returns the added state with its buffers set.
+    T& push ( const T& state, uint32_t confirmedFrame )
+    {
+        if ( const T *evicted = getEvicted ( confirmedFrame ) )
+            erase ( evicted );
+
+        ASSERT ( _freeStack.empty() == false );
+
+        _states.push_back ( state );
+        _states.back().rawBytes = _memoryPool.get() + _freeStack.top() * _stateSize;
+        _states.back().slotBytes = &_slotsPool [ _freeStack.top() ];
+        _freeStack.pop();
+        return _states.back();
+    }
+
+    // Find the newest state at or before the given frame, or null if there is none.
+    // If orOldest is set, the oldest state is returned instead of null.
+    T *find ( IndexedFrame indexedFrame, bool orOldest = false )
+    {
+        for ( auto it = _states.rbegin(); it != _states.rend(); ++it )
+        {
+            if ( it->indexedFrame.value <= indexedFrame.value )
+                return & ( *it );
+        }
+
+        if ( orOldest && !_states.empty() )
+            return &_states.front();
+
+        return 0;
+    }
+
+    // Free the states after the given state, ie after loading it, since they are saved again when re-running
+    void eraseAfter ( const T *state )
+    {
+        while ( !_states.empty() && &_states.back() != state )
+        {
+            _freeStack.push ( getIndex ( _states.back() ) );
+            _states.pop_back();
+        }
+
+        ASSERT ( _states.empty() == false );
+    }
+
+private:
+
+    // Memory pool to allocate the raw bytes of each state, each one has the same size
+    std::unique_ptr<char[]> _memoryPool;
+
+    // Size of the raw bytes of each state
+    size_t _stateSize = 0;
+
+    // Slot array buffers for each index in the memory pool, these keep their capacity between frames
+    std::vector<std::vector<char>> _slotsPool;
+
+    // Unused indices in the memory pool
+    std::stack<size_t> _freeStack;
+
+    // Saved states in chronological order
+    std::list<T> _states;
+
+    size_t getIndex ( const T& state ) const
+    {
+        return state.slotBytes - &_slotsPool[0];
+    }
+
+    void erase ( const T *state )
+    {
+        for ( auto it = _states.begin(); it != _states.end(); ++it )
+        {
+            if ( & ( *it ) != state )
+                continue;
+
+            _freeStack.push ( getIndex ( *it ) );
+            _states.erase ( it );
+            return;
+        }
+
+        ASSERT_IMPOSSIBLE;
+    }
+};
@@ -113,6 +113,11 @@ while True:
 
                 print 'UDP data', repr ( data ), 'address', address
 
+                # echo relay probes back as is, see lib/RelayProber.hpp
+                if len ( data ) == 8 and data[:4] == 'Ping':
+                    s.sendto ( data, address )
+                    continue
+
                 try:
                     index, matchId = struct.unpack ( '<BI', data )
 
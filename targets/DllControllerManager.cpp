@@ -15,6 +15,9 @@ using namespace std;
 #define VK_TOGGLE_OVERLAY ( VK_F4 )
 #define VK_ENABLE_FRAMESTEP ( VK_F5 )
 
+// Button presses older than this are not latched, in microseconds
+#define MAX_LATCH_AGE ( 50 * 1000 )
+
 extern bool stopping;
 
 
@@ -51,6 +54,10 @@ void DllControllerManager::updateControls ( uint16_t *localInputs )
 
     Lock lock ( ControllerManager::get().mutex );
 
+    // Apply the controller state changes polled since the last frame, right before the inputs are read
+    const uint64_t now = ControllerEventQueue::now();
+    ControllerManager::get().events.drain ( now, now - MAX_LATCH_AGE );
+
     bool toggleTrialMenu = false;
     bool toggleOverlay = false;
 
@@ -210,7 +217,7 @@ void DllControllerManager::updateControls ( uint16_t *localInputs )
     if ( !DllOverlayUi::isEnabled() )
     {
         if ( _playerControllers[localPlayer - 1] ) {
-            uint16_t input = getInput ( _playerControllers[localPlayer - 1] );
+            uint16_t input = getSampledInput ( _playerControllers[localPlayer - 1] );
             if ( localPlayer == 1 ) {
                 if ( *CC_P1_FACING_FLAG_ADDR )
                     input |= COMBINE_INPUT ( 0, CC_PLAYER_FACING );
@@ -223,7 +230,7 @@ void DllControllerManager::updateControls ( uint16_t *localInputs )
         }
 
         if ( _playerControllers[remotePlayer - 1] ) {
-            uint16_t input = getInput ( _playerControllers[remotePlayer - 1] );
+            uint16_t input = getSampledInput ( _playerControllers[remotePlayer - 1] );
             if ( remotePlayer == 1 ) {
                 if ( *CC_P1_FACING_FLAG_ADDR )
                     input |= COMBINE_INPUT ( 0, CC_PLAYER_FACING );
@@ -237,6 +244,9 @@ void DllControllerManager::updateControls ( uint16_t *localInputs )
         return;
     }
 
+    // Presses made in the overlay are not player inputs
+    ControllerManager::get().events.clear();
+
     if ( DllOverlayUi::isTrial() )
     {
         handleTrialMenuOverlay();
@@ -247,6 +257,14 @@ void DllControllerManager::updateControls ( uint16_t *localInputs )
     }
 }
 
+uint16_t DllControllerManager::getSampledInput ( const Controller *controller )
+{
+    // Only buttons are latched, a latched direction would be combined with the current one
+    const uint32_t state = ControllerManager::get().events.sample ( controller, controller->getState(), MASK_BUTTONS );
+
+    return convertInputState ( state, controller->getSocdInt() );
+}
+
 void DllControllerManager::disableTrialMenuOverlay()
 {
     _trialMenuSelection = 0;
@@ -294,7 +312,7 @@ void DllControllerManager::handleTrialMenuOverlay()
                     text[2] = "Trials\n...\n";
                 }
                 for ( int i = 0; i < 10; ++i ) {
-                    Trial t = TrialManager::charaTrials[ _trialScrollSelect + i ];
+                    const Trial& t = TrialManager::charaTrials[ _trialScrollSelect + i ];
                     text[2] += t.name;
                     text[2] += "\n";
                     options[1].push_back( t.name );
@@ -306,7 +324,7 @@ void DllControllerManager::handleTrialMenuOverlay()
                 }
             } else {
                 text[2] = "Trials\n\n";
-                for ( Trial t : TrialManager::charaTrials ) {
+                for ( const Trial& t : TrialManager::charaTrials ) {
                     text[2] += t.name;
                     text[2] += "\n";
                     options[1].push_back( t.name );
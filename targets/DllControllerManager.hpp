@@ -68,6 +68,9 @@ private:
 
     bool _controllerAttached = false;
 
+    // Get the input for this frame, including button presses released since the last frame
+    static uint16_t getSampledInput ( const Controller *controller );
+
     void handleTrialMenuOverlay();
     void handleMappingOverlay();
     void disableTrialMenuOverlay();
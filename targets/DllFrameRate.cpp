@@ -17,6 +17,8 @@ double desiredFps = 60.0;
 
 double actualFps = 60.0;
 
+Histogram frameTimes;
+
 bool isEnabled = false;
 
 
@@ -76,6 +78,9 @@ void PresentFrameEnd ( IDirect3DDevice9 *device )
             now = TimerManager::get().getNow ( true );
     }
 
+    if ( last1f )
+        frameTimes.addSample ( now - last1f );
+
     last1f = now;
 
     if ( counter >= 60 )
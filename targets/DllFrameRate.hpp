@@ -1,5 +1,7 @@
 #pragma once
 
+#include "Histogram.hpp"
+
 #include <cstdint>
 
 
@@ -10,6 +12,9 @@ extern double desiredFps;
 
 extern double actualFps;
 
+// Time between presented frames in milliseconds
+extern Histogram frameTimes;
+
 void enable();
 
 }
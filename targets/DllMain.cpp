@@ -15,14 +15,18 @@
 #include "DllControllerManager.hpp"
 #include "DllFrameRate.hpp"
 #include "ReplayManager.hpp"
+#include "ReplayIndex.hpp"
 #include "DllRollbackManager.hpp"
 #include "DllTrialManager.hpp"
+#include "AssetPrefetcher.hpp"
+#include "Profiler.hpp"
 
 #include <windows.h>
 
 #include <vector>
 #include <memory>
 #include <algorithm>
+#include <atomic>
 
 using namespace std;
 
@@ -30,6 +34,9 @@ using namespace std;
 // The main log file path
 #define LOG_FILE                    FOLDER "dll.log"
 
+// Rollback profiler trace, rewritten each time the perf stats are logged
+#define PROFILER_TRACE_FILE         FOLDER "rollback_trace.json"
+
 // The number of milliseconds to poll for events each frame
 #define POLL_TIMEOUT                ( 3 )
 
@@ -42,6 +49,12 @@ using namespace std;
 // The number of milliseconds to wait to perform a delayed stop so that ErrorMessages are received before sockets die
 #define DELAYED_STOP                ( 100 )
 
+// Number of frames between sending full state hashes
+#define STATE_HASHES_INTERVAL       ( 15 )
+
+// Number of frames between logging the rollback and frame time percentiles
+#define PERF_STATS_INTERVAL         ( 60 * 60 )
+
 // The number of milliseconds before resending inputs while waiting for more inputs
 #define RESEND_INPUTS_INTERVAL      ( 100 )
 
@@ -92,6 +105,9 @@ ENUM ( Variable, WorldTime, GameMode, GameState, RoundStart,
 // Global stopping flag
 bool stopping = false;
 
+// If the last profiler trace is still being written on the worker pool
+static atomic<bool> writingTrace ( false );
+
 NetplayManager* netManPtr = 0;
 
 struct DllMain
@@ -100,6 +116,7 @@ struct DllMain
         , public PtrToRefChangeMonitor<Variable, uint32_t>::Owner
         , public SpectatorManager
         , public DllControllerManager
+        , public DesyncDetector::Owner
 {
     // NetplayManager instance
     NetplayManager netMan;
@@ -159,6 +176,10 @@ struct DllMain
     // We should only rollback if this timer is full
     int rollbackTimer = 0;
 
+    // Start time and depth of the current rollback, for the profiler
+    uint64_t rollbackStart = 0;
+    uint16_t rollbackDepth = 0;
+
     // If we should fast-forward when spectating
     bool spectateFastFwd = true;
 
@@ -182,10 +203,68 @@ struct DllMain
     IndexedFrame replayStop = MaxIndexedFrame;
     IndexedFrame replayCheck = MaxIndexedFrame;
     string replayCheckRngHexStr;
+
+    // Keyframes for seeking in the replay, saved next to the replay file
+    ReplayIndex replayIndex;
+    string replayIndexFile;
+
+    // Buffer for the restored keyframe, reused between seeks
+    vector<char> replaySeekState;
+
+    // Skip rendering until this frame when seeking
+    IndexedFrame replaySeek = {{ 0, 0 }};
+#endif // NOT RELEASE
+
+    void prefetchAssets()
+    {
+        AssetPrefetcher& prefetcher = AssetPrefetcher::get();
+
+        prefetcher.prefetch ( *CC_P1_CHARACTER_ADDR, getShortCharaName ( *CC_P1_CHARACTER_ADDR ),
+                              *CC_P1_MOON_SELECTOR_ADDR );
+        prefetcher.prefetch ( *CC_P2_CHARACTER_ADDR, getShortCharaName ( *CC_P2_CHARACTER_ADDR ),
+                              *CC_P2_MOON_SELECTOR_ADDR );
+    }
+
+#ifndef RELEASE
+    // Seek in the replay, returns true if a keyframe was loaded
+    bool seekReplay ( IndexedFrame target )
+    {
+        uint64_t keyframe = 0;
+
+        switch ( replayIndex.plan ( netMan.getIndexedFrame().value, target.value, keyframe ) )
+        {
+            case ReplayIndex::SeekForward:
+                replaySeek = target;
+                return false;
+
+            case ReplayIndex::SeekRestore:
+            {
+                if ( !replayIndex.restore ( keyframe, replaySeekState )
+                        || !rollMan.loadStateBuffer ( replaySeekState, netMan ) )
+                {
+                    LOG ( "Failed to load replay keyframe for target=[%s]", target );
+                    return false;
+                }
+
+                // Play normally from the keyframe, only skipping the rendering
+                replaySeek = target;
+                *CC_SKIP_FRAMES_ADDR = 1;
+
+                LOG_TO ( syncLog, "Seek: target=[%s]; keyframe=[%s]", target, netMan.getIndexedFrame() );
+                return true;
+            }
+
+            default:
+                DllOverlayUi::showMessage ( "No replay keyframe before this frame" );
+                return false;
+        }
+    }
 #endif // NOT RELEASE
 
     void frameStepNormal()
     {
+        PROFILE_SCOPE ( ProfilePhase::FrameStep, netMan.getFrame() );
+
         switch ( netMan.getState().value )
         {
             case NetplayState::PreInitial:
@@ -201,9 +280,23 @@ struct DllMain
                     // Only save rollback states in-game
                     rollMan.saveState ( netMan );
 
+#ifndef RELEASE
+                    // Record replay keyframes while playing
+                    if ( replayInputs && replayIndex.shouldRecord ( netMan.getIndexedFrame().value ) )
+                    {
+                        static vector<char> keyframe;
+
+                        if ( rollMan.copyLatestState ( keyframe ) )
+                            replayIndex.record ( netMan.getIndexedFrame().value, keyframe );
+                    }
+#endif // NOT RELEASE
+
                     // Delayed round over check
                     if ( roundOverTimer > 0 )
                         --roundOverTimer;
+
+                    if ( netMan.getFrame() % PERF_STATS_INTERVAL == 0 )
+                        logPerfStats();
                 }
 
             case NetplayState::CharaSelect:
@@ -232,6 +325,10 @@ struct DllMain
                     }
                 }
 
+                // Load the assets of the characters under the cursors before the game asks for them
+                if ( netMan.getState() == NetplayState::CharaSelect )
+                    prefetchAssets();
+
                 // Update controller state once per frame
                 KeyboardState::update();
                 updateControls ( &localInputs[0] );
@@ -328,7 +425,10 @@ struct DllMain
                 }
 
 #ifndef RELEASE
-                DllOverlayUi::debugText = format ( "%+d [%s]", netMan.getRemoteFrameDelta(), netMan.getIndexedFrame() );
+                DllOverlayUi::debugText = format ( "%+d [%s] rb p99 %llu; frame p99 %llu ms",
+                                                   netMan.getRemoteFrameDelta(), netMan.getIndexedFrame(),
+                                                   rollMan.rollbackDepths.getPercentile ( 99 ),
+                                                   DllFrameRate::frameTimes.getPercentile ( 99 ) );
                 DllOverlayUi::debugTextAlign = 1;
 
                 // Replay inputs and rollback
@@ -572,8 +672,16 @@ struct DllMain
 
             LOG_SYNC ( "rollbacking input: 0x%04x 0x%04x", netMan.getRawInput ( 1 ), netMan.getRawInput ( 2 ) );
             // Reset the game state (this resets game state AND netMan state)
+            const uint64_t loadStart = Profiler::now();
+
             if ( rollMan.loadState ( netMan.getLastChangedFrame(), netMan ) )
             {
+                rollbackStart = loadStart;
+                rollbackDepth = fastFwdStopFrame.parts.frame - netMan.getFrame();
+
+                Profiler::get().record ( ProfilePhase::LoadState, loadStart, Profiler::now(),
+                                         netMan.getFrame(), rollbackDepth );
+
                 // Start fast-forwarding now
                 *CC_SKIP_FRAMES_ADDR = 1;
 
@@ -654,6 +762,10 @@ struct DllMain
         // LOG_SYNC ( "SFX 0x%X: CC_SFX_ARRAY=%u; sfxFilterArray=%u; sfxMuteArray=%u", SFX_NUM,
         //            CC_SFX_ARRAY_ADDR[SFX_NUM], AsmHacks::sfxFilterArray[SFX_NUM], AsmHacks::sfxMuteArray[SFX_NUM] );
 
+        // Exchange full state hashes to detect desyncs
+        if ( dataSocket && dataSocket->isConnected() && netMan.isInGame() && netMan.getRollback() )
+            sendStateHashes();
+
 #ifndef RELEASE
         if ( ! replayInputs )
         {
@@ -741,6 +853,31 @@ struct DllMain
                 LOG_TO ( syncLog, "%s Rollback to target=[%s] failed!", before, target );
             }
         }
+        else if ( netMan.isInGame() && netMan.getRollback() && !fastFwdStopFrame.value && !replaySeek.value )
+        {
+            // Replay seeking: Left steps back one frame, Page Up / Page Down seek back / forward
+            IndexedFrame target = netMan.getIndexedFrame();
+
+            if ( KeyboardState::isPressed ( VK_LEFT ) )
+            {
+                if ( target.parts.frame > 0 )
+                    --target.parts.frame;
+            }
+            else if ( KeyboardState::isPressed ( VK_PRIOR ) )
+            {
+                if ( target.parts.frame <= REPLAY_SEEK_FRAMES )
+                    target.parts.frame = 0;
+                else
+                    target.parts.frame -= REPLAY_SEEK_FRAMES;
+            }
+            else if ( KeyboardState::isPressed ( VK_NEXT ) )
+            {
+                target.parts.frame += REPLAY_SEEK_FRAMES;
+            }
+
+            if ( target.value != netMan.getIndexedFrame().value && seekReplay ( target ) )
+                return;
+        }
 
         if ( dataSocket && dataSocket->isConnected()
                 && ( ( netMan.getFrame() % ( 5 * 60 ) == 0 ) || ( netMan.getFrame() % 150 == 149 ) )
@@ -753,7 +890,7 @@ struct DllMain
                     || ( netMan.getFrame() == 0 )
                     || ( randomInputs && netMan.getFrame() % 150 == 149 ) )
             {
-                MsgPtr msgSyncHash ( new SyncHash ( netMan.getIndexedFrame() ) );
+                MsgPtr msgSyncHash = makePooled<SyncHash> ( netMan.getIndexedFrame() );
                 dataSocket->send ( msgSyncHash );
                 localSync.push_back ( msgSyncHash );
             }
@@ -803,6 +940,10 @@ struct DllMain
         if ( replayInputs && netMan.getIndex() >= repMan.getLastIndex() && netMan.getFrame() >= repMan.getLastFrame() )
         {
             replayInputs = false;
+
+            if ( replayIndex.getNumKeyframes() && !replayIndex.save ( replayIndexFile ) )
+                LOG ( "Failed to save replay index: '%s'", replayIndexFile );
+
             SetForegroundWindow ( ( HWND ) DllHacks::windowHandle );
         }
 
@@ -890,6 +1031,8 @@ struct DllMain
 
     void frameStepRerun()
     {
+        PROFILE_SCOPE ( ProfilePhase::RerunStep, netMan.getFrame(), fastFwdStopFrame.parts.frame - netMan.getFrame() );
+
         // Here we don't save any game states while re-running because the inputs are faked
 
         // Save sound state during rollback re-run
@@ -905,6 +1048,13 @@ struct DllMain
 
             // Finalize rollback sound effects
             rollMan.finishedRerunSounds();
+
+            if ( rollbackStart )
+            {
+                Profiler::get().record ( ProfilePhase::Rollback, rollbackStart, Profiler::now(),
+                                         netMan.getFrame(), rollbackDepth );
+                rollbackStart = 0;
+            }
         }
         else
         {
@@ -955,11 +1105,28 @@ struct DllMain
         frameStepSpectators();
 
         // Write game inputs
-        procMan.writeGameInput ( localPlayer, netMan.getInput ( localPlayer ) );
-        procMan.writeGameInput ( remotePlayer, netMan.getInput ( remotePlayer ) );
+        {
+            PROFILE_SCOPE ( ProfilePhase::Inputs, netMan.getFrame() );
+
+            procMan.writeGameInput ( localPlayer, netMan.getInput ( localPlayer ) );
+            procMan.writeGameInput ( remotePlayer, netMan.getInput ( remotePlayer ) );
+        }
 
 #ifndef RELEASE
-        if ( replayInputs && ( replaySpeed == 1 || KeyboardState::isDown ( VK_SPACE ) ) )
+        if ( replaySeek.value )
+        {
+            // Skip rendering until the seek target is reached
+            if ( netMan.getIndexedFrame().value < replaySeek.value )
+            {
+                *CC_SKIP_FRAMES_ADDR = 1;
+            }
+            else
+            {
+                replaySeek.value = 0;
+                *CC_SKIP_FRAMES_ADDR = 0;
+            }
+        }
+        else if ( replayInputs && ( replaySpeed == 1 || KeyboardState::isDown ( VK_SPACE ) ) )
             DllFrameRate::desiredFps = numeric_limits<double>::max();
         else if ( replayInputs && replaySpeed == 2 )
             *CC_SKIP_FRAMES_ADDR = 1;
@@ -999,6 +1166,10 @@ struct DllMain
 
             // Initialize the overlay now
             DllOverlayUi::init();
+
+            // Set the asset folders before the first prefetch in character select
+            AssetPrefetcher::get().palettesFolder = ProcessManager::appDir + PALETTES_FOLDER;
+            AssetPrefetcher::get().trialsFolder = "cccaster/trials/";
         }
 
         // Leaving Skippable
@@ -1021,7 +1192,7 @@ struct DllMain
         if ( state == NetplayState::InGame )
         {
             if ( netMan.getRollback() )
-                rollMan.allocateStates();
+                rollMan.allocateStates ( netMan.config.mode.isTraining() || netMan.config.mode.isReplay() );
             if ( netMan.config.mode.isTrial() ) {
                 LOG("Load trial file");
                 trialMan.loadTrialFile();
@@ -1076,7 +1247,7 @@ struct DllMain
 
         // Update remote index
         if ( dataSocket && dataSocket->isConnected() )
-            dataSocket->send ( new TransitionIndex ( netMan.getIndex() ) );
+            dataSocket->send ( makePooled<TransitionIndex> ( netMan.getIndex() ) );
     }
 
     void gameModeChanged ( uint32_t previous, uint32_t current )
@@ -1156,6 +1327,76 @@ struct DllMain
         LOG ( "gameStateChanged(%u, %u)", previous, current );
     }
 
+    // Log the percentiles since the last call, then start over
+    void logPerfStats()
+    {
+        LOG ( "Rollback depth: %s frames", rollMan.rollbackDepths.takeSnapshot().str() );
+        LOG ( "Save state: %s ns", rollMan.saveTimes.takeSnapshot().str() );
+        LOG ( "Load state: %s ns", rollMan.loadTimes.takeSnapshot().str() );
+        LOG ( "History copy: %s ns", rollMan.historyTimes.takeSnapshot().str() );
+        LOG ( "Frame time: %s ms", DllFrameRate::frameTimes.takeSnapshot().str() );
+
+        if ( !Profiler::get().isEnabled() )
+            return;
+
+        // Only this thread records, so the records are complete
+        shared_ptr<vector<Profiler::Record>> records ( new vector<Profiler::Record> ( Profiler::get().getRecords() ) );
+        Profiler::get().clear();
+
+        const Profiler::PhaseHistograms phases = Profiler::aggregate ( *records );
+
+        for ( size_t i = 0; i < phases.size(); ++i )
+        {
+            if ( phases[i].getNumSamples() )
+                LOG ( "Profiler %s: %s ns", Profiler::getPhaseName ( ProfilePhase ( i ) ), phases[i].str() );
+        }
+
+        // Formatting and writing the trace takes several ms, so it's done on the worker pool with its own copy of the
+        // records. This interval's trace is skipped if the last one is still being written.
+        if ( writingTrace.exchange ( true ) )
+            return;
+
+        WorkerPool::get().submit ( [records]()
+        {
+            if ( !Profiler::writeChromeTrace ( *records, ProcessManager::appDir + PROFILER_TRACE_FILE ) )
+                LOG ( "Failed to write '%s'", ProcessManager::appDir + PROFILER_TRACE_FILE );
+
+            writingTrace = false;
+        } );
+    }
+
+    void sendStateHashes()
+    {
+        DesyncDetector& detector = rollMan.desyncDetector;
+
+        // States up to the last remote input will never be rolled back, except after a rollback that is still
+        // pending, ie delayed by the rollback spacing, since those were simulated with mispredicted inputs
+        detector.confirm ( netMan.getRemoteIndexedFrame().value, netMan.getLastChangedFrame().value );
+
+        if ( netMan.getFrame() % STATE_HASHES_INTERVAL != 0 && !detector.isDesynced() )
+            return;
+
+        shared_ptr<StateHashes> msg = makePooled<StateHashes>();
+        const bool hasHashes = detector.popOutgoing ( msg->frames, msg->hashes );
+        const bool hasRegions = detector.popOutgoingRegions ( msg->regionsFrame.value, msg->regionHashes );
+
+        if ( hasHashes || hasRegions )
+            dataSocket->send ( msg );
+    }
+
+    void desyncDetected ( DesyncDetector *detector, uint64_t indexedFrame, int region ) override
+    {
+        IndexedFrame divergentFrame;
+        divergentFrame.value = indexedFrame;
+
+        LOG ( "Desync at [%s]: region=%d", divergentFrame, region );
+        LOG_TO ( syncLog, "Desync: state diverged at [%s]; region=%d", divergentFrame, region );
+
+#ifndef RELEASE
+        DllOverlayUi::showMessage ( format ( "Desync at [%s], region %d", divergentFrame, region ) );
+#endif // NOT RELEASE
+    }
+
     void delayedStop ( const string& error )
     {
         if ( ! error.empty() )
@@ -1399,6 +1640,22 @@ struct DllMain
                 netMan.setRngState ( msg->getAs<RngState>() );
                 return;
 
+            case MsgType::StateHashes:
+            {
+                if ( socket != dataSocket.get() )
+                    break;
+
+                const StateHashes& stateHashes = msg->getAs<StateHashes>();
+                rollMan.desyncDetector.receive ( stateHashes.frames, stateHashes.hashes );
+
+                if ( !stateHashes.regionHashes.empty() )
+                {
+                    rollMan.desyncDetector.receiveRegions ( stateHashes.regionsFrame.value,
+                                                            stateHashes.regionHashes );
+                }
+                return;
+            }
+
 #ifndef RELEASE
             case MsgType::SyncHash:
                 remoteSync.push_back ( msg );
@@ -1560,6 +1817,11 @@ struct DllMain
                 syncLog.initialize ( ProcessManager::appDir + SYNC_LOG_FILE, 0 );
                 syncLog.logVersion();
 
+#ifndef RELEASE
+                // Profile the frame steps and rollbacks, the traces are written with the perf stats
+                Profiler::get().enable();
+#endif // NOT RELEASE
+
                 // Manually hit Alt+Enter to enable fullscreen
                 if ( options[Options::Fullscreen] && DllHacks::windowHandle == GetForegroundWindow() )
                 {
@@ -1634,6 +1896,12 @@ struct DllMain
                     const bool good = repMan.load ( replayFile, real );
                     ASSERT ( good == true );
 
+                    // Load the keyframes from previous playbacks, if the rollback memory layout is the same
+                    replayIndexFile = replayFile + REPLAY_INDEX_SUFFIX;
+
+                    if ( !replayIndex.load ( replayIndexFile, DllRollbackManager::getLayoutId() ) )
+                        replayIndex.clear ( DllRollbackManager::getLayoutId() );
+
                     // Parse start index
                     it = find ( args.begin(), args.end(), "start" );
                     if ( it != args.end() )
@@ -1965,6 +2233,8 @@ struct DllMain
         ChangeMonitor::get().addRef ( this, Variable ( Variable::GameState ), *CC_GAME_STATE_ADDR );
         netManPtr = &netMan;
 
+        rollMan.desyncDetector.owner = this;
+
 #ifndef RELEASE
         ChangeMonitor::get().addRef ( this, Variable ( Variable::MenuConfirmState ), AsmHacks::menuConfirmState );
         ChangeMonitor::get().addRef ( this, Variable ( Variable::CurrentMenuIndex ), AsmHacks::currentMenuIndex );
@@ -2033,6 +2303,11 @@ static void deinitialize()
 
     mainApp.reset();
 
+    // Finish any background writes, ie the profiler trace, before the logger goes away
+    WorkerPool::get().wait();
+
+    AssetPrefetcher::get().stop();
+
     EventManager::get().release();
     TimerManager::get().deinitialize();
     SocketManager::get().deinitialize();
@@ -3,7 +3,6 @@
 #include "ProcessManager.hpp"
 #include "Exceptions.hpp"
 #include "CharacterSelect.hpp"
-#include "ReplayCreator.hpp"
 #include "DllTrialManager.hpp"
 
 #include <algorithm>
@@ -11,7 +10,6 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <ctime>
-#include <fstream>
 
 using namespace std;
 
@@ -140,7 +138,7 @@ uint16_t NetplayManager::getDemoInput ( uint8_t player )
         return playerInput;
     }
     LOG("demoinput");
-    Trial currentTrial = TrialManager::charaTrials[TrialManager::currentTrialIndex];
+    const Trial& currentTrial = TrialManager::charaTrials[TrialManager::currentTrialIndex];
     if ( exitCountdown > 0 ) {
         exitCountdown--;
         if ( exitCountdown == 20 ) {
@@ -231,7 +229,7 @@ uint16_t NetplayManager::getInGameInput ( uint8_t player )
                 _trainingResetType = 0;
 
             input |= COMBINE_INPUT ( 0, CC_BUTTON_FN2 );
-            TrialManager::comboTrialPosition = 0;
+            TrialManager::comboProgress.position = 0;
             *CC_P1_COMBO_GUARD_ADDR = 50;
         }
         else if ( ( _trainingResetState == -2 || _trainingResetState >= 0 )
@@ -653,6 +651,9 @@ void NetplayManager::setState ( NetplayState state )
             _roundRngStates.push_back(rngState);
         }
 
+        // Pick up the status of any background exports at state transitions, never per frame
+        checkExports();
+
         // Entering RetryMenu
         if ( state == NetplayState::RetryMenu )
         {
@@ -771,14 +772,15 @@ MsgPtr NetplayManager::getInputs ( uint8_t player ) const
     ASSERT ( getIndex() >= _startIndex );
     ASSERT ( _inputs[player - 1].getEndFrame ( getIndex() - _startIndex ) >= 1 );
 
-    PlayerInputs *playerInputs = new PlayerInputs ( { _inputs[player - 1].getEndFrame() - 1, getIndex() } );
+    shared_ptr<PlayerInputs> playerInputs =
+        makePooled<PlayerInputs> ( IndexedFrame {{ _inputs[player - 1].getEndFrame() - 1, getIndex() }} );
 
     ASSERT ( playerInputs->getIndex() >= _startIndex );
 
     _inputs[player - 1].get ( playerInputs->getIndex() - _startIndex, playerInputs->getStartFrame(),
                               &playerInputs->inputs[0], playerInputs->size() );
 
-    return MsgPtr ( playerInputs );
+    return playerInputs;
 }
 
 void NetplayManager::setInputs ( uint8_t player, const PlayerInputs& playerInputs )
@@ -854,7 +856,7 @@ MsgPtr NetplayManager::getBothInputs ( IndexedFrame& pos ) const
         }
     }
 
-    BothInputs *bothInputs = new BothInputs ( orig );
+    shared_ptr<BothInputs> bothInputs = makePooled<BothInputs> ( orig );
 
     ASSERT ( bothInputs->getIndex() >= _startIndex );
 
@@ -864,7 +866,7 @@ MsgPtr NetplayManager::getBothInputs ( IndexedFrame& pos ) const
     _inputs[1].get ( bothInputs->getIndex() - _startIndex, bothInputs->getStartFrame(),
                      &bothInputs->inputs[1][0], bothInputs->size() );
 
-    return MsgPtr ( bothInputs );
+    return bothInputs;
 }
 
 void NetplayManager::setBothInputs ( const BothInputs& bothInputs )
@@ -1073,76 +1075,84 @@ bool NetplayManager::isValidNext ( NetplayState next )
     return ( it->second.find ( next.value ) != it->second.end() );
 }
 
-void NetplayManager::exportInputs() {
-    char buf[1000];
-    char namebuf[1000];
-    char namebuf2[1000];
+void NetplayManager::exportInputs()
+{
     char timebuf[200];
 
-    std::time_t now = time( NULL );
-    strftime( timebuf, 20, "%y%m%d-%H%M%S", localtime( &now ) );
-
-    sprintf( namebuf, "ReplayVS/%sx%s_%s.repraw",
-             getShortCharaName( *CC_P1_CHARACTER_ADDR ),
-             getShortCharaName( *CC_P2_CHARACTER_ADDR) ,
-             timebuf );
-    ofstream repFile2 ( namebuf, ios::out );
-    vector<int> c = getInGameIndexes();
-    repFile2 << c.size() << endl;
-    for ( int q : c ) {
-        sprintf( buf, "%d\n", _inputs[0].getEndFrame( q ) );
-        repFile2 << buf;
-        for ( uint32_t i = 0; i < _inputs[0].getEndFrame( q ); ++i ) {
-            sprintf( buf, "%04x %04x\n",
-                     _inputs[0].get ( q, i ),
-                     _inputs[1].get ( q, i ) );
-            repFile2 << buf;
-        }
+    std::time_t now = time ( NULL );
+    strftime ( timebuf, 20, "%y%m%d-%H%M%S", localtime ( &now ) );
+
+    // Snapshot the inputs on the game thread, everything else happens on the export thread
+    shared_ptr<ReplayExporter::InputsSnapshot> snapshot ( new ReplayExporter::InputsSnapshot() );
+
+    snapshot->rawPath = format ( "ReplayVS/%sx%s_%s.repraw",
+                                 getShortCharaName ( *CC_P1_CHARACTER_ADDR ),
+                                 getShortCharaName ( *CC_P2_CHARACTER_ADDR ),
+                                 timebuf );
+
+    if ( AsmHacks::replayName )
+    {
+        snapshot->replayPath = AsmHacks::replayName;
+        snapshot->fixedReplayPath = snapshot->replayPath + "2.rep";
     }
-    repFile2.close();
 
-    sprintf( namebuf2, "%s2.rep", ( char* ) AsmHacks::replayName );
-    ReplayCreator::ReplayFile f;
-    ReplayCreator r;
-    r.load( &f, ( char* )AsmHacks::replayName );
-    r.fixReplay( &f, namebuf, NULL );
-    r.dump( f, namebuf2 );
+    for ( int q : getInGameIndexes() )
+    {
+        const uint32_t endFrame = _inputs[0].getEndFrame ( q );
+
+        snapshot->rounds.push_back ( {} );
+        snapshot->rounds.back().reserve ( endFrame );
 
-    exported = true;
+        for ( uint32_t i = 0; i < endFrame; ++i )
+            snapshot->rounds.back().push_back ( { _inputs[0].get ( q, i ), _inputs[1].get ( q, i ) } );
+    }
+
+    _exporter.exportInputs ( snapshot );
 }
 
 void NetplayManager::exportResults()
 {
-    ofstream resFile;
-    resFile.open( "results.csv", ios::out | ios::app );
-    char buf[ 1000 + config.names[0].length() + config.names[1].length() ];
     string moon[3] = { "C", "F", "H" };
     std::time_t now = time( NULL );
     string n1 = sanitizePlayerName( config.names[0] );
     string n2 = sanitizePlayerName( config.names[1] );
+    string line;
     if ( _localPlayer == 1 ) {
-        sprintf( buf, "%s,%s-%s,%d,%s,%s-%s,%d,%d",
-                 n1.c_str(), moon[*CC_P1_MOON_SELECTOR_ADDR].c_str(),
-                 getShortCharaName(*CC_P1_CHARACTER_ADDR),
-                 *CC_P1_WINS_ADDR,
-                 n2.c_str(), moon[*CC_P2_MOON_SELECTOR_ADDR].c_str(),
-                 getShortCharaName(*CC_P2_CHARACTER_ADDR),
-                 *CC_P2_WINS_ADDR,
-                 (int)now
-               );
+        line = format( "%s,%s-%s,%d,%s,%s-%s,%d,%d",
+                       n1, moon[*CC_P1_MOON_SELECTOR_ADDR],
+                       getShortCharaName(*CC_P1_CHARACTER_ADDR),
+                       *CC_P1_WINS_ADDR,
+                       n2, moon[*CC_P2_MOON_SELECTOR_ADDR],
+                       getShortCharaName(*CC_P2_CHARACTER_ADDR),
+                       *CC_P2_WINS_ADDR,
+                       (int)now
+                     );
     } else {
-        sprintf( buf, "%s,%s-%s,%d,%s,%s-%s,%d,%d",
-                 n2.c_str(), moon[*CC_P2_MOON_SELECTOR_ADDR].c_str(),
-                 getShortCharaName(*CC_P2_CHARACTER_ADDR),
-                 *CC_P2_WINS_ADDR,
-                 n1.c_str(), moon[*CC_P1_MOON_SELECTOR_ADDR].c_str(),
-                 getShortCharaName(*CC_P1_CHARACTER_ADDR),
-                 *CC_P1_WINS_ADDR,
-                 (int)now
-               );
+        line = format( "%s,%s-%s,%d,%s,%s-%s,%d,%d",
+                       n2, moon[*CC_P2_MOON_SELECTOR_ADDR],
+                       getShortCharaName(*CC_P2_CHARACTER_ADDR),
+                       *CC_P2_WINS_ADDR,
+                       n1, moon[*CC_P1_MOON_SELECTOR_ADDR],
+                       getShortCharaName(*CC_P1_CHARACTER_ADDR),
+                       *CC_P1_WINS_ADDR,
+                       (int)now
+                     );
+    }
+    _exporter.exportResult ( "results.csv", line );
+}
+
+void NetplayManager::checkExports()
+{
+    ReplayExporter::Status status;
+
+    while ( _exporter.popCompleted ( status ) )
+    {
+        LOG ( "Exported %s: success=%u; path='%s'",
+              status.type == ReplayExporter::Status::Inputs ? "inputs" : "results", status.success, status.path );
+
+        if ( status.type == ReplayExporter::Status::Inputs && status.success )
+            exported = true;
     }
-    resFile << buf << endl;
-    resFile.close();
 }
 
 void NetplayManager::resetInGameIndexes() {
@@ -3,6 +3,7 @@
 #include "Messages.hpp"
 #include "InputsContainer.hpp"
 #include "NetplayStates.hpp"
+#include "ReplayExporter.hpp"
 
 #include <vector>
 #include <climits>
@@ -69,6 +70,9 @@ public:
     // Log Results
     void exportResults();
 
+    // Collect the status of finished background exports
+    void checkExports();
+
     // Get / set the current NetplayState
     NetplayState getState() const { return _state; }
     void setState ( NetplayState state );
@@ -198,6 +202,9 @@ private:
     // Exported
     bool exported = false;
 
+    // Writes replays and results off the game thread
+    ReplayExporter _exporter;
+
     // Separate delays for p1/p2
     bool splitDelay = true;
 
@@ -442,8 +442,8 @@ void renderOverlayText ( IDirect3DDevice9 *device, const D3DVIEWPORT9& viewport
         rect.left = 30;
         for ( wstring text : TrialManager::comboTrialText ) {
             TextCalcRectW( font, text, rect, DT_LEFT, 0);
-            D3DCOLOR color = ( TrialManager::comboTrialPosition > i ) ? OVERLAY_BUTTON_DONE_COLOR :
-              ( TrialManager::comboTrialPosition == i ) ? OVERLAY_DEBUG_COLOR : OVERLAY_BUTTON_COLOR;
+            D3DCOLOR color = ( TrialManager::comboProgress.position > i ) ? OVERLAY_BUTTON_DONE_COLOR :
+              ( TrialManager::comboProgress.position == i ) ? OVERLAY_DEBUG_COLOR : OVERLAY_BUTTON_COLOR;
             DrawTextW ( font, text, rect, DT_WORDBREAK |
                    ( TrialManager::comboTrialTextAlign == 0 ? DT_CENTER : ( TrialManager::comboTrialTextAlign < 0 ? DT_LEFT : DT_RIGHT ) ),
                        color );
@@ -1,4 +1,5 @@
 #include "PaletteManager.hpp"
+#include "AssetPrefetcher.hpp"
 #include "DllAsmHacks.hpp"
 #include "Logger.hpp"
 #include "CharacterSelect.hpp"
@@ -23,8 +24,33 @@ void colorLoadCallback ( uint32_t player, uint32_t chara, uint32_t *allPaletteDa
 
     if ( palMans[player - 1].find ( chara ) == palMans[player - 1].end() )
     {
-        palMans[player - 1][chara].cache ( ( const uint32_t * ) allPaletteData );
-        palMans[player - 1][chara].load ( ProcessManager::appDir + PALETTES_FOLDER, charaName );
+        PaletteManager& palMan = palMans[player - 1][chara];
+
+        // Mirror matches can reuse the other player's palettes, otherwise use the palettes loaded during
+        // character select if they are ready, and only load them now as a last resort.
+        const auto other = palMans[2 - player].find ( chara );
+        unique_ptr<AssetPrefetcher::Palettes> prefetched;
+
+        if ( other != palMans[2 - player].end() )
+        {
+            palMan = other->second;
+            palMan.cache ( ( const uint32_t * ) allPaletteData );
+        }
+        else if ( ( prefetched = AssetPrefetcher::get().takePalettes ( chara ) ) )
+        {
+            if ( prefetched->loaded )
+                palMan = prefetched->palMan;
+
+            palMan.cache ( ( const uint32_t * ) allPaletteData );
+            palMan.optimize();
+        }
+        else
+        {
+            LOG ( "Palettes not prefetched" );
+
+            palMan.cache ( ( const uint32_t * ) allPaletteData );
+            palMan.load ( ProcessManager::appDir + PALETTES_FOLDER, charaName );
+        }
     }
 
     palMans[player - 1][chara].apply ( allPaletteData );
@@ -2,34 +2,55 @@
 #include "MemDump.hpp"
 #include "DllAsmHacks.hpp"
 #include "ErrorStringsExt.hpp"
+#include "ProcessManager.hpp"
+#include "Profiler.hpp"
 
 #include <utility>
 #include <algorithm>
+#include <chrono>
 
 using namespace std;
 
 
-// Linked rollback memory data (binary message format)
+// Non-release builds use this rollback memory data instead of the linked one if it exists
+#define ROLLBACK_LAYOUT_FILE FOLDER "rollback.bin"
+
+
+// Linked rollback memory data (flat layout format)
 extern const unsigned char binary_res_rollback_bin_start;
 extern const unsigned char binary_res_rollback_bin_end;
 
-// Deserialized rollback memory data
-static MemDumpList allAddrs;
+// Rollback memory data, used in place from the linked data or a memory mapped file
+static MemDumpLayout allAddrs;
+
+// Nanoseconds since an arbitrary point, for timing saves and loads
+static inline uint64_t getNowNs()
+{
+    return chrono::duration_cast<chrono::nanoseconds> ( chrono::steady_clock::now().time_since_epoch() ).count();
+}
 
-template<typename T>
-static inline void deleteArray ( T *ptr ) { delete[] ptr; }
+// Header of a game state in the history, followed by the raw bytes then the slot arrays
+struct HistoryHeader
+{
+    uint64_t indexedFrame;
+    uint32_t netplayState, startWorldTime;
+    std::fenv_t fp_env;
+};
 
 
-void DllRollbackManager::GameState::save()
+void DllRollbackManager::GameState::save ( vector<uint64_t>& hashes )
 {
     ASSERT ( rawBytes != 0 );
+    ASSERT ( hashes.size() == allAddrs.plan.getNumRegions() + allAddrs.slots.size() );
+
+    allAddrs.plan.saveDump ( rawBytes, &hashes[0] );
 
-    char *dump = rawBytes;
+    ASSERT ( slotBytes != 0 );
 
-    for ( const MemDump& mem : allAddrs.addrs )
-        mem.saveDump ( dump );
+    slotBytes->clear();
 
-    ASSERT ( dump == rawBytes + allAddrs.totalSize );
+    for ( size_t i = 0; i < allAddrs.slots.size(); ++i )
+        allAddrs.slots[i].saveDump ( *slotBytes, &hashes [ allAddrs.plan.getNumRegions() + i ] );
 }
 
 void DllRollbackManager::GameState::load()
@@ -38,32 +59,89 @@ void DllRollbackManager::GameState::load()
 
     ASSERT ( rawBytes != 0 );
 
-    const char *dump = rawBytes;
+    allAddrs.plan.loadDump ( rawBytes );
+
+    ASSERT ( slotBytes != 0 );
+
+    const char *dump = slotBytes->data();
+
+    for ( const MemDumpSlots& array : allAddrs.slots )
+        array.loadDump ( dump );
+
+    ASSERT ( dump == slotBytes->data() + slotBytes->size() );
+}
+
+void DllRollbackManager::GameState::saveHistory ( vector<char>& buffer ) const
+{
+    ASSERT ( rawBytes != 0 );
+    ASSERT ( slotBytes != 0 );
+
+    const HistoryHeader header = { indexedFrame.value, ( uint32_t ) netplayState.value, startWorldTime, fp_env };
+
+    buffer.resize ( sizeof ( header ) + allAddrs.totalSize + slotBytes->size() );
+
+    memcpy ( &buffer[0], &header, sizeof ( header ) );
+    memcpy ( &buffer [ sizeof ( header ) ], rawBytes, allAddrs.totalSize );
+
+    if ( !slotBytes->empty() )
+        memcpy ( &buffer [ sizeof ( header ) + allAddrs.totalSize ], slotBytes->data(), slotBytes->size() );
+}
+
+bool DllRollbackManager::GameState::loadHistory ( const vector<char>& buffer )
+{
+    ASSERT ( rawBytes != 0 );
+    ASSERT ( slotBytes != 0 );
+
+    if ( buffer.size() < sizeof ( HistoryHeader ) + allAddrs.totalSize )
+        return false;
+
+    HistoryHeader header;
+    memcpy ( &header, &buffer[0], sizeof ( header ) );
 
-    for ( const MemDump& mem : allAddrs.addrs )
-        mem.loadDump ( dump );
+    netplayState = ( NetplayState::Enum ) header.netplayState;
+    startWorldTime = header.startWorldTime;
+    indexedFrame.value = header.indexedFrame;
+    fp_env = header.fp_env;
 
-    ASSERT ( dump == rawBytes + allAddrs.totalSize );
+    memcpy ( rawBytes, &buffer [ sizeof ( header ) ], allAddrs.totalSize );
+    slotBytes->assign ( buffer.begin() + sizeof ( header ) + allAddrs.totalSize, buffer.end() );
+    return true;
 }
 
-void DllRollbackManager::allocateStates()
+// Load the rollback memory data once, from the layout file if there is one, otherwise from the linked data
+static void loadLayout()
 {
+#ifndef RELEASE
+    if ( allAddrs.empty() && allAddrs.load ( ProcessManager::appDir + ROLLBACK_LAYOUT_FILE ) )
+        LOG ( "Using '%s'", ProcessManager::appDir + ROLLBACK_LAYOUT_FILE );
+#endif // NOT RELEASE
+
     if ( allAddrs.empty() )
     {
         const size_t size = ( ( char * ) &binary_res_rollback_bin_end ) - ( char * ) &binary_res_rollback_bin_start;
         allAddrs.load ( ( char * ) &binary_res_rollback_bin_start, size );
     }
+}
+
+void DllRollbackManager::allocateStates ( bool keepHistory )
+{
+    loadLayout();
 
     if ( allAddrs.empty() )
         THROW_EXCEPTION ( "Failed to load rollback data!", ERROR_BAD_ROLLBACK_DATA );
 
-    if ( ! _memoryPool )
-        _memoryPool.reset ( new char[NUM_ROLLBACK_STATES * allAddrs.totalSize], deleteArray<char> );
+    _stateHashes.resize ( allAddrs.plan.getNumRegions() + allAddrs.slots.size() );
+
+    desyncDetector.clear();
 
-    for ( size_t i = 0; i < NUM_ROLLBACK_STATES; ++i )
-        _freeStack.push ( i * allAddrs.totalSize );
+    _states.allocate ( NUM_ROLLBACK_STATES, allAddrs.totalSize );
 
-    _statesList.clear();
+    if ( !keepHistory )
+        _history.reset();
+    else if ( _history )
+        _history->clear();
+    else
+        _history.reset ( new StateHistory ( ROLLBACK_HISTORY_BUDGET, ROLLBACK_HISTORY_KEYFRAMES ) );
 
     for ( auto& sfxArray : _sfxHistory )
         memset ( &sfxArray[0], 0, CC_SFX_ARRAY_LEN );
@@ -71,152 +149,266 @@ void DllRollbackManager::allocateStates()
 
 void DllRollbackManager::deallocateStates()
 {
-    _memoryPool.reset();
+    _states.deallocate();
 
-    while ( ! _freeStack.empty() )
-        _freeStack.pop();
-
-    _statesList.clear();
+    _history.reset();
+    vector<char>().swap ( _historyBuffer );
 }
 
 void DllRollbackManager::saveState ( const NetplayManager& netMan )
 {
-    if ( _freeStack.empty() )
-    {
-        ASSERT ( _statesList.empty() == false );
+    PROFILE_SCOPE ( ProfilePhase::SaveState, netMan.getFrame() );
 
-        if ( _statesList.front().indexedFrame.parts.frame <= netMan.getRemoteFrame() )
-        {
-            auto it = _statesList.begin();
-            ++it;
-            _freeStack.push ( it->rawBytes - _memoryPool.get() );
-            _statesList.erase ( it );
-        }
-        else
-        {
-            _freeStack.push ( _statesList.front().rawBytes - _memoryPool.get() );
-            _statesList.pop_front();
-        }
-    }
+    // The evicted state goes to the history before its buffer is reused
+    if ( const GameState *evicted = _states.getEvicted ( netMan.getRemoteFrame() ) )
+        pushHistory ( *evicted );
 
     std::fenv_t fp_env;
 
     fegetenv(&fp_env);
 
-    GameState state =
+    GameState& state = _states.push (
     {
         netMan._state,
         netMan._startWorldTime,
         netMan._indexedFrame,
         fp_env,
-        _memoryPool.get() + _freeStack.top()
-    };
+        0,
+        0
+    }, netMan.getRemoteFrame() );
 
-    _freeStack.pop();
-    state.save();
-    _statesList.push_back ( state );
+    const uint64_t start = getNowNs();
+    state.save ( _stateHashes );
+    saveTimes.addSample ( getNowNs() - start );
+
+    desyncDetector.record ( state.indexedFrame.value, _stateHashes );
 
     uint8_t *currentSfxArray = &_sfxHistory [ netMan.getFrame() % NUM_ROLLBACK_STATES ][0];
     memcpy ( currentSfxArray, AsmHacks::sfxFilterArray, CC_SFX_ARRAY_LEN );
+
+#ifndef RELEASE
+    // Slots that weren't saved are zeroed on load, so check once a second that the dump restores every slot exactly
+    if ( netMan.getFrame() % 60 == 0 )
+    {
+        const char *dump = state.slotBytes->data();
+
+        for ( const MemDumpSlots& array : allAddrs.slots )
+        {
+            const size_t numMismatched = array.countMismatchedSlots ( dump );
+
+            if ( numMismatched )
+            {
+                LOG ( "Slot array 0x%06X has %u slots that won't be restored",
+                      array.addr, ( uint32_t ) numMismatched );
+            }
+
+            ASSERT ( numMismatched == 0 );
+        }
+    }
+#endif // NOT RELEASE
 }
 
 bool DllRollbackManager::loadState ( IndexedFrame indexedFrame, NetplayManager& netMan )
 {
-    if ( _statesList.empty() )
+    // Frames older than all the saved states can only be loaded from the history
+    if ( _history && ( _states.empty() || indexedFrame.value < _states.front().indexedFrame.value ) )
+    {
+        if ( loadHistoryState ( indexedFrame, netMan ) )
+            return true;
+    }
+
+    if ( _states.empty() )
     {
         LOG ( "Failed to load state: indexedFrame=%s", indexedFrame );
         return false;
     }
 
-    LOG ( "Trying to load state: indexedFrame=%s; _statesList={ %s ... %s }",
-          indexedFrame, _statesList.front().indexedFrame, _statesList.back().indexedFrame );
+    LOG ( "Trying to load state: indexedFrame=%s; _states={ %s ... %s }",
+          indexedFrame, _states.front().indexedFrame, _states.back().indexedFrame );
 
     const uint32_t origFrame = netMan.getFrame();
 
-    for ( auto it = _statesList.rbegin(); it != _statesList.rend(); ++it )
-    {
 #ifdef RELEASE
-        if ( ( it->indexedFrame.value <= indexedFrame.value ) || ( & ( *it ) == &_statesList.front() ) )
+    GameState *it = _states.find ( indexedFrame, true );
 #else
-        if ( it->indexedFrame.value <= indexedFrame.value )
+    GameState *it = _states.find ( indexedFrame );
 #endif
-        {
-            LOG ( "Loaded state: indexedFrame=%s", it->indexedFrame );
-
-            // Overwrite the current game state
-            netMan._state = it->netplayState;
-            netMan._startWorldTime = it->startWorldTime;
-            netMan._indexedFrame = it->indexedFrame;
-            it->load();
-
-            // Count the number of frames rolled back
-            int rbFrames;
-            if ( !netMan.config.mode.isTraining() ) {
-                int rbFrames = _statesList.back().indexedFrame.value - it->indexedFrame.value;
-                LOG("Rolled back %i frames", rbFrames);
-            }
-            // Erase all other states after the current one.
-            // Note: it.base() returns 1 after the position of it, but moving forward.
-            for ( auto jt = it.base(); jt != _statesList.end(); ++jt )
-            {
-                _freeStack.push ( jt->rawBytes - _memoryPool.get() );
-            }
 
-            // Disable rollback for input history if in training mode
-            if ( !netMan.config.mode.isTraining() ) {
-                // Erase one frame of inputs from the game's replay structs for each frame rolled back.
-                for (; rbFrames > 0; rbFrames--) {
-                    if (!*(RepRound**)CC_REPROUND_TBL_ENDPTR_ADDR) break;
-                    RepRound* curRound = (*(RepRound**)CC_REPROUND_TBL_ENDPTR_ADDR - 1);
-                    if (!curRound->inputs) break;
-                    // Assumes there are always containers for 4 players in input container table; may not be true
-                    for (int i=0; i<4; i++) {
-                        RepInputContainer* inputs = &(curRound->inputs[i]);
-                        if (!inputs->states) continue;
-                        RepInputState* state = &(inputs->states[inputs->activeIndex]);
-                        if (!state->frameCount) continue;
-                        if (state->frameCount == 1) {
-                            memset(state, 0, sizeof(RepInputState));
-                            inputs->statesEnd -= sizeof(RepInputState);
-                            LOG("Replay state %i for p%i has frame count 1; decrementing index", inputs->activeIndex, i+1);
-                            inputs->activeIndex--;
-                        } else {
-                            LOG("Replay state %i for p%i has frame count %i; decrementing count", inputs->activeIndex, i+1, state->frameCount);
-                            state->frameCount--;
-                        }
-                    }
+    if ( !it )
+    {
+        LOG ( "Failed to load state: indexedFrame=%s", indexedFrame );
+        return false;
+    }
+
+    LOG ( "Loaded state: indexedFrame=%s", it->indexedFrame );
+
+    // Overwrite the current game state
+    netMan._state = it->netplayState;
+    netMan._startWorldTime = it->startWorldTime;
+    netMan._indexedFrame = it->indexedFrame;
+
+    const uint64_t start = getNowNs();
+    it->load();
+    loadTimes.addSample ( getNowNs() - start );
+
+    if ( origFrame >= it->indexedFrame.parts.frame )
+        rollbackDepths.addSample ( origFrame - it->indexedFrame.parts.frame );
+
+    // States after this one are not saved again during the re-run
+    desyncDetector.rewind ( it->indexedFrame.value );
+
+    if ( _history )
+        _history->discardAfter ( it->indexedFrame.value );
+
+    // Count the number of frames rolled back
+    int rbFrames;
+    if ( !netMan.config.mode.isTraining() ) {
+        int rbFrames = _states.back().indexedFrame.value - it->indexedFrame.value;
+        LOG("Rolled back %i frames", rbFrames);
+    }
+
+    // Disable rollback for input history if in training mode
+    if ( !netMan.config.mode.isTraining() ) {
+        // Erase one frame of inputs from the game's replay structs for each frame rolled back.
+        for (; rbFrames > 0; rbFrames--) {
+            if (!*(RepRound**)CC_REPROUND_TBL_ENDPTR_ADDR) break;
+            RepRound* curRound = (*(RepRound**)CC_REPROUND_TBL_ENDPTR_ADDR - 1);
+            if (!curRound->inputs) break;
+            // Assumes there are always containers for 4 players in input container table; may not be true
+            for (int i=0; i<4; i++) {
+                RepInputContainer* inputs = &(curRound->inputs[i]);
+                if (!inputs->states) continue;
+                RepInputState* state = &(inputs->states[inputs->activeIndex]);
+                if (!state->frameCount) continue;
+                if (state->frameCount == 1) {
+                    memset(state, 0, sizeof(RepInputState));
+                    inputs->statesEnd -= sizeof(RepInputState);
+                    LOG("Replay state %i for p%i has frame count 1; decrementing index", inputs->activeIndex, i+1);
+                    inputs->activeIndex--;
+                } else {
+                    LOG("Replay state %i for p%i has frame count %i; decrementing count", inputs->activeIndex, i+1, state->frameCount);
+                    state->frameCount--;
                 }
             }
+        }
+    }
 
-            _statesList.erase ( it.base(), _statesList.end() );
+    // Erase all other states after the current one
+    _states.eraseAfter ( it );
 
-            // Initialize the SFX filter by flagging all played SFX flags in the range (R,S),
-            // where R is the actual reset frame, and S is the original starting frame.
-            // Note: we can skip frame S, because the current SFX filter array is already initialized by frame S.
-            for ( uint32_t i = netMan.getFrame() + 1; i < origFrame; ++i )
-            {
-                for ( uint32_t j = 0; j < CC_SFX_ARRAY_LEN; ++j )
-                    AsmHacks::sfxFilterArray[j] |= _sfxHistory [ i % NUM_ROLLBACK_STATES ][j];
-            }
+    // Initialize the SFX filter by flagging all played SFX flags in the range (R,S),
+    // where R is the actual reset frame, and S is the original starting frame.
+    // Note: we can skip frame S, because the current SFX filter array is already initialized by frame S.
+    for ( uint32_t i = netMan.getFrame() + 1; i < origFrame; ++i )
+    {
+        for ( uint32_t j = 0; j < CC_SFX_ARRAY_LEN; ++j )
+            AsmHacks::sfxFilterArray[j] |= _sfxHistory [ i % NUM_ROLLBACK_STATES ][j];
+    }
 
-            // We set the SFX filter flag to 0x80. Since played (but filtered) SFX are incremented,
-            // unplayed sound effects in the filter will stay as 0 or 0x80.
-            for ( uint32_t j = 0; j < CC_SFX_ARRAY_LEN; ++j )
-            {
-                if ( AsmHacks::sfxFilterArray[j] )
-                    AsmHacks::sfxFilterArray[j] = 0x80;
-            }
+    // We set the SFX filter flag to 0x80. Since played (but filtered) SFX are incremented,
+    // unplayed sound effects in the filter will stay as 0 or 0x80.
+    for ( uint32_t j = 0; j < CC_SFX_ARRAY_LEN; ++j )
+    {
+        if ( AsmHacks::sfxFilterArray[j] )
+            AsmHacks::sfxFilterArray[j] = 0x80;
+    }
 
-            return true;
-        }
+    return true;
+}
+
+void DllRollbackManager::pushHistory ( const GameState& state )
+{
+    if ( !_history )
+        return;
+
+    // The evicted state's buffers are reused by the next save, so the state is copied here on the game thread,
+    // only the compression runs on the WorkerPool. This is one memcpy of the state into a recycled buffer, which
+    // is cheaper than the save itself, see historyTimes. It only happens in training and replay modes.
+    const uint64_t start = getNowNs();
+    vector<char> buffer = _history->getBuffer();
+    state.saveHistory ( buffer );
+    _history->push ( state.indexedFrame.value, move ( buffer ) );
+    historyTimes.addSample ( getNowNs() - start );
+}
+
+bool DllRollbackManager::loadHistoryState ( IndexedFrame indexedFrame, NetplayManager& netMan )
+{
+    uint64_t restored = 0;
+
+    if ( !_history->restore ( indexedFrame.value, _historyBuffer, restored ) )
+        return false;
+
+    if ( !loadStateBuffer ( _historyBuffer, netMan ) )
+        return false;
+
+    LOG ( "Loaded history state: indexedFrame=%s; target=%s", netMan._indexedFrame, indexedFrame );
+    return true;
+}
+
+bool DllRollbackManager::copyLatestState ( vector<char>& buffer ) const
+{
+    if ( _states.empty() )
+        return false;
+
+    _states.back().saveHistory ( buffer );
+    return true;
+}
+
+bool DllRollbackManager::loadStateBuffer ( const vector<char>& buffer, NetplayManager& netMan )
+{
+    if ( !_states.isAllocated() || buffer.size() < sizeof ( HistoryHeader ) + allAddrs.totalSize )
+        return false;
+
+    // The loaded state replaces all the saved states, since they may be from a different timeline
+    _states.clear();
+
+    GameState& state = _states.push ( GameState(), 0 );
+
+    if ( !state.loadHistory ( buffer ) )
+    {
+        _states.clear();
+        return false;
     }
 
-    LOG ( "Failed to load state: indexedFrame=%s", indexedFrame );
-    return false;
+    netMan._state = state.netplayState;
+    netMan._startWorldTime = state.startWorldTime;
+    netMan._indexedFrame = state.indexedFrame;
+    state.load();
+
+    if ( _history )
+        _history->discardAfter ( state.indexedFrame.value );
+
+    desyncDetector.rewind ( state.indexedFrame.value );
+
+    // There is no sound effect history for this state, so only the current sound effects are filtered
+    for ( uint32_t j = 0; j < CC_SFX_ARRAY_LEN; ++j )
+    {
+        if ( AsmHacks::sfxFilterArray[j] )
+            AsmHacks::sfxFilterArray[j] = 0x80;
+    }
+
+    return true;
+}
+
+uint32_t DllRollbackManager::getLayoutId()
+{
+    loadLayout();
+
+    // FNV-1a hash of the rollback memory data in use, which may be the layout file instead of the linked data
+    const string layout = allAddrs.save();
+
+    uint32_t hash = 2166136261u;
+
+    for ( char c : layout )
+        hash = ( hash ^ ( unsigned char ) c ) * 16777619u;
+
+    return hash;
 }
 
 void DllRollbackManager::saveRerunSounds ( uint32_t frame )
 {
+    PROFILE_SCOPE ( ProfilePhase::RerunSounds, frame );
+
     uint8_t *currentSfxArray = &_sfxHistory [ frame % NUM_ROLLBACK_STATES ][0];
 
     // Rewrite the sound effects history during re-run
@@ -231,6 +423,8 @@ void DllRollbackManager::saveRerunSounds ( uint32_t frame )
 
 void DllRollbackManager::finishedRerunSounds()
 {
+    PROFILE_SCOPE ( ProfilePhase::RerunSounds );
+
     // Cancel unplayed sound effects after rollback
     for ( uint32_t j = 0; j < CC_SFX_ARRAY_LEN; ++j )
     {
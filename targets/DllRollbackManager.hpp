@@ -1,13 +1,16 @@
 #pragma once
 
 #include "DllNetplayManager.hpp"
+#include "DesyncDetector.hpp"
+#include "RollbackStates.hpp"
+#include "StateHistory.hpp"
+#include "Histogram.hpp"
 #include "Constants.hpp"
 
 #include <memory>
-#include <stack>
-#include <list>
 #include <array>
 #include <cfenv>
+#include <vector>
 
 struct __attribute__((packed)) RepInputState
 {
@@ -40,14 +43,31 @@ class DllRollbackManager
 {
 public:
 
-    // Allocate / deallocate memory for saving game states
-    void allocateStates();
+    // Compares the hashes of saved states with the remote
+    DesyncDetector desyncDetector;
+
+    // Frames rolled back by each load, and the time taken by each save / load in nanoseconds
+    Histogram rollbackDepths, saveTimes, loadTimes;
+
+    // Time taken to copy each evicted state to the history in nanoseconds
+    Histogram historyTimes;
+
+    // Allocate / deallocate memory for saving game states.
+    // If keepHistory is set, states older than the rollback states are compressed so they can still be loaded.
+    void allocateStates ( bool keepHistory = false );
     void deallocateStates();
 
     // Save / load current game state
     void saveState ( const NetplayManager& netMan );
     bool loadState ( IndexedFrame indexedFrame, NetplayManager& netMan );
 
+    // Copy the last saved state to a buffer / load a state from a buffer, for replay keyframes
+    bool copyLatestState ( std::vector<char>& buffer ) const;
+    bool loadStateBuffer ( const std::vector<char>& buffer, NetplayManager& netMan );
+
+    // Identifies the rollback memory layout, states copied with a different layout can't be loaded
+    static uint32_t getLayoutId();
+
     // Save sounds during rollback re-run
     void saveRerunSounds ( uint32_t frame );
 
@@ -68,19 +88,35 @@ private:
         // The pointer to the raw bytes in the state pool
         char *rawBytes;
 
-        // Save / load the game state
-        void save();
+        // The slot arrays, these have a variable size so they are stored separately
+        std::vector<char> *slotBytes;
+
+        // Save / load the game state, saving also hashes each region of the state in the same pass
+        void save ( std::vector<uint64_t>& hashes );
         void load();
+
+        // Copy the game state to / from a buffer for the history
+        void saveHistory ( std::vector<char>& buffer ) const;
+        bool loadHistory ( const std::vector<char>& buffer );
     };
 
-    // Memory pool to allocate game states
-    std::shared_ptr<char> _memoryPool;
+    // Saved game states in chronological order
+    RollbackStates<GameState> _states;
+
+    // Hashes of the last saved state, one per MemDump region, then one per slot array
+    std::vector<uint64_t> _stateHashes;
+
+    // Compressed states older than the saved states, only in training mode and replays
+    std::unique_ptr<StateHistory> _history;
+
+    // Buffer to restore states from the history
+    std::vector<char> _historyBuffer;
 
-    // Unused indices in the memory pool, each game state has the same size
-    std::stack<size_t> _freeStack;
+    // Move the oldest state to the history before it is overwritten
+    void pushHistory ( const GameState& state );
 
-    // List of saved game states in chronological order
-    std::list<GameState> _statesList;
+    // Load the newest state in the history at or before the given frame
+    bool loadHistoryState ( IndexedFrame indexedFrame, NetplayManager& netMan );
 
     // History of sound effect playbacks
     std::array<std::array<uint8_t, CC_SFX_ARRAY_LEN>, NUM_ROLLBACK_STATES> _sfxHistory;
@@ -3,12 +3,14 @@
 #include "DllTrialManager.hpp"
 #include "DllTrialManager.hpp"
 #include "DllOverlayUi.hpp"
+#include "AssetPrefetcher.hpp"
 #include "DllNetplayManager.hpp"
 #include "ProcessManager.hpp"
 #include "StringUtils.hpp"
 #include "Shlwapi.h"
 
 #include <fstream>
+#include <sstream>
 #include <locale>
 #include <codecvt>
 #include <string>
@@ -27,7 +29,8 @@ vector<wstring> fullStrings;
 string dtext;
 int comboTrialTextAlign = 0;
 int comboTrialLength = 0;
-uint32_t comboTrialPosition = 0;
+ComboProgress comboProgress;
+uint32_t trialsVersion = 0;
 int currentTrialIndex = 0;
 bool hideText = false;
 LPDIRECT3DTEXTURE9 trialTextures = NULL;
@@ -43,12 +46,8 @@ bool isRecording = false;
 vector<Trial> charaTrials;
 int trialScale;
 
-bool comboDrop = false;
-bool comboStart = false;
 bool inputGuideEnabled = false;
 bool playInputs = false;
-int comboDropPos = -1;
-int currentHitcount = 0;
 int inputPosition = 0;
 
 bool playAudioCue = false;
@@ -79,6 +78,18 @@ void loadTrialFolder() {
     const char* cname = getShortCharaName ( *CC_P1_CHARACTER_ADDR );
     fileNameBase.append( "-" );
     fileNameBase.append( cname );
+
+    // Use the trial files read during character select if they are ready
+    unique_ptr<AssetPrefetcher::TrialFiles> prefetched =
+        AssetPrefetcher::get().takeTrials( *CC_P1_CHARACTER_ADDR, *CC_P1_MOON_SELECTOR_ADDR );
+    if ( prefetched ) {
+        for ( const AssetPrefetcher::TrialFile& file : *prefetched ) {
+            istringstream trialFile( file.data );
+            TrialManager::handleTrialFile( fileNameBase + "/" + file.name, trialFile );
+        }
+        return;
+    }
+    LOG("Trials not prefetched");
     WIN32_FIND_DATA fd;
     string searchPath = fileNameBase+"/*.txt";
     HANDLE hFind = ::FindFirstFile(searchPath.c_str(), &fd);
@@ -192,8 +203,12 @@ vector<uint16_t> unformatDemo( vector<DemoInput> fdemoInputs )
 }
 
 void handleTrialFile( string fileName ) {
-    LOG("handling trial: %s", fileName );
     ifstream trialFile( fileName );
+    handleTrialFile( fileName, trialFile );
+}
+
+void handleTrialFile( string fileName, istream& trialFile ) {
+    LOG("handling trial: %s", fileName );
     array<int32_t, 3> startingPositions;
     // Default starting positions
     startingPositions[0] = -16384;
@@ -262,6 +277,7 @@ void handleTrialFile( string fileName ) {
                 formatDemo( demoInputs ),
                 tokenizeText( comboText )
     };
+    t.combo.compile( comboSeq, comboHit, CC_SEQ_CROUCH_TRANSITION );
     LOG(t.name);
     for( Move m : t.tokens ) {
         for( Token t : m.text ) {
@@ -269,6 +285,7 @@ void handleTrialFile( string fileName ) {
         }
     }
     charaTrials.push_back( t );
+    ++trialsVersion;
 }
 
 void saveTrial( Trial trial ) {
@@ -343,77 +360,60 @@ int getHitcount()
     return *(uint32_t*)((*CC_P1_COMBO_OFFSET_ADDR * 0x2C) / 4 + CC_P1_COMBO_HIT_BASE_ADDR );
 }
 
+// Debug readout of the sequences, only formatted again when one of them changes
+static void updateDebugText( bool hasTrial, const ComboFrame& frame, int hitcount, int expectedSeq )
+{
+    static bool lastHasTrial = false;
+    static ComboFrame lastFrame = { 0, 0, 0, -1 };
+    static int lastHitcount = -1;
+    static int lastExpectedSeq = -1;
+
+    if ( !dtext.empty() && hasTrial == lastHasTrial && frame.seq == lastFrame.seq &&
+         frame.partnerSeq == lastFrame.partnerSeq && frame.hitcount == lastFrame.hitcount &&
+         hitcount == lastHitcount && expectedSeq == lastExpectedSeq )
+        return;
+
+    lastHasTrial = hasTrial;
+    lastFrame = frame;
+    lastHitcount = hitcount;
+    lastExpectedSeq = expectedSeq;
+
+    char buf[128];
+    if ( hasTrial ) {
+        snprintf(buf, sizeof ( buf ), "ghc=%03d, hitcount=%03d, partnerSeq=%03d, currSeq=%03d, exSeq=%02d",
+                 frame.hitcount, hitcount, frame.partnerSeq, frame.seq, expectedSeq );
+    } else {
+        snprintf(buf, sizeof ( buf ), "partnerSeq=%03d, currSeq=%03d", frame.partnerSeq, frame.seq );
+    }
+    dtext = buf;
+}
+
 void frameStepTrial()
 {
-    uint32_t seqAddr;
-    uint32_t partnerAddr;
+    ComboFrame frame;
     if ( *CC_P1_PUPPET_STATE_ADDR ) {
-        seqAddr = *CC_P3_SEQUENCE_ADDR;
-        partnerAddr = *CC_P1_SEQUENCE_ADDR;
+        frame.seq = *CC_P3_SEQUENCE_ADDR;
+        frame.partnerSeq = *CC_P1_SEQUENCE_ADDR;
     } else {
-        seqAddr = *CC_P1_SEQUENCE_ADDR;
-        partnerAddr = *CC_P3_SEQUENCE_ADDR;
+        frame.seq = *CC_P1_SEQUENCE_ADDR;
+        frame.partnerSeq = *CC_P3_SEQUENCE_ADDR;
     }
+    frame.targetSeq = *CC_P2_SEQUENCE_ADDR;
+    frame.hitcount = getHitcount();
+
     if ( charaTrials.empty() ) {
-        char buf[1000];
-        sprintf(buf, "partnerSeq=%03d, currSeq=%03d", partnerAddr, seqAddr );
-        dtext = buf;
+        updateDebugText( false, frame, 0, 0 );
         return;
     }
 
-    Trial currentTrial = charaTrials[currentTrialIndex];
-    char buf[1000];
-    /*
-    sprintf(buf, "temp1=%d, temp=%d, ehitC=%d, rhitc=%02d,cCombo=%02d, p2cseq=%03d, currSeq=%03d, exSeq=%02d",
-            0,0,
-            currentHitcount,
-            0,
-            currentTrialIndex,
-            *CC_P2_SEQUENCE_ADDR,
-            seqAddr,
-            currentTrial.comboSeq[comboTrialPosition]);
-    */
-    sprintf(buf, "ghc=%03d, hitcount=%03d, partnerSeq=%03d, currSeq=%03d, exSeq=%02d",
-            getHitcount(),
-            currentHitcount,
-            partnerAddr,
-            seqAddr,
-            currentTrial.comboSeq[comboTrialPosition]);
-    dtext = buf;
-    if ( !comboDrop ) {
-        if ( seqAddr == currentTrial.comboSeq[0] &&
-             *CC_P2_SEQUENCE_ADDR != 0 && !comboStart ) {
-            comboTrialPosition = 1;
-            comboStart = true;
-            currentHitcount = getHitcount();
-        } else if ( ( seqAddr == currentTrial.comboSeq[comboTrialPosition] ||
-                      ( ( currentTrial.comboSeq[comboTrialPosition] == 0 ) && ( seqAddr == CC_SEQ_CROUCH_TRANSITION ) ) ||
-                      ( ( currentTrial.comboHit[comboTrialPosition] == 2 ) && ( partnerAddr == currentTrial.comboSeq[comboTrialPosition] ) ) )
-                    && comboStart &&
-                    ( ( currentTrial.comboHit[comboTrialPosition] == 1 ) ?
-                      ( getHitcount() > currentHitcount ) : true ) ) {
-            comboTrialPosition += 1;
-            currentHitcount = getHitcount();
-        } else if ( getHitcount() > currentHitcount ) {
-            currentHitcount = getHitcount();
-        }
-        if ( *CC_P2_SEQUENCE_ADDR == 0 ) {
-            comboDrop = true;
-            comboDropPos = comboTrialPosition;
-            comboStart = false;
-            currentHitcount = 0;
-        }
-    } else if ( seqAddr == 0 &&
-                *CC_P2_SEQUENCE_ADDR == 0 ) {
-        if ( comboTrialPosition < currentTrial.comboSeq.size() )
-            comboTrialPosition = 0;
-    } else if ( seqAddr == currentTrial.comboSeq[0] &&
-                *CC_P2_SEQUENCE_ADDR != 0 ) {
-        comboTrialPosition = 1;
-        comboDrop = false;
-        comboStart = true;
-        currentHitcount = getHitcount();
-    }
+    // Only read the current trial, it's compiled when loaded so stepping doesn't allocate
+    const Trial& currentTrial = charaTrials[currentTrialIndex];
+    const CompiledCombo& combo = currentTrial.combo;
+
+    updateDebugText( true, frame, comboProgress.hitcount,
+                     comboProgress.position < combo.steps.size() ? combo.steps[comboProgress.position].seq : -1 );
+
+    comboProgress.step( combo, frame );
 
     if ( isRecording ) {
         uint16_t rawinput = netManPtr->getRawInput( 1 );
@@ -700,8 +700,8 @@ void DllTrialManager::loadTrialFile()
     //fscanf (file, "%d %d %d %d %d %d", &i1, &i2, &i3, &i4, &i5, &i6);
     i1 = 4;
     i2 = 5;
-    i3 = 7;
-    i4 = 20;
+    i3 = COMBO_MOVE_RIGHT_OFFSET;
+    i4 = COMBO_START_X;
     i5 = 300;
     i6 = 11;
 
@@ -714,7 +714,7 @@ void DllTrialManager::loadCombo( int comboId )
     if ( comboId < 0 )
         comboId = numCombos - 1;
     TrialManager::currentTrialIndex = ( comboId % numCombos );
-    TrialManager::comboTrialPosition = 0;
+    TrialManager::comboProgress.position = 0;
     currentHitcount = 0;
     comboDrop = false;
     comboStart = false;
@@ -750,12 +750,15 @@ void DllTrialManager::drawArrow( int direction, int screenX, int screenY, int wi
     CallDrawSprite ( width, 0, *(int*)BUTTON_SPRITE_TEX, screenX, screenY, height, 0x19*direction, 0, 0x19, 0x19, 0xFFFFFFFF, 0, 0x2cc );
 }
 
-void DllTrialManager::drawText( string text, int screenX, int screenY, int width, int height, int layer )
+// The game's text functions take a mutable string, so copy into a buffer instead of allocating one
+#define MAX_DRAW_TEXT_LENGTH ( 256 )
+
+void DllTrialManager::drawText( const char *text, int screenX, int screenY, int width, int height, int layer )
 {
-    vector<char> ctext(text.begin(), text.end());
-    ctext.push_back(0);
+    char ctext[MAX_DRAW_TEXT_LENGTH];
+    snprintf( ctext, sizeof ( ctext ), "%s", text );
 
-    CallDrawText ( width, height, screenX, screenY, &ctext[0],
+    CallDrawText ( width, height, screenX, screenY, ctext,
                    0xff, // alpha
                    0xff, // shade
                    layer, // also alpha?
@@ -763,30 +766,35 @@ void DllTrialManager::drawText( string text, int screenX, int screenY, int width
                    0, 0, 0 );
 }
 
-void DllTrialManager::drawTextWithBorder( string text, int screenX, int screenY, int width, int height, int layer )
+void DllTrialManager::drawText( const string& text, int screenX, int screenY, int width, int height, int layer )
 {
-    vector<char> ctext(text.begin(), text.end());
-    ctext.push_back(0);
+    drawText( text.c_str(), screenX, screenY, width, height, layer );
+}
 
-    CallDrawText ( width, height, screenX-1, screenY, &ctext[0],
+void DllTrialManager::drawTextWithBorder( const char *text, int screenX, int screenY, int width, int height, int layer )
+{
+    char ctext[MAX_DRAW_TEXT_LENGTH];
+    snprintf( ctext, sizeof ( ctext ), "%s", text );
+
+    CallDrawText ( width, height, screenX-1, screenY, ctext,
                    0xff, // alpha
                    0x0, // shade
                    layer,
                    (void*) FONT2,
                    0, 0, 0 );
-    CallDrawText ( width, height, screenX+1, screenY, &ctext[0],
+    CallDrawText ( width, height, screenX+1, screenY, ctext,
                    0xff, // alpha
                    0x0, // shade
                    layer,
                    (void*) FONT2,
                    0, 0, 0 );
-    CallDrawText ( width, height, screenX, screenY-1, &ctext[0],
+    CallDrawText ( width, height, screenX, screenY-1, ctext,
                    0xff, // alpha
                    0x0, // shade
                    layer,
                    (void*) FONT2,
                    0, 0, 0 );
-    CallDrawText ( width, height, screenX, screenY+1, &ctext[0],
+    CallDrawText ( width, height, screenX, screenY+1, ctext,
                    0xff, // alpha
                    0x0, // shade
                    layer,
@@ -795,6 +803,11 @@ void DllTrialManager::drawTextWithBorder( string text, int screenX, int screenY,
 
 }
 
+void DllTrialManager::drawTextWithBorder( const string& text, int screenX, int screenY, int width, int height, int layer )
+{
+    drawTextWithBorder( text.c_str(), screenX, screenY, width, height, layer );
+}
+
 void DllTrialManager::drawShadowButton( int buttonId, int screenX, int screenY, int width, int height )
 {
     // Buttons:
@@ -891,70 +904,7 @@ void DllTrialManager::drawInputs()
     }
 }
 
-int DllTrialManager::getMoveWidth( Move move, int x )
-{
-    int moveWidth = 0;
-    int roffset = i3;
-    for( Token token : move.text ) {
-        if ( token.type == Button ) {
-            moveWidth += 25;
-        } else if ( token.type == Direction ) {
-            moveWidth += 25;
-        } else if ( token.type == String ) {
-            moveWidth += 24*token.text.length();
-            if ( token.text[token.text.size() - 1] == ')') {
-                moveWidth -= 20;
-            }
-        } else if ( token.type == Symbol ) {
-            if ( token.text[ 0 ] == 'd' ) {
-                moveWidth += 35 + 11;
-            } else if ( token.text[ 0 ] == 'j' ) {
-                moveWidth += 30;
-            } else if ( token.text[ 0 ] == 'A' ) {
-                moveWidth += 20;
-                moveWidth += 16;
-                moveWidth += 14;
-                moveWidth += 17;
-            } else if ( token.text[ 0 ] == 't' ) {
-                moveWidth += 15;
-                moveWidth += 11;
-                moveWidth += 15;
-            }
-        }
-    }
-    return moveWidth + roffset + 18;
-}
-
-int DllTrialManager::getMoveWidthScaled( Move move, int x, int buttonWidth )
-{
-    int moveWidth = 0;
-    int roffset = i3;
-    for( Token token : move.text ) {
-        if ( token.type == Button ) {
-            moveWidth += buttonWidth;
-        } else if ( token.type == Direction ) {
-            moveWidth += buttonWidth;
-        } else if ( token.type == String ) {
-            moveWidth += buttonWidth*token.text.length();
-            if ( token.text[token.text.size() - 1] == ')') {
-                moveWidth -= buttonWidth / 2;
-            }
-        } else if ( token.type == Symbol ) {
-            if ( token.text[ 0 ] == 'd' ) {
-                moveWidth += buttonWidth*3;
-            } else if ( token.text[ 0 ] == 'j' ) {
-                moveWidth += buttonWidth*2;
-            } else if ( token.text[ 0 ] == 'A' ) {
-                moveWidth += buttonWidth*4;
-            } else if ( token.text[ 0 ] == 't' ) {
-                moveWidth += buttonWidth*3;
-            }
-        }
-    }
-    return moveWidth + roffset;
-}
-
-int DllTrialManager::drawMove( Move move, MoveStatus color, int x, int y )
+int DllTrialManager::drawMove( const Move& move, MoveStatus color, int x, int y, int width )
 {
     int loffset = i1;
     if ( move.position != Start ) {
@@ -962,11 +912,9 @@ int DllTrialManager::drawMove( Move move, MoveStatus color, int x, int y )
     }
     int yoffset = i2;
     int ytextoffset = i2;
-    int roffset = i3;
     int currX = x + loffset;
     int nextX = x + loffset;
-    int moveWidth = 0;
-    for( Token token : move.text ) {
+    for( const Token& token : move.text ) {
         if ( token.type == Button ) {
             nextX += 25;
             /*
@@ -978,12 +926,10 @@ int DllTrialManager::drawMove( Move move, MoveStatus color, int x, int y )
             int buttonId = token.text[0] - L'A';
             drawButton( buttonId, currX, y+yoffset );
             currX += 25;
-            moveWidth += 25;
         } else if ( token.type == Direction ) {
             int buttonId = token.text[0] - L'0';
             drawArrow( buttonId, currX, y+yoffset );
             currX += 25;
-            moveWidth += 25;
         } else if ( token.type == String ) {
             if ( token.text == "Airbackdash" ) {
                 drawText( "A", currX, y+ytextoffset );
@@ -1008,7 +954,6 @@ int DllTrialManager::drawMove( Move move, MoveStatus color, int x, int y )
                 currX += 24;
                 drawText( "h", currX, y+ytextoffset );
                 currX += 24;
-                moveWidth += 24*token.text.length() - 20;
             } else if ( token.text == "Airdash" ) {
                 drawText( "A", currX, y+ytextoffset );
                 currX += 24 - 8;
@@ -1024,7 +969,6 @@ int DllTrialManager::drawMove( Move move, MoveStatus color, int x, int y )
                 currX += 24 - 8;
                 drawText( "h", currX, y+ytextoffset );
                 currX += 24;
-                moveWidth += 24*token.text.length() -8 -8 -10 -10 - 11 -8;
             } else if ( token.text == "Airdodge" ) {
                 drawText( "A", currX, y+ytextoffset );
                 currX += 24;
@@ -1042,14 +986,11 @@ int DllTrialManager::drawMove( Move move, MoveStatus color, int x, int y )
                 currX += 24;
                 drawText( "e", currX, y+ytextoffset );
                 currX += 24;
-                moveWidth += 24*token.text.length();
             } else {
                 drawText( token.text, currX, y+ytextoffset );
                 currX += 24*token.text.length();
-                moveWidth += 24*token.text.length();
                 if ( token.text[token.text.size() - 1] == ')') {
                     currX -= 20;
-                    moveWidth -= 20;
                 }
             }
         } else if ( token.type == Symbol ) {
@@ -1058,43 +999,34 @@ int DllTrialManager::drawMove( Move move, MoveStatus color, int x, int y )
                 drawText( "j", currX + 14, y+ytextoffset );
                 drawText( ".", currX + 25, y+ytextoffset );
                 currX += 35 + 11;
-                moveWidth += 35 + 11;
             } else if ( token.text[ 0 ] == 'j' ) {
                 drawText( "j", currX, y+ytextoffset );
                 drawText( ".", currX + 10, y+ytextoffset );
                 currX += 30;
-                moveWidth += 30;
             } else if ( token.text[ 0 ] == 'A' ) {
                 drawText( "A", currX, y+ytextoffset );
                 currX += 20;
-                moveWidth += 20;
                 drawText( "d", currX, y+ytextoffset );
                 currX += 16;
-                moveWidth += 16;
                 drawText( "d", currX, y+ytextoffset );
                 currX += 14;
-                moveWidth += 14;
                 drawText( ".", currX, y+ytextoffset );
                 currX += 17;
-                moveWidth += 17;
             } else if ( token.text[ 0 ] == 't' ) {
                 drawText( "t", currX, y+ytextoffset );
                 currX += 15;
-                moveWidth += 15;
                 drawText( "k", currX, y+ytextoffset );
                 currX += 11;
-                moveWidth += 11;
                 drawText( ".", currX, y+ytextoffset );
                 currX += 15;
-                moveWidth += 15;
             }
         }
     }
-    x = drawComboBacking( move.position, color, x, y, moveWidth+roffset );
+    x = drawComboBacking( move.position, color, x, y, width );
     return x;
 }
 
-int DllTrialManager::drawMoveScaled( Move move, MoveStatus color, int x, int y, int buttonWidth )
+int DllTrialManager::drawMoveScaled( const Move& move, MoveStatus color, int x, int y, int width, int buttonWidth )
 {
     int loffset = i1;
     if ( move.position != Start ) {
@@ -1102,128 +1034,76 @@ int DllTrialManager::drawMoveScaled( Move move, MoveStatus color, int x, int y,
     }
     int yoffset = i2;
     int ytextoffset = i2;
-    int roffset = i3;
     int currX = x + loffset;
-    int moveWidth = 0;
 
-    for( Token token : move.text ) {
+    for( const Token& token : move.text ) {
         if ( token.type == Button ) {
             int buttonId = token.text[0] - 'A';
             drawButton( buttonId, currX, y+yoffset, buttonWidth, buttonWidth );
             currX += buttonWidth;
-            moveWidth += buttonWidth;
         } else if ( token.type == Direction ) {
             int buttonId = token.text[0] - '0';
             drawArrow( buttonId, currX, y+yoffset, buttonWidth, buttonWidth );
             currX += buttonWidth;
-            moveWidth += buttonWidth;
         } else if ( token.type == String ) {
             drawText( token.text, currX, y+ytextoffset, buttonWidth, buttonWidth );
             drawTextWithBorder( token.text, currX, y+ytextoffset, buttonWidth, buttonWidth );
             currX += buttonWidth*token.text.length();
-            moveWidth += buttonWidth*token.text.length();
             if ( token.text[token.text.size() - 1] == ')') {
                 currX -= buttonWidth / 2;
-                moveWidth -= buttonWidth / 2;
             }
         } else if ( token.type == Symbol ) {
             if ( token.text[ 0 ] == 'd' ) {
                 drawText( "dj.", currX, y+ytextoffset, buttonWidth, buttonWidth );
                 drawTextWithBorder( "dj.", currX, y+ytextoffset, buttonWidth, buttonWidth );
                 currX += buttonWidth*3;
-                moveWidth += buttonWidth*3;
             } else if ( token.text[ 0 ] == 'j' ) {
                 drawText( "j.", currX, y+ytextoffset, buttonWidth, buttonWidth );
                 drawTextWithBorder( "j.", currX, y+ytextoffset, buttonWidth, buttonWidth );
                 currX += buttonWidth*2;
-                moveWidth += buttonWidth*2;
             } else if ( token.text[ 0 ] == 'A' ) {
                 drawText( "Add.", currX, y+ytextoffset, buttonWidth, buttonWidth );
                 drawTextWithBorder( "Add.", currX, y+ytextoffset, buttonWidth, buttonWidth );
                 currX += buttonWidth*4;
-                moveWidth += buttonWidth*4;
             } else if ( token.text[ 0 ] == 't' ) {
                 drawText( "tk.", currX, y+ytextoffset, buttonWidth, buttonWidth );
                 drawTextWithBorder( "tk.", currX, y+ytextoffset, buttonWidth, buttonWidth );
                 currX += buttonWidth*3;
-                moveWidth += buttonWidth*3;
             }
             currX -= buttonWidth / 2;
-            moveWidth -= buttonWidth / 2;
         }
     }
-    x = drawComboBacking( move.position, color, x, y, moveWidth+roffset, buttonWidth + 7 );
+    x = drawComboBacking( move.position, color, x, y, width, buttonWidth + 7 );
     return x;
 }
 
 void DllTrialManager::drawCombo()
 {
-    int x = i4;
-    int newx = i4;
-    int y = i5;
-    y = 20;
-    if ( TrialManager::inputGuideEnabled ) {
-        y += 25;
-    }
-    int loffset = 0;
-    int yoffset = 0;
-    //int roffset = 10;
-    int currentMove = 0;
-    int currentFail = 3;
-    MoveStatus color;
-
-    vector<string> comboTrialText;
-    Trial currentTrial;
-    vector<Move> moveList;
-    if ( !TrialManager::charaTrials.empty() ) {
-        currentTrial = TrialManager::charaTrials[TrialManager::currentTrialIndex];
-        comboTrialText = currentTrial.comboText;
-        moveList = currentTrial.tokens;
-        currentMove = TrialManager::comboTrialPosition;
-        currentFail = TrialManager::comboDropPos;
-    }
+    if ( TrialManager::charaTrials.empty() )
+        return;
+
+    const Trial& currentTrial = TrialManager::charaTrials[TrialManager::currentTrialIndex];
+    const ComboProgress& progress = TrialManager::comboProgress;
+
+    // The positions only change when the trial, its progress or the scale does
+    const uint32_t trialId = ( TrialManager::trialsVersion << 16 ) | TrialManager::currentTrialIndex;
+    comboLayout.update( trialId, currentTrial.tokens,
+                        progress.position, progress.dropPos, TrialManager::trialScale,
+                        TrialManager::inputGuideEnabled );
 
     if ( !TrialManager::inputGuideEnabled ) {
+        int y = COMBO_START_Y;
         drawText ( currentTrial.name, 30, y-16, 14, 16, 0x1f0 );
         drawTextWithBorder ( currentTrial.name, 30, y-16, 14, 16, 0x1f0 );
         drawSolidRect( 25, y-16, currentTrial.name.size() * 15, 17, bg, 0x2ef );
     }
-    for( uint16_t i = 0; i < moveList.size(); ++i ) {
-        if ( i < currentMove ) {
-            color = Done;
-        } else if ( i == currentMove ) {
-            color = Current;
-        } else if ( i == currentFail ) {
-            color = Failed;
-        } else {
-            color = Next;
-        }
-        Move move = moveList[i];
-        int moveWidth;
+
+    for( const ComboLayout::Entry& entry : comboLayout.entries ) {
+        const Move& move = currentTrial.tokens[entry.move];
         if ( TrialManager::trialScale == 0 ) {
-            moveWidth = getMoveWidth( move, x+loffset );
-            if ( moveWidth + x > 630 ) {
-                y += 30;
-                x = i4;
-            }
-            newx = drawMove( move, color, x+loffset, y+yoffset );
-            x = newx;
-        } else if ( TrialManager::trialScale == 1 ) {
-            moveWidth = getMoveWidthScaled( move, x+loffset, 20 );
-            if ( moveWidth + x > 630 ) {
-                y += 26;
-                x = i4;
-            }
-            newx = drawMoveScaled( move, color, x+loffset, y+yoffset, 20 );
-            x = newx;
-        } else if ( TrialManager::trialScale == 2 ) {
-            moveWidth = getMoveWidth( move, x+loffset );
-            if ( moveWidth + x > 630 ) {
-                y += 18;
-                x = i4;
-            }
-            newx = drawMoveScaled( move, color, x+loffset, y+yoffset, 0xc );
-            x = newx;
+            drawMove( move, entry.status, entry.x, entry.y, entry.width );
+        } else {
+            drawMoveScaled( move, entry.status, entry.x, entry.y, entry.width, comboLayout.buttonWidth );
         }
     }
 }
@@ -1338,7 +1218,7 @@ void DllTrialManager::drawInputGuideButtons( uint16_t input, uint16_t lastinput,
 
 void DllTrialManager::drawInputGuide() {
     int x = TrialManager::inputPosition;
-    Trial currentTrial = TrialManager::charaTrials[TrialManager::currentTrialIndex];
+    const Trial& currentTrial = TrialManager::charaTrials[TrialManager::currentTrialIndex];
     drawSolidRect( 0, 21, 640, 3, white, 0x2ca );
     drawSolidRect( 30, 0, 3, 45, white, 0x2ca );
     drawSolidRect( 0, 0, 640, 46, darkgrey, 0x2ca );
@@ -1531,7 +1411,7 @@ void DllTrialManager::clear()
     comboHit.clear();
     TrialManager::comboTrialText.clear();
     TrialManager::fullStrings.clear();
-    TrialManager::comboTrialPosition = 0;
+    TrialManager::comboProgress.reset();
     currentHitcount = 0;
     comboDrop = false;
     comboStart = false;
@@ -1539,9 +1419,9 @@ void DllTrialManager::clear()
     TrialManager::demoPosition = 0;
     TrialManager::isRecording = false;
     TrialManager::charaTrials.clear();
+    ++TrialManager::trialsVersion;
     TrialManager::inputGuideEnabled = false;
     TrialManager::playInputs = false;
-    TrialManager::comboDrop = false;
-    TrialManager::comboStart = false;
     TrialManager::inputPosition = 0;
+    comboLayout.invalidate();
 }
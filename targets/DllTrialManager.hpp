@@ -1,30 +1,12 @@
 #pragma once
+#include "ComboTrial.hpp"
+
 #include <vector>
 
 #include <d3dx9.h>
 
 using namespace std;
 
-enum MovePosition {
-    Start,
-    Middle,
-    Ending
-};
-
-enum MoveStatus {
-    Next,
-    Current,
-    Done,
-    Failed
-};
-
-enum TokenTypes {
-    String,
-    Direction,
-    Button,
-    Symbol
-};
-
 struct ARGB {
     uint8_t alpha;
     uint8_t red;
@@ -32,17 +14,6 @@ struct ARGB {
     uint8_t blue;
 };
 
-struct Token {
-    string text;
-    TokenTypes type;
-    uint32_t width;
-};
-
-struct Move {
-    vector<Token> text;
-    MovePosition position;
-};
-
 struct DemoInput {
     int frame;
     int direction;
@@ -58,6 +29,7 @@ struct Trial {
     vector<uint16_t> demoInputs;
     vector<DemoInput> demoInputsFormatted;
     vector<Move> tokens;
+    CompiledCombo combo;
 };
 
 namespace TrialManager {
@@ -74,7 +46,11 @@ extern int comboTrialTextAlign;
 
 extern int comboTrialLength;
 
-extern uint32_t comboTrialPosition;
+// Progress through the current trial's combo
+extern ComboProgress comboProgress;
+
+// Changes whenever the loaded trials change
+extern uint32_t trialsVersion;
 
 extern int currentTrialIndex;
 
@@ -93,6 +69,8 @@ extern uint32_t screenFlashColor;
 // rework
 void loadTrialFolder();
 void handleTrialFile( string filename );
+
+void handleTrialFile( string filename, istream& trialFile );
 void saveTrial( Trial trial );
 void saveTrial();
 void frameStepTrial();
@@ -111,12 +89,8 @@ extern bool isRecording;
 extern int demoPosition;
 extern vector<Trial> charaTrials;
 
-extern bool comboDrop;
-extern bool comboStart;
 extern bool inputGuideEnabled;;
-extern int comboDropPos;
 
-extern int currentHitcount;
 extern int trialScale;
 
 } // namespace TrialManager
@@ -133,8 +107,10 @@ public:
     void render();
     void drawButton( int buttonId, int screenX, int screenY, int width=25, int height=25 );
     void drawArrow( int buttonId, int screenX, int screenY, int width=25, int height=25 );
-    void drawText( string text, int screenX, int screenY, int width=24, int height=24, int layer=0xff );
-    void drawTextWithBorder( string text, int screenX, int screenY, int width=24, int height=24, int layer=0xff );
+    void drawText( const char *text, int screenX, int screenY, int width=24, int height=24, int layer=0xff );
+    void drawText( const string& text, int screenX, int screenY, int width=24, int height=24, int layer=0xff );
+    void drawTextWithBorder( const char *text, int screenX, int screenY, int width=24, int height=24, int layer=0xff );
+    void drawTextWithBorder( const string& text, int screenX, int screenY, int width=24, int height=24, int layer=0xff );
     void drawShadowButton( int buttonId, int screenX, int screenY, int width=25, int height=25 );
     void drawShadowArrow( int buttonId, int screenX, int screenY, int width=25, int height=25 );
     void drawInputs();
@@ -145,12 +121,10 @@ public:
     void drawInputGuideButtons( uint16_t input, uint16_t lastinput, int x );
     void drawAttackDisplay();
     void drawAttackDisplayRow( string label, string value, int y );
-    int getMoveWidth( Move move, int x );
-    int getMoveWidthScaled( Move move, int x, int buttonWidth );
     int drawComboBacking( MovePosition position, MoveStatus status, int screenX, int screenY, int width, int height=32 );
     void drawCombo();
-    int drawMove( Move move, MoveStatus color, int x, int y );
-    int drawMoveScaled( Move move, MoveStatus color, int x, int y, int buttonWidth );
+    int drawMove( const Move& move, MoveStatus color, int x, int y, int width );
+    int drawMoveScaled( const Move& move, MoveStatus color, int x, int y, int width, int buttonWidth );
 
     bool initialized = false;
 
@@ -171,6 +145,9 @@ private:
 
     int getHitcount();
 
+    // Cached positions of the moves of the current trial
+    ComboLayout comboLayout;
+
     int tmp2 = 0;
     int i1;
     int i2;
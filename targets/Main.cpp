@@ -5,6 +5,7 @@
 #include "StringUtils.hpp"
 #include "ConsoleUi.hpp"
 #include "Version.hpp"
+#include "SmartSocket.hpp"
 
 #include <optionparser.h>
 #include <windows.h>
@@ -426,6 +427,9 @@ int main ( int argc, char *argv[] )
     }
 #endif // NOT RELEASE
 
+    // Rank the relay servers in the background while the user is in the menus
+    SmartSocket::probeRelays();
+
     // Initialize config
     ui.initialize();
     ui.initialConfig.mode.flags |= ( opt[Options::Training] && !opt[Options::Tournament] ? ClientMode::Training : 0 );
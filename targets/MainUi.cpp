@@ -352,7 +352,7 @@ void MainUi::lobby( RunFuncPtr run )
                 }
             }
         } else if ( _lobby->mode == DEFAULT_LOBBY ) {
-            if ( mode < 0 || mode >= 20 ) {
+            if ( mode < 0 || mode >= ( int ) lobbyText.size() ) {
                 break;
             } else if ( mode >= numEntries  ) {
                 //Hosting
@@ -2,6 +2,8 @@
 #include "Logger.hpp"
 #include "ProcessManager.hpp"
 
+#include <fstream>
+#include <sstream>
 #include <vector>
 #include <unordered_set>
 
@@ -16,6 +18,9 @@ using namespace std;
 // Timeout for update version check
 #define VERSION_CHECK_TIMEOUT ( 1000 )
 
+// Folder of the unpacked files of a version on the update server, and of the patched files in the download folder
+#define UPDATE_FOLDER "cccaster.v%s"
+
 
 static const vector<string> updateServers =
 {
@@ -45,6 +50,8 @@ void MainUpdater::fetch ( const Type& type )
 
     _currentServerIdx = 0;
 
+    _deltaFailed = false;
+
     doFetch ( type );
 }
 
@@ -79,6 +86,17 @@ void MainUpdater::doFetch ( const Type& type )
                 return;
             }
 
+            _deltaDir.clear();
+
+            // Try to only download the blocks that changed, falling back to the whole archive
+            if ( !_deltaFailed )
+            {
+                _fetchingManifest = true;
+                _httpGet.reset ( new HttpGet ( this, getDeltaUrl ( UPDATE_MANIFEST_FILE ) ) );
+                _httpGet->start();
+                break;
+            }
+
             url += format ( "cccaster.v%s.zip", _targetVersion.code );
             _httpDownload.reset ( new HttpDownload ( this, url, _downloadDir + UPDATE_ARCHIVE_FILE ) );
             _httpDownload->start();
@@ -116,11 +134,14 @@ bool MainUpdater::openChangeLog() const
 
 bool MainUpdater::extractArchive() const
 {
-    DWORD val = GetFileAttributes ( ( _downloadDir + UPDATE_ARCHIVE_FILE ).c_str() );
+    // The updater copies the folder of patched files instead of unzipping the archive
+    const string archive = ( _deltaDir.empty() ? _downloadDir + UPDATE_ARCHIVE_FILE : _deltaDir );
+
+    DWORD val = GetFileAttributes ( archive.c_str() );
 
     if ( val == INVALID_FILE_ATTRIBUTES )
     {
-        LOG ( "Missing: %s", _downloadDir + UPDATE_ARCHIVE_FILE );
+        LOG ( "Missing: %s", archive );
         return false;
     }
 
@@ -143,7 +164,7 @@ bool MainUpdater::extractArchive() const
     const string command = format ( "\"" + tmpUpdater + "\" %d %s %s %s",
                                     GetCurrentProcessId(),
                                     binary,
-                                    _downloadDir + UPDATE_ARCHIVE_FILE,
+                                    archive,
                                     ProcessManager::appDir );
 
     LOG ( "Binary: %s", binary );
@@ -208,6 +229,13 @@ std::string MainUpdater::getTargetDescName() const
 void MainUpdater::httpResponse ( HttpGet *httpGet, int code, const string& data, uint32_t remainingBytes )
 {
     ASSERT ( _httpGet.get() == httpGet );
+
+    if ( _type == Type::Archive )
+    {
+        deltaResponse ( httpGet, code, data, remainingBytes );
+        return;
+    }
+
     ASSERT ( _type == Type::Version );
 
     Version version;
@@ -247,6 +275,20 @@ void MainUpdater::httpResponse ( HttpGet *httpGet, int code, const string& data,
 void MainUpdater::httpFailed ( HttpGet *httpGet )
 {
     ASSERT ( _httpGet.get() == httpGet );
+
+    if ( _type == Type::Archive )
+    {
+        LOG ( "Delta request failed: %s", httpGet->url );
+
+        _httpGet.reset();
+
+        if ( _fetchingManifest || ++_rangeFailures > MAX_SEGMENT_RETRIES )
+            deltaFailed();
+        else
+            fetchNextRange();
+        return;
+    }
+
     ASSERT ( _type == Type::Version );
 
     _httpGet.reset();
@@ -303,3 +345,210 @@ void MainUpdater::downloadProgress ( HttpDownload *httpDownload, uint32_t downlo
 
     LOG ( "%u / %u", downloadedBytes, totalBytes );
 }
+
+string MainUpdater::getDeltaUrl ( const string& path ) const
+{
+    return updateServers[_currentServerIdx] + format ( UPDATE_FOLDER "/", _targetVersion.code ) + path;
+}
+
+static bool readFile ( const string& path, string& data )
+{
+    ifstream fin ( path.c_str(), ios::binary );
+
+    if ( !fin.good() )
+        return false;
+
+    stringstream ss;
+    ss << fin.rdbuf();
+    data = ss.str();
+    return true;
+}
+
+static string getLocalPath ( string path )
+{
+    for ( char& c : path )
+        if ( c == '/' )
+            c = '\\';
+
+    return path;
+}
+
+bool MainUpdater::planDeltas ( const string& manifest )
+{
+    UpdateManifest newManifest;
+
+    if ( !newManifest.parse ( manifest ) || newManifest.files.empty() )
+        return false;
+
+    _deltas.clear();
+    _deltaIndex = _rangeIndex = 0;
+    _rangeData.clear();
+    _rangeFailures = _deltaBytes = _deltaTotalBytes = 0;
+
+    for ( const UpdateManifest::File& file : newManifest.files )
+    {
+        _deltas.push_back ( FileDelta() );
+        _deltas.back().file = file;
+
+        string& oldData = _deltas.back().oldData;
+
+        // The binary is named after its version, so patch the new binary from the installed one
+        if ( !readFile ( ProcessManager::appDir + getLocalPath ( file.path ), oldData )
+                && file.path.find ( '/' ) == string::npos && file.path.find ( ".exe" ) != string::npos )
+        {
+            readFile ( ProcessManager::appDir + BINARY, oldData );
+        }
+
+        _deltas.back().delta.compute ( oldData, file );
+        _deltaTotalBytes += _deltas.back().delta.getDownloadSize();
+    }
+
+    LOG ( "Delta: %u / %u bytes", _deltaTotalBytes, newManifest.getTotalSize() );
+
+    _deltaDir = _downloadDir + format ( UPDATE_FOLDER "\\", _targetVersion.code );
+    CreateDirectory ( _deltaDir.c_str(), 0 );
+    return true;
+}
+
+void MainUpdater::fetchNextRange()
+{
+    while ( _deltaIndex < _deltas.size() )
+    {
+        const FileDelta& fileDelta = _deltas[_deltaIndex];
+
+        if ( _rangeIndex < fileDelta.delta.ranges.size() )
+        {
+            const BlockDelta::Range& range = fileDelta.delta.ranges[_rangeIndex];
+
+            // Resume the range after the bytes already received
+            uint32_t received = _rangeData.size();
+
+            for ( size_t i = 0; i < _rangeIndex; ++i )
+                received -= fileDelta.delta.ranges[i].end - fileDelta.delta.ranges[i].start;
+
+            _httpGet.reset ( new HttpGet ( this, getDeltaUrl ( fileDelta.file.path ), DEFAULT_GET_TIMEOUT,
+                                           HttpGet::Incremental ) );
+            _httpGet->start ( range.start + received, range.end );
+            return;
+        }
+
+        if ( !fileDelta.delta.isUnchanged() && !applyDelta ( fileDelta ) )
+        {
+            deltaFailed();
+            return;
+        }
+
+        // Free the installed data once patched
+        _deltas[_deltaIndex].oldData.clear();
+        _rangeData.clear();
+        _rangeIndex = 0;
+        ++_deltaIndex;
+    }
+
+    _deltas.clear();
+
+    if ( owner )
+        owner->fetchCompleted ( this, Type::Archive );
+}
+
+bool MainUpdater::applyDelta ( const FileDelta& fileDelta )
+{
+    string newData;
+
+    if ( !fileDelta.delta.apply ( fileDelta.oldData, _rangeData, newData ) )
+        return false;
+
+    const string path = _deltaDir + getLocalPath ( fileDelta.file.path );
+
+    // Create the sub-folders
+    for ( size_t i = path.find ( '\\', _deltaDir.size() ); i != string::npos; i = path.find ( '\\', i + 1 ) )
+        CreateDirectory ( path.substr ( 0, i ).c_str(), 0 );
+
+    ofstream fout ( path.c_str(), ios::binary );
+    fout.write ( &newData[0], newData.size() );
+    fout.close();
+
+    if ( !fout.good() )
+    {
+        LOG ( "Failed to write: %s", path );
+        return false;
+    }
+
+    LOG ( "Patched: %s", path );
+    return true;
+}
+
+void MainUpdater::deltaResponse ( HttpGet *httpGet, int code, const string& data, uint32_t remainingBytes )
+{
+    if ( _fetchingManifest )
+    {
+        _fetchingManifest = false;
+        _httpGet.reset();
+
+        if ( code != 200 || !planDeltas ( data ) )
+        {
+            LOG ( "No update manifest" );
+            deltaFailed();
+            return;
+        }
+
+        fetchNextRange();
+        return;
+    }
+
+    ASSERT ( _deltaIndex < _deltas.size() );
+    ASSERT ( _rangeIndex < _deltas[_deltaIndex].delta.ranges.size() );
+
+    // A server that ignores ranges would send the whole file
+    if ( code != 206 )
+    {
+        LOG ( "Ranges not supported (%d)", code );
+        _httpGet.reset();
+        deltaFailed();
+        return;
+    }
+
+    const BlockDelta& delta = _deltas[_deltaIndex].delta;
+
+    uint32_t rangesSize = 0;
+
+    for ( size_t i = 0; i <= _rangeIndex; ++i )
+        rangesSize += delta.ranges[i].end - delta.ranges[i].start;
+
+    const uint32_t count = min<uint32_t> ( data.size(), rangesSize - _rangeData.size() );
+
+    _rangeData.append ( data, 0, count );
+    _deltaBytes += count;
+    _rangeFailures = 0;
+
+    if ( owner )
+        owner->fetchProgress ( this, Type::Archive, double ( _deltaBytes ) / max<uint32_t> ( 1, _deltaTotalBytes ) );
+
+    if ( _rangeData.size() == rangesSize )
+    {
+        _httpGet.reset();
+        ++_rangeIndex;
+        fetchNextRange();
+        return;
+    }
+
+    // The response ended before the end of the range
+    if ( remainingBytes == 0 )
+        httpFailed ( httpGet );
+}
+
+void MainUpdater::deltaFailed()
+{
+    LOG ( "Falling back to the update archive" );
+
+    _fetchingManifest = false;
+    _deltaFailed = true;
+    _deltas.clear();
+    _deltaDir.clear();
+
+    doFetch ( Type::Archive );
+
+    // Reset the download progress to zero
+    if ( owner )
+        owner->fetchProgress ( this, Type::Archive, 0 );
+}
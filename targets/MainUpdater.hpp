@@ -1,11 +1,13 @@
 #pragma once
 
+#include "BlockDelta.hpp"
 #include "Enum.hpp"
 #include "HttpDownload.hpp"
 #include "HttpGet.hpp"
 #include "Version.hpp"
 
 #include <string>
+#include <vector>
 
 
 class MainUpdater
@@ -70,8 +72,45 @@ private:
 
     std::string _downloadDir;
 
+    // A file of the new version that is patched from the installed version
+    struct FileDelta
+    {
+        UpdateManifest::File file;
+
+        BlockDelta delta;
+
+        std::string oldData;
+    };
+
+    // Archive fetch by block deltas: the manifest of the new version, then the changed ranges of each file
+    bool _fetchingManifest = false, _deltaFailed = false;
+
+    std::vector<FileDelta> _deltas;
+
+    size_t _deltaIndex = 0, _rangeIndex = 0;
+
+    // Ranges received so far for the current file, concatenated
+    std::string _rangeData;
+
+    uint32_t _rangeFailures = 0, _deltaBytes = 0, _deltaTotalBytes = 0;
+
+    // Folder of the files patched from deltas, empty if the archive was downloaded instead
+    std::string _deltaDir;
+
     void doFetch ( const Type& type );
 
+    std::string getDeltaUrl ( const std::string& path ) const;
+
+    bool planDeltas ( const std::string& manifest );
+
+    void fetchNextRange();
+
+    bool applyDelta ( const FileDelta& fileDelta );
+
+    void deltaResponse ( HttpGet *httpGet, int code, const std::string& data, uint32_t remainingBytes );
+
+    void deltaFailed();
+
     void httpResponse ( HttpGet *httpGet, int code, const std::string& data, uint32_t remainingBytes ) override;
     void httpFailed ( HttpGet *httpGet ) override;
     void httpProgress ( HttpGet *httpGet, uint32_t receivedBytes, uint32_t totalBytes ) override {}
@@ -0,0 +1,559 @@
+#ifndef RELEASE
+
+#include "RollbackSimulator.hpp"
+#include "RollbackStates.hpp"
+#include "InputsContainer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <map>
+#include <random>
+
+using namespace std;
+
+
+#define FRAME_TIME              ( 1000.0 / 60 )
+
+// Input bits of the fake game
+#define INPUT_LEFT              ( 0x01 )
+#define INPUT_RIGHT             ( 0x02 )
+#define INPUT_UP                ( 0x04 )
+#define INPUT_ATTACK            ( 0x10 )
+#define INPUT_SPECIAL           ( 0x20 )
+
+#define STAGE_WIDTH             ( 100000 )
+#define GROUND                  ( 0 )
+
+
+static double now()
+{
+    return chrono::duration_cast<chrono::nanoseconds> (
+               chrono::steady_clock::now().time_since_epoch() ).count() / 1000.0;
+}
+
+
+FakeGame::FakeGame() : _camera ( new Camera() )
+{
+    memset ( &world, 0, sizeof ( world ) );
+    memset ( effects, 0, sizeof ( effects ) );
+    memset ( heap, 0, sizeof ( heap ) );
+
+    world.rng = 0x12345678;
+    world.camera = _camera.get();
+    world.camera->zoom = 1.0f;
+
+    for ( uint32_t i = 0; i < 2; ++i )
+    {
+        world.players[i].x = ( i ? 3 : 1 ) * STAGE_WIDTH / 4;
+        world.players[i].health = 11400;
+    }
+}
+
+MemDumpList FakeGame::getMemDumpList()
+{
+    MemDumpList list;
+
+    list.append ( MemDump ( &world, sizeof ( world ),
+    {
+        MemDumpPtr ( offsetof ( World, camera ), 0, sizeof ( Camera ) )
+    } ) );
+
+    list.append ( MemDump ( heap, sizeof ( heap ) ) );
+
+    list.append ( MemDumpSlots ( effects, sizeof ( Effect ), FAKE_GAME_NUM_EFFECTS,
+                                 offsetof ( Effect, active ), sizeof ( effects[0].active ) ) );
+
+    list.update();
+    return list;
+}
+
+void FakeGame::step ( const uint16_t inputs[2] )
+{
+    ++world.frame;
+
+    for ( uint32_t i = 0; i < 2; ++i )
+    {
+        Player& player = world.players[i];
+        Player& other = world.players[1 - i];
+        const uint16_t input = inputs[i];
+
+        player.vx = ( ( input & INPUT_RIGHT ) ? 300 : 0 ) - ( ( input & INPUT_LEFT ) ? 300 : 0 );
+
+        if ( ( input & INPUT_UP ) && player.y == GROUND )
+            player.vy = 1500;
+
+        player.x = max ( 0, min ( STAGE_WIDTH, player.x + player.vx ) );
+        player.y = max ( GROUND, player.y + player.vy );
+        player.vy = ( player.y == GROUND ? 0 : player.vy - 100 );
+
+        if ( player.stateTime )
+        {
+            --player.stateTime;
+        }
+        else if ( ( input & ( INPUT_ATTACK | INPUT_SPECIAL ) ) && !( player.lastInput & INPUT_ATTACK ) )
+        {
+            player.state = ( input & INPUT_SPECIAL ) ? 2 : 1;
+            player.stateTime = ( input & INPUT_SPECIAL ) ? 30 : 8;
+
+            if ( abs ( player.x - other.x ) < 5000 && other.y == GROUND )
+            {
+                other.health -= ( input & INPUT_SPECIAL ) ? 300 : 100;
+                player.meter = min ( 30000, player.meter + 150 );
+                ++player.combo;
+            }
+            else
+            {
+                player.combo = 0;
+            }
+
+            // Specials spawn a projectile in the first free slot
+            if ( input & INPUT_SPECIAL )
+            {
+                for ( Effect& effect : effects )
+                {
+                    if ( effect.active )
+                        continue;
+
+                    effect.active = 1;
+                    effect.owner = i;
+                    effect.x = player.x;
+                    effect.y = 4000;
+                    effect.vx = ( other.x > player.x ? 800 : -800 );
+                    effect.life = 90;
+                    ++world.numEffects;
+                    break;
+                }
+            }
+        }
+        else
+        {
+            player.state = 0;
+        }
+
+        player.lastInput = input;
+    }
+
+    for ( Effect& effect : effects )
+    {
+        if ( !effect.active )
+            continue;
+
+        effect.x += effect.vx;
+
+        Player& target = world.players[1 - effect.owner];
+
+        const bool hit = ( abs ( effect.x - target.x ) < 2000 && target.y < 8000 );
+
+        if ( hit )
+            target.health -= 200;
+
+        // Freed slots are cleared, so they are skipped when saving
+        if ( hit || --effect.life <= 0 || effect.x < 0 || effect.x > STAGE_WIDTH )
+        {
+            memset ( &effect, 0, sizeof ( effect ) );
+            --world.numEffects;
+        }
+    }
+
+    // Scattered writes across the large block, like the game's animation and particle state
+    for ( uint32_t i = 0; i < 64; ++i )
+    {
+        world.rng = world.rng * 1103515245 + 12345;
+        heap [ ( world.rng >> 8 ) % sizeof ( heap ) ] ^= char ( world.frame + i );
+    }
+
+    world.camera->x = ( world.players[0].x + world.players[1].x ) / 2;
+    world.camera->y = max ( world.players[0].y, world.players[1].y ) / 2;
+    world.camera->zoom = 1.0f + abs ( world.players[0].x - world.players[1].x ) / float ( STAGE_WIDTH );
+    world.camera->shake = ( world.camera->shake ? world.camera->shake - 1 : ( world.numEffects ? 4 : 0 ) );
+}
+
+void FakeGame::corrupt()
+{
+    ++world.players[1].health;
+}
+
+
+namespace
+{
+
+// Input packet, each one carries all the inputs the other side hasn't acknowledged yet, like the netplay inputs
+struct InputPacket
+{
+    uint32_t startFrame = 0;
+    vector<uint16_t> inputs;
+
+    // Number of contiguous inputs the sender has received
+    uint32_t ack = 0;
+};
+
+// State hashes are sent reliably, like the other non-input messages
+struct HashPacket
+{
+    vector<uint64_t> frames, hashes;
+
+    bool hasRegions = false;
+    uint64_t regionsFrame = 0;
+    vector<uint64_t> regions;
+};
+
+class Peer : public DesyncDetector::Owner
+{
+public:
+
+    const RollbackSimulator::Config& config;
+
+    const uint32_t id;
+
+    RollbackSimulator::Stats& stats;
+
+    FakeGame game;
+
+    DesyncDetector detector;
+
+    // Next frame to run, the current state is the state at the start of this frame
+    uint32_t frame = 0;
+
+    // The remote has all our inputs before this frame
+    uint32_t remoteAck = 0;
+
+    vector<uint16_t> localInputs;
+
+    // Remote inputs with the same prediction as the netplay, inputs past the last known one repeat it, and the
+    // last changed frame is the earliest frame that was run with a mispredicted input
+    InputsContainer<uint16_t> remoteInputs;
+
+    multimap<double, InputPacket> inputPackets;
+
+    multimap<double, HashPacket> hashPackets;
+
+    Peer ( const RollbackSimulator::Config& config, uint32_t id, RollbackSimulator::Stats& stats )
+        : config ( config ), id ( id ), stats ( stats )
+        , localInputs ( config.frames + config.inputDelay )
+    {
+        _addrs = game.getMemDumpList();
+        _plan.compile ( _addrs );
+        _hashes.resize ( _plan.getNumRegions() + _addrs.slots.size() );
+
+        _states.allocate ( config.numStates, _addrs.totalSize );
+
+        // Both sides know their own inputs during the input delay
+        remoteInputs.set ( 0, 0, ( uint16_t ) 0, config.inputDelay );
+
+        detector.owner = this;
+
+        // Inputs are held for a random number of frames, so predicting the last input is usually right
+        mt19937 rng ( config.seed * 2 + id );
+        uint16_t input = 0;
+
+        for ( uint32_t i = config.inputDelay; i < localInputs.size(); ++i )
+        {
+            if ( rng() % 8 == 0 )
+                input = rng() % 0x40;
+
+            localInputs[i] = input;
+        }
+    }
+
+    size_t getStateSize() const
+    {
+        return _addrs.totalSize;
+    }
+
+    // Hash of the current state
+    uint64_t getHash()
+    {
+        vector<char> dump ( _plan.totalSize ), slots;
+        _plan.saveDump ( &dump[0], &_hashes[0] );
+
+        for ( size_t i = 0; i < _addrs.slots.size(); ++i )
+            _addrs.slots[i].saveDump ( slots, &_hashes [ _plan.getNumRegions() + i ] );
+
+        return DesyncDetector::combine ( _hashes );
+    }
+
+    // All the remote inputs before this frame are known
+    uint32_t getRemoteEndFrame() const
+    {
+        return remoteInputs.getEndFrame();
+    }
+
+    // True if a frame that was already run had a mispredicted remote input
+    bool isRollbackPending() const
+    {
+        return remoteInputs.getLastChangedFrame().value < getIndexedFrame().value;
+    }
+
+    bool isDone() const
+    {
+        return frame == config.frames && getRemoteEndFrame() >= config.frames && !isRollbackPending();
+    }
+
+    void receive ( double time )
+    {
+        // Clear the last changed frame before we get new inputs, like DllMain
+        remoteInputs.clearLastChangedFrame();
+
+        for ( auto it = inputPackets.begin(); it != inputPackets.end() && it->first <= time; )
+        {
+            const InputPacket& packet = it->second;
+
+            // Check every input for mispredictions, like the netplay does in rollback mode
+            if ( !packet.inputs.empty() )
+                remoteInputs.set ( 0, packet.startFrame, &packet.inputs[0], packet.inputs.size(), 0 );
+
+            remoteAck = max ( remoteAck, packet.ack );
+
+            it = inputPackets.erase ( it );
+        }
+
+        for ( auto it = hashPackets.begin(); it != hashPackets.end() && it->first <= time; )
+        {
+            detector.receive ( it->second.frames, it->second.hashes );
+
+            if ( it->second.hasRegions )
+                detector.receiveRegions ( it->second.regionsFrame, it->second.regions );
+
+            it = hashPackets.erase ( it );
+        }
+    }
+
+    void update()
+    {
+        if ( isRollbackPending() )
+        {
+            const uint32_t target = frame;
+
+            // The state pool always has more states than the max rollback
+            if ( !loadState ( remoteInputs.getLastChangedFrame() ) )
+            {
+                ASSERT_IMPOSSIBLE;
+                return;
+            }
+
+            const uint32_t depth = target - frame;
+
+            ++stats.rollbacks;
+            stats.resimulatedFrames += depth;
+            stats.maxRollbackDepth = max ( stats.maxRollbackDepth, depth );
+            stats.rollbackDepths.addSample ( depth );
+
+            remoteInputs.clearLastChangedFrame();
+
+            while ( frame < target )
+                runFrame();
+        }
+
+        const uint32_t remoteFrame = getRemoteEndFrame();
+
+        // States after the last confirmed remote input are never rolled back to
+        if ( min ( remoteFrame, frame ) > 0 )
+            detector.confirm ( min ( remoteFrame, frame ) - 1 );
+
+        if ( frame == config.frames )
+            return;
+
+        // Wait for the remote if we are too far ahead, like the netplay does
+        if ( frame >= remoteFrame + config.maxRollback )
+        {
+            ++stats.stalls;
+            return;
+        }
+
+        runFrame();
+    }
+
+    void send ( Peer& remote, double time, mt19937& rng )
+    {
+        InputPacket packet;
+        packet.startFrame = remoteAck;
+        packet.ack = getRemoteEndFrame();
+
+        const uint32_t end = min ( frame + config.inputDelay, config.frames );
+
+        if ( end > remoteAck )
+            packet.inputs.assign ( localInputs.begin() + remoteAck, localInputs.begin() + end );
+
+        ++stats.packetsSent;
+
+        if ( uniform_real_distribution<double> ( 0, 1 ) ( rng ) < config.loss )
+            ++stats.packetsLost;
+        else
+            remote.inputPackets.insert ( { time + delay ( rng ), packet } );
+
+        HashPacket hashPacket;
+
+        if ( !detector.popOutgoing ( hashPacket.frames, hashPacket.hashes ) )
+            return;
+
+        hashPacket.hasRegions = detector.popOutgoingRegions ( hashPacket.regionsFrame, hashPacket.regions );
+
+        remote.hashPackets.insert ( { time + delay ( rng ), hashPacket } );
+    }
+
+    void desyncDetected ( DesyncDetector *detector, uint64_t indexedFrame, int region ) override
+    {
+        if ( stats.desynced && stats.desyncRegion >= 0 )
+            return;
+
+        stats.desynced = true;
+        stats.desyncFrame = indexedFrame;
+        stats.desyncRegion = region;
+    }
+
+private:
+
+    struct GameState
+    {
+        IndexedFrame indexedFrame;
+
+        // The buffers in the state pool
+        char *rawBytes;
+        vector<char> *slotBytes;
+    };
+
+    MemDumpList _addrs;
+
+    MemDumpPlan _plan;
+
+    vector<uint64_t> _hashes;
+
+    RollbackStates<GameState> _states;
+
+    IndexedFrame getIndexedFrame() const
+    {
+        return {{ frame, 0 }};
+    }
+
+    double delay ( mt19937& rng ) const
+    {
+        return config.latency + uniform_real_distribution<double> ( 0, config.jitter ) ( rng );
+    }
+
+    void runFrame()
+    {
+        // The loaded state is kept, so it isn't saved again
+        if ( _states.empty() || _states.back().indexedFrame.value != getIndexedFrame().value )
+            saveState();
+
+        uint16_t inputs[2];
+        inputs[id] = localInputs[frame];
+        inputs[1 - id] = remoteInputs.get ( 0, frame );
+
+        const double start = now();
+
+        game.step ( inputs );
+
+        if ( id == 1 && config.desyncFrame && frame == config.desyncFrame )
+            game.corrupt();
+
+        stats.stepTime += now() - start;
+        ++stats.steps;
+        ++frame;
+    }
+
+    void saveState()
+    {
+        // Same as NetplayManager::getRemoteFrame, the last known remote frame
+        const uint32_t remoteFrame = getRemoteEndFrame();
+        const uint32_t confirmedFrame = ( remoteFrame ? remoteFrame - 1 : 0 );
+
+        GameState& state = _states.push ( { getIndexedFrame(), 0, 0 }, confirmedFrame );
+
+        const double start = now();
+
+        _plan.saveDump ( state.rawBytes, &_hashes[0] );
+
+        state.slotBytes->clear();
+
+        for ( size_t i = 0; i < _addrs.slots.size(); ++i )
+            _addrs.slots[i].saveDump ( *state.slotBytes, &_hashes [ _plan.getNumRegions() + i ] );
+
+        const double saveTime = now() - start;
+        stats.saveTime += saveTime;
+        stats.saveTimes.addSample ( uint64_t ( saveTime * 1000 ) );
+        ++stats.saves;
+
+        detector.record ( state.indexedFrame.value, _hashes );
+    }
+
+    bool loadState ( IndexedFrame target )
+    {
+        GameState *state = _states.find ( target );
+
+        if ( !state )
+            return false;
+
+        const double start = now();
+
+        _plan.loadDump ( state->rawBytes );
+
+        const char *dump = state->slotBytes->data();
+
+        for ( const MemDumpSlots& array : _addrs.slots )
+            array.loadDump ( dump );
+
+        const double loadTime = now() - start;
+        stats.loadTime += loadTime;
+        stats.loadTimes.addSample ( uint64_t ( loadTime * 1000 ) );
+        ++stats.loads;
+
+        frame = state->indexedFrame.parts.frame;
+
+        detector.rewind ( state->indexedFrame.value );
+
+        _states.eraseAfter ( state );
+        return true;
+    }
+};
+
+} // namespace
+
+
+RollbackSimulator::Stats RollbackSimulator::run()
+{
+    Stats stats;
+
+    // The peers are too large for the stack
+    unique_ptr<Peer> peers[2] = { unique_ptr<Peer> ( new Peer ( config, 0, stats ) ),
+                                  unique_ptr<Peer> ( new Peer ( config, 1, stats ) )
+                                };
+
+    stats.stateSize = peers[0]->getStateSize();
+
+    mt19937 rng ( config.seed );
+
+    const double start = now();
+
+    // Give up if the link never delivers, eg with 100% loss
+    const uint64_t maxTicks = uint64_t ( config.frames ) * 100 + 1000;
+
+    for ( uint64_t tick = 0; tick < maxTicks && !( peers[0]->isDone() && peers[1]->isDone() ); ++tick )
+    {
+        const double time = tick * FRAME_TIME;
+
+        for ( uint32_t i = 0; i < 2; ++i )
+        {
+            peers[i]->receive ( time );
+            peers[i]->update();
+            peers[i]->send ( *peers[1 - i], time, rng );
+        }
+    }
+
+    // Deliver the last state hashes
+    for ( uint32_t i = 0; i < 2; ++i )
+        peers[i]->send ( *peers[1 - i], 0, rng );
+
+    for ( auto& peer : peers )
+        peer->receive ( 1e30 );
+
+    stats.wallTime = ( now() - start ) / 1e6;
+    stats.frames = min ( peers[0]->frame, peers[1]->frame );
+    stats.seconds = stats.frames / 60.0;
+    stats.statesMatch = ( peers[0]->isDone() && peers[1]->isDone() && peers[0]->getHash() == peers[1]->getHash() );
+
+    return stats;
+}
+
+#endif // NOT RELEASE
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "MemDump.hpp"
+#include "DesyncDetector.hpp"
+#include "Histogram.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+
+// Size of the synthetic game memory
+#define FAKE_GAME_NUM_EFFECTS       ( 128 )
+#define FAKE_GAME_HEAP_SIZE         ( 512 * 1024 )
+
+// Same defaults as netplay/Constants.hpp, which can't be included in the host build
+#define SIMULATOR_MAX_ROLLBACK      ( 15 )
+#define SIMULATOR_ROLLBACK_STATES   ( 60 )
+
+
+// Deterministic stand-in for the game, it is large so allocate it on the heap. The memory has the same kinds of
+// regions as the rollback data: a fixed block with a pointer to separately allocated memory, a large block, and a
+// slot array of effects.
+// Stepping only depends on the memory and the inputs, so two instances given the same inputs stay identical.
+class FakeGame
+{
+public:
+
+    struct Camera
+    {
+        int32_t x, y;
+        float zoom;
+        uint32_t shake;
+    };
+
+    struct Player
+    {
+        int32_t x, y, vx, vy;
+        int32_t health, meter;
+        uint32_t state, stateTime;
+        uint32_t lastInput, combo;
+    };
+
+    struct Effect
+    {
+        // Non-zero while the slot is in use, free slots are zeroed
+        uint32_t active;
+        uint32_t owner;
+        int32_t x, y, vx, life;
+    };
+
+    struct World
+    {
+        uint32_t frame, rng;
+        Player players[2];
+        Camera *camera;
+        uint32_t numEffects;
+    };
+
+    World world;
+
+    Effect effects[FAKE_GAME_NUM_EFFECTS];
+
+    // Large block after the world, so the world is always the first region
+    char heap[FAKE_GAME_HEAP_SIZE];
+
+    FakeGame();
+
+    // The memory layout for rollback, the addresses differ between instances, but the layout is the same
+    MemDumpList getMemDumpList();
+
+    // Advance one frame with the inputs of both players
+    void step ( const uint16_t inputs[2] );
+
+    // Change one value without going through step, to simulate a desync
+    void corrupt();
+
+private:
+
+    std::unique_ptr<Camera> _camera;
+
+    // Not copyable, since the world points to its own camera
+    FakeGame ( const FakeGame& ) = delete;
+    const FakeGame& operator= ( const FakeGame& ) = delete;
+};
+
+
+// Headless rollback harness: two peers each run a FakeGame, exchange delayed inputs over a simulated lossy and
+// jittery link, predict the remote inputs, and roll back on misprediction. The remote inputs are predicted with the
+// same InputsContainer as NetplayManager, and states are saved with the same MemDumpPlan and RollbackStates pool as
+// DllRollbackManager, then compared with DesyncDetector.
+class RollbackSimulator
+{
+public:
+
+    struct Config
+    {
+        // Number of frames each peer plays
+        uint32_t frames = 3600;
+
+        // Input delay in frames, and the max number of frames ahead of the last confirmed remote input
+        uint32_t inputDelay = 1, maxRollback = SIMULATOR_MAX_ROLLBACK;
+
+        // Number of states in each peer's state pool
+        uint32_t numStates = SIMULATOR_ROLLBACK_STATES;
+
+        // One way latency and random extra delay in milliseconds, and the fraction of input packets lost
+        double latency = 40, jitter = 10, loss = 0.05;
+
+        uint32_t seed = 1;
+
+        // If non-zero, peer 1 corrupts its state while stepping this frame
+        uint32_t desyncFrame = 0;
+    };
+
+    struct Stats
+    {
+        // Frames played by each peer, and the same in seconds at 60 fps
+        uint32_t frames = 0;
+        double seconds = 0;
+
+        // Totals for both peers
+        uint32_t rollbacks = 0, resimulatedFrames = 0, maxRollbackDepth = 0, stalls = 0;
+        uint32_t saves = 0, loads = 0, steps = 0;
+        uint32_t packetsSent = 0, packetsLost = 0;
+
+        // Total time spent saving, loading, and stepping in microseconds, and the wall time of the run in seconds
+        double saveTime = 0, loadTime = 0, stepTime = 0, wallTime = 0;
+
+        // Distributions of rollback depths in frames, and of save / load times in nanoseconds
+        Histogram rollbackDepths, saveTimes, loadTimes;
+
+        // Size of one saved state
+        size_t stateSize = 0;
+
+        // Desync detection result, the first divergent frame and region as reported by DesyncDetector
+        bool desynced = false;
+        uint64_t desyncFrame = UINT64_MAX;
+        int desyncRegion = -1;
+
+        // True if both peers ended with the same state
+        bool statesMatch = false;
+    };
+
+    const Config config;
+
+    RollbackSimulator ( const Config& config ) : config ( config ) {}
+
+    // Run both peers until they have played every frame with confirmed inputs
+    Stats run();
+};
@@ -0,0 +1,137 @@
+#ifndef RELEASE
+
+#include "AssetPrefetcher.hpp"
+
+#include <gtest/gtest.h>
+
+#include <sys/stat.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <vector>
+
+using namespace std;
+
+
+#define TEST_CHARA      ( 12 )
+#define TEST_MOON       ( 1 )
+
+
+static void writeFile ( const string& path, const string& data )
+{
+    ofstream fout ( path.c_str(), ios::binary );
+    fout << data;
+}
+
+static vector<uint32_t> generatePaletteData()
+{
+    vector<uint32_t> data ( NUM_PALETTES * NUM_COLORS );
+
+    for ( uint32_t& color : data )
+        color = ( uint32_t ( rand() ) << 16 ) ^ rand();
+
+    return data;
+}
+
+
+TEST ( AssetPrefetcher, PrefetchAndTake )
+{
+    const string folder = "./";
+    const string chara = "TestPrefetch";
+    const string trialFolder = AssetPrefetcher::getTrialFolder ( folder, chara, TEST_MOON );
+
+    EXPECT_EQ ( "./F-TestPrefetch", trialFolder );
+
+    writeFile ( folder + chara + "_palettes.txt", "color_01_001=#FF0000\ncolor_02_010=#123456\n" );
+
+#ifdef _WIN32
+    mkdir ( trialFolder.c_str() );
+#else
+    mkdir ( trialFolder.c_str(), 0755 );
+#endif
+
+    writeFile ( trialFolder + "/b.txt", "trial b" );
+    writeFile ( trialFolder + "/a.txt", "trial a" );
+    writeFile ( trialFolder + "/_d.txt", "trial d" );
+    writeFile ( trialFolder + "/C.txt", "trial c" );
+    writeFile ( trialFolder + "/ignored.dat", "not a trial" );
+
+    {
+        AssetPrefetcher prefetcher;
+        prefetcher.palettesFolder = folder;
+        prefetcher.trialsFolder = folder;
+
+        EXPECT_FALSE ( prefetcher.takePalettes ( TEST_CHARA ) );
+
+        // Repeated prefetches while the cursor stays on the same character only load once
+        for ( int i = 0; i < 100; ++i )
+            prefetcher.prefetch ( TEST_CHARA, chara.c_str(), TEST_MOON );
+
+        prefetcher.flush();
+
+        unique_ptr<AssetPrefetcher::Palettes> palettes = prefetcher.takePalettes ( TEST_CHARA );
+        ASSERT_TRUE ( palettes.get() );
+        EXPECT_TRUE ( palettes->loaded );
+
+        // Caching the originals after loading must give the same result as loading after caching
+        const vector<uint32_t> original = generatePaletteData();
+
+        PaletteManager expected;
+        expected.cache ( &original[0] );
+        EXPECT_TRUE ( expected.load ( folder, chara ) );
+
+        palettes->palMan.cache ( &original[0] );
+        palettes->palMan.optimize();
+
+        vector<uint32_t> a = original, b = original;
+        expected.apply ( &a[0] );
+        palettes->palMan.apply ( &b[0] );
+        EXPECT_EQ ( a, b );
+
+        unique_ptr<AssetPrefetcher::TrialFiles> trials = prefetcher.takeTrials ( TEST_CHARA, TEST_MOON );
+        ASSERT_TRUE ( trials.get() );
+        ASSERT_EQ ( 4u, trials->size() );
+        EXPECT_EQ ( "a.txt", ( *trials ) [0].name );
+        EXPECT_EQ ( "trial a", ( *trials ) [0].data );
+        EXPECT_EQ ( "b.txt", ( *trials ) [1].name );
+        EXPECT_EQ ( "trial b", ( *trials ) [1].data );
+
+        // Case-insensitive like NTFS, compared in upper case so '_' is after the letters
+        EXPECT_EQ ( "C.txt", ( *trials ) [2].name );
+        EXPECT_EQ ( "_d.txt", ( *trials ) [3].name );
+
+        // Taking clears the slots
+        EXPECT_FALSE ( prefetcher.takePalettes ( TEST_CHARA ) );
+        EXPECT_FALSE ( prefetcher.takeTrials ( TEST_CHARA, TEST_MOON ) );
+
+        // Missing files are still loaded, so the game thread knows not to look for them
+        prefetcher.prefetch ( TEST_CHARA + 1, "TestMissing", 0 );
+        prefetcher.flush();
+
+        palettes = prefetcher.takePalettes ( TEST_CHARA + 1 );
+        ASSERT_TRUE ( palettes.get() );
+        EXPECT_FALSE ( palettes->loaded );
+
+        trials = prefetcher.takeTrials ( TEST_CHARA + 1, 0 );
+        ASSERT_TRUE ( trials.get() );
+        EXPECT_TRUE ( trials->empty() );
+
+        // Invalid characters and moons are ignored
+        prefetcher.prefetch ( NUM_CHARAS, chara.c_str(), 0 );
+        prefetcher.prefetch ( 0, chara.c_str(), NUM_MOONS );
+        prefetcher.flush();
+        EXPECT_FALSE ( prefetcher.takeTrials ( 0, NUM_MOONS ) );
+    }
+
+    remove ( ( folder + chara + "_palettes.txt" ).c_str() );
+    remove ( ( folder + chara + "_palettes.cache" ).c_str() );
+    remove ( ( trialFolder + "/a.txt" ).c_str() );
+    remove ( ( trialFolder + "/b.txt" ).c_str() );
+    remove ( ( trialFolder + "/C.txt" ).c_str() );
+    remove ( ( trialFolder + "/_d.txt" ).c_str() );
+    remove ( ( trialFolder + "/ignored.dat" ).c_str() );
+    rmdir ( trialFolder.c_str() );
+}
+
+#endif // NOT RELEASE
@@ -0,0 +1,164 @@
+#ifndef RELEASE
+
+#include "BlockDelta.hpp"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+using namespace std;
+
+
+#define TEST_BLOCK_SIZE ( 1024 )
+
+
+static string getTestData ( uint32_t size, uint32_t seed )
+{
+    string data ( size, '\0' );
+
+    for ( char& c : data )
+    {
+        seed = seed * 1103515245 + 12345;
+        c = char ( seed >> 16 );
+    }
+
+    return data;
+}
+
+// Concatenate the ranges of the new data, like downloading them
+static string getRanges ( const BlockDelta& delta, const string& newData )
+{
+    string downloaded;
+
+    for ( const BlockDelta::Range& range : delta.ranges )
+        downloaded += newData.substr ( range.start, range.end - range.start );
+
+    return downloaded;
+}
+
+
+TEST ( BlockDelta, Manifest )
+{
+    UpdateManifest manifest;
+    manifest.files.push_back ( UpdateManifest::hashData ( "cccaster.v3.1.exe", getTestData ( 2500, 1 ),
+                                                          TEST_BLOCK_SIZE ) );
+    manifest.files.push_back ( UpdateManifest::hashData ( "cccaster/empty file.txt", "", TEST_BLOCK_SIZE ) );
+    manifest.files.push_back ( UpdateManifest::hashData ( "GRP/a.grp", getTestData ( 1024, 2 ), TEST_BLOCK_SIZE ) );
+
+    EXPECT_EQ ( 3u, manifest.files[0].blockHashes.size() );
+    EXPECT_EQ ( 0u, manifest.files[1].blockHashes.size() );
+    EXPECT_EQ ( 1u, manifest.files[2].blockHashes.size() );
+    EXPECT_EQ ( 3524u, manifest.getTotalSize() );
+
+    // Known MD5 of the empty string
+    EXPECT_EQ ( "d41d8cd98f00b204e9800998ecf8427e", manifest.files[1].hash );
+
+    UpdateManifest parsed;
+    ASSERT_TRUE ( parsed.parse ( manifest.str() ) );
+    ASSERT_EQ ( 3u, parsed.files.size() );
+    EXPECT_EQ ( manifest.str(), parsed.str() );
+    EXPECT_EQ ( "cccaster/empty file.txt", parsed.files[1].path );
+
+    // Missing block hashes
+    string text = manifest.str();
+    EXPECT_FALSE ( parsed.parse ( text.substr ( 0, text.rfind ( '\n', text.size() - 2 ) + 1 ) ) );
+    EXPECT_TRUE ( parsed.files.empty() );
+
+    // Paths outside the app folder
+    EXPECT_FALSE ( parsed.parse ( "file 0 1024 d41d8cd98f00b204e9800998ecf8427e ../evil.exe\n" ) );
+    EXPECT_FALSE ( parsed.parse ( "file 0 1024 d41d8cd98f00b204e9800998ecf8427e /etc/evil\n" ) );
+    EXPECT_FALSE ( parsed.parse ( "file 0 1024 d41d8cd98f00b204e9800998ecf8427e C:\\evil.exe\n" ) );
+    EXPECT_FALSE ( parsed.parse ( "file 0 0 d41d8cd98f00b204e9800998ecf8427e a\n" ) );
+}
+
+TEST ( BlockDelta, Unchanged )
+{
+    const string data = getTestData ( 5000, 3 );
+
+    BlockDelta delta;
+    delta.compute ( data, UpdateManifest::hashData ( "a", data, TEST_BLOCK_SIZE ) );
+
+    EXPECT_TRUE ( delta.isUnchanged() );
+    EXPECT_TRUE ( delta.ranges.empty() );
+
+    string newData;
+    ASSERT_TRUE ( delta.apply ( data, "", newData ) );
+    EXPECT_EQ ( data, newData );
+}
+
+TEST ( BlockDelta, ChangedMovedAndAppended )
+{
+    const string oldData = getTestData ( 10 * TEST_BLOCK_SIZE, 4 );
+
+    // Block 2 and 3 changed, block 5 moved to the start, and a partial block appended
+    string newData = oldData.substr ( 5 * TEST_BLOCK_SIZE, TEST_BLOCK_SIZE ) + oldData;
+    newData.replace ( 3 * TEST_BLOCK_SIZE + 10, 2 * TEST_BLOCK_SIZE - 20, getTestData ( 2 * TEST_BLOCK_SIZE - 20, 5 ) );
+    newData += getTestData ( 300, 6 );
+
+    BlockDelta delta;
+    delta.compute ( oldData, UpdateManifest::hashData ( "a", newData, TEST_BLOCK_SIZE ) );
+
+    EXPECT_FALSE ( delta.isUnchanged() );
+
+    // New blocks 3 and 4 are merged into one range
+    ASSERT_EQ ( 2u, delta.ranges.size() );
+    EXPECT_EQ ( 3u * TEST_BLOCK_SIZE, delta.ranges[0].start );
+    EXPECT_EQ ( 5u * TEST_BLOCK_SIZE, delta.ranges[0].end );
+    EXPECT_EQ ( 11u * TEST_BLOCK_SIZE, delta.ranges[1].start );
+    EXPECT_EQ ( newData.size(), delta.ranges[1].end );
+    EXPECT_EQ ( 2u * TEST_BLOCK_SIZE + 300, delta.getDownloadSize() );
+
+    string patched;
+    ASSERT_TRUE ( delta.apply ( oldData, getRanges ( delta, newData ), patched ) );
+    EXPECT_TRUE ( newData == patched );
+}
+
+TEST ( BlockDelta, MissingFile )
+{
+    const string newData = getTestData ( 2500, 7 );
+
+    BlockDelta delta;
+    delta.compute ( "", UpdateManifest::hashData ( "a", newData, TEST_BLOCK_SIZE ) );
+
+    // The whole file in one range
+    ASSERT_EQ ( 1u, delta.ranges.size() );
+    EXPECT_EQ ( 0u, delta.ranges[0].start );
+    EXPECT_EQ ( newData.size(), delta.ranges[0].end );
+
+    string patched;
+    ASSERT_TRUE ( delta.apply ( "", newData, patched ) );
+    EXPECT_TRUE ( newData == patched );
+}
+
+TEST ( BlockDelta, RejectsBadData )
+{
+    const string oldData = getTestData ( 4 * TEST_BLOCK_SIZE, 8 );
+
+    string newData = oldData;
+    newData[100] ^= 1;
+
+    BlockDelta delta;
+    delta.compute ( oldData, UpdateManifest::hashData ( "a", newData, TEST_BLOCK_SIZE ) );
+    ASSERT_EQ ( 1u, delta.ranges.size() );
+
+    string downloaded = getRanges ( delta, newData ), patched;
+
+    // Wrong size
+    EXPECT_FALSE ( delta.apply ( oldData, downloaded + "x", patched ) );
+
+    // Corrupt download
+    downloaded[5] ^= 1;
+    EXPECT_FALSE ( delta.apply ( oldData, downloaded, patched ) );
+    downloaded[5] ^= 1;
+
+    // Installed file changed since the delta was computed
+    string changed = oldData;
+    changed[2 * TEST_BLOCK_SIZE] ^= 1;
+    EXPECT_FALSE ( delta.apply ( changed, downloaded, patched ) );
+    EXPECT_FALSE ( delta.apply ( oldData.substr ( 0, TEST_BLOCK_SIZE ), downloaded, patched ) );
+
+    EXPECT_TRUE ( delta.apply ( oldData, downloaded, patched ) );
+    EXPECT_TRUE ( newData == patched );
+}
+
+#endif // NOT RELEASE
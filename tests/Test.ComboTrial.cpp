@@ -0,0 +1,222 @@
+#ifndef RELEASE
+
+#include "ComboTrial.hpp"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+#define TEST_CROUCH_SEQ ( 12 )
+#define TEST_TARGET_SEQ ( 100 )
+
+
+static Move getMove ( MovePosition position, const vector<Token>& tokens )
+{
+    return Move { tokens, position };
+}
+
+// 5A, 2B
+static vector<Move> getShortCombo()
+{
+    return
+    {
+        getMove ( Start, { { "5", Direction, 1 }, { "A", Button, 1 } } ),
+        getMove ( Ending, { { "2", Direction, 1 }, { "B", Button, 1 } } ),
+    };
+}
+
+// Follow the progress through a recorded stream of frames, returns the position after each frame
+static vector<uint32_t> replay ( ComboProgress& progress, const CompiledCombo& combo, const vector<ComboFrame>& frames )
+{
+    vector<uint32_t> positions;
+
+    for ( const ComboFrame& frame : frames )
+    {
+        progress.step ( combo, frame );
+        positions.push_back ( progress.position );
+    }
+
+    return positions;
+}
+
+
+TEST ( ComboTrial, Compile )
+{
+    CompiledCombo combo;
+    combo.compile ( { 10, 0, 30 }, { 1, 0 }, TEST_CROUCH_SEQ );
+
+    ASSERT_EQ ( 3u, combo.steps.size() );
+    EXPECT_EQ ( 10u, combo.steps[0].altSeq );
+    EXPECT_EQ ( 0u, combo.steps[1].seq );
+    EXPECT_EQ ( uint32_t ( TEST_CROUCH_SEQ ), combo.steps[1].altSeq );
+    EXPECT_EQ ( 1, combo.steps[0].hit );
+
+    // Missing hit requirements default to any
+    EXPECT_EQ ( 0, combo.steps[2].hit );
+}
+
+TEST ( ComboTrial, Progress )
+{
+    CompiledCombo combo;
+    combo.compile ( { 10, 20, 0, 30, 40 }, { 0, 1, 0, 2, 0 }, TEST_CROUCH_SEQ );
+
+    ComboProgress progress;
+
+    // { seq, partnerSeq, targetSeq, hitcount }
+    const vector<ComboFrame> frames =
+    {
+        { 20, 0, TEST_TARGET_SEQ, 0 },                  // Not started yet
+        { 10, 0, TEST_TARGET_SEQ, 0 },                  // Start
+        { 20, 0, TEST_TARGET_SEQ, 0 },                  // Has to hit
+        { 20, 0, TEST_TARGET_SEQ, 1 },
+        { TEST_CROUCH_SEQ, 0, TEST_TARGET_SEQ, 1 },     // Crouching
+        { 5, 30, TEST_TARGET_SEQ, 2 },                  // Partner
+        { 40, 0, TEST_TARGET_SEQ, 3 },                  // Completed
+        { 40, 0, 0, 3 },
+        { 0, 0, 0, 0 },                                 // Stays completed
+    };
+
+    EXPECT_EQ ( vector<uint32_t> ( { 0, 1, 1, 2, 3, 4, 5, 5, 5 } ), replay ( progress, combo, frames ) );
+    EXPECT_TRUE ( progress.drop );
+    EXPECT_EQ ( 5, progress.dropPos );
+}
+
+TEST ( ComboTrial, Drop )
+{
+    CompiledCombo combo;
+    combo.compile ( { 10, 20, 30 }, { 0, 1, 0 }, TEST_CROUCH_SEQ );
+
+    ComboProgress progress;
+
+    const vector<ComboFrame> frames =
+    {
+        { 10, 0, TEST_TARGET_SEQ, 4 },
+        { 20, 0, TEST_TARGET_SEQ, 5 },
+        { 20, 0, 0, 5 },                                // Dropped
+        { 30, 0, TEST_TARGET_SEQ, 5 },                  // Ignored until the next attempt
+        { 0, 0, 0, 0 },                                 // Neutral resets
+        { 10, 0, TEST_TARGET_SEQ, 1 },                  // Next attempt
+        { 20, 0, TEST_TARGET_SEQ, 1 },
+    };
+
+    EXPECT_EQ ( vector<uint32_t> ( { 1, 2, 2, 2, 0, 1, 1 } ), replay ( progress, combo, frames ) );
+    EXPECT_FALSE ( progress.drop );
+    EXPECT_TRUE ( progress.start );
+    EXPECT_EQ ( 2, progress.dropPos );
+
+    progress.reset();
+    EXPECT_EQ ( 0u, progress.position );
+    EXPECT_EQ ( -1, progress.dropPos );
+
+    // An empty combo never starts
+    CompiledCombo empty;
+    progress.step ( empty, { 10, 0, TEST_TARGET_SEQ, 1 } );
+    EXPECT_FALSE ( progress.start );
+}
+
+TEST ( ComboTrial, Widths )
+{
+    const Move move = getMove ( Middle, { { "j.", Symbol, 2 }, { "5", Direction, 1 }, { "C", Button, 1 },
+                                          { "(whiff)", String, 7 } } );
+
+    EXPECT_EQ ( 30 + 25 + 25 + 24 * 7 - 20 + 7 + 18, ComboLayout::getWrapWidth ( move, 0 ) );
+    EXPECT_EQ ( 30 + 25 + 25 + 24 * 7 - 20, ComboLayout::getDrawnWidth ( move, 0 ) );
+    EXPECT_EQ ( 20 * 2 + 20 + 20 + 20 * 7 - 10 + 7, ComboLayout::getWrapWidth ( move, 20 ) );
+    EXPECT_EQ ( 20 * 2 - 10 + 20 + 20 + 20 * 7 - 10, ComboLayout::getDrawnWidth ( move, 20 ) );
+
+    // Letters drawn with tighter spacing
+    EXPECT_EQ ( 24 * 7 - 55, ComboLayout::getDrawnWidth ( getMove ( Middle, { { "Airdash", String, 7 } } ), 0 ) );
+}
+
+TEST ( ComboTrial, Layout )
+{
+    const vector<Move> moves = getShortCombo();
+
+    ComboLayout layout;
+    ASSERT_TRUE ( layout.update ( 1, moves, 1, -1, 0, false ) );
+    ASSERT_EQ ( 2u, layout.entries.size() );
+    EXPECT_EQ ( 0, layout.buttonWidth );
+
+    EXPECT_EQ ( Done, layout.entries[0].status );
+    EXPECT_EQ ( 20, layout.entries[0].x );
+    EXPECT_EQ ( 20, layout.entries[0].y );
+    EXPECT_EQ ( 57, layout.entries[0].width );
+
+    EXPECT_EQ ( Current, layout.entries[1].status );
+    EXPECT_EQ ( 20 + 57 + 4, layout.entries[1].x );
+    EXPECT_EQ ( 57, layout.entries[1].width );
+
+    // Scaled icons
+    ASSERT_TRUE ( layout.update ( 1, moves, 1, -1, 1, false ) );
+    EXPECT_EQ ( 20, layout.buttonWidth );
+    EXPECT_EQ ( 47, layout.entries[0].width );
+    EXPECT_EQ ( 20 + 47 + 4, layout.entries[1].x );
+
+    // Small icons that still wrap like unscaled ones
+    ASSERT_TRUE ( layout.update ( 1, moves, 1, -1, 2, true ) );
+    EXPECT_EQ ( 0xc, layout.buttonWidth );
+    EXPECT_EQ ( 31, layout.entries[0].width );
+    EXPECT_EQ ( 20 + 31 + 4, layout.entries[1].x );
+    EXPECT_EQ ( 20 + 25, layout.entries[1].y );
+
+    // Unknown scale
+    ASSERT_TRUE ( layout.update ( 1, moves, 1, -1, 3, false ) );
+    EXPECT_TRUE ( layout.entries.empty() );
+}
+
+TEST ( ComboTrial, LayoutWrapsAndStatus )
+{
+    const Token text = { "abcdefghij", String, 10 };
+
+    const vector<Move> moves =
+    {
+        getShortCombo()[0],
+        getMove ( Middle, { text } ),
+        getMove ( Middle, { text } ),
+        getMove ( Middle, { text } ),
+        getMove ( Ending, { text } ),
+    };
+
+    ComboLayout layout;
+    ASSERT_TRUE ( layout.update ( 1, moves, 1, 3, 0, false ) );
+    ASSERT_EQ ( 5u, layout.entries.size() );
+
+    const int widths[] = { 57, 247, 247, 247, 247 };
+    const int xs[] = { 20, 81, 347, 20, 286 };
+    const int ys[] = { 20, 20, 20, 50, 50 };
+    const MoveStatus statuses[] = { Done, Current, Next, Failed, Next };
+
+    for ( size_t i = 0; i < layout.entries.size(); ++i )
+    {
+        EXPECT_EQ ( i, layout.entries[i].move );
+        EXPECT_EQ ( widths[i], layout.entries[i].width );
+        EXPECT_EQ ( xs[i], layout.entries[i].x ) << "move " << i;
+        EXPECT_EQ ( ys[i], layout.entries[i].y ) << "move " << i;
+        EXPECT_EQ ( statuses[i], layout.entries[i].status ) << "move " << i;
+    }
+}
+
+TEST ( ComboTrial, LayoutCache )
+{
+    const vector<Move> moves = getShortCombo();
+
+    ComboLayout layout;
+    EXPECT_TRUE ( layout.update ( 1, moves, 0, -1, 0, false ) );
+    EXPECT_FALSE ( layout.update ( 1, moves, 0, -1, 0, false ) );
+
+    EXPECT_TRUE ( layout.update ( 1, moves, 1, -1, 0, false ) );
+    EXPECT_TRUE ( layout.update ( 1, moves, 1, 1, 0, false ) );
+    EXPECT_TRUE ( layout.update ( 1, moves, 1, 1, 1, false ) );
+    EXPECT_TRUE ( layout.update ( 1, moves, 1, 1, 1, true ) );
+    EXPECT_TRUE ( layout.update ( 2, moves, 1, 1, 1, true ) );
+    EXPECT_FALSE ( layout.update ( 2, moves, 1, 1, 1, true ) );
+
+    layout.invalidate();
+    EXPECT_TRUE ( layout.update ( 2, moves, 1, 1, 1, true ) );
+}
+
+#endif // NOT RELEASE
@@ -0,0 +1,170 @@
+#ifndef RELEASE
+
+#include "ControllerEventQueue.hpp"
+#include "Thread.hpp"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+using namespace std;
+
+
+#define BUTTON_A            ( 0x00000100u )
+#define BUTTON_B            ( 0x00000200u )
+#define DIR_LEFT            ( 0x00000004u )
+#define LATCH_MASK          ( 0xFFFFFFF0u )
+#define FRAME_US            ( 16667 )
+#define NUM_STRESS_EVENTS   ( 20000 )
+
+
+// Fake controller, pushes its state like ControllerManager::check when it changes
+struct FakeController
+{
+    ControllerEventQueue& queue;
+
+    uint32_t state = 0, queuedState = 0;
+
+    FakeController ( ControllerEventQueue& queue ) : queue ( queue ) {}
+
+    bool set ( uint32_t newState, uint64_t timestamp )
+    {
+        state = newState;
+
+        if ( state == queuedState )
+            return true;
+
+        queuedState = state;
+        return queue.push ( this, state, timestamp );
+    }
+};
+
+
+TEST ( ControllerEventQueue, LatchesTaps )
+{
+    ControllerEventQueue queue;
+    FakeController a ( queue ), b ( queue );
+
+    // Tap A within one frame, and tap left which is not latched
+    a.set ( BUTTON_A, 1000 );
+    a.set ( BUTTON_A | DIR_LEFT, 2000 );
+    a.set ( 0, 5000 );
+
+    queue.drain ( FRAME_US );
+    EXPECT_EQ ( BUTTON_A, queue.sample ( &a, a.state, LATCH_MASK ) );
+
+    // The tap only lasts one frame
+    queue.drain ( 2 * FRAME_US );
+    EXPECT_EQ ( 0u, queue.sample ( &a, a.state, LATCH_MASK ) );
+
+    // Held buttons are not extended after they are released
+    b.set ( BUTTON_B, 2 * FRAME_US + 100 );
+    queue.drain ( 3 * FRAME_US );
+    EXPECT_EQ ( BUTTON_B, queue.sample ( &b, b.state, LATCH_MASK ) );
+
+    b.set ( 0, 3 * FRAME_US + 100 );
+    queue.drain ( 4 * FRAME_US );
+    EXPECT_EQ ( 0u, queue.sample ( &b, b.state, LATCH_MASK ) );
+
+    // Sources without events are sampled as is
+    int other;
+    EXPECT_EQ ( BUTTON_B, queue.sample ( &other, BUTTON_B, LATCH_MASK ) );
+}
+
+TEST ( ControllerEventQueue, Deadline )
+{
+    ControllerEventQueue queue;
+    FakeController a ( queue );
+
+    // A tap after the deadline is left for the next frame
+    a.set ( BUTTON_A, FRAME_US + 10 );
+    a.set ( 0, FRAME_US + 20 );
+
+    queue.drain ( FRAME_US );
+    EXPECT_EQ ( 0u, queue.sample ( &a, 0, LATCH_MASK ) );
+
+    queue.drain ( 2 * FRAME_US );
+    EXPECT_EQ ( BUTTON_A, queue.sample ( &a, 0, LATCH_MASK ) );
+
+    // Stale presses are not latched
+    a.set ( BUTTON_A, 3 * FRAME_US );
+    a.set ( 0, 3 * FRAME_US + 10 );
+
+    queue.drain ( 10 * FRAME_US, 9 * FRAME_US );
+    EXPECT_EQ ( 0u, queue.sample ( &a, 0, LATCH_MASK ) );
+
+    // Clearing forgets the latched presses
+    a.set ( BUTTON_A, 11 * FRAME_US );
+    a.set ( 0, 11 * FRAME_US + 10 );
+
+    queue.drain ( 12 * FRAME_US );
+    queue.clear();
+    EXPECT_EQ ( 0u, queue.sample ( &a, 0, LATCH_MASK ) );
+}
+
+TEST ( ControllerEventQueue, Overflow )
+{
+    ControllerEventQueue queue;
+    FakeController a ( queue );
+
+    for ( size_t i = 0; i < ControllerEventQueue::capacity; ++i )
+        ASSERT_TRUE ( a.set ( ( i % 2 ) ? 0 : BUTTON_A, i ) );
+
+    EXPECT_FALSE ( a.set ( BUTTON_B, 1000 ) );
+    EXPECT_EQ ( 1u, queue.getNumDropped() );
+
+    // The current state is still sampled, only the latched press of B is lost
+    queue.drain ( 2000 );
+    EXPECT_EQ ( BUTTON_A | BUTTON_B, queue.sample ( &a, a.state, LATCH_MASK ) );
+
+    EXPECT_TRUE ( a.set ( 0, 3000 ) );
+}
+
+// Polling thread that pushes a different bit at each timestamp, retrying when the queue is full
+class PollingThread : public Thread
+{
+public:
+
+    ControllerEventQueue& queue;
+
+    const void *source;
+
+    PollingThread ( ControllerEventQueue& queue, const void *source ) : queue ( queue ), source ( source ) {}
+
+    void run() override
+    {
+        for ( uint32_t i = 1; i <= NUM_STRESS_EVENTS; )
+        {
+            if ( queue.push ( source, 1u << ( i % 32 ), i ) )
+                ++i;
+        }
+    }
+};
+
+TEST ( ControllerEventQueue, Concurrent )
+{
+    ControllerEventQueue queue;
+    FakeController controller ( queue );
+
+    PollingThread thread ( queue, &controller );
+    thread.start();
+
+    // Drain one timestamp at a time, so each drain must latch exactly the bit pushed at that time
+    for ( uint32_t i = 1; i <= NUM_STRESS_EVENTS; )
+    {
+        queue.drain ( i );
+
+        const uint32_t sampled = queue.sample ( &controller, 0, 0xFFFFFFFF );
+
+        // Not pushed yet
+        if ( sampled == 0 )
+            continue;
+
+        ASSERT_EQ ( 1u << ( i % 32 ), sampled );
+        ++i;
+    }
+
+    thread.join();
+}
+
+#endif // NOT RELEASE
@@ -0,0 +1,331 @@
+#ifndef RELEASE
+
+#include "DesyncDetector.hpp"
+#include "MemDump.hpp"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+
+#define NUM_OBJECTS         ( 64 )
+#define FIXED_SIZE          ( NUM_OBJECTS * sizeof ( char * ) + 0x14 )
+#define PLAIN_OFFSET        ( 0x800 )
+#define PLAIN_SIZE          ( 0x123 )
+#define OBJECT_SIZE         ( 0x30 )
+#define NUM_FRAMES          ( 120 )
+#define DESYNC_FRAME        ( 74 )
+#define NUM_HASH_ITERATIONS ( 2000 )
+
+
+// Synthetic game state: a fixed region with pointers to objects, and a plain region, in the same order in memory
+// like the game's static data. Each peer allocates its own objects, so the pointer values differ between peers
+// while the contents are the same.
+struct GameMemory
+{
+    vector<char> data;
+
+    char *fixed, *plain;
+
+    vector<unique_ptr<char[]>> objects;
+
+    GameMemory() : data ( PLAIN_OFFSET + PLAIN_SIZE ), fixed ( &data[0] ), plain ( &data[PLAIN_OFFSET] )
+    {
+        for ( size_t i = 0; i < NUM_OBJECTS; ++i )
+        {
+            objects.push_back ( unique_ptr<char[]> ( new char[OBJECT_SIZE + rand() % 0x40] ) );
+
+            char *ptr = objects.back().get();
+            memcpy ( &fixed[i * sizeof ( char * )], &ptr, sizeof ( ptr ) );
+        }
+    }
+
+    MemDumpList build()
+    {
+        vector<MemDumpPtr> ptrs;
+
+        for ( size_t i = 0; i < NUM_OBJECTS; ++i )
+            ptrs.push_back ( MemDumpPtr ( i * sizeof ( char * ), 0, OBJECT_SIZE ) );
+
+        MemDumpList list;
+        list.append ( MemDump ( fixed, FIXED_SIZE, ptrs ) );
+        list.append ( MemDump ( plain, PLAIN_SIZE ) );
+        list.update();
+        return list;
+    }
+
+    // Deterministic simulation of one frame
+    void step ( uint32_t frame )
+    {
+        for ( size_t i = NUM_OBJECTS * sizeof ( char * ); i < FIXED_SIZE; ++i )
+            fixed[i] = char ( frame * 7 + i );
+
+        for ( size_t i = 0; i < PLAIN_SIZE; ++i )
+            plain[i] = char ( frame ^ ( i * 13 ) );
+
+        for ( size_t i = 0; i < NUM_OBJECTS; ++i )
+            for ( size_t j = 0; j < OBJECT_SIZE; ++j )
+                objects[i][j] = char ( frame + i * j );
+    }
+};
+
+// One side of a netplay session
+struct Peer : public DesyncDetector::Owner
+{
+    GameMemory memory;
+
+    MemDumpPlan plan;
+
+    vector<char> dump;
+
+    vector<uint64_t> hashes;
+
+    DesyncDetector detector;
+
+    int numReports = 0;
+
+    uint64_t reportedFrame = UINT64_MAX;
+
+    int reportedRegion = -2;
+
+    Peer()
+    {
+        plan.compile ( memory.build() );
+        dump.resize ( plan.totalSize );
+        hashes.resize ( plan.getNumRegions() );
+        detector.owner = this;
+    }
+
+    void saveState ( uint64_t indexedFrame )
+    {
+        plan.saveDump ( &dump[0], &hashes[0] );
+        detector.record ( indexedFrame, hashes );
+    }
+
+    void desyncDetected ( DesyncDetector *detector, uint64_t indexedFrame, int region ) override
+    {
+        ++numReports;
+        reportedFrame = indexedFrame;
+        reportedRegion = region;
+    }
+};
+
+static void exchange ( Peer& from, Peer& to )
+{
+    vector<uint64_t> frames, hashes;
+
+    if ( from.detector.popOutgoing ( frames, hashes ) )
+        to.detector.receive ( frames, hashes );
+
+    uint64_t indexedFrame;
+
+    if ( from.detector.popOutgoingRegions ( indexedFrame, hashes ) )
+        to.detector.receiveRegions ( indexedFrame, hashes );
+}
+
+// Same layout as IndexedFrame::value
+static uint64_t indexedFrame ( uint32_t index, uint32_t frame )
+{
+    return ( uint64_t ( index ) << 32 ) | frame;
+}
+
+// Run both peers, perturbing one byte on the remote side at the desync frame
+static void runSession ( Peer& local, Peer& remote, char *perturb )
+{
+    for ( uint32_t frame = 0; frame < NUM_FRAMES; ++frame )
+    {
+        local.memory.step ( frame );
+        remote.memory.step ( frame );
+
+        if ( frame == DESYNC_FRAME )
+            ++ ( *perturb );
+
+        local.saveState ( indexedFrame ( 1, frame ) );
+        remote.saveState ( indexedFrame ( 1, frame ) );
+
+        // Pretend to roll back every few frames, which drops the states after the target, these frames are then
+        // only recorded by the remote, so they are never compared
+        if ( frame % 10 == 9 )
+            local.detector.rewind ( indexedFrame ( 1, frame - 3 ) );
+
+        // The remote confirms with a few frames of lag
+        if ( frame >= 2 )
+        {
+            local.detector.confirm ( indexedFrame ( 1, frame - 2 ) );
+            remote.detector.confirm ( indexedFrame ( 1, frame - 2 ) );
+        }
+
+        exchange ( local, remote );
+        exchange ( remote, local );
+    }
+}
+
+
+TEST ( DesyncDetector, HashIgnoresPointers )
+{
+    Peer a, b;
+
+    a.memory.step ( 5 );
+    b.memory.step ( 5 );
+
+    ASSERT_EQ ( 2u, a.plan.getNumRegions() );
+    ASSERT_NE ( 0, memcmp ( a.memory.fixed, b.memory.fixed, NUM_OBJECTS * sizeof ( char * ) ) );
+
+    // The hashes must match even though the pointer values differ
+    a.plan.saveDump ( &a.dump[0], &a.hashes[0] );
+    b.plan.saveDump ( &b.dump[0], &b.hashes[0] );
+    EXPECT_EQ ( a.hashes, b.hashes );
+
+    // Hashing must not change the dump
+    vector<char> expected ( a.plan.totalSize );
+    a.plan.saveDump ( &expected[0] );
+    EXPECT_TRUE ( expected == a.dump );
+
+    // Changing the data behind a pointer changes only its region
+    ++b.memory.objects[10][5];
+    b.plan.saveDump ( &b.dump[0], &b.hashes[0] );
+    EXPECT_NE ( a.hashes[0], b.hashes[0] );
+    EXPECT_EQ ( a.hashes[1], b.hashes[1] );
+
+    // Slot arrays also hash without pointer values
+    const vector<MemDumpPtr> slotPtrs = { MemDumpPtr ( 0, 0, 0x10 ) };
+    vector<char> slotsA ( 0x40 * 8 ), slotsB ( 0x40 * 8 );
+
+    for ( size_t i = 0; i < 8; i += 3 )
+    {
+        char *objectA = a.memory.objects[i].get(), *objectB = b.memory.objects[i].get();
+        memcpy ( &slotsA[i * 0x40], &objectA, sizeof ( char * ) );
+        memcpy ( &slotsB[i * 0x40], &objectB, sizeof ( char * ) );
+        slotsA[i * 0x40 + 0x20] = slotsB[i * 0x40 + 0x20] = 1;
+    }
+
+    const MemDumpSlots arrayA ( &slotsA[0], 0x40, 8, 0x20, 1, slotPtrs );
+    const MemDumpSlots arrayB ( &slotsB[0], 0x40, 8, 0x20, 1, slotPtrs );
+
+    uint64_t hashA = 0, hashB = 0;
+    vector<char> dumpA, dumpB;
+    arrayA.saveDump ( dumpA, &hashA );
+    arrayB.saveDump ( dumpB, &hashB );
+    EXPECT_EQ ( hashA, hashB );
+
+    b.memory.objects[3][0] ^= 0x40;
+    dumpB.clear();
+    arrayB.saveDump ( dumpB, &hashB );
+    EXPECT_NE ( hashA, hashB );
+}
+
+TEST ( DesyncDetector, NoDesync )
+{
+    Peer local, remote;
+
+    // Perturb memory that isn't part of the state
+    char unused = 0;
+    runSession ( local, remote, &unused );
+
+    EXPECT_FALSE ( local.detector.isDesynced() );
+    EXPECT_FALSE ( remote.detector.isDesynced() );
+    EXPECT_EQ ( 0, local.numReports );
+    EXPECT_EQ ( 0, remote.numReports );
+}
+
+TEST ( DesyncDetector, LocalisesDivergence )
+{
+    for ( int region = 0; region < 2; ++region )
+    {
+        Peer local, remote;
+
+        char *perturb = ( region == 0 ? &remote.memory.objects[NUM_OBJECTS - 1][OBJECT_SIZE - 1]
+                                      : &remote.memory.plain[0x100] );
+
+        runSession ( local, remote, perturb );
+
+        for ( const Peer *peer : { &local, &remote } )
+        {
+            EXPECT_TRUE ( peer->detector.isDesynced() );
+            EXPECT_EQ ( 1, peer->numReports );
+            EXPECT_EQ ( indexedFrame ( 1, DESYNC_FRAME ), peer->reportedFrame );
+            EXPECT_EQ ( region, peer->reportedRegion );
+        }
+    }
+}
+
+TEST ( DesyncDetector, RollbackAfterConfirm )
+{
+    // Without the pending rollback frame, the mispredicted states are confirmed and reported as a desync
+    for ( bool pendingRollback : { true, false } )
+    {
+        Peer local, remote;
+
+        for ( uint32_t frame = 0; frame < 10; ++frame )
+        {
+            local.memory.step ( frame );
+            remote.memory.step ( frame );
+
+            // The local side predicted the wrong inputs for frame 6, so the states from frame 7 are wrong, and the
+            // rollback to frame 6 is delayed
+            if ( frame >= 7 )
+                ++local.memory.plain[0];
+
+            local.saveState ( indexedFrame ( 1, frame ) );
+            remote.saveState ( indexedFrame ( 1, frame ) );
+        }
+
+        // The remote inputs are known up to frame 8 before the rollback happens
+        local.detector.confirm ( indexedFrame ( 1, 8 ), pendingRollback ? indexedFrame ( 1, 6 ) : UINT64_MAX );
+        remote.detector.confirm ( indexedFrame ( 1, 8 ) );
+
+        exchange ( local, remote );
+        exchange ( remote, local );
+
+        local.detector.rewind ( indexedFrame ( 1, 6 ) );
+
+        for ( uint32_t frame = 7; frame < 10; ++frame )
+        {
+            local.memory.step ( frame );
+            local.saveState ( indexedFrame ( 1, frame ) );
+        }
+
+        local.detector.confirm ( indexedFrame ( 1, 9 ) );
+        remote.detector.confirm ( indexedFrame ( 1, 9 ) );
+
+        exchange ( local, remote );
+        exchange ( remote, local );
+
+        EXPECT_EQ ( !pendingRollback, local.detector.isDesynced() );
+        EXPECT_EQ ( !pendingRollback, remote.detector.isDesynced() );
+
+        if ( !pendingRollback )
+        {
+            EXPECT_EQ ( indexedFrame ( 1, 7 ), local.detector.getDivergentFrame() );
+        }
+    }
+}
+
+TEST ( DesyncDetector, HashPerf )
+{
+    Peer peer;
+    peer.memory.step ( 1 );
+
+    auto start = chrono::steady_clock::now();
+    for ( int i = 0; i < NUM_HASH_ITERATIONS; ++i )
+        peer.plan.saveDump ( &peer.dump[0] );
+    auto copyTime = chrono::steady_clock::now() - start;
+
+    start = chrono::steady_clock::now();
+    for ( int i = 0; i < NUM_HASH_ITERATIONS; ++i )
+        peer.plan.saveDump ( &peer.dump[0], &peer.hashes[0] );
+    auto hashTime = chrono::steady_clock::now() - start;
+
+    typedef chrono::duration<double, micro> us;
+
+    PRINT ( "%u bytes: copy %.2f us; copy and hash %.2f us", ( uint32_t ) peer.plan.totalSize,
+            us ( copyTime ).count() / NUM_HASH_ITERATIONS, us ( hashTime ).count() / NUM_HASH_ITERATIONS );
+}
+
+#endif // NOT RELEASE
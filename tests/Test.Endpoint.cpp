@@ -0,0 +1,233 @@
+#ifndef RELEASE
+
+#include "Endpoint.hpp"
+#include "Algorithms.hpp"
+#include "StringUtils.hpp"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using namespace std;
+
+
+#define NUM_BENCHMARK_PEERS     ( 4096 )
+#define NUM_BENCHMARK_PACKETS   ( 200000 )
+
+
+static sockaddr_storage getV4 ( uint32_t addr, uint16_t port )
+{
+    sockaddr_storage sas;
+    memset ( &sas, 0, sizeof ( sas ) );
+
+    sockaddr_in *in = ( sockaddr_in * ) &sas;
+    in->sin_family = AF_INET;
+    in->sin_addr.s_addr = htonl ( addr );
+    in->sin_port = htons ( port );
+    return sas;
+}
+
+static sockaddr_storage getV6 ( const vector<uint8_t>& bytes, uint16_t port )
+{
+    sockaddr_storage sas;
+    memset ( &sas, 0, sizeof ( sas ) );
+
+    sockaddr_in6 *in6 = ( sockaddr_in6 * ) &sas;
+    in6->sin6_family = AF_INET6;
+    memcpy ( &in6->sin6_addr, &bytes[0], 16 );
+    in6->sin6_port = htons ( port );
+    return sas;
+}
+
+// 2001:db8::<index>
+static vector<uint8_t> getV6Bytes ( uint32_t index )
+{
+    vector<uint8_t> bytes ( 16, 0 );
+    bytes[0] = 0x20;
+    bytes[1] = 0x01;
+    bytes[2] = 0x0d;
+    bytes[3] = 0xb8;
+    bytes[14] = uint8_t ( index >> 8 );
+    bytes[15] = uint8_t ( index );
+    return bytes;
+}
+
+// The same key and hash as IpAddrPort, which is only built for Windows
+struct AddrPortKey
+{
+    string addr;
+    uint16_t port;
+
+    bool operator== ( const AddrPortKey& other ) const { return ( addr == other.addr && port == other.port ); }
+};
+
+struct AddrPortKeyHash
+{
+    size_t operator() ( const AddrPortKey& a ) const
+    {
+        size_t seed = 0;
+        hash_combine ( seed, a.addr );
+        hash_combine ( seed, a.port );
+        return seed;
+    }
+};
+
+// Formatted like getAddrFromSockAddr, which the receive path used to do for every packet
+static AddrPortKey getAddrPortKey ( const sockaddr *sa )
+{
+    char addr[NI_MAXHOST];
+    const socklen_t saLen = ( sa->sa_family == AF_INET ? sizeof ( sockaddr_in ) : sizeof ( sockaddr_in6 ) );
+    getnameinfo ( sa, saLen, addr, sizeof ( addr ), 0, 0, NI_NUMERICHOST );
+
+    const Endpoint endpoint ( sa );
+    return AddrPortKey { addr, endpoint.port };
+}
+
+
+TEST ( Endpoint, V4 )
+{
+    const sockaddr_storage sas = getV4 ( 0x01020304, 5678 );
+    const Endpoint endpoint ( ( sockaddr * ) &sas );
+
+    EXPECT_TRUE ( endpoint.isV4 );
+    EXPECT_FALSE ( endpoint.empty() );
+    EXPECT_EQ ( 5678, endpoint.port );
+    EXPECT_EQ ( "1.2.3.4", endpoint.getAddr() );
+    EXPECT_EQ ( "1.2.3.4:5678", endpoint.str() );
+    EXPECT_EQ ( endpoint, Endpoint::parse ( "1.2.3.4", 5678 ) );
+    EXPECT_NE ( endpoint, Endpoint::parse ( "1.2.3.4", 5679 ) );
+    EXPECT_NE ( endpoint, Endpoint::parse ( "1.2.3.5", 5678 ) );
+}
+
+TEST ( Endpoint, V6 )
+{
+    const sockaddr_storage sas = getV6 ( getV6Bytes ( 1 ), 3939 );
+    const Endpoint endpoint ( ( sockaddr * ) &sas );
+
+    EXPECT_FALSE ( endpoint.isV4 );
+    EXPECT_EQ ( 3939, endpoint.port );
+    EXPECT_EQ ( "2001:db8::1", endpoint.getAddr() );
+    EXPECT_EQ ( "2001:db8::1:3939", endpoint.str() );
+    EXPECT_EQ ( endpoint, Endpoint::parse ( "2001:db8::1", 3939 ) );
+
+    // An IPv4-mapped address received on an IPv6 socket isn't the same peer as one received on an IPv4 socket
+    const Endpoint mapped = Endpoint::parse ( "::ffff:1.2.3.4", 5678 );
+    EXPECT_FALSE ( mapped.isV4 );
+    EXPECT_NE ( Endpoint::parse ( "1.2.3.4", 5678 ), mapped );
+}
+
+TEST ( Endpoint, Parse )
+{
+    EXPECT_TRUE ( Endpoint().empty() );
+    EXPECT_EQ ( "", Endpoint().str() );
+
+    // Numeric addresses only, so it never does a DNS lookup
+    EXPECT_TRUE ( Endpoint::parse ( "", 1 ).empty() );
+    EXPECT_TRUE ( Endpoint::parse ( "localhost", 1 ).empty() );
+    EXPECT_TRUE ( Endpoint::parse ( "1.2.3.4.5", 1 ).empty() );
+}
+
+TEST ( Endpoint, Hash )
+{
+    unordered_set<Endpoint> endpoints;
+
+    // Peers behind the same NAT only differ by port, peers on the same subnet only by the last bytes
+    for ( uint32_t i = 0; i < NUM_BENCHMARK_PEERS; ++i )
+    {
+        sockaddr_storage sas = getV4 ( 0xC0A80001, uint16_t ( 3939 + i ) );
+        endpoints.insert ( Endpoint ( ( sockaddr * ) &sas ) );
+
+        sas = getV4 ( 0x0A000000 + i, 3939 );
+        endpoints.insert ( Endpoint ( ( sockaddr * ) &sas ) );
+
+        sas = getV6 ( getV6Bytes ( i ), 3939 );
+        endpoints.insert ( Endpoint ( ( sockaddr * ) &sas ) );
+    }
+
+    EXPECT_EQ ( 3u * NUM_BENCHMARK_PEERS, endpoints.size() );
+
+    size_t maxBucketSize = 0;
+
+    for ( size_t i = 0; i < endpoints.bucket_count(); ++i )
+        maxBucketSize = max ( maxBucketSize, endpoints.bucket_size ( i ) );
+
+    EXPECT_LE ( maxBucketSize, 8u );
+}
+
+// Finding the child socket of each received packet, keyed by the formatted address vs the binary address
+TEST ( Endpoint, Benchmark )
+{
+    vector<sockaddr_storage> peers;
+    unordered_map<AddrPortKey, uint32_t, AddrPortKeyHash> addrPortChildren;
+    unordered_map<Endpoint, uint32_t> endpointChildren;
+
+    for ( uint32_t i = 0; i < NUM_BENCHMARK_PEERS; ++i )
+    {
+        if ( i % 2 )
+            peers.push_back ( getV6 ( getV6Bytes ( i ), uint16_t ( 1024 + rand() % 60000 ) ) );
+        else
+            peers.push_back ( getV4 ( 0x0A000000 + i, uint16_t ( 1024 + rand() % 60000 ) ) );
+
+        addrPortChildren[getAddrPortKey ( ( sockaddr * ) &peers.back() )] = i;
+        endpointChildren[Endpoint ( ( sockaddr * ) &peers.back() )] = i;
+    }
+
+    ASSERT_EQ ( size_t ( NUM_BENCHMARK_PEERS ), addrPortChildren.size() );
+    ASSERT_EQ ( size_t ( NUM_BENCHMARK_PEERS ), endpointChildren.size() );
+
+    vector<uint32_t> packets ( NUM_BENCHMARK_PACKETS );
+
+    for ( uint32_t& peer : packets )
+        peer = rand() % NUM_BENCHMARK_PEERS;
+
+    uint64_t addrPortSum = 0, endpointSum = 0, expectedSum = 0;
+
+    for ( uint32_t peer : packets )
+        expectedSum += peer;
+
+    auto start = chrono::steady_clock::now();
+
+    for ( uint32_t peer : packets )
+    {
+        const auto it = addrPortChildren.find ( getAddrPortKey ( ( sockaddr * ) &peers[peer] ) );
+        addrPortSum += ( it == addrPortChildren.end() ? 0 : it->second );
+    }
+
+    auto addrPortTime = chrono::steady_clock::now() - start;
+
+    start = chrono::steady_clock::now();
+
+    for ( uint32_t peer : packets )
+    {
+        const auto it = endpointChildren.find ( Endpoint ( ( sockaddr * ) &peers[peer] ) );
+        endpointSum += ( it == endpointChildren.end() ? 0 : it->second );
+    }
+
+    auto endpointTime = chrono::steady_clock::now() - start;
+
+    EXPECT_EQ ( expectedSum, addrPortSum );
+    EXPECT_EQ ( expectedSum, endpointSum );
+
+    typedef chrono::duration<double, nano> ns;
+
+    PRINT ( "%u packets from %u peers: formatted address %.1f ns / packet, binary endpoint %.1f ns / packet",
+            NUM_BENCHMARK_PACKETS, NUM_BENCHMARK_PEERS,
+            chrono::duration_cast<ns> ( addrPortTime ).count() / NUM_BENCHMARK_PACKETS,
+            chrono::duration_cast<ns> ( endpointTime ).count() / NUM_BENCHMARK_PACKETS );
+}
+
+#endif // NOT RELEASE
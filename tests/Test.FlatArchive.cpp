@@ -0,0 +1,322 @@
+#ifndef RELEASE
+
+#include "FlatArchive.hpp"
+#include "Logger.hpp"
+
+#include <cereal/types/array.hpp>
+#include <cereal/types/map.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/vector.hpp>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <sstream>
+
+using namespace std;
+
+
+#define NUM_FUZZ_ITERATIONS     ( 2000 )
+#define NUM_BENCH_MESSAGES      ( 200000 )
+
+
+// The protocol layer isn't built natively, so these stand in for the messages, with the same kinds of fields
+// and the same boilerplate as PROTOCOL_MESSAGE_BOILERPLATE.
+#define FAKE_MESSAGE_BOILERPLATE(...)                                                                       \
+    void save ( cereal::BinaryOutputArchive& ar ) const { ar ( sequence, __VA_ARGS__ ); }                   \
+    void load ( cereal::BinaryInputArchive& ar ) { ar ( sequence, __VA_ARGS__ ); }                          \
+    bool saveFlat ( FlatWriter& writer ) const { return writer.save ( sequence, __VA_ARGS__ ); }             \
+    bool loadFlat ( FlatReader& reader ) { return reader.load ( sequence, __VA_ARGS__ ); }
+
+
+ENUM ( FakeMode, Host, Client, SpectateNetplay, SpectateBroadcast, Broadcast, Offline );
+
+enum class FakeMsgType : uint8_t { First, Second, Third };
+
+static mt19937 rng ( 1234 );
+
+template<typename T>
+static T randomValue() { return T ( rng() ); }
+
+static string randomString()
+{
+    string str ( rng() % 40, ' ' );
+
+    for ( char& c : str )
+        c = char ( rng() );
+
+    return str;
+}
+
+
+// Like BothInputs
+struct FakeBothInputs
+{
+    uint32_t sequence = 0;
+    uint64_t indexedFrame = 0;
+    array<array<uint16_t, 30>, 2> inputs;
+
+    void randomize()
+    {
+        sequence = randomValue<uint32_t>();
+        indexedFrame = ( uint64_t ( rng() ) << 32 ) | rng();
+
+        for ( auto& player : inputs )
+            for ( uint16_t& input : player )
+                input = randomValue<uint16_t>();
+    }
+
+    bool operator== ( const FakeBothInputs& other ) const
+    {
+        return sequence == other.sequence && indexedFrame == other.indexedFrame && inputs == other.inputs;
+    }
+
+    FAKE_MESSAGE_BOILERPLATE ( indexedFrame, inputs )
+};
+
+// Like InitialConfig and SplitMessage
+struct FakeConfig
+{
+    uint32_t sequence = 0;
+    FakeMode mode;
+    FakeMsgType type = FakeMsgType::First;
+    uint16_t dataPort = 0;
+    string localName, remoteName;
+    uint8_t winCount = 0;
+    bool flag = false;
+    double latency = 0;
+
+    void randomize()
+    {
+        sequence = randomValue<uint32_t>();
+        mode = FakeMode::Enum ( rng() % 7 );
+        type = FakeMsgType ( rng() % 3 );
+        dataPort = randomValue<uint16_t>();
+        localName = randomString();
+        remoteName = randomString();
+        winCount = randomValue<uint8_t>();
+        flag = rng() % 2;
+        latency = rng() / 7.0;
+    }
+
+    bool operator== ( const FakeConfig& other ) const
+    {
+        return sequence == other.sequence && mode == other.mode && type == other.type
+               && dataPort == other.dataPort && localName == other.localName && remoteName == other.remoteName
+               && winCount == other.winCount && flag == other.flag && latency == other.latency;
+    }
+
+    FAKE_MESSAGE_BOILERPLATE ( mode, type, dataPort, localName, remoteName, winCount, flag, latency )
+};
+
+// Like StateHashes and SyncHash
+struct FakeHashes
+{
+    uint32_t sequence = 0;
+    vector<uint64_t> frames;
+    vector<array<uint32_t, 4>> regionHashes;
+    vector<string> names;
+    char hash[16];
+    int32_t cameraX = 0;
+
+    void randomize()
+    {
+        sequence = randomValue<uint32_t>();
+        frames.resize ( rng() % 20 );
+        regionHashes.resize ( rng() % 5 );
+        names.resize ( rng() % 3 );
+
+        for ( uint64_t& frame : frames )
+            frame = ( uint64_t ( rng() ) << 32 ) | rng();
+
+        for ( auto& region : regionHashes )
+            for ( uint32_t& value : region )
+                value = randomValue<uint32_t>();
+
+        for ( string& name : names )
+            name = randomString();
+
+        for ( char& c : hash )
+            c = char ( rng() );
+
+        cameraX = randomValue<int32_t>();
+    }
+
+    bool operator== ( const FakeHashes& other ) const
+    {
+        return sequence == other.sequence && frames == other.frames && regionHashes == other.regionHashes
+               && names == other.names && !memcmp ( hash, other.hash, sizeof ( hash ) ) && cameraX == other.cameraX;
+    }
+
+    FAKE_MESSAGE_BOILERPLATE ( frames, regionHashes, names, hash, cameraX )
+};
+
+// Like OptionsMessage, which has no flat layout
+struct FakeOptions
+{
+    uint32_t sequence = 0;
+    map<uint32_t, string> options;
+
+    FAKE_MESSAGE_BOILERPLATE ( options )
+};
+
+
+template<typename T>
+static string cerealSave ( const T& msg )
+{
+    ostringstream ss ( stringstream::binary );
+    cereal::BinaryOutputArchive archive ( ss );
+    msg.save ( archive );
+    return ss.str();
+}
+
+template<typename T>
+static bool cerealLoad ( const string& bytes, T& msg )
+{
+    istringstream ss ( bytes, stringstream::binary );
+    cereal::BinaryInputArchive archive ( ss );
+
+    try
+    {
+        msg.load ( archive );
+    }
+    catch ( ... )
+    {
+        return false;
+    }
+
+    return true;
+}
+
+template<typename T>
+static string flatSave ( const T& msg )
+{
+    string bytes;
+    FlatWriter writer ( bytes );
+    EXPECT_TRUE ( msg.saveFlat ( writer ) );
+    return bytes;
+}
+
+template<typename T>
+static bool flatLoad ( const string& bytes, T& msg )
+{
+    FlatReader reader ( bytes.data(), bytes.size() );
+    EXPECT_TRUE ( msg.loadFlat ( reader ) );
+    return !reader.failed() && reader.remaining() == 0;
+}
+
+
+template<typename T>
+static void fuzzRoundTrip()
+{
+    for ( size_t i = 0; i < NUM_FUZZ_ITERATIONS; ++i )
+    {
+        T msg;
+        msg.randomize();
+
+        // Same bytes as cereal
+        const string bytes = flatSave ( msg );
+        ASSERT_EQ ( cerealSave ( msg ), bytes );
+
+        // Both ways round trip
+        T flatLoaded, cerealLoaded;
+        ASSERT_TRUE ( flatLoad ( bytes, flatLoaded ) );
+        ASSERT_TRUE ( cerealLoad ( bytes, cerealLoaded ) );
+        EXPECT_TRUE ( msg == flatLoaded );
+        EXPECT_TRUE ( msg == cerealLoaded );
+
+        // Truncated data fails cleanly
+        const string truncated = bytes.substr ( 0, rng() % bytes.size() );
+        T partial;
+        EXPECT_FALSE ( flatLoad ( truncated, partial ) );
+
+        // Garbage data never reads out of bounds, any sizes larger than the data fail
+        string garbage = bytes;
+        for ( size_t j = 0; j < 4; ++j )
+            garbage [ rng() % garbage.size() ] = char ( rng() );
+        T unused;
+        flatLoad ( garbage, unused );
+    }
+}
+
+
+TEST ( FlatArchive, Inputs )
+{
+    fuzzRoundTrip<FakeBothInputs>();
+}
+
+TEST ( FlatArchive, Config )
+{
+    fuzzRoundTrip<FakeConfig>();
+}
+
+TEST ( FlatArchive, Hashes )
+{
+    fuzzRoundTrip<FakeHashes>();
+}
+
+TEST ( FlatArchive, HugeSize )
+{
+    // A size that would make cereal allocate gigabytes is rejected before allocating
+    string bytes ( 4, '\0' );
+    bytes += string ( "\xff\xff\xff\x7f", 4 );
+
+    FakeHashes msg;
+    FlatReader reader ( bytes.data(), bytes.size() );
+    EXPECT_TRUE ( msg.loadFlat ( reader ) );
+    EXPECT_TRUE ( reader.failed() );
+    EXPECT_TRUE ( msg.frames.empty() );
+}
+
+TEST ( FlatArchive, NoFlatLayout )
+{
+    FakeOptions msg;
+    msg.options[1] = "one";
+
+    string bytes = "x";
+    FlatWriter writer ( bytes );
+    EXPECT_FALSE ( msg.saveFlat ( writer ) );
+    EXPECT_EQ ( "x", bytes );
+
+    FlatReader reader ( bytes.data(), bytes.size() );
+    EXPECT_FALSE ( msg.loadFlat ( reader ) );
+    EXPECT_EQ ( 1u, reader.remaining() );
+}
+
+TEST ( FlatArchive, Throughput )
+{
+    vector<FakeBothInputs> msgs ( 64 );
+
+    for ( FakeBothInputs& msg : msgs )
+        msg.randomize();
+
+    uint32_t checksum = 0;
+
+    auto start = chrono::steady_clock::now();
+    for ( size_t i = 0; i < NUM_BENCH_MESSAGES; ++i )
+    {
+        FakeBothInputs msg;
+        flatLoad ( flatSave ( msgs [ i % msgs.size() ] ), msg );
+        checksum += msg.inputs[1][i % 30];
+    }
+    auto flatTime = chrono::steady_clock::now() - start;
+
+    start = chrono::steady_clock::now();
+    for ( size_t i = 0; i < NUM_BENCH_MESSAGES; ++i )
+    {
+        FakeBothInputs msg;
+        cerealLoad ( cerealSave ( msgs [ i % msgs.size() ] ), msg );
+        checksum += msg.inputs[1][i % 30];
+    }
+    auto cerealTime = chrono::steady_clock::now() - start;
+
+    typedef chrono::duration<double> seconds;
+
+    PRINT ( "Inputs save + load: flat %.0f messages / s, cereal %.0f messages / s (checksum %08x)",
+            NUM_BENCH_MESSAGES / seconds ( flatTime ).count(), NUM_BENCH_MESSAGES / seconds ( cerealTime ).count(),
+            checksum );
+}
+
+#endif // NOT RELEASE
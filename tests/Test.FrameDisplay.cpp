@@ -0,0 +1,447 @@
+#ifndef RELEASE
+
+#include "mbaacc_framedisplay.h"
+#include "StringUtils.hpp"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+#define TEST_PACK_FILE          "Test.FrameDisplay.p"
+#define TEST_XOR_KEY            ( 0x1A2B3C4D )
+
+#define SPRITE_SIZE             ( 64 )
+#define SPRITES_PER_SOURCE      ( 4 )
+#define NUM_BENCHMARK_SPRITES   ( 2000 )
+#define NUM_VIEWED_SPRITES      ( 50 )
+
+#define CG_IMAGE_HEADER_SIZE    ( 72 )
+#define CG_INDICES_OFFSET       ( 0x2044 )
+#define CG_IMAGES_OFFSET        ( 0x4F30 )
+
+
+// Same layout as in mbaacc_cg.cc
+struct CgAlignment
+{
+    int x, y, width, height;
+    short sourceX, sourceY, sourceImage, copyFlag;
+};
+
+// Exposes the internals that the old loader allocated up front
+struct TestCG : public MBAACC_CG
+{
+    // Build every cell table, like the old loader did
+    void buildAllCells()
+    {
+        for ( unsigned int i = 0; i < m_image_count; ++i )
+            get_cells ( i );
+    }
+
+    size_t getIndexSize() const
+    {
+        return m_cell_sources.size() * sizeof ( CellSource ) + m_cell_source_start.size() * sizeof ( unsigned int );
+    }
+
+    size_t getImageCount() const { return m_image_count; }
+};
+
+
+// The pack encryption, written out again here so the tests don't depend on the one being tested
+static void encrypt ( uint8_t *data, size_t size, uint32_t key, uint32_t mod )
+{
+    uint8_t step = ( mod & 0xFF ) ? ( mod & 0xFF ) : 1;
+    uint8_t keyBytes[4] = { uint8_t ( key ), uint8_t ( key >> 8 ), uint8_t ( key >> 16 ), uint8_t ( key >> 24 ) };
+
+    for ( size_t i = 0; i < min ( size, size_t ( 4096 ) ); ++i )
+    {
+        data[i] ^= keyBytes[i % 4];
+
+        if ( i % 4 == 3 )
+        {
+            for ( uint8_t& byte : keyBytes )
+                byte += step;
+        }
+    }
+}
+
+static void append ( string& bytes, const void *data, size_t size )
+{
+    bytes.append ( ( const char * ) data, size );
+}
+
+static void appendUint ( string& bytes, uint32_t value )
+{
+    append ( bytes, &value, sizeof ( value ) );
+}
+
+static void appendName ( string& bytes, const string& name, size_t size, uint32_t mod )
+{
+    vector<uint8_t> buffer ( size, 0 );
+    memcpy ( &buffer[0], name.c_str(), name.size() );
+    encrypt ( &buffer[0], size, TEST_XOR_KEY, mod );
+    append ( bytes, &buffer[0], size );
+}
+
+// Write a FilePacHeaderA pack, the folders are { name, files } in order
+static void writePack ( const vector<pair<string, vector<pair<string, string>>>>& folders )
+{
+    string table, data;
+    uint32_t numFiles = 0;
+
+    for ( const auto& folder : folders )
+    {
+        appendUint ( table, 0 );
+        appendUint ( table, numFiles );
+        appendUint ( table, 0 );
+        appendName ( table, folder.first, 256, 0 );
+
+        numFiles += folder.second.size();
+    }
+
+    for ( const auto& folder : folders )
+    {
+        for ( const auto& file : folder.second )
+        {
+            appendUint ( table, data.size() );
+            appendUint ( table, 0 );
+            appendUint ( table, file.second.size() );
+            appendName ( table, file.first, 32, file.second.size() );
+
+            string encrypted = file.second;
+            encrypt ( ( uint8_t * ) &encrypted[0], encrypted.size(), TEST_XOR_KEY, 0x03 );
+            data += encrypted;
+        }
+    }
+
+    const uint32_t headerSize = 52;
+
+    string pack = "FilePacHeaderA";
+    pack.resize ( 16, '\0' );
+    appendUint ( pack, 0 );
+    appendUint ( pack, TEST_XOR_KEY );
+    appendUint ( pack, headerSize + table.size() );
+    appendUint ( pack, data.size() );
+    appendUint ( pack, folders.size() );
+    appendUint ( pack, numFiles );
+    pack.resize ( headerSize, '\0' );
+
+    pack += table + data;
+
+    FILE *file = fopen ( TEST_PACK_FILE, "wb" );
+    ASSERT_TRUE ( file != 0 );
+    fwrite ( &pack[0], 1, pack.size(), file );
+    fclose ( file );
+}
+
+static uint8_t getPixelIndex ( uint32_t sprite, uint32_t x, uint32_t y )
+{
+    return uint8_t ( sprite * 7 + x + y * 3 );
+}
+
+// A .CG with square 8bpp sprites, SPRITES_PER_SOURCE of them side by side in each source image
+static string makeCG ( uint32_t numSprites )
+{
+    string cg = "BMP Cutter3";
+    cg.resize ( CG_IMAGES_OFFSET, '\0' );
+
+    uint32_t *header = ( uint32_t * ) &cg[0x14 + 0x2000];
+    header[3] = numSprites;
+
+    string images, aligns;
+
+    for ( uint32_t i = 0; i < numSprites; ++i )
+    {
+        const uint32_t offset = CG_IMAGES_OFFSET + images.size();
+        memcpy ( &cg[CG_INDICES_OFFSET + i * 4], &offset, 4 );
+
+        string name = format ( "spr%04u.bmp", i );
+        name.resize ( 32, '\0' );
+        images += name;
+
+        const uint32_t fields[] = { 0, SPRITE_SIZE, SPRITE_SIZE, 8, 0, 0, SPRITE_SIZE, SPRITE_SIZE, i, 1 };
+        append ( images, fields, sizeof ( fields ) );
+
+        for ( uint32_t y = 0; y < SPRITE_SIZE; ++y )
+            for ( uint32_t x = 0; x < SPRITE_SIZE; ++x )
+                images += char ( getPixelIndex ( i, x, y ) );
+
+        const CgAlignment align = { 0, 0, SPRITE_SIZE, SPRITE_SIZE,
+                                    short ( ( i % SPRITES_PER_SOURCE ) * SPRITE_SIZE ), 0,
+                                    short ( i / SPRITES_PER_SOURCE ), 0
+                                  };
+        append ( aligns, &align, sizeof ( align ) );
+    }
+
+    cg += images;
+
+    const uint32_t alignOffset = cg.size();
+    memcpy ( &cg[CG_INDICES_OFFSET + 3000 * 4], &alignOffset, 4 );
+
+    return cg + aligns;
+}
+
+static vector<uint32_t> getPalette()
+{
+    vector<uint32_t> palette ( 256 );
+
+    for ( uint32_t i = 0; i < palette.size(); ++i )
+        palette[i] = 0xFF000000 | ( i * 0x010203 );
+
+    return palette;
+}
+
+static void expectSprite ( const MBAACC_DecodedImage *decoded, uint32_t sprite, const vector<uint32_t>& palette )
+{
+    ASSERT_TRUE ( decoded != 0 );
+    ASSERT_EQ ( SPRITE_SIZE, decoded->width );
+    ASSERT_EQ ( SPRITE_SIZE, decoded->height );
+    EXPECT_FALSE ( decoded->is_8bpp );
+
+    const uint32_t *pixels = ( const uint32_t * ) decoded->pixels;
+    size_t numWrong = 0;
+
+    for ( uint32_t y = 0; y < SPRITE_SIZE; ++y )
+        for ( uint32_t x = 0; x < SPRITE_SIZE; ++x )
+            numWrong += ( pixels[y * SPRITE_SIZE + x] != palette[getPixelIndex ( sprite, x, y )] );
+
+    EXPECT_EQ ( 0u, numWrong ) << "sprite " << sprite;
+}
+
+
+TEST ( FrameDisplay, Pack )
+{
+    // Sizes that aren't a multiple of 4, and longer than the encrypted part
+    string large ( 5003, '\0' ), small = "abcdefg";
+
+    for ( size_t i = 0; i < large.size(); ++i )
+        large[i] = char ( i * 13 );
+
+    writePack (
+    {
+        { ".\\data", { { "LARGE.BIN", large }, { "Small.txt", small } } },
+        { ".\\se", { { "SE.WAV", "wave" } } },
+    } );
+
+    MBAACC_Pack pack;
+    ASSERT_TRUE ( pack.open_pack ( TEST_PACK_FILE ) );
+    EXPECT_FALSE ( pack.open_pack ( TEST_PACK_FILE ) );
+
+    unsigned int size = 0;
+    const char *data = pack.map_file ( "large.bin", &size );
+    ASSERT_TRUE ( data != 0 );
+    EXPECT_EQ ( large, string ( data, size ) );
+
+    // Decrypting the file in place doesn't touch the next one, and it's only decrypted once
+    const char *smallData = pack.map_file ( "SMALL.TXT", &size );
+    ASSERT_TRUE ( smallData != 0 );
+    EXPECT_EQ ( small, string ( smallData, size ) );
+    EXPECT_EQ ( data, pack.map_file ( "LARGE.BIN", &size ) );
+    EXPECT_EQ ( large, string ( data, size ) );
+
+    char *copy = 0;
+    ASSERT_TRUE ( pack.read_file ( "small.txt", &copy, &size ) );
+    EXPECT_EQ ( small, string ( copy, size ) );
+    EXPECT_EQ ( '\0', copy[size] );
+    delete[] copy;
+
+    // Only the data folder is looked in
+    EXPECT_TRUE ( pack.map_file ( "SE.WAV", &size ) == 0 );
+    EXPECT_TRUE ( pack.map_file ( "missing", &size ) == 0 );
+
+    pack.close_pack();
+    EXPECT_TRUE ( pack.map_file ( "LARGE.BIN", &size ) == 0 );
+
+    // Changes in the mapping are private
+    ASSERT_TRUE ( pack.open_pack ( TEST_PACK_FILE ) );
+    data = pack.map_file ( "LARGE.BIN", &size );
+    ASSERT_TRUE ( data != 0 );
+    EXPECT_EQ ( large, string ( data, size ) );
+    pack.close_pack();
+
+    // Without a data folder
+    writePack ( { { ".\\se", { { "SE.WAV", "wave" } } } } );
+    EXPECT_FALSE ( pack.open_pack ( TEST_PACK_FILE ) );
+
+    remove ( TEST_PACK_FILE );
+    EXPECT_FALSE ( pack.open_pack ( TEST_PACK_FILE ) );
+}
+
+TEST ( FrameDisplay, LazyCells )
+{
+    writePack ( { { ".\\data", { { "TEST.CG", makeCG ( 16 ) } } } } );
+
+    MBAACC_Pack pack;
+    ASSERT_TRUE ( pack.open_pack ( TEST_PACK_FILE ) );
+
+    vector<uint32_t> palette = getPalette();
+
+    TestCG cg;
+    ASSERT_TRUE ( cg.load ( &pack, "test.cg" ) );
+    EXPECT_EQ ( 16, cg.get_image_count() );
+    EXPECT_EQ ( 16u / SPRITES_PER_SOURCE, cg.getImageCount() );
+    EXPECT_STREQ ( "spr0005.bmp", cg.get_filename ( 5 ) );
+
+    // No cell tables until something is drawn
+    EXPECT_EQ ( 0u, cg.get_table_size() );
+
+    expectSprite ( cg.get_decoded_image ( 5, &palette[0], 1 ), 5, palette );
+    const unsigned int tableSize = cg.get_table_size();
+    EXPECT_GT ( tableSize, 0u );
+
+    // Sprites cut from the same source image share its cells
+    expectSprite ( cg.get_decoded_image ( 6, &palette[0], 1 ), 6, palette );
+    EXPECT_EQ ( tableSize, cg.get_table_size() );
+
+    expectSprite ( cg.get_decoded_image ( 15, &palette[0], 1 ), 15, palette );
+    EXPECT_EQ ( 2 * tableSize, cg.get_table_size() );
+
+    EXPECT_TRUE ( cg.get_decoded_image ( 16, &palette[0], 1 ) == 0 );
+
+    // The 8bpp path used for saving
+    MBAACC_DecodedImage decoded;
+    ASSERT_TRUE ( cg.decode_image ( 3, &palette[0], 1, 1, &decoded ) );
+    EXPECT_TRUE ( decoded.is_8bpp );
+    EXPECT_EQ ( getPixelIndex ( 3, 10, 20 ), decoded.pixels[20 * SPRITE_SIZE + 10] );
+    delete[] decoded.pixels;
+
+    cg.free();
+    EXPECT_EQ ( 0u, cg.get_table_size() );
+    EXPECT_FALSE ( cg.load ( &pack, "missing.cg" ) );
+
+    remove ( TEST_PACK_FILE );
+}
+
+TEST ( FrameDisplay, Cache )
+{
+    writePack ( { { ".\\data", { { "TEST.CG", makeCG ( 16 ) } } } } );
+
+    MBAACC_Pack pack;
+    ASSERT_TRUE ( pack.open_pack ( TEST_PACK_FILE ) );
+
+    vector<uint32_t> palette = getPalette(), other = getPalette();
+    other[1] = 0;
+
+    MBAACC_CG cg;
+    ASSERT_TRUE ( cg.load ( &pack, "TEST.CG" ) );
+
+    const unsigned int spriteBytes = SPRITE_SIZE * SPRITE_SIZE * 4;
+    cg.set_cache_budget ( 3 * spriteBytes );
+
+    const MBAACC_DecodedImage *first = cg.get_decoded_image ( 0, &palette[0], 1 );
+    EXPECT_EQ ( first, cg.get_decoded_image ( 0, &palette[0], 1 ) );
+    EXPECT_EQ ( spriteBytes, cg.get_cache_size() );
+
+    // Each palette is cached separately
+    expectSprite ( cg.get_decoded_image ( 0, &other[0], 1 ), 0, other );
+    EXPECT_EQ ( 2 * spriteBytes, cg.get_cache_size() );
+
+    // Using the first one again keeps it when the least recently used ones are dropped
+    cg.get_decoded_image ( 1, &palette[0], 1 );
+    const unsigned char *firstPixels = cg.get_decoded_image ( 0, &palette[0], 1 )->pixels;
+
+    for ( uint32_t i = 2; i < 4; ++i )
+        expectSprite ( cg.get_decoded_image ( i, &palette[0], 1 ), i, palette );
+
+    EXPECT_EQ ( 3 * spriteBytes, cg.get_cache_size() );
+    EXPECT_EQ ( firstPixels, cg.get_decoded_image ( 0, &palette[0], 1 )->pixels );
+
+    // Smaller budget
+    cg.set_cache_budget ( spriteBytes );
+    EXPECT_EQ ( spriteBytes, cg.get_cache_size() );
+
+    // Palettes changed in place
+    palette[getPixelIndex ( 0, 0, 0 )] = 0x12345678;
+    cg.flush_cache();
+    EXPECT_EQ ( 0u, cg.get_cache_size() );
+    expectSprite ( cg.get_decoded_image ( 0, &palette[0], 1 ), 0, palette );
+
+    cg.free();
+    EXPECT_EQ ( 0u, cg.get_cache_size() );
+
+    remove ( TEST_PACK_FILE );
+}
+
+// Opening a character and viewing some sprites, the old way read the whole .CG into the heap and built every
+// cell table up front
+TEST ( FrameDisplay, Benchmark )
+{
+    writePack ( { { ".\\data", { { "TEST.CG", makeCG ( NUM_BENCHMARK_SPRITES ) } } } } );
+
+    vector<uint32_t> palette = getPalette();
+    typedef chrono::duration<double, milli> ms;
+
+    // Old: copy + every cell table
+    auto start = chrono::steady_clock::now();
+
+    MBAACC_Pack eagerPack;
+    ASSERT_TRUE ( eagerPack.open_pack ( TEST_PACK_FILE ) );
+
+    char *copy = 0;
+    unsigned int cgSize = 0;
+    ASSERT_TRUE ( eagerPack.read_file ( "TEST.CG", &copy, &cgSize ) );
+
+    TestCG eager;
+    ASSERT_TRUE ( eager.load ( &eagerPack, "TEST.CG" ) );
+    eager.buildAllCells();
+
+    const double eagerTime = chrono::duration_cast<ms> ( chrono::steady_clock::now() - start ).count();
+    const size_t eagerBytes = cgSize + eager.get_table_size() + eager.getIndexSize();
+
+    delete[] copy;
+
+    // New: mapped, lazily built cell tables
+    start = chrono::steady_clock::now();
+
+    MBAACC_Pack pack;
+    ASSERT_TRUE ( pack.open_pack ( TEST_PACK_FILE ) );
+
+    TestCG cg;
+    ASSERT_TRUE ( cg.load ( &pack, "TEST.CG" ) );
+
+    const double loadTime = chrono::duration_cast<ms> ( chrono::steady_clock::now() - start ).count();
+
+    ASSERT_EQ ( size_t ( NUM_BENCHMARK_SPRITES / SPRITES_PER_SOURCE ), cg.getImageCount() );
+    EXPECT_EQ ( 0u, cg.get_table_size() );
+
+    // Stepping back and forth through the first few sprites
+    start = chrono::steady_clock::now();
+
+    for ( uint32_t i = 0; i < NUM_VIEWED_SPRITES; ++i )
+        ASSERT_TRUE ( cg.get_decoded_image ( i, &palette[0], 1 ) != 0 );
+
+    const double missTime = chrono::duration_cast<ms> ( chrono::steady_clock::now() - start ).count();
+
+    start = chrono::steady_clock::now();
+
+    for ( uint32_t i = 0; i < NUM_VIEWED_SPRITES; ++i )
+        ASSERT_TRUE ( cg.get_decoded_image ( i, &palette[0], 1 ) != 0 );
+
+    const double hitTime = chrono::duration_cast<ms> ( chrono::steady_clock::now() - start ).count();
+
+    expectSprite ( cg.get_decoded_image ( NUM_VIEWED_SPRITES - 1, &palette[0], 1 ), NUM_VIEWED_SPRITES - 1, palette );
+
+    const size_t lazyBytes = cg.get_table_size() + cg.getIndexSize();
+
+    EXPECT_LT ( lazyBytes, eagerBytes / 10 );
+
+    PRINT ( "%u sprites in a %u KB .CG: open %.2f ms, %u KB heap vs %.2f ms, %u KB heap reading it eagerly",
+            NUM_BENCHMARK_SPRITES, cgSize / 1024, loadTime, lazyBytes / 1024, eagerTime, eagerBytes / 1024 );
+
+    PRINT ( "%u sprites viewed: %.1f us / sprite decoding, %.2f us / sprite cached, %u KB of decoded RGBA",
+            NUM_VIEWED_SPRITES, 1000 * missTime / NUM_VIEWED_SPRITES, 1000 * hitTime / NUM_VIEWED_SPRITES,
+            cg.get_cache_size() / 1024 );
+
+    cg.free();
+    eager.free();
+
+    remove ( TEST_PACK_FILE );
+}
+
+#endif // NOT RELEASE
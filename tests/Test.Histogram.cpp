@@ -0,0 +1,179 @@
+#ifndef RELEASE
+
+#include "Histogram.hpp"
+#include "Logger.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+
+#define NUM_SAMPLES         ( 100000 )
+#define NUM_BENCH_SAMPLES   ( 10000000 )
+
+// Percentiles are the middle of a bucket at most 1/32 of the value wide
+#define MAX_RELATIVE_ERROR  ( 1.0 / 64 )
+
+
+// Exact percentile with the same rank as Histogram::getPercentile
+static uint64_t exactPercentile ( const vector<uint64_t>& sorted, double percentile )
+{
+    const size_t rank = max ( size_t ( 1 ), size_t ( ceil ( percentile / 100.0 * sorted.size() ) ) );
+    return sorted [ rank - 1 ];
+}
+
+static void checkAccuracy ( const char *name, const vector<uint64_t>& samples )
+{
+    Histogram histogram;
+
+    for ( uint64_t value : samples )
+        histogram.addSample ( value );
+
+    vector<uint64_t> sorted = samples;
+    sort ( sorted.begin(), sorted.end() );
+
+    EXPECT_EQ ( samples.size(), histogram.getNumSamples() );
+    EXPECT_EQ ( sorted.front(), histogram.getMin() );
+    EXPECT_EQ ( sorted.back(), histogram.getMax() );
+
+    double worst = 0;
+
+    for ( double percentile : { 1.0, 10.0, 25.0, 50.0, 75.0, 90.0, 95.0, 99.0, 99.9, 99.99, 100.0 } )
+    {
+        const double exact = exactPercentile ( sorted, percentile );
+        const double actual = histogram.getPercentile ( percentile );
+        const double error = ( exact ? fabs ( actual - exact ) / exact : actual );
+
+        EXPECT_LE ( error, MAX_RELATIVE_ERROR ) << name << " p" << percentile << " " << actual << " vs " << exact;
+        worst = max ( worst, error );
+    }
+
+    PRINT ( "%s: %s; worst relative error %.4f", name, histogram.str(), worst );
+}
+
+
+TEST ( Histogram, Buckets )
+{
+    // Every value is inside its bucket, and the buckets cover the whole range without gaps
+    for ( size_t i = 0; i < Histogram::numBuckets; ++i )
+    {
+        EXPECT_EQ ( i, Histogram::getBucketIndex ( Histogram::getBucketLow ( i ) ) );
+        EXPECT_EQ ( i, Histogram::getBucketIndex ( Histogram::getBucketHigh ( i ) ) );
+
+        if ( i + 1 < Histogram::numBuckets )
+        {
+            EXPECT_EQ ( Histogram::getBucketHigh ( i ) + 1, Histogram::getBucketLow ( i + 1 ) );
+        }
+    }
+
+    EXPECT_EQ ( Histogram::maxValue, Histogram::getBucketHigh ( Histogram::numBuckets - 1 ) );
+
+    // Values past the max are counted in the last bucket
+    EXPECT_EQ ( Histogram::numBuckets - 1, Histogram::getBucketIndex ( UINT64_MAX ) );
+
+    Histogram histogram;
+    histogram.addSample ( UINT64_MAX );
+    EXPECT_EQ ( UINT64_MAX, histogram.getMax() );
+    EXPECT_EQ ( UINT64_MAX, histogram.getPercentile ( 50 ) );
+}
+
+TEST ( Histogram, ExactSmallValues )
+{
+    Histogram histogram;
+
+    EXPECT_EQ ( 0u, histogram.getPercentile ( 50 ) );
+    EXPECT_EQ ( 0u, histogram.getMin() );
+
+    // Rollback depths are small, so they are counted exactly
+    for ( uint64_t i = 0; i < 100; ++i )
+        histogram.addSample ( i % 16 );
+
+    EXPECT_EQ ( 7u, histogram.getPercentile ( 50 ) );
+    EXPECT_EQ ( 15u, histogram.getPercentile ( 99 ) );
+    EXPECT_EQ ( 0u, histogram.getPercentile ( 0 ) );
+    EXPECT_DOUBLE_EQ ( 7.26, histogram.getMean() );
+}
+
+TEST ( Histogram, Accuracy )
+{
+    mt19937_64 rng ( 1234 );
+    vector<uint64_t> samples ( NUM_SAMPLES );
+
+    // Frame times in microseconds
+    uniform_int_distribution<uint64_t> uniform ( 16000, 17400 );
+    for ( uint64_t& value : samples )
+        value = uniform ( rng );
+    checkAccuracy ( "Uniform", samples );
+
+    // Ping times with a long tail
+    lognormal_distribution<double> lognormal ( 4.0, 0.6 );
+    for ( uint64_t& value : samples )
+        value = uint64_t ( lognormal ( rng ) );
+    checkAccuracy ( "Lognormal", samples );
+
+    // Save times in nanoseconds with occasional huge stalls
+    exponential_distribution<double> exponential ( 1.0 / 50000 );
+    for ( uint64_t& value : samples )
+        value = uint64_t ( exponential ( rng ) ) + ( rng() % 1000 == 0 ? 100000000 : 0 );
+    checkAccuracy ( "Exponential", samples );
+}
+
+TEST ( Histogram, MergeAndSnapshot )
+{
+    mt19937_64 rng ( 5678 );
+    Histogram a, b, both;
+
+    for ( size_t i = 0; i < 10000; ++i )
+    {
+        const uint64_t value = rng() % 1000000;
+        ( i % 3 ? a : b ).addSample ( value );
+        both.addSample ( value );
+    }
+
+    Histogram merged = a;
+    merged.merge ( b );
+
+    EXPECT_EQ ( both.getNumSamples(), merged.getNumSamples() );
+    EXPECT_EQ ( both.getMin(), merged.getMin() );
+    EXPECT_EQ ( both.getMax(), merged.getMax() );
+    EXPECT_DOUBLE_EQ ( both.getMean(), merged.getMean() );
+    EXPECT_EQ ( both.str(), merged.str() );
+
+    // Merging an empty histogram changes nothing
+    merged.merge ( Histogram() );
+    EXPECT_EQ ( both.str(), merged.str() );
+
+    const Histogram snapshot = merged.takeSnapshot();
+    EXPECT_EQ ( both.str(), snapshot.str() );
+    EXPECT_EQ ( 0u, merged.getNumSamples() );
+    EXPECT_EQ ( 0u, merged.getMax() );
+}
+
+TEST ( Histogram, Insertion )
+{
+    mt19937 rng ( 1 );
+    vector<uint32_t> values ( 4096 );
+
+    for ( uint32_t& value : values )
+        value = rng() >> ( rng() % 32 );
+
+    Histogram histogram;
+
+    auto start = chrono::steady_clock::now();
+    for ( size_t i = 0; i < NUM_BENCH_SAMPLES; ++i )
+        histogram.addSample ( values [ i % values.size() ] );
+    auto elapsed = chrono::steady_clock::now() - start;
+
+    EXPECT_EQ ( uint64_t ( NUM_BENCH_SAMPLES ), histogram.getNumSamples() );
+
+    PRINT ( "%u bytes; %.2f ns / sample (p50 %llu)", sizeof ( histogram ),
+            chrono::duration<double, nano> ( elapsed ).count() / NUM_BENCH_SAMPLES, histogram.getPercentile ( 50 ) );
+}
+
+#endif // NOT RELEASE
@@ -0,0 +1,662 @@
+#ifndef RELEASE
+
+#include "HttpRange.hpp"
+#include "StringUtils.hpp"
+#include "Thread.hpp"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+
+#ifdef _WIN32
+typedef int socklen_t;
+#define CLOSE_SOCKET(FD) closesocket ( FD )
+#else
+typedef int SOCKET;
+#define CLOSE_SOCKET(FD) close ( FD )
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL ( 0 )
+#endif
+
+#define TEST_FILE_SIZE      ( 1024 * 1024 + 123 )
+#define TEST_SEGMENT_SIZE   ( 64 * 1024 )
+
+
+static string getTestData ( uint32_t size, uint32_t seed )
+{
+    string data ( size, '\0' );
+
+    for ( char& c : data )
+    {
+        seed = seed * 1103515245 + 12345;
+        c = char ( seed >> 16 );
+    }
+
+    return data;
+}
+
+// Local stand-in for the update server, serves one file over HTTP with byte ranges and an ETag, and can
+// disconnect after sending part of each response.
+class StandInHttpServer : public Thread
+{
+public:
+
+    uint16_t port = 0;
+
+    // Body bytes sent before disconnecting, 0 to send whole responses
+    atomic<uint32_t> disconnectAfter { 0 };
+
+    // Send the whole file with a 200 response like a server without range support
+    atomic<bool> ignoreRanges { false };
+
+    // Counted before responding, so they are final once the client has the response
+    atomic<uint32_t> numRequests { 0 }, numRequestedBytes { 0 };
+
+    StandInHttpServer ( const string& data, const string& tag ) : _data ( data ), _tag ( tag )
+    {
+        _fd = socket ( AF_INET, SOCK_STREAM, IPPROTO_TCP );
+
+        sockaddr_in addr;
+        memset ( &addr, 0, sizeof ( addr ) );
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl ( INADDR_LOOPBACK );
+
+        bind ( _fd, ( sockaddr * ) &addr, sizeof ( addr ) );
+        listen ( _fd, 16 );
+
+        socklen_t len = sizeof ( addr );
+        getsockname ( _fd, ( sockaddr * ) &addr, &len );
+        port = ntohs ( addr.sin_port );
+
+        start();
+    }
+
+    ~StandInHttpServer()
+    {
+        _stop = true;
+        join();
+
+        for ( const auto& connection : _connections )
+            connection->join();
+
+        CLOSE_SOCKET ( _fd );
+    }
+
+    void setData ( const string& data, const string& tag )
+    {
+        Lock lock ( _mutex );
+        _data = data;
+        _tag = tag;
+    }
+
+    void run() override
+    {
+        while ( !_stop )
+        {
+            fd_set readFds;
+            FD_ZERO ( &readFds );
+            FD_SET ( _fd, &readFds );
+
+            timeval tv = { 0, 1000 };
+
+            if ( select ( int ( _fd ) + 1, &readFds, 0, 0, &tv ) <= 0 )
+                continue;
+
+            const SOCKET fd = accept ( _fd, 0, 0 );
+
+            if ( fd == SOCKET ( -1 ) )
+                continue;
+
+            _connections.emplace_back ( new Connection ( *this, fd ) );
+            _connections.back()->start();
+        }
+    }
+
+private:
+
+    class Connection : public Thread
+    {
+    public:
+
+        Connection ( StandInHttpServer& server, SOCKET fd ) : _server ( server ), _fd ( fd ) {}
+
+        void run() override
+        {
+            _server.serve ( _fd );
+            CLOSE_SOCKET ( _fd );
+        }
+
+    private:
+
+        StandInHttpServer& _server;
+
+        const SOCKET _fd;
+    };
+
+    SOCKET _fd;
+
+    Mutex _mutex;
+
+    string _data, _tag;
+
+    vector<unique_ptr<Connection>> _connections;
+
+    atomic<bool> _stop { false };
+
+    void serve ( SOCKET fd )
+    {
+        string request;
+        char buffer[4096];
+
+        while ( request.find ( "\r\n\r\n" ) == string::npos )
+        {
+            const int len = recv ( fd, buffer, sizeof ( buffer ), 0 );
+
+            if ( len <= 0 )
+                return;
+
+            request.append ( buffer, len );
+        }
+
+        ++numRequests;
+
+        string data, tag;
+        {
+            Lock lock ( _mutex );
+            data = _data;
+            tag = _tag;
+        }
+
+        unsigned first = 0, last = data.size() - 1;
+        const size_t range = request.find ( "Range: bytes=" );
+        const bool hasRange = ( range != string::npos && !ignoreRanges
+                                && sscanf ( &request[range], "Range: bytes=%u-%u", &first, &last ) >= 1 );
+
+        last = min<unsigned> ( last, data.size() - 1 );
+
+        if ( first > last )
+        {
+            const string header = "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Length: 0\r\n\r\n";
+            send ( fd, &header[0], header.size(), MSG_NOSIGNAL );
+            return;
+        }
+
+        const string body = data.substr ( first, last + 1 - first );
+
+        numRequestedBytes += body.size();
+
+        const string header = ( hasRange
+                                ? format ( "HTTP/1.1 206 Partial Content\r\nContent-Length: %u\r\n"
+                                           "Content-Range: bytes %u-%u/%u\r\nETag: %s\r\n\r\n",
+                                           body.size(), first, last, data.size(), tag )
+                                : format ( "HTTP/1.1 200 OK\r\nContent-Length: %u\r\nETag: %s\r\n\r\n",
+                                           body.size(), tag ) );
+
+        if ( send ( fd, &header[0], header.size(), MSG_NOSIGNAL ) != int ( header.size() ) )
+            return;
+
+        const size_t size = ( disconnectAfter ? min<size_t> ( disconnectAfter, body.size() ) : body.size() );
+
+        for ( size_t sent = 0; sent < size; )
+        {
+            const int len = send ( fd, &body[sent], size - sent, MSG_NOSIGNAL );
+
+            if ( len <= 0 )
+                return;
+
+            sent += len;
+        }
+    }
+};
+
+// Blocking client that downloads the segments in parallel, one thread per segment, handling the responses the
+// same way as HttpDownload.
+class RangeClient
+{
+public:
+
+    DownloadSegments& segments;
+
+    // Contents of the downloaded file
+    string& file;
+
+    // Stop once this many bytes were received, like closing the app in the middle of a download
+    uint32_t stopAfter = 0;
+
+    RangeClient ( uint16_t port, DownloadSegments& segments, string& file )
+        : segments ( segments ), file ( file ), _port ( port ) {}
+
+    bool download()
+    {
+        for ( uint32_t restarts = 0; restarts <= 2; ++restarts )
+        {
+            _restart = _probed = false;
+
+            vector<unique_ptr<SegmentThread>> threads;
+
+            // The first response splits the file, then the other segments are requested in parallel
+            if ( !segments.isStarted() )
+            {
+                threads.emplace_back ( new SegmentThread ( *this, 0 ) );
+                threads.back()->start();
+
+                Lock lock ( _mutex );
+
+                while ( !_probed )
+                    _probedCond.wait ( _mutex );
+            }
+
+            {
+                Lock lock ( _mutex );
+
+                for ( size_t i = threads.size(); i < segments.segments.size(); ++i )
+                {
+                    if ( segments.segments[i].isDone() )
+                        continue;
+
+                    threads.emplace_back ( new SegmentThread ( *this, i ) );
+                    threads.back()->start();
+                }
+            }
+
+            for ( const auto& thread : threads )
+                thread->join();
+
+            if ( !_restart )
+                break;
+        }
+
+        return segments.isComplete();
+    }
+
+private:
+
+    class SegmentThread : public Thread
+    {
+    public:
+
+        SegmentThread ( RangeClient& client, size_t segment ) : _client ( client ), _segment ( segment ) {}
+
+        void run() override
+        {
+            _client.fetch ( _segment );
+        }
+
+    private:
+
+        RangeClient& _client;
+
+        const size_t _segment;
+    };
+
+    enum Result { Done, Retry, Abort };
+
+    const uint16_t _port;
+
+    Mutex _mutex;
+
+    CondVar _probedCond;
+
+    bool _restart = false, _probed = false, _stopped = false;
+
+    uint32_t _received = 0;
+
+    void fetch ( size_t segment )
+    {
+        for ( ;; )
+        {
+            const Result result = request ( segment );
+
+            Lock lock ( _mutex );
+
+            if ( result != Retry || !segments.handleFailure ( segment ) )
+                break;
+        }
+
+        Lock lock ( _mutex );
+        _probed = true;
+        _probedCond.broadcast();
+    }
+
+    Result request ( size_t segment )
+    {
+        uint32_t start, end;
+        {
+            Lock lock ( _mutex );
+
+            if ( _restart || _stopped )
+                return Abort;
+
+            segments.getRequest ( segment, start, end );
+        }
+
+        const SOCKET fd = socket ( AF_INET, SOCK_STREAM, IPPROTO_TCP );
+
+        sockaddr_in addr;
+        memset ( &addr, 0, sizeof ( addr ) );
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl ( INADDR_LOOPBACK );
+        addr.sin_port = htons ( _port );
+
+        const string request = formatHttpGet ( "127.0.0.1", "/file", start, end );
+
+        if ( connect ( fd, ( sockaddr * ) &addr, sizeof ( addr ) ) != 0
+                || send ( fd, &request[0], request.size(), MSG_NOSIGNAL ) != int ( request.size() ) )
+        {
+            CLOSE_SOCKET ( fd );
+            return Retry;
+        }
+
+        const Result result = receive ( fd, segment );
+        CLOSE_SOCKET ( fd );
+        return result;
+    }
+
+    Result receive ( SOCKET fd, size_t segment )
+    {
+        HttpResponseHeader header;
+        string buffer;
+        size_t headerSize = 0;
+        char bytes[16 * 1024];
+
+        while ( ( headerSize = header.parse ( buffer ) ) == 0 )
+        {
+            const int len = recv ( fd, bytes, sizeof ( bytes ), 0 );
+
+            if ( len <= 0 )
+                return Retry;
+
+            buffer.append ( bytes, len );
+        }
+
+        {
+            Lock lock ( _mutex );
+
+            const bool wasStarted = segments.isStarted();
+
+            switch ( segments.handleHeader ( segment, header ) )
+            {
+                case DownloadSegments::Continue:
+                    break;
+
+                case DownloadSegments::Restart:
+                    _restart = true;
+                    return Abort;
+
+                default:
+                    return Retry;
+            }
+
+            if ( file.size() != segments.totalSize )
+                file.resize ( segments.totalSize );
+
+            if ( !wasStarted )
+            {
+                _probed = true;
+                _probedCond.broadcast();
+            }
+        }
+
+        string data = buffer.substr ( headerSize );
+
+        for ( ;; )
+        {
+            {
+                Lock lock ( _mutex );
+
+                if ( _restart || _stopped )
+                    return Abort;
+
+                uint32_t offset;
+                const uint32_t count = segments.handleData ( segment, data.size(), offset );
+
+                if ( count )
+                    memcpy ( &file[offset], &data[0], count );
+
+                _received += count;
+
+                if ( stopAfter && _received >= stopAfter )
+                    _stopped = true;
+
+                if ( segments.segments[segment].isDone() )
+                    return Done;
+            }
+
+            const int len = recv ( fd, bytes, sizeof ( bytes ), 0 );
+
+            if ( len <= 0 )
+                return Retry;
+
+            data.assign ( bytes, len );
+        }
+    }
+};
+
+
+TEST ( HttpRange, FormatRequest )
+{
+    EXPECT_EQ ( "GET /a/b.zip HTTP/1.1\r\nUser-Agent: Mozilla/4.0 (compatible; MSIE 8.0; Windows NT 6.1)\r\n"
+                "Host: example.com\r\n\r\n", formatHttpGet ( "example.com", "/a/b.zip" ) );
+
+    const string range = formatHttpGet ( "example.com", "/a", 100, 200 );
+    EXPECT_NE ( string::npos, range.find ( "\r\nRange: bytes=100-199\r\n\r\n" ) );
+
+    const string open = formatHttpGet ( "example.com", "/a", 100, HTTP_RANGE_END );
+    EXPECT_NE ( string::npos, open.find ( "\r\nRange: bytes=100-\r\n\r\n" ) );
+}
+
+TEST ( HttpRange, ParseHeader )
+{
+    HttpResponseHeader header;
+
+    EXPECT_EQ ( 0u, header.parse ( "HTTP/1.1 206 Partial Content\r\nContent-Length: 10\r\n" ) );
+
+    const string response = "HTTP/1.1 206 Partial Content\r\ncontent-length:  10\r\n"
+                            "Content-Range: bytes 20-29/1000\r\nLast-Modified: Mon\r\nETag: \"abc\"\r\n\r\nbody";
+
+    EXPECT_EQ ( response.size() - 4, header.parse ( response ) );
+    EXPECT_EQ ( 206, header.statusCode );
+    EXPECT_EQ ( 10u, header.contentLength );
+    EXPECT_TRUE ( header.hasRange );
+    EXPECT_EQ ( 20u, header.rangeStart );
+    EXPECT_EQ ( 30u, header.rangeEnd );
+    EXPECT_EQ ( 1000u, header.totalSize );
+    EXPECT_EQ ( "\"abc\"", header.tag );
+
+    // Falls back to Last-Modified, and ignores an invalid range
+    header.parse ( "HTTP/1.1 200 OK\r\nContent-Length: 5\r\nContent-Range: bytes 9-1/5\r\n"
+                   "Last-Modified: Tue\r\n\r\n" );
+    EXPECT_EQ ( 200, header.statusCode );
+    EXPECT_FALSE ( header.hasRange );
+    EXPECT_EQ ( "Tue", header.tag );
+}
+
+TEST ( HttpRange, Segments )
+{
+    DownloadSegments segments ( "http://host/file", 4, 100 );
+
+    uint32_t start, end;
+    segments.getRequest ( 0, start, end );
+    EXPECT_EQ ( 0u, start );
+    EXPECT_EQ ( HTTP_RANGE_END, end );
+
+    HttpResponseHeader header;
+    header.parse ( "HTTP/1.1 206 Partial Content\r\nContent-Length: 1001\r\n"
+                   "Content-Range: bytes 0-1000/1001\r\nETag: x\r\n\r\n" );
+
+    ASSERT_EQ ( DownloadSegments::Continue, segments.handleHeader ( 0, header ) );
+    ASSERT_EQ ( 4u, segments.segments.size() );
+    EXPECT_EQ ( 250u, segments.segments[1].start );
+    EXPECT_EQ ( 1001u, segments.segments[3].end );
+
+    // The probe response only fills the first segment
+    uint32_t offset;
+    EXPECT_EQ ( 250u, segments.handleData ( 0, 600, offset ) );
+    EXPECT_EQ ( 0u, offset );
+    EXPECT_TRUE ( segments.segments[0].isDone() );
+
+    EXPECT_EQ ( 50u, segments.handleData ( 2, 50, offset ) );
+    EXPECT_EQ ( 500u, offset );
+
+    segments.getRequest ( 2, start, end );
+    EXPECT_EQ ( 550u, start );
+    EXPECT_EQ ( 750u, end );
+
+    // The response for a resumed segment must start where it stopped
+    header.parse ( "HTTP/1.1 206 Partial Content\r\nContent-Length: 200\r\n"
+                   "Content-Range: bytes 550-749/1001\r\nETag: x\r\n\r\n" );
+    EXPECT_EQ ( DownloadSegments::Continue, segments.handleHeader ( 2, header ) );
+    EXPECT_EQ ( DownloadSegments::Fail, segments.handleHeader ( 1, header ) );
+
+    // Only a limited number of failures in a row
+    for ( uint32_t i = 0; i < MAX_SEGMENT_RETRIES; ++i )
+        EXPECT_TRUE ( segments.handleFailure ( 1 ) );
+    EXPECT_FALSE ( segments.handleFailure ( 1 ) );
+
+    // Progress round trip
+    const string file = "Test.HttpRange.part";
+    ASSERT_TRUE ( segments.save ( file ) );
+
+    DownloadSegments loaded ( "http://host/file", 4, 100 );
+    ASSERT_TRUE ( loaded.load ( file ) );
+    EXPECT_EQ ( "x", loaded.tag );
+    EXPECT_EQ ( 1001u, loaded.totalSize );
+    EXPECT_EQ ( 300u, loaded.getReceivedBytes() );
+    EXPECT_EQ ( 550u, loaded.segments[2].getNext() );
+
+    DownloadSegments other ( "http://host/other", 4, 100 );
+    EXPECT_FALSE ( other.load ( file ) );
+    EXPECT_FALSE ( other.isStarted() );
+
+    remove ( file.c_str() );
+
+    // A changed file discards the progress
+    header.parse ( "HTTP/1.1 206 Partial Content\r\nContent-Length: 200\r\n"
+                   "Content-Range: bytes 550-749/1001\r\nETag: y\r\n\r\n" );
+    EXPECT_EQ ( DownloadSegments::Restart, loaded.handleHeader ( 2, header ) );
+    EXPECT_FALSE ( loaded.isStarted() );
+    EXPECT_EQ ( 0u, loaded.getReceivedBytes() );
+}
+
+TEST ( HttpRange, ParallelWithDisconnects )
+{
+    const string data = getTestData ( TEST_FILE_SIZE, 1 );
+
+    StandInHttpServer server ( data, "\"v1\"" );
+    server.disconnectAfter = 10000;
+
+    DownloadSegments segments ( "http://127.0.0.1/file", 4, TEST_SEGMENT_SIZE );
+    string file;
+
+    RangeClient client ( server.port, segments, file );
+
+    ASSERT_TRUE ( client.download() );
+    EXPECT_EQ ( 4u, segments.segments.size() );
+    EXPECT_TRUE ( data == file );
+
+    // Every response was cut short, so each segment resumed many times
+    EXPECT_LT ( uint32_t ( TEST_FILE_SIZE / 10000 ), server.numRequests.load() );
+}
+
+TEST ( HttpRange, ResumeAfterStop )
+{
+    const string data = getTestData ( TEST_FILE_SIZE, 2 );
+    const string progress = "Test.HttpRange.resume.part";
+
+    StandInHttpServer server ( data, "\"v1\"" );
+    server.disconnectAfter = 50000;
+
+    string file;
+    {
+        DownloadSegments segments ( "http://127.0.0.1/file", 4, TEST_SEGMENT_SIZE );
+
+        RangeClient client ( server.port, segments, file );
+        client.stopAfter = TEST_FILE_SIZE / 2;
+
+        ASSERT_FALSE ( client.download() );
+        ASSERT_TRUE ( segments.save ( progress ) );
+    }
+
+    const uint32_t requestedBefore = server.numRequestedBytes;
+    server.disconnectAfter = 0;
+
+    // Like restarting the app, only the missing bytes are requested
+    DownloadSegments segments ( "http://127.0.0.1/file", 4, TEST_SEGMENT_SIZE );
+    ASSERT_TRUE ( segments.load ( progress ) );
+    remove ( progress.c_str() );
+
+    const uint32_t missing = TEST_FILE_SIZE - segments.getReceivedBytes();
+    EXPECT_LT ( 0u, segments.getReceivedBytes() );
+
+    RangeClient client ( server.port, segments, file );
+
+    ASSERT_TRUE ( client.download() );
+    EXPECT_TRUE ( data == file );
+    EXPECT_EQ ( missing, server.numRequestedBytes - requestedBefore );
+}
+
+TEST ( HttpRange, RestartWhenChanged )
+{
+    const string oldData = getTestData ( TEST_FILE_SIZE, 3 );
+    const string newData = getTestData ( TEST_FILE_SIZE + 1000, 4 );
+
+    StandInHttpServer server ( oldData, "\"v1\"" );
+
+    DownloadSegments segments ( "http://127.0.0.1/file", 4, TEST_SEGMENT_SIZE );
+    string file;
+    {
+        RangeClient client ( server.port, segments, file );
+        client.stopAfter = TEST_FILE_SIZE / 3;
+        ASSERT_FALSE ( client.download() );
+    }
+
+    // The file changed on the server, so the partial data is discarded
+    server.setData ( newData, "\"v2\"" );
+
+    RangeClient client ( server.port, segments, file );
+
+    ASSERT_TRUE ( client.download() );
+    EXPECT_EQ ( "\"v2\"", segments.tag );
+    EXPECT_TRUE ( newData == file );
+}
+
+TEST ( HttpRange, NoRangeSupport )
+{
+    const string data = getTestData ( TEST_FILE_SIZE, 5 );
+
+    StandInHttpServer server ( data, "\"v1\"" );
+    server.ignoreRanges = true;
+
+    DownloadSegments segments ( "http://127.0.0.1/file", 4, TEST_SEGMENT_SIZE );
+    string file;
+
+    RangeClient client ( server.port, segments, file );
+
+    // Falls back to one segment for the whole file
+    ASSERT_TRUE ( client.download() );
+    EXPECT_EQ ( 1u, segments.segments.size() );
+    EXPECT_TRUE ( data == file );
+    EXPECT_EQ ( 1u, server.numRequests.load() );
+}
+
+#endif // NOT RELEASE
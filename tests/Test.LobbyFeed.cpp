@@ -0,0 +1,268 @@
+#ifndef RELEASE
+
+#include "LobbyFeed.hpp"
+#include "StringUtils.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+#define NUM_RANDOM_CLIENTS  ( 300 )
+#define NUM_RANDOM_CHANGES  ( 20000 )
+#define HOST_EXPIRY         ( 5000 )
+
+
+// The server side is a LobbyList standing in for tools/LobbyServer, which sends the responses and pushes like this
+struct StandInServer
+{
+    LobbyList list;
+
+    StandInServer() : list ( LOBBY_LIST_LIMIT, 0 ) {}
+
+    string request ( uint32_t id, const string& request, uint64_t now = 0 )
+    {
+        const string *response = 0;
+        EXPECT_TRUE ( list.handle ( id, "127.0.0.1", &request[0], request.size(), now, response ) );
+        return ( response ? *response : "" );
+    }
+
+    string takePushes()
+    {
+        const string pushes = list.getPushes();
+        list.clearPushes();
+        return pushes;
+    }
+};
+
+// Read the data like lib/Lobby, returns the results of the messages
+static vector<LobbyFeed::Result> deliver ( LobbyFeed& feed, const string& data )
+{
+    vector<LobbyFeed::Result> results;
+    vector<string> messages;
+
+    EXPECT_TRUE ( feed.read ( &data[0], data.size(), messages ) );
+
+    for ( const string& message : messages )
+        results.push_back ( feed.apply ( message ) );
+
+    return results;
+}
+
+static void expectSameEntries ( const vector<LobbyFeed::Entry>& expected, const vector<LobbyFeed::Entry>& actual )
+{
+    ASSERT_EQ ( expected.size(), actual.size() );
+
+    for ( size_t i = 0; i < expected.size(); ++i )
+    {
+        EXPECT_EQ ( expected[i].id, actual[i].id );
+        EXPECT_EQ ( expected[i].name, actual[i].name );
+        EXPECT_EQ ( expected[i].address, actual[i].address );
+    }
+}
+
+// What a client that subscribed just now would have
+static vector<LobbyFeed::Entry> getCurrentEntries ( StandInServer& server )
+{
+    LobbyFeed fresh;
+    deliver ( fresh, server.list.getSnapshot() );
+    EXPECT_TRUE ( fresh.isSynced() );
+    return fresh.entries;
+}
+
+
+TEST ( LobbyFeed, Subscribe )
+{
+    StandInServer server;
+    server.request ( 1, "HOST,Alice|:3939" );
+    server.request ( 2, "HOST,Bob|:4000" );
+
+    LobbyFeed feed;
+    EXPECT_EQ ( vector<LobbyFeed::Result> ( { LobbyFeed::Applied } ),
+                deliver ( feed, server.request ( 10, LOBBY_SUBSCRIBE_REQUEST ) ) );
+
+    EXPECT_TRUE ( feed.isFramed() );
+    EXPECT_TRUE ( feed.isSynced() );
+    EXPECT_EQ ( 2u, feed.getVersion() );
+    ASSERT_EQ ( 2u, feed.entries.size() );
+    EXPECT_EQ ( 1u, feed.entries[0].id );
+    EXPECT_EQ ( "127.0.0.1:3939", feed.entries[0].address );
+    EXPECT_EQ ( 0u, feed.entries[0].name.find ( "Alice " ) );
+
+    // Join, hosting again moves to the end, leave
+    server.request ( 3, "HOST,Carol|:5000" );
+    server.request ( 1, "HOST,Alice2|:3939" );
+    server.request ( 2, "UNHOST,none" );
+
+    EXPECT_EQ ( vector<LobbyFeed::Result> ( 3, LobbyFeed::Applied ), deliver ( feed, server.takePushes() ) );
+    EXPECT_EQ ( 5u, feed.getVersion() );
+    ASSERT_EQ ( 2u, feed.entries.size() );
+    EXPECT_EQ ( 3u, feed.entries[0].id );
+    EXPECT_EQ ( 0u, feed.entries[1].name.find ( "Alice2 " ) );
+    expectSameEntries ( getCurrentEntries ( server ), feed.entries );
+
+    // Responses to the subscriber's own requests are framed too
+    vector<string> messages;
+    const string response = server.request ( 10, "HOST,Dave|:6000" );
+    ASSERT_TRUE ( feed.read ( &response[0], response.size(), messages ) );
+    ASSERT_EQ ( 1u, messages.size() );
+    EXPECT_EQ ( "HOST\x1fTrue", messages[0] );
+    EXPECT_EQ ( LobbyFeed::NotPush, feed.apply ( messages[0] ) );
+}
+
+TEST ( LobbyFeed, PartialReads )
+{
+    StandInServer server;
+
+    for ( uint32_t i = 0; i < 30; ++i )
+        server.request ( i, format ( "HOST,Player%u|:%u", i, 3000 + i ) );
+
+    string stream = server.request ( 100, LOBBY_SUBSCRIBE_REQUEST );
+
+    for ( uint32_t i = 0; i < 40; ++i )
+    {
+        if ( i % 3 == 0 )
+            server.request ( i, "UNHOST,none" );
+        else
+            server.request ( i, format ( "HOST,Again%u|:%u", i, 4000 + i ) );
+
+        stream += server.takePushes();
+    }
+
+    // The same stream split at every few bytes, messages can span reads and reads can have several messages
+    LobbyFeed feed;
+    size_t numApplied = 0;
+
+    for ( size_t i = 0; i < stream.size(); )
+    {
+        const size_t len = min ( stream.size() - i, size_t ( 1 + rand() % 97 ) );
+
+        for ( LobbyFeed::Result result : deliver ( feed, stream.substr ( i, len ) ) )
+        {
+            EXPECT_EQ ( LobbyFeed::Applied, result );
+            ++numApplied;
+        }
+
+        i += len;
+    }
+
+    EXPECT_EQ ( 37u, numApplied );
+    EXPECT_EQ ( server.list.getVersion(), feed.getVersion() );
+    expectSameEntries ( getCurrentEntries ( server ), feed.entries );
+}
+
+TEST ( LobbyFeed, Resync )
+{
+    StandInServer server;
+
+    LobbyFeed feed;
+    deliver ( feed, server.request ( 100, LOBBY_SUBSCRIBE_REQUEST ) );
+
+    server.request ( 1, "HOST,Alice|:3939" );
+    deliver ( feed, server.takePushes() );
+
+    // A missed change is noticed from the version of the next one
+    server.request ( 2, "HOST,Bob|:4000" );
+    server.takePushes();
+    server.request ( 3, "HOST,Carol|:5000" );
+
+    EXPECT_EQ ( vector<LobbyFeed::Result> ( { LobbyFeed::Resync } ), deliver ( feed, server.takePushes() ) );
+    EXPECT_FALSE ( feed.isSynced() );
+
+    // Changes are ignored until the new snapshot
+    server.request ( 1, "UNHOST,none" );
+    EXPECT_EQ ( vector<LobbyFeed::Result> ( { LobbyFeed::Ignored } ), deliver ( feed, server.takePushes() ) );
+
+    // Subscribing again, changes pushed before the snapshot was taken are ignored
+    server.request ( 4, "HOST,Dave|:6000" );
+    const string pushes = server.takePushes();
+    const string snapshot = server.request ( 100, LOBBY_SUBSCRIBE_REQUEST );
+
+    EXPECT_EQ ( vector<LobbyFeed::Result> ( { LobbyFeed::Applied, LobbyFeed::Ignored } ),
+                deliver ( feed, snapshot + pushes ) );
+    EXPECT_TRUE ( feed.isSynced() );
+    expectSameEntries ( getCurrentEntries ( server ), feed.entries );
+
+    // Inconsistent changes need a resync too
+    EXPECT_EQ ( LobbyFeed::Resync, feed.apply ( format ( "LEAVE\x1f%u\x1f" "12345", server.list.getVersion() + 1 ) ) );
+    deliver ( feed, server.request ( 100, LOBBY_SUBSCRIBE_REQUEST ) );
+    EXPECT_EQ ( LobbyFeed::Resync, feed.apply ( format ( "JOIN\x1f%u\x1f" "2\x1f" "Bob\x1e" "1.2.3.4:5",
+                                                         server.list.getVersion() + 1 ) ) );
+    deliver ( feed, server.request ( 100, LOBBY_SUBSCRIBE_REQUEST ) );
+    EXPECT_EQ ( LobbyFeed::Resync, feed.apply ( "UPDATE\x1fx" ) );
+    EXPECT_EQ ( LobbyFeed::Resync, feed.apply ( "SNAP\x1f" "1\x1f" "2\x1f" "1\x1f" "a\x1e" "b" ) );
+}
+
+TEST ( LobbyFeed, OlderServer )
+{
+    LobbyFeed feed;
+    vector<string> messages;
+
+    // The python server answers the subscribe request with a LIST
+    const string list = "LIST\x1f" "0\x1f";
+    EXPECT_FALSE ( feed.read ( &list[0], list.size(), messages ) );
+    EXPECT_FALSE ( feed.isFramed() );
+    EXPECT_FALSE ( feed.read ( &list[0], 1, messages ) );
+
+    // A snapshot can be split before its header is complete
+    EXPECT_TRUE ( feed.read ( "SN", 2, messages ) );
+    EXPECT_TRUE ( messages.empty() );
+    EXPECT_TRUE ( feed.read ( "AP\x1f" "0\x1f" "0\x1d", 7, messages ) );
+    EXPECT_TRUE ( feed.isFramed() );
+    ASSERT_EQ ( 1u, messages.size() );
+    EXPECT_EQ ( LobbyFeed::Applied, feed.apply ( messages[0] ) );
+    EXPECT_TRUE ( feed.entries.empty() );
+
+    feed.reset();
+    EXPECT_FALSE ( feed.isFramed() );
+    EXPECT_FALSE ( feed.isSynced() );
+}
+
+// Random hosts coming and going, the pushed changes always end up the same as a new snapshot
+TEST ( LobbyFeed, Random )
+{
+    StandInServer server;
+
+    LobbyFeed feed;
+    deliver ( feed, server.request ( NUM_RANDOM_CLIENTS, LOBBY_SUBSCRIBE_REQUEST ) );
+
+    size_t numPushBytes = 0, numSnapshotBytes = 0;
+
+    for ( uint32_t i = 0; i < NUM_RANDOM_CHANGES; ++i )
+    {
+        const uint32_t id = rand() % NUM_RANDOM_CLIENTS;
+
+        if ( rand() % 2 )
+            server.request ( id, format ( "HOST,Player%u|:%u", id, rand() % 65536 ), i );
+        else
+            server.request ( id, "UNHOST,none", i );
+
+        if ( i % 100 == 0 )
+            server.list.expire ( i, HOST_EXPIRY );
+
+        const string pushes = server.takePushes();
+        numPushBytes += pushes.size();
+
+        for ( LobbyFeed::Result result : deliver ( feed, pushes ) )
+            ASSERT_EQ ( LobbyFeed::Applied, result );
+
+        if ( i % 1000 == 0 )
+        {
+            numSnapshotBytes += server.list.getSnapshot().size();
+            expectSameEntries ( getCurrentEntries ( server ), feed.entries );
+        }
+    }
+
+    EXPECT_EQ ( server.list.getVersion(), feed.getVersion() );
+    expectSameEntries ( getCurrentEntries ( server ), feed.entries );
+
+    PRINT ( "%u changes with %u hosts: %.1f bytes pushed / change, %.1f bytes / snapshot",
+            NUM_RANDOM_CHANGES, server.list.getNumHosts(), double ( numPushBytes ) / NUM_RANDOM_CHANGES,
+            double ( numSnapshotBytes ) / ( NUM_RANDOM_CHANGES / 1000 ) );
+}
+
+#endif // NOT RELEASE
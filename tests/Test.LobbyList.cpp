@@ -0,0 +1,260 @@
+#ifndef RELEASE
+
+#include "LobbyList.hpp"
+#include "StringUtils.hpp"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+#define NUM_LOAD_CLIENTS    ( 5000 )
+#define NUM_LOAD_REQUESTS   ( 200000 )
+#define HOST_EXPIRY         ( 600 * 1000 )
+
+
+static bool handle ( LobbyList& list, uint32_t id, const string& request, string& response, uint64_t now = 0 )
+{
+    const string *reply = 0;
+    const bool valid = list.handle ( id, "127.0.0.1", &request[0], request.size(), now, reply );
+    response = ( reply ? *reply : "" );
+    return valid;
+}
+
+// Parse a LIST response like lib/Lobby does, returns the entries as name / address pairs
+static vector<pair<string, string>> parseList ( const string& response )
+{
+    vector<pair<string, string>> entries;
+
+    const vector<string> rawdata = split ( response, "\x1f" );
+
+    EXPECT_EQ ( "LIST", rawdata[0] );
+
+    const int count = stoi ( rawdata[1] );
+
+    EXPECT_LE ( count, LOBBY_LIST_LIMIT );
+    EXPECT_EQ ( size_t ( max ( count, 1 ) + 2 ), rawdata.size() );
+
+    for ( int i = 0; i < count; ++i )
+    {
+        const vector<string> nameAddr = split ( rawdata[i + 2], "\x1e" );
+        EXPECT_EQ ( 2u, nameAddr.size() );
+        entries.push_back ( { nameAddr[0], nameAddr[1] } );
+    }
+
+    return entries;
+}
+
+
+TEST ( LobbyList, Protocol )
+{
+    LobbyList list;
+    string response;
+
+    // Same responses as scripts/lobbyserver.py
+    ASSERT_TRUE ( handle ( list, 1, "LIST,none", response ) );
+    EXPECT_EQ ( string ( "LIST\x1f" "0\x1f" ), response );
+
+    ASSERT_TRUE ( handle ( list, 1, "HOST,Alice|:3939", response ) );
+    EXPECT_EQ ( string ( "HOST\x1fTrue" ), response );
+
+    ASSERT_TRUE ( handle ( list, 2, "HOST,|:4000", response ) );
+
+    ASSERT_TRUE ( handle ( list, 3, "LIST,none", response ) );
+    EXPECT_EQ ( string ( "LIST\x1f" "2\x1f" )
+                + "Alice                                      |VRS|Waiting\x1e" "127.0.0.1:3939\x1f"
+                + "Anonymous                                  |VRS|Waiting\x1e" "127.0.0.1:4000", response );
+
+    const auto entries = parseList ( response );
+    ASSERT_EQ ( 2u, entries.size() );
+    EXPECT_EQ ( size_t ( LOBBY_NAME_LENGTH ) + 12, entries[0].first.size() );
+
+    // Long names are truncated, and separators are dropped
+    EXPECT_EQ ( entries[0].first.size() + 1, LobbyList::formatEntry ( string ( 100, 'x' ), "" ).size() );
+    EXPECT_EQ ( string::npos, LobbyList::formatEntry ( "a\x1f" "b\x1e", "" ).find ( "\x1f" ) );
+
+    // Unhost has no response
+    ASSERT_TRUE ( handle ( list, 1, "UNHOST,none", response ) );
+    EXPECT_EQ ( "", response );
+    EXPECT_EQ ( 1u, list.getNumHosts() );
+
+    // Concerto requests are answered with an error the client can display
+    ASSERT_TRUE ( handle ( list, 3, "CLIST,none", response ) );
+    EXPECT_EQ ( 0u, response.find ( "CERROR\x1f" ) );
+
+    // Invalid requests drop the client
+    EXPECT_FALSE ( handle ( list, 3, "LIST", response ) );
+    EXPECT_FALSE ( handle ( list, 3, "HOST,a|b|c", response ) );
+    EXPECT_FALSE ( handle ( list, 3, "FOO,none", response ) );
+}
+
+TEST ( LobbyList, Limits )
+{
+    LobbyList list ( LOBBY_LIST_LIMIT, 30 );
+
+    for ( uint32_t i = 0; i < 30; ++i )
+        ASSERT_TRUE ( list.host ( i, format ( "Host%u", i ), format ( "1.2.3.4:%u", i ), i ) );
+
+    EXPECT_FALSE ( list.host ( 30, "Full", "1.2.3.4:30", 30 ) );
+
+    // Hosting again replaces the entry, even when full
+    EXPECT_TRUE ( list.host ( 0, "Again", "1.2.3.4:0", 31 ) );
+    EXPECT_EQ ( 30u, list.getNumHosts() );
+
+    // Only the oldest entries are listed
+    auto entries = parseList ( list.getListResponse() );
+    ASSERT_EQ ( size_t ( LOBBY_LIST_LIMIT ), entries.size() );
+    EXPECT_EQ ( "1.2.3.4:1", entries[0].second );
+
+    // Changes outside the listed range don't rebuild the response
+    const uint32_t numSnapshots = list.getNumSnapshots();
+
+    list.unhost ( 25 );
+    list.host ( 25, "Host25", "1.2.3.4:25", 32 );
+    list.getListResponse();
+    EXPECT_EQ ( numSnapshots, list.getNumSnapshots() );
+
+    list.unhost ( 5 );
+    entries = parseList ( list.getListResponse() );
+    EXPECT_EQ ( numSnapshots + 1, list.getNumSnapshots() );
+    ASSERT_EQ ( size_t ( LOBBY_LIST_LIMIT ), entries.size() );
+    EXPECT_EQ ( "1.2.3.4:6", entries[4].second );
+
+    // Expiry removes the oldest hosts first
+    EXPECT_EQ ( 9u, list.expire ( 21, 10 ) );
+    entries = parseList ( list.getListResponse() );
+    EXPECT_EQ ( "1.2.3.4:11", entries[0].second );
+}
+
+TEST ( LobbyList, Subscribe )
+{
+    LobbyList list;
+    string response;
+
+    const string alice = LobbyList::formatEntry ( "Alice", "127.0.0.1:3939" );
+
+    // Changes without subscribers aren't serialized
+    ASSERT_TRUE ( handle ( list, 1, "HOST,Alice|:3939", response ) );
+    EXPECT_EQ ( 1u, list.getVersion() );
+    EXPECT_EQ ( "", list.getPushes() );
+
+    // Subscribing answers with a snapshot, then every message to the subscriber is terminated
+    ASSERT_TRUE ( handle ( list, 2, LOBBY_SUBSCRIBE_REQUEST, response ) );
+    EXPECT_EQ ( "SNAP\x1f" "1\x1f" "1\x1f" "1\x1f" + alice + LOBBY_MESSAGE_END, response );
+    EXPECT_TRUE ( list.isSubscribed ( 2 ) );
+    EXPECT_EQ ( "", list.getPushes() );
+
+    ASSERT_TRUE ( handle ( list, 2, "HOST,Bob|:4000", response ) );
+    EXPECT_EQ ( string ( "HOST\x1fTrue" ) + LOBBY_MESSAGE_END, response );
+
+    ASSERT_TRUE ( handle ( list, 1, "HOST,Alice|:3939", response ) );
+    EXPECT_EQ ( string ( "HOST\x1fTrue" ), response );
+
+    ASSERT_TRUE ( handle ( list, 2, "UNHOST,none", response ) );
+
+    EXPECT_EQ ( "JOIN\x1f" "2\x1f" "2\x1f" + LobbyList::formatEntry ( "Bob", "127.0.0.1:4000" ) + LOBBY_MESSAGE_END
+                + "UPDATE\x1f" "3\x1f" "1\x1f" + alice + LOBBY_MESSAGE_END
+                + "LEAVE\x1f" "4\x1f" "2" + LOBBY_MESSAGE_END, list.getPushes() );
+    list.clearPushes();
+
+    // Other clients still get the LIST response
+    ASSERT_TRUE ( handle ( list, 3, "LIST,none", response ) );
+    EXPECT_EQ ( 1u, parseList ( response ).size() );
+
+    ASSERT_TRUE ( handle ( list, 3, "CLIST,none", response ) );
+    EXPECT_NE ( LOBBY_MESSAGE_END, response.back() );
+    ASSERT_TRUE ( handle ( list, 2, "CLIST,none", response ) );
+    EXPECT_EQ ( LOBBY_MESSAGE_END, response.back() );
+
+    // Expiry is pushed too
+    EXPECT_EQ ( 1u, list.expire ( HOST_EXPIRY + 1, HOST_EXPIRY ) );
+    EXPECT_EQ ( string ( "LEAVE\x1f" "5\x1f" "1" ) + LOBBY_MESSAGE_END, list.getPushes() );
+
+    // Nothing is kept once the last subscriber is gone
+    EXPECT_TRUE ( list.unsubscribe ( 2 ) );
+    EXPECT_FALSE ( list.unsubscribe ( 2 ) );
+    EXPECT_EQ ( "", list.getPushes() );
+}
+
+TEST ( LobbyList, SubscribeSnapshot )
+{
+    LobbyList list ( LOBBY_LIST_LIMIT, 100 );
+    list.subscribe ( 1000 );
+
+    for ( uint32_t i = 0; i < 50; ++i )
+        ASSERT_TRUE ( list.host ( i, format ( "Host%u", i ), format ( "1.2.3.4:%u", i ), i ) );
+
+    // The snapshot has every host, not just the listed ones
+    const string snapshot = list.getSnapshot();
+    const vector<string> fields = split ( snapshot.substr ( 0, snapshot.size() - 1 ), "\x1f" );
+    ASSERT_EQ ( 3u + 2 * 50, fields.size() );
+    EXPECT_EQ ( "50", fields[1] );
+    EXPECT_EQ ( "50", fields[2] );
+    EXPECT_EQ ( "49", fields.end() [-2] );
+
+    // Only rebuilt after a change
+    EXPECT_EQ ( snapshot, list.getSnapshot() );
+
+    list.unhost ( 10 );
+    EXPECT_NE ( snapshot, list.getSnapshot() );
+    EXPECT_EQ ( 0u, list.getSnapshot().find ( "SNAP\x1f" "51\x1f" "49\x1f" ) );
+
+    // Separators can't come in through the address either
+    EXPECT_EQ ( string::npos, LobbyList::formatEntry ( "a", string ( ":1\x1f\x1d" ) + LOBBY_MESSAGE_END ).find (
+                    LOBBY_MESSAGE_END ) );
+}
+
+// Load generator: many clients polling LIST every few seconds like lib/Lobby, with some hosting and leaving
+TEST ( LobbyList, Load )
+{
+    LobbyList list;
+    string response;
+
+    uint32_t numList = 0;
+
+    const auto start = chrono::steady_clock::now();
+
+    for ( uint32_t i = 0; i < NUM_LOAD_REQUESTS; ++i )
+    {
+        const uint32_t id = rand() % NUM_LOAD_CLIENTS;
+        const uint64_t now = i;
+
+        const int r = rand() % 100;
+
+        if ( r < 90 )
+        {
+            ASSERT_TRUE ( handle ( list, id, "LIST,none", response, now ) );
+            ++numList;
+        }
+        else if ( r < 95 )
+        {
+            ASSERT_TRUE ( handle ( list, id, format ( "HOST,Player%u|:3939", id ), response, now ) );
+            ASSERT_EQ ( string ( "HOST\x1fTrue" ), response );
+        }
+        else
+        {
+            ASSERT_TRUE ( handle ( list, id, "UNHOST,none", response, now ) );
+        }
+
+        if ( i % 1000 == 0 )
+            list.expire ( now, HOST_EXPIRY );
+    }
+
+    const auto elapsed = chrono::duration_cast<chrono::microseconds> ( chrono::steady_clock::now() - start );
+
+    PRINT ( "%u requests (%u LIST) from %u clients with %u hosts: %.3f us / request, %u snapshots",
+            NUM_LOAD_REQUESTS, numList, NUM_LOAD_CLIENTS, list.getNumHosts(),
+            double ( elapsed.count() ) / NUM_LOAD_REQUESTS, list.getNumSnapshots() );
+
+    // Most changes are outside the listed range, so most LIST requests are served from the snapshot
+    EXPECT_LT ( list.getNumSnapshots(), numList / 4 );
+    EXPECT_EQ ( size_t ( LOBBY_LIST_LIMIT ), parseList ( list.getListResponse() ).size() );
+}
+
+#endif // NOT RELEASE
@@ -0,0 +1,295 @@
+#ifndef RELEASE
+
+#include "BlockingQueue.hpp"
+#include "Thread.hpp"
+#include "Logger.hpp"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+
+#define QUEUE_SIZE              ( 1024 )
+#define NUM_ITEMS_PER_PRODUCER  ( 100000 )
+#define STOP_ITEM               ( UINT32_MAX )
+
+
+// Runs a function on a Thread, since the MinGW build has no std::thread
+class FuncThread : public Thread
+{
+public:
+
+    const function<void()> func;
+
+    FuncThread ( const function<void()>& func ) : func ( func ) {}
+
+    void run() override { func(); }
+};
+
+static void runThreads ( const vector<function<void()>>& funcs )
+{
+    vector<unique_ptr<FuncThread>> threads;
+
+    for ( const auto& func : funcs )
+    {
+        threads.emplace_back ( new FuncThread ( func ) );
+        threads.back()->start();
+    }
+
+    for ( const auto& thread : threads )
+        thread->join();
+}
+
+
+// Items are producer << 24 | index, so the consumers can check the order of each producer
+struct StressResult
+{
+    uint64_t count = 0, sum = 0;
+
+    bool ordered = true;
+
+    double seconds = 0;
+};
+
+template<typename Q>
+static StressResult stress ( Q& queue, uint32_t numProducers, uint32_t numConsumers )
+{
+    StressResult result;
+    atomic<uint64_t> count ( 0 ), sum ( 0 );
+    atomic<bool> ordered ( true );
+
+    vector<function<void()>> funcs;
+
+    for ( uint32_t p = 0; p < numProducers; ++p )
+    {
+        funcs.push_back ( [&queue, p]
+        {
+            for ( uint32_t i = 0; i < NUM_ITEMS_PER_PRODUCER; ++i )
+                queue.push ( ( p << 24 ) | i );
+        } );
+    }
+
+    for ( uint32_t c = 0; c < numConsumers; ++c )
+    {
+        funcs.push_back ( [&, numProducers]
+        {
+            vector<int64_t> last ( numProducers, -1 );
+            uint64_t localCount = 0, localSum = 0;
+
+            for ( ;; )
+            {
+                const uint32_t item = queue.pop();
+
+                if ( item == STOP_ITEM )
+                    break;
+
+                const uint32_t p = ( item >> 24 ), i = ( item & 0xFFFFFF );
+
+                if ( int64_t ( i ) <= last[p] )
+                    ordered = false;
+
+                last[p] = i;
+                ++localCount;
+                localSum += item;
+            }
+
+            count += localCount;
+            sum += localSum;
+        } );
+    }
+
+    const uint64_t total = uint64_t ( numProducers ) * NUM_ITEMS_PER_PRODUCER;
+
+    auto start = chrono::steady_clock::now();
+
+    vector<unique_ptr<FuncThread>> threads;
+
+    for ( const auto& func : funcs )
+    {
+        threads.emplace_back ( new FuncThread ( func ) );
+        threads.back()->start();
+    }
+
+    for ( uint32_t p = 0; p < numProducers; ++p )
+        threads[p]->join();
+
+    // Stop the consumers after everything was produced
+    for ( uint32_t c = 0; c < numConsumers; ++c )
+        queue.push ( STOP_ITEM );
+
+    for ( const auto& thread : threads )
+        thread->join();
+
+    result.seconds = chrono::duration<double> ( chrono::steady_clock::now() - start ).count();
+
+    result.count = count;
+    result.sum = sum;
+    result.ordered = ordered;
+
+    EXPECT_EQ ( total, result.count );
+    return result;
+}
+
+static uint64_t expectedSum ( uint32_t numProducers )
+{
+    uint64_t sum = 0;
+
+    for ( uint64_t p = 0; p < numProducers; ++p )
+        sum += ( p << 24 ) * NUM_ITEMS_PER_PRODUCER + uint64_t ( NUM_ITEMS_PER_PRODUCER - 1 ) * NUM_ITEMS_PER_PRODUCER / 2;
+
+    return sum;
+}
+
+
+TEST ( LockFreeQueue, SingleThread )
+{
+    LockFreeQueue<int, 4> queue;
+    int value = 0;
+
+    EXPECT_TRUE ( queue.empty() );
+    EXPECT_FALSE ( queue.tryPop ( value ) );
+
+    // Wraps around the ring a few times
+    for ( int round = 0; round < 3; ++round )
+    {
+        for ( int i = 0; i < 4; ++i )
+            EXPECT_TRUE ( queue.tryPush ( round * 10 + i ) );
+
+        EXPECT_FALSE ( queue.tryPush ( 99 ) );
+        EXPECT_EQ ( 4u, queue.size() );
+
+        for ( int i = 0; i < 4; ++i )
+        {
+            EXPECT_TRUE ( queue.tryPop ( value ) );
+            EXPECT_EQ ( round * 10 + i, value );
+        }
+
+        EXPECT_TRUE ( queue.empty() );
+    }
+
+    queue.push ( 1 );
+    queue.push ( 2 );
+    queue.clear();
+    EXPECT_TRUE ( queue.empty() );
+}
+
+TEST ( LockFreeQueue, Timeouts )
+{
+    LockFreeQueue<int, 2> queue;
+
+    EXPECT_EQ ( -1, queue.pop ( 10, -1 ) );
+
+    EXPECT_TRUE ( queue.push ( 1, 10 ) );
+    EXPECT_TRUE ( queue.push ( 2, 10 ) );
+    EXPECT_FALSE ( queue.push ( 3, 10 ) );
+
+    EXPECT_EQ ( 1, queue.pop ( 10, -1 ) );
+}
+
+TEST ( LockFreeQueue, ReleasesValues )
+{
+    LockFreeQueue<shared_ptr<int>, 4> queue;
+    shared_ptr<int> value ( new int ( 1 ) );
+
+    queue.push ( value );
+    EXPECT_EQ ( 2, value.use_count() );
+
+    // Popping doesn't leave a copy in the cell
+    queue.pop();
+    EXPECT_EQ ( 1, value.use_count() );
+}
+
+TEST ( LockFreeQueue, Stress )
+{
+    const uint32_t configs[][2] = { { 1, 1 }, { 4, 1 }, { 1, 4 }, { 4, 4 } };
+
+    for ( const auto& config : configs )
+    {
+        LockFreeQueue<uint32_t, QUEUE_SIZE> queue;
+        const StressResult result = stress ( queue, config[0], config[1] );
+
+        EXPECT_EQ ( expectedSum ( config[0] ), result.sum );
+        EXPECT_TRUE ( result.ordered );
+        EXPECT_TRUE ( queue.empty() );
+    }
+}
+
+TEST ( LockFreeQueue, Contention )
+{
+    const uint32_t configs[][2] = { { 1, 1 }, { 4, 4 } };
+
+    for ( const auto& config : configs )
+    {
+        unique_ptr<LockFreeQueue<uint32_t, QUEUE_SIZE>> lockFree ( new LockFreeQueue<uint32_t, QUEUE_SIZE>() );
+        unique_ptr<StaticBlockingQueue<uint32_t, QUEUE_SIZE>> locked ( new StaticBlockingQueue<uint32_t, QUEUE_SIZE>() );
+        unique_ptr<BlockingQueue<uint32_t>> unbounded ( new BlockingQueue<uint32_t>() );
+
+        const double total = double ( config[0] ) * NUM_ITEMS_PER_PRODUCER;
+
+        const double lockFreeTime = stress ( *lockFree, config[0], config[1] ).seconds;
+        const double lockedTime = stress ( *locked, config[0], config[1] ).seconds;
+        const double unboundedTime = stress ( *unbounded, config[0], config[1] ).seconds;
+
+        PRINT ( "%u producers, %u consumers: LockFreeQueue %.2fM items / s; StaticBlockingQueue %.2fM items / s; "
+                "BlockingQueue %.2fM items / s",
+                config[0], config[1], total / lockFreeTime / 1e6, total / lockedTime / 1e6,
+                total / unboundedTime / 1e6 );
+    }
+}
+
+TEST ( WorkerPool, RunsAllTasks )
+{
+    atomic<uint32_t> count ( 0 );
+
+    {
+        WorkerPool pool ( 3 );
+        EXPECT_EQ ( 3u, pool.getNumThreads() );
+
+        // More tasks than fit in the queue at once
+        for ( uint32_t i = 0; i < 1000; ++i )
+            pool.submit ( [&count] { ++count; } );
+
+        pool.wait();
+        EXPECT_EQ ( 1000u, count );
+
+        // Empty tasks are ignored
+        pool.submit ( WorkerPool::Task() );
+        pool.wait();
+
+        // The queued tasks are finished before the pool is destroyed
+        for ( uint32_t i = 0; i < 100; ++i )
+            pool.submit ( [&count] { ++count; } );
+    }
+
+    EXPECT_EQ ( 1100u, count );
+}
+
+TEST ( WorkerPool, SubmitFromManyThreads )
+{
+    atomic<uint64_t> sum ( 0 );
+    WorkerPool& pool = WorkerPool::get();
+
+    vector<function<void()>> funcs;
+
+    for ( uint64_t t = 0; t < 4; ++t )
+    {
+        funcs.push_back ( [&pool, &sum, t]
+        {
+            for ( uint64_t i = 0; i < 1000; ++i )
+                pool.submit ( [&sum, t, i] { sum += t * 1000 + i; } );
+        } );
+    }
+
+    runThreads ( funcs );
+    pool.wait();
+
+    EXPECT_EQ ( 4000u * 3999u / 2, sum );
+}
+
+#endif // NOT RELEASE
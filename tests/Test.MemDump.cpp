@@ -0,0 +1,560 @@
+#ifndef RELEASE
+
+#include "MemDump.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+#define NUM_OBJECTS         ( 400 )
+#define OBJECT_SIZE         ( 0x40 )
+#define NUM_SAVE_ITERATIONS ( 2000 )
+
+#define NUM_SLOTS           ( 1000 )
+#define SLOT_SIZE           ( 0x33C )
+#define SLOT_PTR_OFFSET     ( 0x320 )
+#define NUM_USED_SLOTS      ( 40 )
+
+#define NUM_LOAD_ITERATIONS ( 200 )
+
+
+// Synthetic address space: a fixed region with pointers to an array of objects, which point to each other
+struct AddressSpace
+{
+    vector<char> fixed, objects;
+
+    AddressSpace() : fixed ( 0x1000 ), objects ( NUM_OBJECTS * OBJECT_SIZE ) {}
+
+    char *object ( size_t i ) { return &objects[i * OBJECT_SIZE]; }
+
+    void setPtr ( char *at, char *value ) { memcpy ( at, &value, sizeof ( value ) ); }
+
+    // Randomize everything except the pointers
+    void scramble()
+    {
+        for ( size_t i = 0x200; i < fixed.size(); ++i )
+            fixed[i] = rand();
+
+        for ( size_t i = 0; i < NUM_OBJECTS; ++i )
+            for ( size_t j = 2 * sizeof ( char * ); j < OBJECT_SIZE; ++j )
+                object ( i ) [j] = rand();
+    }
+
+    // Layout:
+    //   fixed[0 .. 0x200) holds pointers to objects, some null, some to consecutive objects
+    //   each object holds a pointer to the next object at 0, and a pointer into itself at 8
+    MemDumpList build()
+    {
+        const size_t ptrSize = sizeof ( char * );
+        const size_t numPtrs = 0x200 / ptrSize;
+
+        vector<MemDumpPtr> fixedPtrs;
+
+        for ( size_t i = 0; i < numPtrs; ++i )
+        {
+            setPtr ( &fixed[i * ptrSize], ( i % 7 == 3 ) ? 0 : object ( i ) );
+
+            // Data of the object, then the object's own pointers
+            fixedPtrs.push_back ( MemDumpPtr ( i * ptrSize, 2 * ptrSize, 0x10 ) );
+            fixedPtrs.push_back ( MemDumpPtr ( i * ptrSize, 2 * ptrSize + 0x10, OBJECT_SIZE - 2 * ptrSize - 0x10 ) );
+            fixedPtrs.push_back ( MemDumpPtr ( i * ptrSize, 0, 2 * ptrSize, {
+                MemDumpPtr ( 0, 0, OBJECT_SIZE, {
+                    MemDumpPtr ( ptrSize, 4, 0x10 )
+                } )
+            } ) );
+        }
+
+        for ( size_t i = 0; i < NUM_OBJECTS; ++i )
+        {
+            setPtr ( object ( i ), ( i + 1 < NUM_OBJECTS && i % 5 != 0 ) ? object ( i + 1 ) : 0 );
+            setPtr ( object ( i ) + ptrSize, object ( i ) + 0x20 );
+        }
+
+        MemDumpList list;
+        list.append ( MemDump ( &fixed[0], 0x200, fixedPtrs ) );
+        list.append ( MemDump ( &fixed[0x200], 0x100 ) );
+        list.append ( MemDump ( &fixed[0x300], 0x100 ) );
+        list.append ( MemDump ( &fixed[0x800], 0x800 ) );
+        list.update();
+        return list;
+    }
+};
+
+static void saveDump ( const MemDumpList& list, char *dump )
+{
+    for ( const MemDump& mem : list.addrs )
+        mem.saveDump ( dump );
+}
+
+static void loadDump ( const MemDumpList& list, const char *dump )
+{
+    for ( const MemDump& mem : list.addrs )
+        mem.loadDump ( dump );
+}
+
+
+TEST ( MemDump, PlanMatchesTree )
+{
+    AddressSpace space;
+    const MemDumpList list = space.build();
+    space.scramble();
+
+    MemDumpPlan plan;
+    plan.compile ( list );
+
+    ASSERT_EQ ( list.totalSize, plan.totalSize );
+    EXPECT_LT ( plan.getNumOps(), list.addrs.size() + 0x200 / sizeof ( char * ) * 5 );
+
+    // Save must give the same bytes
+    vector<char> expected ( list.totalSize ), actual ( list.totalSize, 'x' );
+    saveDump ( list, &expected[0] );
+    plan.saveDump ( &actual[0] );
+    EXPECT_TRUE ( expected == actual );
+
+    // Load must restore the same memory, which is checked by saving again with the other path
+    vector<char> saved ( list.totalSize );
+
+    space.scramble();
+    plan.loadDump ( &expected[0] );
+    saveDump ( list, &saved[0] );
+    EXPECT_TRUE ( expected == saved );
+
+    space.scramble();
+    loadDump ( list, &expected[0] );
+    plan.saveDump ( &saved[0] );
+    EXPECT_TRUE ( expected == saved );
+
+    // Loading must follow the pointers in the dump, not the pointers currently in memory
+    space.setPtr ( &space.fixed[0], space.object ( 100 ) );
+    saveDump ( list, &expected[0] );
+    space.setPtr ( &space.fixed[0], space.object ( 0 ) );
+    space.scramble();
+    const vector<char> scrambled = space.objects;
+
+    plan.loadDump ( &expected[0] );
+    const vector<char> planFixed = space.fixed, planObjects = space.objects;
+
+    space.setPtr ( &space.fixed[0], space.object ( 0 ) );
+    space.objects = scrambled;
+    loadDump ( list, &expected[0] );
+    EXPECT_TRUE ( planFixed == space.fixed );
+    EXPECT_TRUE ( planObjects == space.objects );
+}
+
+// Synthetic effects array, each slot in use has its flag at 0 and a pointer to some shared data
+struct SlotSpace
+{
+    vector<char> slots, targets;
+
+    SlotSpace() : slots ( NUM_SLOTS * SLOT_SIZE ), targets ( 0x1000 ) {}
+
+    char *slot ( size_t i ) { return &slots[i * SLOT_SIZE]; }
+
+    // Free every slot, then use a random set of slots with random data, freed slots are cleared like the game does
+    void shuffle()
+    {
+        fill ( slots.begin(), slots.end(), 0 );
+
+        for ( char& c : targets )
+            c = rand();
+
+        for ( size_t n = 0; n < NUM_USED_SLOTS; ++n )
+        {
+            char *s = slot ( rand() % NUM_SLOTS );
+
+            for ( size_t j = 0; j < SLOT_SIZE; ++j )
+                s[j] = rand();
+
+            s[0] = 1 + rand() % 0x7F;
+
+            char *target = ( rand() % 4 ) ? &targets[ ( rand() % 0x100 ) * 0x10 ] : 0;
+            memcpy ( s + SLOT_PTR_OFFSET, &target, sizeof ( target ) );
+        }
+    }
+
+    vector<MemDumpPtr> ptrs() const
+    {
+        return { MemDumpPtr ( SLOT_PTR_OFFSET, 4, 8 ) };
+    }
+
+    // The old layout, every slot saved in full
+    MemDumpList buildFull()
+    {
+        MemDumpList list;
+        const MemDump first ( slot ( 0 ), SLOT_SIZE, ptrs() );
+
+        for ( size_t i = 0; i < NUM_SLOTS; ++i )
+            list.append ( first, SLOT_SIZE * i );
+
+        list.update();
+        return list;
+    }
+};
+
+TEST ( MemDump, SlotsMatchFullCopy )
+{
+    SlotSpace space;
+    space.shuffle();
+
+    const MemDumpList full = space.buildFull();
+    const MemDumpSlots slots ( space.slot ( 0 ), SLOT_SIZE, NUM_SLOTS, 0, 1, space.ptrs() );
+
+    vector<char> fullDump ( full.totalSize ), slotsDump;
+    saveDump ( full, &fullDump[0] );
+    slots.saveDump ( slotsDump );
+
+    const char *dump = &slotsDump[0];
+    EXPECT_EQ ( 0u, slots.countMismatchedSlots ( dump ) );
+    EXPECT_EQ ( &slotsDump[0] + slotsDump.size(), dump );
+
+    EXPECT_LT ( slotsDump.size(), fullDump.size() / 10 );
+    EXPECT_LE ( slotsDump.size(), slots.getMaxDumpSize() );
+
+    const vector<char> savedSlots = space.slots;
+
+    // Restoring the slots must give the same memory as restoring the full copy
+    space.shuffle();
+    dump = &slotsDump[0];
+    EXPECT_LT ( 0u, slots.countMismatchedSlots ( dump ) );
+    dump = &slotsDump[0];
+    slots.loadDump ( dump );
+    EXPECT_EQ ( &slotsDump[0] + slotsDump.size(), dump );
+    EXPECT_TRUE ( savedSlots == space.slots );
+
+    // Including the data behind the pointers
+    vector<char> resaved ( full.totalSize );
+    saveDump ( full, &resaved[0] );
+    EXPECT_TRUE ( fullDump == resaved );
+
+    space.shuffle();
+    loadDump ( full, &fullDump[0] );
+    EXPECT_TRUE ( savedSlots == space.slots );
+
+    // Slots that are freed without being cleared are still saved, so they are restored exactly
+    space.slot ( 3 ) [0] = 0;
+    space.slot ( 3 ) [10] = 1;
+    space.slot ( 4 ) [0] = 0;
+    space.slot ( 4 ) [SLOT_SIZE - 1] = 1;
+    const vector<char> dirtySlots = space.slots;
+
+    // Also without an in use flag
+    const MemDumpSlots unflagged ( space.slot ( 0 ), SLOT_SIZE, NUM_SLOTS, 0, 0, space.ptrs() );
+
+    for ( const MemDumpSlots *array : { &slots, &unflagged } )
+    {
+        slotsDump.clear();
+        array->saveDump ( slotsDump );
+
+        space.shuffle();
+        dump = &slotsDump[0];
+        array->loadDump ( dump );
+        EXPECT_TRUE ( dirtySlots == space.slots );
+
+        dump = &slotsDump[0];
+        EXPECT_EQ ( 0u, array->countMismatchedSlots ( dump ) );
+    }
+
+    // Save timing
+    auto start = chrono::steady_clock::now();
+    for ( int i = 0; i < NUM_SAVE_ITERATIONS; ++i )
+        saveDump ( full, &fullDump[0] );
+    auto fullTime = chrono::steady_clock::now() - start;
+
+    start = chrono::steady_clock::now();
+    for ( int i = 0; i < NUM_SAVE_ITERATIONS; ++i )
+    {
+        slotsDump.clear();
+        slots.saveDump ( slotsDump );
+    }
+    auto slotsTime = chrono::steady_clock::now() - start;
+
+    start = chrono::steady_clock::now();
+    for ( int i = 0; i < NUM_SAVE_ITERATIONS; ++i )
+    {
+        slotsDump.clear();
+        unflagged.saveDump ( slotsDump );
+    }
+    auto unflaggedTime = chrono::steady_clock::now() - start;
+
+    typedef chrono::duration<double, micro> us;
+
+    PRINT ( "Effects save: full %u bytes %.2f us; slots %u bytes %.2f us; slots without a flag %.2f us",
+            ( uint32_t ) fullDump.size(), us ( fullTime ).count() / NUM_SAVE_ITERATIONS,
+            ( uint32_t ) slotsDump.size(), us ( slotsTime ).count() / NUM_SAVE_ITERATIONS,
+            us ( unflaggedTime ).count() / NUM_SAVE_ITERATIONS );
+}
+
+TEST ( MemDump, PlanPerf )
+{
+    AddressSpace space;
+    const MemDumpList list = space.build();
+    space.scramble();
+
+    MemDumpPlan plan;
+    plan.compile ( list );
+
+    vector<char> dump ( list.totalSize );
+
+    auto start = chrono::steady_clock::now();
+    for ( int i = 0; i < NUM_SAVE_ITERATIONS; ++i )
+        saveDump ( list, &dump[0] );
+    auto treeSaveTime = chrono::steady_clock::now() - start;
+
+    start = chrono::steady_clock::now();
+    for ( int i = 0; i < NUM_SAVE_ITERATIONS; ++i )
+        plan.saveDump ( &dump[0] );
+    auto planSaveTime = chrono::steady_clock::now() - start;
+
+    start = chrono::steady_clock::now();
+    for ( int i = 0; i < NUM_SAVE_ITERATIONS; ++i )
+        loadDump ( list, &dump[0] );
+    auto treeLoadTime = chrono::steady_clock::now() - start;
+
+    start = chrono::steady_clock::now();
+    for ( int i = 0; i < NUM_SAVE_ITERATIONS; ++i )
+        plan.loadDump ( &dump[0] );
+    auto planLoadTime = chrono::steady_clock::now() - start;
+
+    typedef chrono::duration<double, micro> us;
+
+    PRINT ( "%u bytes, %u ops: save tree %.2f us, plan %.2f us; load tree %.2f us, plan %.2f us",
+            ( uint32_t ) plan.totalSize, ( uint32_t ) plan.getNumOps(),
+            us ( treeSaveTime ).count() / NUM_SAVE_ITERATIONS, us ( planSaveTime ).count() / NUM_SAVE_ITERATIONS,
+            us ( treeLoadTime ).count() / NUM_SAVE_ITERATIONS, us ( planLoadTime ).count() / NUM_SAVE_ITERATIONS );
+}
+
+// Layout with fixed 32-bit addresses like the generated one, since the cereal format only has 32-bit addresses.
+// It is never dumped, but the pointers still have the host's size so the layout is valid.
+static MemDumpList buildGameLayout()
+{
+    const size_t ptrSize = sizeof ( char * );
+
+    const vector<MemDumpPtr> effectPtrs =
+    {
+        MemDumpPtr ( 0x320, 0x38, ptrSize, {
+            MemDumpPtr ( 0, 0, ptrSize, {
+                MemDumpPtr ( 0, 0, 4 )
+            } )
+        } )
+    };
+
+    vector<MemDump> playerAddrs;
+
+    for ( uint32_t i = 0; i < 0x400; i += 0x20 )
+    {
+        if ( i % 0x100 == 0x40 )
+        {
+            playerAddrs.push_back ( MemDump ( 0x555130 + i, 0x555130 + i + 0x10, {
+                MemDumpPtr ( 0x0, 0x8, 0x40, { MemDumpPtr ( 0x4, 0, 0x10 ) } ),
+                MemDumpPtr ( 0x4, 0x0, 0x20 ),
+            } ) );
+        }
+        else
+        {
+            playerAddrs.push_back ( MemDump ( 0x555130 + i, 0x555130 + i + 0x10 ) );
+        }
+    }
+
+    MemDumpList list;
+    list.append ( MemDump ( 0x54EEE8, 0x54EEEC ) );
+    list.append ( MemDump ( 0x55D1D0, 0x55D1D4 ) );
+    list.append ( MemDump ( 0x55D1D4, 0x55D1E0 ) );
+    list.append ( MemDump ( 0x563864, 0x563864 + ptrSize, { MemDumpPtr ( 0, 0, 0x100 ) } ) );
+
+    for ( size_t i = 0; i < 4; ++i )
+        list.append ( playerAddrs, i * 0xAFC );
+
+    list.append ( MemDumpSlots ( ( char * ) 0x67BDE8, SLOT_SIZE, NUM_SLOTS, 0, 1, effectPtrs ) );
+    list.update();
+    return list;
+}
+
+static string readFile ( const string& file )
+{
+    string data;
+    FILE *f = fopen ( file.c_str(), "rb" );
+
+    if ( !f )
+        return data;
+
+    char buffer[4096];
+    size_t n;
+
+    while ( ( n = fread ( buffer, 1, sizeof ( buffer ), f ) ) > 0 )
+        data.append ( buffer, n );
+
+    fclose ( f );
+    return data;
+}
+
+TEST ( MemDump, LayoutMatchesCereal )
+{
+    const MemDumpList list = buildGameLayout();
+
+    // The old path: cereal, then compiling the plan
+    const string cerealFile = "Test.MemDump.cereal.bin";
+    ASSERT_TRUE ( list.save ( cerealFile ) );
+
+    MemDumpList cerealList;
+    ASSERT_TRUE ( cerealList.load ( cerealFile ) );
+
+    MemDumpLayout cerealLayout;
+    cerealLayout.compile ( cerealList );
+
+    // The flat layout, used in place
+    MemDumpLayout compiled;
+    compiled.compile ( list );
+    const string flat = compiled.save();
+
+    MemDumpLayout layout;
+    ASSERT_TRUE ( layout.load ( flat.data(), flat.size() ) );
+
+    // Every table and slot array must be the same
+    EXPECT_EQ ( cerealList.totalSize, layout.totalSize );
+    EXPECT_EQ ( cerealLayout.plan.getNumOps(), layout.plan.getNumOps() );
+    EXPECT_EQ ( cerealList.addrs.size(), layout.plan.getNumRegions() );
+    ASSERT_EQ ( cerealList.slots.size(), layout.slots.size() );
+    EXPECT_EQ ( cerealList.slots[0].addr, layout.slots[0].addr );
+    EXPECT_EQ ( cerealList.slots[0].count, layout.slots[0].count );
+    EXPECT_EQ ( cerealList.slots[0].getMaxDumpSize(), layout.slots[0].getMaxDumpSize() );
+    EXPECT_TRUE ( cerealLayout.save() == layout.save() );
+
+    // Unaligned data can't be used in place
+    string unaligned = " " + flat;
+    MemDumpLayout copied;
+    EXPECT_FALSE ( copied.load ( &unaligned[1], flat.size() ) );
+    EXPECT_TRUE ( copied.empty() );
+
+    // Memory mapped file
+    const string flatFile = "Test.MemDump.flat.bin";
+    ASSERT_TRUE ( compiled.save ( flatFile ) );
+    EXPECT_TRUE ( flat == readFile ( flatFile ) );
+
+    MemDumpLayout mapped;
+    ASSERT_TRUE ( mapped.load ( flatFile ) );
+    EXPECT_TRUE ( flat == mapped.save() );
+    mapped.clear();
+    EXPECT_TRUE ( mapped.empty() );
+
+    // Load timing, both from memory like the linked data
+    const string cerealData = readFile ( cerealFile );
+
+    auto start = chrono::steady_clock::now();
+    for ( int i = 0; i < NUM_LOAD_ITERATIONS; ++i )
+    {
+        MemDumpList tmp;
+        tmp.load ( cerealData.data(), cerealData.size() );
+        MemDumpPlan plan;
+        plan.compile ( tmp );
+    }
+    auto cerealTime = chrono::steady_clock::now() - start;
+
+    start = chrono::steady_clock::now();
+    for ( int i = 0; i < NUM_LOAD_ITERATIONS; ++i )
+    {
+        MemDumpLayout tmp;
+        tmp.load ( flat.data(), flat.size() );
+    }
+    auto flatTime = chrono::steady_clock::now() - start;
+
+    remove ( cerealFile.c_str() );
+    remove ( flatFile.c_str() );
+
+    typedef chrono::duration<double, micro> us;
+
+    PRINT ( "Layout load: cereal %u bytes + compile %.2f us; flat %u bytes %.2f us",
+            ( uint32_t ) cerealData.size(), us ( cerealTime ).count() / NUM_LOAD_ITERATIONS,
+            ( uint32_t ) flat.size(), us ( flatTime ).count() / NUM_LOAD_ITERATIONS );
+}
+
+TEST ( MemDump, LayoutDumps )
+{
+    AddressSpace space;
+    SlotSpace slotSpace;
+
+    MemDumpList list = space.build();
+    list.append ( MemDumpSlots ( slotSpace.slot ( 0 ), SLOT_SIZE, NUM_SLOTS, 0, 1, slotSpace.ptrs() ) );
+
+    space.scramble();
+    slotSpace.shuffle();
+
+    MemDumpPlan plan;
+    plan.compile ( list );
+
+    MemDumpLayout compiled;
+    compiled.compile ( list );
+    const string flat = compiled.save();
+
+    MemDumpLayout layout;
+    ASSERT_TRUE ( layout.load ( flat.data(), flat.size() ) );
+    ASSERT_EQ ( plan.totalSize, layout.plan.totalSize );
+    ASSERT_EQ ( plan.getNumRegions(), layout.plan.getNumRegions() );
+
+    // Saving with the tables in place must give the same bytes and hashes
+    vector<char> expected ( plan.totalSize ), actual ( plan.totalSize, 'x' );
+    vector<uint64_t> expectedHashes ( plan.getNumRegions() ), actualHashes ( plan.getNumRegions() );
+    plan.saveDump ( &expected[0], &expectedHashes[0] );
+    layout.plan.saveDump ( &actual[0], &actualHashes[0] );
+    EXPECT_TRUE ( expected == actual );
+    EXPECT_TRUE ( expectedHashes == actualHashes );
+
+    vector<char> expectedSlots, actualSlots;
+    list.slots[0].saveDump ( expectedSlots );
+    layout.slots[0].saveDump ( actualSlots );
+    EXPECT_TRUE ( expectedSlots == actualSlots );
+
+    // And loading must restore the same memory
+    space.scramble();
+    slotSpace.shuffle();
+
+    layout.plan.loadDump ( &expected[0] );
+    const char *dump = &actualSlots[0];
+    layout.slots[0].loadDump ( dump );
+
+    plan.saveDump ( &actual[0] );
+    EXPECT_TRUE ( expected == actual );
+
+    actualSlots.clear();
+    list.slots[0].saveDump ( actualSlots );
+    EXPECT_TRUE ( expectedSlots == actualSlots );
+}
+
+TEST ( MemDump, LayoutRejectsBadData )
+{
+    MemDumpLayout compiled;
+    compiled.compile ( buildGameLayout() );
+    const string flat = compiled.save();
+
+    MemDumpLayout layout;
+    EXPECT_FALSE ( layout.load ( flat.data(), 0 ) );
+    EXPECT_FALSE ( layout.load ( flat.data(), 16 ) );
+    EXPECT_FALSE ( layout.load ( flat.data(), flat.size() - 1 ) );
+    EXPECT_FALSE ( layout.load ( "Test.MemDump.missing.bin" ) );
+
+    // Every byte of the tables is covered by the checksum
+    for ( size_t i = 48; i < flat.size(); i += 7 )
+    {
+        string bad = flat;
+        bad[i] ^= 0x10;
+        EXPECT_FALSE ( layout.load ( bad.data(), bad.size() ) ) << i;
+        EXPECT_TRUE ( layout.empty() );
+    }
+
+    // Other versions aren't loaded
+    string bad = flat;
+    bad[4] = MEM_DUMP_LAYOUT_VERSION + 1;
+    EXPECT_FALSE ( layout.load ( bad.data(), bad.size() ) );
+
+    EXPECT_TRUE ( layout.load ( flat.data(), flat.size() ) );
+}
+
+#endif // NOT RELEASE
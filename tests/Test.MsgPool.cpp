@@ -0,0 +1,382 @@
+#ifndef RELEASE
+
+#include "MsgPool.hpp"
+#include "Messages.hpp"
+#include "GoBackN.hpp"
+#include "Compression.hpp"
+#include "Logger.hpp"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+
+#define MINIZ_NO_ZLIB_COMPATIBLE_NAMES
+#include <miniz.h>
+
+using namespace std;
+
+
+#define NUM_WARMUP_FRAMES   ( 1000 )
+#define NUM_FRAMES          ( 100000 )
+#define NUM_ROUND_TRIPS     ( 10000 )
+#define NUM_IN_FLIGHT       ( 64 )
+
+
+// These compare the pool against make_shared with the same shapes as the hot path messages: a polymorphic base like
+// Serializable, inputs like PlayerInputs / BothInputs, and a small ack like AckSequence.
+struct FakeMsg
+{
+    virtual ~FakeMsg() {}
+    virtual uint32_t getSize() const = 0;
+};
+
+struct FakeInputs : public FakeMsg
+{
+    uint64_t indexedFrame;
+    array<uint16_t, 30> inputs;
+    FakeInputs ( uint64_t indexedFrame ) : indexedFrame ( indexedFrame ) { inputs.fill ( 0 ); }
+    uint32_t getSize() const override { return sizeof ( *this ); }
+};
+
+struct FakeBothInputs : public FakeMsg
+{
+    uint64_t indexedFrame;
+    array<array<uint16_t, 30>, 2> inputs;
+    FakeBothInputs ( uint64_t indexedFrame ) : indexedFrame ( indexedFrame ) {}
+    uint32_t getSize() const override { return sizeof ( *this ); }
+};
+
+struct FakeAck : public FakeMsg
+{
+    uint32_t sequence;
+    FakeAck ( uint32_t sequence ) : sequence ( sequence ) {}
+    uint32_t getSize() const override { return sizeof ( *this ); }
+};
+
+typedef shared_ptr<FakeMsg> FakeMsgPtr;
+
+
+// The generated message registry in ProtocolCreate.cpp needs every message type, most of which are only built for
+// Windows, so the real hot path messages are registered here instead.
+#define REGISTER_MESSAGE(NAME)                                                                              \
+    inline MsgPtr NAME::clone() const                                                                       \
+    {                                                                                                       \
+        MsgPtr msg = makePooled<NAME> ( *this );                                                            \
+        msg->invalidate();                                                                                  \
+        return msg;                                                                                         \
+    }                                                                                                       \
+    inline MsgType NAME::getMsgType() const { return MsgType::NAME; }
+
+REGISTER_MESSAGE ( PlayerInputs )
+REGISTER_MESSAGE ( BothInputs )
+REGISTER_MESSAGE ( AckSequence )
+
+// NullAddress in IpAddrPort.hpp, which Messages.hpp includes, needs the vtable too
+REGISTER_MESSAGE ( IpAddrPort )
+
+MsgPtr Protocol::create ( MsgType type )
+{
+    switch ( type )
+    {
+        case MsgType::PlayerInputs: return makePooled<PlayerInputs>();
+        case MsgType::BothInputs: return makePooled<BothInputs>();
+        case MsgType::AckSequence: return makePooled<AckSequence>();
+
+        default:
+            return NullMsg;
+    }
+}
+
+
+// Count heap allocations in the host tests, the Windows build keeps the default operator new
+#ifndef _WIN32
+
+static atomic<size_t> numHeapAllocs ( 0 );
+
+// Not inlined, otherwise GCC sees the malloc and free inside them and warns about mismatched allocations
+__attribute__ ( ( noinline ) ) void *operator new ( size_t size )
+{
+    ++numHeapAllocs;
+
+    if ( void *ptr = malloc ( size ? size : 1 ) )
+        return ptr;
+
+    throw bad_alloc();
+}
+
+__attribute__ ( ( noinline ) ) void operator delete ( void *ptr ) noexcept
+{
+    free ( ptr );
+}
+
+#define COUNTING_ALLOCS     ( 1 )
+
+#else
+
+static size_t numHeapAllocs = 0;
+
+#endif
+
+
+// One frame of netplay traffic: send inputs, keep them until acked like GoBackN, and ack the remote
+template<bool POOLED>
+static void runFrame ( uint32_t frame, array<FakeMsgPtr, NUM_IN_FLIGHT>& inFlight, uint32_t& checksum )
+{
+    FakeMsgPtr inputs, bothInputs, ack;
+
+    if ( POOLED )
+    {
+        inputs = makePooled<FakeInputs> ( frame );
+        bothInputs = makePooled<FakeBothInputs> ( frame );
+        ack = makePooled<FakeAck> ( frame );
+    }
+    else
+    {
+        inputs = make_shared<FakeInputs> ( frame );
+        bothInputs = make_shared<FakeBothInputs> ( frame );
+        ack = make_shared<FakeAck> ( frame );
+    }
+
+    // Replacing the oldest message releases it, like an ack removing it from the send list
+    inFlight [ frame % NUM_IN_FLIGHT ] = bothInputs;
+
+    // Copies are shared, eg with the spectators
+    FakeMsgPtr copy = inputs;
+
+    checksum += copy->getSize() + ack->getSize() + inFlight [ ( frame + 1 ) % NUM_IN_FLIGHT ].use_count();
+}
+
+
+// One frame of netplay traffic through the protocol: encode inputs and an ack into the socket's buffer, send the
+// bytes to the remote read buffer, then decode them there
+static void runRoundTrip ( uint32_t frame, string& sendBuffer, string& recvBuffer, uint32_t& checksum )
+{
+    const IndexedFrame indexedFrame = {{ frame, 0 }};
+
+    shared_ptr<PlayerInputs> inputs = makePooled<PlayerInputs> ( indexedFrame );
+    shared_ptr<BothInputs> bothInputs = makePooled<BothInputs> ( indexedFrame );
+
+    // Mostly neutral inputs, which compress, and a changing direction
+    inputs->inputs.fill ( 0 );
+    inputs->inputs [ frame % NUM_INPUTS ] = ( frame % 10 );
+    bothInputs->inputs [ 0 ] = bothInputs->inputs [ 1 ] = inputs->inputs;
+    bothInputs->setSequence ( frame );
+
+    const MsgPtr msgs[] = { inputs, bothInputs, makePooled<AckSequence> ( frame ) };
+
+    for ( const MsgPtr& msg : msgs )
+    {
+        Protocol::encode ( msg, sendBuffer );
+
+        recvBuffer.assign ( sendBuffer );
+
+        size_t consumed = 0;
+        const MsgPtr decoded = Protocol::decode ( &recvBuffer[0], recvBuffer.size(), consumed );
+
+        if ( ! decoded || consumed != recvBuffer.size() )
+            return;
+
+        checksum += ( uint32_t ) decoded->getMsgType();
+    }
+}
+
+
+TEST ( MsgPool, BlockReuse )
+{
+    BlockPool pool ( 24, 4 );
+
+    EXPECT_EQ ( 0u, pool.blockSize % alignof ( max_align_t ) );
+    EXPECT_GE ( pool.blockSize, 24u );
+
+    void *a = pool.allocate();
+    void *b = pool.allocate();
+    EXPECT_EQ ( 2u, pool.getNumHeapAllocs() );
+
+    pool.deallocate ( a );
+    EXPECT_EQ ( a, pool.allocate() );
+    EXPECT_EQ ( 2u, pool.getNumHeapAllocs() );
+    EXPECT_EQ ( 1u, pool.getNumReused() );
+
+    pool.deallocate ( a );
+    pool.deallocate ( b );
+
+    // Only up to the max free blocks are kept
+    pool.reserve ( 10 );
+    EXPECT_EQ ( 4u, pool.getNumFree() );
+
+    void *blocks[6];
+
+    for ( void *& block : blocks )
+        block = pool.allocate();
+
+    for ( void *block : blocks )
+        pool.deallocate ( block );
+
+    EXPECT_EQ ( 4u, pool.getNumFree() );
+}
+
+// Only creating and releasing the message objects is counted, not encoding or decoding them
+TEST ( MsgPool, NoSteadyStateAllocs )
+{
+    array<FakeMsgPtr, NUM_IN_FLIGHT> inFlight;
+    uint32_t checksum = 0;
+
+    for ( uint32_t frame = 0; frame < NUM_WARMUP_FRAMES; ++frame )
+        runFrame<true> ( frame, inFlight, checksum );
+
+    // The object and the control block share one pooled block
+    const BlockPool& pool = PoolAllocator<FakeInputs>::getPool();
+    EXPECT_GE ( pool.blockSize, sizeof ( FakeInputs ) );
+
+    size_t before = numHeapAllocs;
+
+    for ( uint32_t frame = NUM_WARMUP_FRAMES; frame < NUM_FRAMES; ++frame )
+        runFrame<true> ( frame, inFlight, checksum );
+
+    const size_t pooledAllocs = numHeapAllocs - before;
+
+    before = numHeapAllocs;
+
+    for ( uint32_t frame = NUM_WARMUP_FRAMES; frame < NUM_FRAMES; ++frame )
+        runFrame<false> ( frame, inFlight, checksum );
+
+    const size_t sharedAllocs = numHeapAllocs - before;
+
+    PRINT ( "%u frames: %u heap allocations pooled, %u with make_shared (checksum %08x)",
+            NUM_FRAMES - NUM_WARMUP_FRAMES, pooledAllocs, sharedAllocs, checksum );
+
+#ifdef COUNTING_ALLOCS
+    EXPECT_EQ ( 0u, pooledAllocs );
+    EXPECT_EQ ( 3u * ( NUM_FRAMES - NUM_WARMUP_FRAMES ), sharedAllocs );
+#endif
+}
+
+TEST ( MsgPool, CompressionMatchesZlib )
+{
+    string data ( 1000, ( char ) 0 );
+
+    for ( size_t i = 0; i < data.size(); i += 7 )
+        data[i] = ( char ) i;
+
+    for ( int level : { 1, 6, 9 } )
+    {
+        string expected ( compressBound ( data.size() ), ( char ) 0 );
+        mz_ulong expectedSize = expected.size();
+
+        ASSERT_EQ ( MZ_OK, mz_compress2 ( ( unsigned char * ) &expected[0], &expectedSize,
+                                          ( const unsigned char * ) &data[0], data.size(), level ) );
+        expected.resize ( expectedSize );
+
+        string compressed ( compressBound ( data.size() ), ( char ) 0 );
+        compressed.resize ( compress ( &data[0], data.size(), &compressed[0], compressed.size(), level ) );
+
+        EXPECT_EQ ( expected, compressed );
+
+        string uncompressed ( data.size(), ( char ) 0 );
+        EXPECT_EQ ( data.size(), uncompress ( &compressed[0], compressed.size(), &uncompressed[0], data.size() ) );
+        EXPECT_EQ ( data, uncompressed );
+
+        // Truncated data fails instead of returning partial data
+        EXPECT_EQ ( 0u, uncompress ( &compressed[0], compressed.size() / 2, &uncompressed[0], data.size() ) );
+    }
+}
+
+TEST ( MsgPool, RoundTrip )
+{
+    const IndexedFrame indexedFrame = {{ 123, 4 }};
+
+    PlayerInputs inputs ( indexedFrame );
+    inputs.inputs.fill ( 0 );
+    inputs.inputs [ 5 ] = 6;
+
+    // Neutral inputs are compressed, a single ack isn't
+    const MsgPtr msgs[] = { inputs.clone(), makePooled<AckSequence> ( 7 ) };
+    const uint8_t compressionLevels[] = { 9, 0 };
+
+    string buffer;
+
+    for ( size_t i = 0; i < 2; ++i )
+    {
+        Protocol::encode ( msgs[i], buffer );
+        EXPECT_EQ ( compressionLevels[i], msgs[i]->compressionLevel );
+
+        // Same bytes as the allocating version
+        msgs[i]->invalidate();
+        EXPECT_EQ ( buffer, Protocol::encode ( msgs[i] ) );
+
+        // Trailing bytes belong to the next message
+        buffer += "next";
+
+        size_t consumed = 0;
+        const MsgPtr decoded = Protocol::decode ( &buffer[0], buffer.size(), consumed );
+
+        ASSERT_TRUE ( decoded.get() );
+        EXPECT_EQ ( buffer.size() - 4, consumed );
+        EXPECT_EQ ( msgs[i]->getMsgType(), decoded->getMsgType() );
+
+        // Truncated messages don't decode
+        EXPECT_FALSE ( Protocol::decode ( &buffer[0], buffer.size() - 5, consumed ).get() );
+        EXPECT_EQ ( 0u, consumed );
+    }
+}
+
+// Encoding into the socket's buffer and decoding from the read buffer reuse their buffers, and the decoded messages
+// come from the pools. miniz allocates with malloc, which isn't counted, but Compression.cpp doesn't call it per
+// message either.
+TEST ( MsgPool, NoRoundTripAllocs )
+{
+    string sendBuffer, recvBuffer;
+    uint32_t checksum = 0;
+
+    for ( uint32_t frame = 0; frame < NUM_WARMUP_FRAMES; ++frame )
+        runRoundTrip ( frame, sendBuffer, recvBuffer, checksum );
+
+    // Every message decoded
+    const uint32_t typesPerFrame = ( uint32_t ) MsgType::PlayerInputs + ( uint32_t ) MsgType::BothInputs
+                                   + ( uint32_t ) MsgType::AckSequence;
+    EXPECT_EQ ( NUM_WARMUP_FRAMES * typesPerFrame, checksum );
+
+    const size_t before = numHeapAllocs;
+
+    for ( uint32_t frame = NUM_WARMUP_FRAMES; frame < NUM_WARMUP_FRAMES + NUM_ROUND_TRIPS; ++frame )
+        runRoundTrip ( frame, sendBuffer, recvBuffer, checksum );
+
+    const size_t roundTripAllocs = numHeapAllocs - before;
+
+    PRINT ( "%u frames: %u heap allocations encoding, sending and decoding (checksum %08x)",
+            NUM_ROUND_TRIPS, roundTripAllocs, checksum );
+
+#ifdef COUNTING_ALLOCS
+    EXPECT_EQ ( 0u, roundTripAllocs );
+#endif
+}
+
+TEST ( MsgPool, Throughput )
+{
+    array<FakeMsgPtr, NUM_IN_FLIGHT> inFlight;
+    uint32_t checksum = 0;
+
+    for ( uint32_t frame = 0; frame < NUM_WARMUP_FRAMES; ++frame )
+        runFrame<true> ( frame, inFlight, checksum );
+
+    auto start = chrono::steady_clock::now();
+    for ( uint32_t frame = 0; frame < NUM_FRAMES; ++frame )
+        runFrame<true> ( frame, inFlight, checksum );
+    auto pooledTime = chrono::steady_clock::now() - start;
+
+    start = chrono::steady_clock::now();
+    for ( uint32_t frame = 0; frame < NUM_FRAMES; ++frame )
+        runFrame<false> ( frame, inFlight, checksum );
+    auto sharedTime = chrono::steady_clock::now() - start;
+
+    typedef chrono::duration<double, nano> ns;
+
+    PRINT ( "3 messages / frame: pooled %.1f ns / frame, make_shared %.1f ns / frame (checksum %08x)",
+            ns ( pooledTime ).count() / NUM_FRAMES, ns ( sharedTime ).count() / NUM_FRAMES, checksum );
+}
+
+#endif // NOT RELEASE
@@ -0,0 +1,212 @@
+#ifndef RELEASE
+
+#include "PaletteManager.hpp"
+#include "StringUtils.hpp"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <vector>
+
+using namespace std;
+
+
+#define NUM_APPLY_ITERATIONS ( 2000 )
+
+
+static vector<uint32_t> generatePaletteData()
+{
+    vector<uint32_t> data ( NUM_PALETTES * NUM_COLORS );
+
+    for ( uint32_t& color : data )
+        color = ( uint32_t ( rand() ) << 16 ) ^ rand();
+
+    return data;
+}
+
+// Per color reference, the same as the old map based apply
+static void referenceApply ( const PaletteManager& palMan, uint32_t *allPaletteData )
+{
+    for ( uint32_t i = 0; i < NUM_PALETTES; ++i )
+    {
+        for ( uint32_t j = 0; j < NUM_COLORS; ++j )
+        {
+            allPaletteData [ i * NUM_COLORS + j ] = ( allPaletteData [ i * NUM_COLORS + j ] & 0xFF000000 )
+                                                    | ( 0xFFFFFF & SWAP_R_AND_B ( palMan.get ( i, j ) ) );
+        }
+    }
+}
+
+
+TEST ( PaletteManager, ApplyMatchesReference )
+{
+    const vector<uint32_t> original = generatePaletteData();
+
+    PaletteManager palMan;
+    palMan.cache ( &original[0] );
+
+    for ( int i = 0; i < 3000; ++i )
+        palMan.set ( rand() % NUM_PALETTES, rand() % NUM_COLORS, rand() );
+
+    palMan.clear ( 5 );
+    palMan.clear ( 7, 3 );
+
+    vector<uint32_t> expected = generatePaletteData(), actual = expected;
+
+    referenceApply ( palMan, &expected[0] );
+    palMan.apply ( &actual[0] );
+    EXPECT_EQ ( expected, actual );
+
+    // Single palette apply at an unaligned address
+    vector<uint32_t> single ( NUM_COLORS + 1 ), singleExpected;
+    for ( uint32_t& color : single )
+        color = rand();
+    singleExpected.assign ( single.begin() + 1, single.end() );
+
+    for ( uint32_t j = 0; j < NUM_COLORS; ++j )
+        singleExpected[j] = ( singleExpected[j] & 0xFF000000 ) | ( 0xFFFFFF & SWAP_R_AND_B ( palMan.get ( 9, j ) ) );
+
+    palMan.apply ( 9, &single[1] );
+    EXPECT_TRUE ( equal ( singleExpected.begin(), singleExpected.end(), single.begin() + 1 ) );
+}
+
+#ifndef DISABLE_SERIALIZATION
+
+TEST ( PaletteManager, SerializeWireCompatible )
+{
+    PaletteManager palMan;
+    palMan.set ( 0, 1, 0x123456 );
+    palMan.set ( 35, 255, 0xABCDEF );
+    palMan.set ( 12, 40, 0xFF00FF );
+
+    // The dense tables must still serialize as the old sparse map
+    map<uint32_t, map<uint32_t, uint32_t>> sparse = { { 0, { { 1, 0x123456 } } },
+                                                      { 12, { { 40, 0xFF00FF } } },
+                                                      { 35, { { 255, 0xABCDEF } } } };
+    ostringstream expected ( stringstream::binary );
+    {
+        cereal::BinaryOutputArchive archive ( expected );
+        archive ( sparse );
+    }
+
+    ostringstream actual ( stringstream::binary );
+    {
+        cereal::BinaryOutputArchive archive ( actual );
+        palMan.save ( archive );
+    }
+
+    EXPECT_EQ ( expected.str(), actual.str() );
+
+    PaletteManager loaded;
+    istringstream ss ( actual.str(), stringstream::binary );
+    {
+        cereal::BinaryInputArchive archive ( ss );
+        loaded.load ( archive );
+    }
+
+    EXPECT_EQ ( 0x123456u, loaded.get ( 0, 1 ) );
+    EXPECT_EQ ( 0xABCDEFu, loaded.get ( 35, 255 ) );
+    EXPECT_EQ ( 0xFF00FFu, loaded.get ( 12, 40 ) );
+}
+
+#endif // NOT DISABLE_SERIALIZATION
+
+TEST ( PaletteManager, BinaryCache )
+{
+    const string folder = "./";
+    const string chara = "TestChara";
+    const string textFile = folder + chara + "_palettes.txt";
+    const string cacheFile = folder + chara + "_palettes.cache";
+
+    remove ( cacheFile.c_str() );
+
+    {
+        ofstream fout ( textFile.c_str() );
+        fout << "# comment" << endl;
+        fout << "color_01_001=#FF0000" << endl;
+        fout << "color_03_123=#00FF00" << endl;
+        fout << "color_36_256=#0000FF" << endl;
+        fout << "color_99_001=#0000FF" << endl;
+    }
+
+    const vector<uint32_t> original = generatePaletteData();
+
+    PaletteManager parsed;
+    parsed.cache ( &original[0] );
+    EXPECT_TRUE ( parsed.load ( folder, chara ) );
+
+    EXPECT_EQ ( 0xFF0000u, parsed.get ( 0, 0 ) );
+    EXPECT_EQ ( 0x00FF00u, parsed.get ( 2, 122 ) );
+    EXPECT_EQ ( 0x0000FFu, parsed.get ( 35, 255 ) );
+
+    // The second load comes from the cache, which must give identical results
+    ASSERT_TRUE ( ifstream ( cacheFile.c_str() ).good() );
+
+    PaletteManager cached;
+    cached.cache ( &original[0] );
+    EXPECT_TRUE ( cached.load ( folder, chara ) );
+
+    vector<uint32_t> a = original, b = original;
+    parsed.apply ( &a[0] );
+    cached.apply ( &b[0] );
+    EXPECT_EQ ( a, b );
+
+    // A corrupt cache falls back to parsing the text file
+    {
+        ofstream fout ( cacheFile.c_str(), ios::binary );
+        fout << "CCPC garbage";
+    }
+
+    PaletteManager fallback;
+    fallback.cache ( &original[0] );
+    EXPECT_TRUE ( fallback.load ( folder, chara ) );
+    EXPECT_EQ ( 0x00FF00u, fallback.get ( 2, 122 ) );
+
+    // Saving again within the same second, with a text file of the same size, must not load the old cache
+    EXPECT_TRUE ( fallback.save ( folder, chara ) );
+    EXPECT_TRUE ( fallback.load ( folder, chara ) );
+
+    fallback.set ( 2, 122, 0x00FF01 );
+    EXPECT_TRUE ( fallback.save ( folder, chara ) );
+
+    PaletteManager saved;
+    saved.cache ( &original[0] );
+    EXPECT_TRUE ( saved.load ( folder, chara ) );
+    EXPECT_EQ ( 0x00FF01u, saved.get ( 2, 122 ) );
+
+    remove ( textFile.c_str() );
+    remove ( cacheFile.c_str() );
+}
+
+TEST ( PaletteManager, ApplyPerf )
+{
+    const vector<uint32_t> original = generatePaletteData();
+
+    PaletteManager palMan;
+    palMan.cache ( &original[0] );
+
+    for ( int i = 0; i < 2000; ++i )
+        palMan.set ( rand() % NUM_PALETTES, rand() % NUM_COLORS, rand() );
+
+    vector<uint32_t> data = original;
+
+    auto start = chrono::steady_clock::now();
+    for ( int i = 0; i < NUM_APPLY_ITERATIONS; ++i )
+        referenceApply ( palMan, &data[0] );
+    auto referenceTime = chrono::steady_clock::now() - start;
+
+    start = chrono::steady_clock::now();
+    for ( int i = 0; i < NUM_APPLY_ITERATIONS; ++i )
+        palMan.apply ( &data[0] );
+    auto applyTime = chrono::steady_clock::now() - start;
+
+    typedef chrono::duration<double, micro> us;
+
+    PRINT ( "Full apply: per color %.2f us; masked blend %.2f us",
+            us ( referenceTime ).count() / NUM_APPLY_ITERATIONS, us ( applyTime ).count() / NUM_APPLY_ITERATIONS );
+}
+
+#endif // NOT RELEASE
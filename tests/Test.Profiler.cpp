@@ -0,0 +1,231 @@
+#ifndef RELEASE
+
+#include "Profiler.hpp"
+#include "Logger.hpp"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+
+
+#define NUM_BENCH_SCOPES ( 1000000 )
+
+
+// Records scopes on its own thread, using Thread since the MinGW build has no std::thread
+class ProfiledThread : public Thread
+{
+public:
+
+    const uint32_t id;
+
+    ProfiledThread ( uint32_t id ) : id ( id ) {}
+
+    void run() override
+    {
+        for ( uint32_t i = 0; i < 100; ++i )
+        {
+            PROFILE_SCOPE ( ProfilePhase::SaveState, id * 1000 + i );
+        }
+    }
+};
+
+static size_t countSubstr ( const string& str, const string& sub )
+{
+    size_t count = 0;
+
+    for ( size_t pos = str.find ( sub ); pos != string::npos; pos = str.find ( sub, pos + 1 ) )
+        ++count;
+
+    return count;
+}
+
+
+TEST ( Profiler, Disabled )
+{
+    Profiler& profiler = Profiler::get();
+    profiler.disable();
+    profiler.clear();
+
+    {
+        PROFILE_SCOPE ( ProfilePhase::FrameStep, 1 );
+    }
+
+    profiler.record ( ProfilePhase::LoadState, 1, 2 );
+
+    EXPECT_TRUE ( profiler.getRecords().empty() );
+}
+
+TEST ( Profiler, NestedScopes )
+{
+    Profiler& profiler = Profiler::get();
+    profiler.enable();
+    profiler.clear();
+
+    {
+        PROFILE_SCOPE ( ProfilePhase::RerunStep, 10, 3 );
+        {
+            PROFILE_SCOPE ( ProfilePhase::RerunSounds, 10 );
+        }
+        {
+            PROFILE_SCOPE ( ProfilePhase::Inputs, 10 );
+        }
+    }
+
+    profiler.disable();
+
+    // Inner scopes finish first
+    const vector<Profiler::Record> records = profiler.getRecords();
+    ASSERT_EQ ( 3u, records.size() );
+
+    EXPECT_EQ ( ProfilePhase::RerunSounds, records[0].phase );
+    EXPECT_EQ ( ProfilePhase::Inputs, records[1].phase );
+    EXPECT_EQ ( ProfilePhase::RerunStep, records[2].phase );
+    EXPECT_EQ ( 10u, records[2].frame );
+    EXPECT_EQ ( 3u, records[2].depth );
+
+    for ( const Profiler::Record& record : records )
+        EXPECT_LE ( record.start, record.end );
+
+    EXPECT_LE ( records[2].start, records[0].start );
+    EXPECT_GE ( records[2].end, records[1].end );
+}
+
+TEST ( Profiler, RingBuffer )
+{
+    Profiler& profiler = Profiler::get();
+    profiler.enable();
+    profiler.clear();
+
+    // Only the newest records are kept
+    for ( uint32_t i = 0; i < PROFILER_BUFFER_SIZE + 10; ++i )
+        profiler.record ( ProfilePhase::FrameStep, i, i + 1, i );
+
+    profiler.disable();
+
+    const vector<Profiler::Record> records = profiler.getRecords();
+    ASSERT_EQ ( size_t ( PROFILER_BUFFER_SIZE ), records.size() );
+    EXPECT_EQ ( 10u, records.front().frame );
+    EXPECT_EQ ( PROFILER_BUFFER_SIZE + 9u, records.back().frame );
+}
+
+TEST ( Profiler, Threads )
+{
+    Profiler& profiler = Profiler::get();
+    profiler.enable();
+    profiler.clear();
+
+    vector<unique_ptr<ProfiledThread>> threads;
+
+    for ( uint32_t i = 1; i <= 3; ++i )
+    {
+        threads.emplace_back ( new ProfiledThread ( i ) );
+        threads.back()->start();
+    }
+
+    for ( const auto& thread : threads )
+        thread->join();
+
+    profiler.disable();
+
+    // Each thread has its own buffer, with its records in order
+    const vector<Profiler::Record> records = profiler.getRecords();
+    ASSERT_EQ ( 300u, records.size() );
+
+    for ( size_t i = 0; i < records.size(); i += 100 )
+    {
+        const uint32_t id = records[i].frame / 1000;
+
+        for ( uint32_t j = 0; j < 100; ++j )
+        {
+            EXPECT_EQ ( records[i].thread, records [ i + j ].thread );
+            EXPECT_EQ ( id * 1000 + j, records [ i + j ].frame );
+        }
+    }
+
+    EXPECT_NE ( records[0].thread, records[100].thread );
+    EXPECT_NE ( records[100].thread, records[200].thread );
+}
+
+TEST ( Profiler, AggregateAndTrace )
+{
+    vector<Profiler::Record> records;
+
+    // A 3 frame rollback: load, then 3 re-run steps, with the game simulating in between
+    records.push_back ( { 1000000, 1400000, 100, 3, ProfilePhase::LoadState, 0 } );
+    records.push_back ( { 1500000, 1510000, 100, 3, ProfilePhase::RerunStep, 0 } );
+    records.push_back ( { 2000000, 2012000, 101, 2, ProfilePhase::RerunStep, 0 } );
+    records.push_back ( { 2500000, 2014000, 102, 1, ProfilePhase::RerunStep, 0 } );
+    records.push_back ( { 1000000, 3000000, 103, 3, ProfilePhase::Rollback, 0 } );
+
+    const Profiler::PhaseHistograms phases = Profiler::aggregate ( records );
+
+    EXPECT_EQ ( 1u, phases [ size_t ( ProfilePhase::LoadState ) ].getNumSamples() );
+    EXPECT_EQ ( 400000u, phases [ size_t ( ProfilePhase::LoadState ) ].getMax() );
+
+    // The record that ends before it starts is ignored
+    EXPECT_EQ ( 2u, phases [ size_t ( ProfilePhase::RerunStep ) ].getNumSamples() );
+    EXPECT_EQ ( 12000u, phases [ size_t ( ProfilePhase::RerunStep ) ].getMax() );
+    EXPECT_EQ ( 0u, phases [ size_t ( ProfilePhase::SaveState ) ].getNumSamples() );
+
+    const string trace = Profiler::getChromeTrace ( records );
+
+    EXPECT_EQ ( 0u, trace.find ( "{\"traceEvents\":[" ) );
+    EXPECT_EQ ( records.size(), countSubstr ( trace, "\"ph\":\"X\"" ) );
+    EXPECT_NE ( string::npos, trace.find ( "\"name\":\"LoadState\",\"ph\":\"X\",\"pid\":1,\"tid\":0,\"ts\":0.000,"
+                                           "\"dur\":400.000,\"args\":{\"frame\":100,\"depth\":3}" ) );
+    EXPECT_NE ( string::npos, trace.find ( "\"name\":\"Rollback\"" ) );
+
+    const string file = "Test.Profiler.trace.json";
+    ASSERT_TRUE ( Profiler::writeChromeTrace ( records, file ) );
+
+    ifstream fin ( file.c_str(), ios::binary );
+    stringstream ss;
+    ss << fin.rdbuf();
+    fin.close();
+    remove ( file.c_str() );
+
+    EXPECT_EQ ( trace, ss.str() );
+
+    EXPECT_EQ ( "{\"traceEvents\":[\n],\"displayTimeUnit\":\"ns\"}\n", Profiler::getChromeTrace ( {} ) );
+}
+
+TEST ( Profiler, Overhead )
+{
+    Profiler& profiler = Profiler::get();
+    profiler.disable();
+    profiler.clear();
+
+    auto start = chrono::steady_clock::now();
+    for ( uint32_t i = 0; i < NUM_BENCH_SCOPES; ++i )
+    {
+        PROFILE_SCOPE ( ProfilePhase::FrameStep, i );
+    }
+    auto disabledTime = chrono::steady_clock::now() - start;
+
+    profiler.enable();
+
+    start = chrono::steady_clock::now();
+    for ( uint32_t i = 0; i < NUM_BENCH_SCOPES; ++i )
+    {
+        PROFILE_SCOPE ( ProfilePhase::FrameStep, i );
+    }
+    auto enabledTime = chrono::steady_clock::now() - start;
+
+    profiler.disable();
+
+    EXPECT_EQ ( size_t ( PROFILER_BUFFER_SIZE ), profiler.getRecords().size() );
+    profiler.clear();
+
+    typedef chrono::duration<double, nano> ns;
+
+    PRINT ( "Scope: disabled %.2f ns; enabled %.2f ns",
+            ns ( disabledTime ).count() / NUM_BENCH_SCOPES, ns ( enabledTime ).count() / NUM_BENCH_SCOPES );
+}
+
+#endif // NOT RELEASE
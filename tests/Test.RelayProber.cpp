@@ -0,0 +1,250 @@
+#ifndef RELEASE
+
+#include "RelayProber.hpp"
+#include "StringUtils.hpp"
+#include "Thread.hpp"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+
+using namespace std;
+
+
+#ifdef _WIN32
+typedef int socklen_t;
+#define CLOSE_SOCKET(FD) closesocket ( FD )
+#else
+typedef int SOCKET;
+#define CLOSE_SOCKET(FD) close ( FD )
+#endif
+
+#define FAST_DELAY          ( 5 )
+#define SLOW_DELAY          ( 60 )
+
+
+static double now()
+{
+    return chrono::duration_cast<chrono::microseconds> (
+               chrono::steady_clock::now().time_since_epoch() ).count() / 1000.0;
+}
+
+// Local UDP stand-in for a relay server, echoes pings after a delay, and drops some of them.
+// Loss is deterministic: the first numDropped of every 5 packets are dropped.
+class StandInRelay : public Thread
+{
+public:
+
+    uint16_t port = 0;
+
+    StandInRelay ( double delay, uint32_t numDropped, bool echo = true )
+        : _delay ( delay ), _numDropped ( numDropped ), _echo ( echo )
+    {
+        _fd = socket ( AF_INET, SOCK_DGRAM, IPPROTO_UDP );
+
+        sockaddr_in addr;
+        memset ( &addr, 0, sizeof ( addr ) );
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl ( INADDR_LOOPBACK );
+
+        bind ( _fd, ( sockaddr * ) &addr, sizeof ( addr ) );
+
+        socklen_t len = sizeof ( addr );
+        getsockname ( _fd, ( sockaddr * ) &addr, &len );
+        port = ntohs ( addr.sin_port );
+
+        start();
+    }
+
+    ~StandInRelay()
+    {
+        _stop = true;
+        join();
+        CLOSE_SOCKET ( _fd );
+    }
+
+    string getAddress() const { return format ( "127.0.0.1:%u", port ); }
+
+    void run() override
+    {
+        while ( !_stop )
+        {
+            // Send the delayed replies that are due
+            while ( !_pending.empty() && _pending.front().sendTime <= now() )
+            {
+                const Packet& packet = _pending.front();
+                sendto ( _fd, packet.data, packet.len, 0, ( sockaddr * ) &packet.from, sizeof ( packet.from ) );
+                _pending.pop_front();
+            }
+
+            fd_set readFds;
+            FD_ZERO ( &readFds );
+            FD_SET ( _fd, &readFds );
+
+            timeval tv = { 0, 1000 };
+
+            if ( select ( int ( _fd ) + 1, &readFds, 0, 0, &tv ) <= 0 )
+                continue;
+
+            Packet packet;
+            socklen_t fromLen = sizeof ( packet.from );
+            packet.len = recvfrom ( _fd, packet.data, sizeof ( packet.data ), 0, ( sockaddr * ) &packet.from, &fromLen );
+
+            if ( packet.len <= 0 || !_echo || ( _count++ % 5 ) < _numDropped )
+                continue;
+
+            packet.sendTime = now() + _delay;
+            _pending.push_back ( packet );
+        }
+    }
+
+private:
+
+    struct Packet
+    {
+        char data[64];
+        int len;
+        sockaddr_in from;
+        double sendTime;
+    };
+
+    SOCKET _fd;
+
+    const double _delay;
+
+    const uint32_t _numDropped;
+
+    const bool _echo;
+
+    uint32_t _count = 0;
+
+    deque<Packet> _pending;
+
+    atomic<bool> _stop { false };
+};
+
+
+TEST ( RelayProber, RankByRttAndLoss )
+{
+    StandInRelay fast ( FAST_DELAY, 0 ), slow ( SLOW_DELAY, 0 ), lossy ( FAST_DELAY, 3 ), dead ( 0, 0, false );
+
+    // Listed worst first, with a relay that can't be resolved
+    const vector<string> relays =
+    {
+        dead.getAddress(), "no-port", lossy.getAddress(), slow.getAddress(), fast.getAddress()
+    };
+
+    RelayProber prober;
+    prober.numProbes = 5;
+    prober.timeout = 500;
+
+    const double start = now();
+    vector<RelayProber::Result> results = prober.probe ( relays );
+    const double elapsed = now() - start;
+
+    // Everything is probed concurrently, so the dead relay doesn't add up on top of the others
+    EXPECT_LT ( elapsed, prober.timeout + 200.0 );
+
+    ASSERT_EQ ( relays.size(), results.size() );
+
+    for ( size_t i = 0; i < relays.size(); ++i )
+        EXPECT_EQ ( relays[i], results[i].relay );
+
+    EXPECT_FALSE ( results[0].isReachable() );
+    EXPECT_EQ ( 5u, results[0].sent );
+    EXPECT_FALSE ( results[1].isReachable() );
+    EXPECT_TRUE ( results[1].resolved.empty() );
+
+    EXPECT_EQ ( 2u, results[2].received );
+    EXPECT_NEAR ( 0.6, results[2].getLoss(), 0.01 );
+
+    EXPECT_EQ ( 5u, results[3].received );
+    EXPECT_GE ( results[3].rtt, SLOW_DELAY );
+
+    EXPECT_EQ ( 5u, results[4].received );
+    EXPECT_GE ( results[4].rtt, FAST_DELAY );
+    EXPECT_LT ( results[4].rtt, SLOW_DELAY );
+    EXPECT_EQ ( fast.getAddress(), results[4].resolved );
+
+    // Loss costs more than the slow relay's extra latency
+    RelayProber::rank ( results );
+
+    EXPECT_EQ ( fast.getAddress(), results[0].relay );
+    EXPECT_EQ ( slow.getAddress(), results[1].relay );
+    EXPECT_EQ ( lossy.getAddress(), results[2].relay );
+    EXPECT_EQ ( dead.getAddress(), results[3].relay );
+    EXPECT_EQ ( "no-port", results[4].relay );
+
+    // Fast failover for reachable relays, the default timeout otherwise
+    EXPECT_EQ ( uint64_t ( RELAY_MIN_TIMEOUT ), results[0].getConnectTimeout() );
+    EXPECT_EQ ( 0u, results[3].getConnectTimeout() );
+}
+
+TEST ( RelayProber, Cache )
+{
+    StandInRelay fast ( FAST_DELAY, 0 ), slow ( SLOW_DELAY, 0 );
+
+    RelayProber prober;
+    prober.timeout = 500;
+
+    vector<RelayProber::Result> results = prober.probe ( { slow.getAddress(), fast.getAddress(), "no-port" } );
+    RelayProber::rank ( results );
+
+    const string file = "Test.RelayProber.txt";
+
+    ASSERT_TRUE ( RelayProber::save ( file, results ) );
+
+    vector<RelayProber::Result> cached;
+    ASSERT_TRUE ( RelayProber::load ( file, cached ) );
+    ASSERT_EQ ( results.size(), cached.size() );
+
+    for ( size_t i = 0; i < results.size(); ++i )
+    {
+        EXPECT_EQ ( results[i].relay, cached[i].relay );
+        EXPECT_EQ ( results[i].resolved, cached[i].resolved );
+        EXPECT_EQ ( results[i].received, cached[i].received );
+        EXPECT_NEAR ( results[i].rtt, cached[i].rtt, 0.01 );
+    }
+
+    // The next session uses the cached ranking before probing again, new relays go before unreachable ones
+    const vector<RelayProber::Result> ordered =
+        RelayProber::order ( { "no-port", "new:3939", slow.getAddress(), fast.getAddress() }, cached );
+
+    ASSERT_EQ ( 4u, ordered.size() );
+    EXPECT_EQ ( fast.getAddress(), ordered[0].relay );
+    EXPECT_EQ ( slow.getAddress(), ordered[1].relay );
+    EXPECT_EQ ( "new:3939", ordered[2].relay );
+    EXPECT_EQ ( "no-port", ordered[3].relay );
+
+    // The cached address isn't trusted, since it may have changed
+    EXPECT_TRUE ( ordered[0].resolved.empty() );
+
+    // Corrupt caches are ignored
+    FILE *fp = fopen ( file.c_str(), "w" );
+    ASSERT_TRUE ( fp != 0 );
+    fputs ( "relay:1 - 5 6 1.0\n", fp );
+    fclose ( fp );
+
+    EXPECT_FALSE ( RelayProber::load ( file, cached ) );
+    EXPECT_TRUE ( cached.empty() );
+
+    remove ( file.c_str() );
+}
+
+#endif // NOT RELEASE
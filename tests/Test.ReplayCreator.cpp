@@ -0,0 +1,215 @@
+#ifndef RELEASE
+
+#include "ReplayCreator.hpp"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+#define NUM_LARGE_ROUNDS    ( 200 )
+#define NUM_LARGE_INPUTS    ( 20000 )
+
+
+static ReplayCreator::ReplayFile generateReplay ( int numRounds, int numInputs, int seed )
+{
+    srand ( seed );
+
+    ReplayCreator::ReplayFile rf;
+    memset ( ( void * ) &rf, 0, REPLAY_HEADER_SIZE );
+    memcpy ( rf.headername, FILE_HEADER, sizeof ( rf.headername ) );
+    rf.year = 2026;
+    rf.numPlayers = 2;
+    rf.numWins = 2;
+    rf.p1.character = rand() % 32;
+    rf.p2.character = rand() % 32;
+    rf.numRounds = numRounds;
+    rf.rounds.resize ( numRounds );
+
+    for ( ReplayCreator::Round& round : rf.rounds )
+    {
+        for ( size_t i = 0; i < REPLAY_ROUND_HEAD_SIZE; ++i )
+            ( ( char * ) &round ) [i] = rand();
+
+        vector<ReplayCreator::Input> *inputs[] = { &round.p1Inputs, &round.p2Inputs, &round.p3Inputs, &round.p4Inputs };
+
+        for ( auto *list : inputs )
+        {
+            // p3/p4 are usually empty
+            const int count = ( list == &round.p3Inputs || list == &round.p4Inputs ) ? rand() % 3 : numInputs;
+
+            for ( int i = 0; i < count; ++i )
+            {
+                ReplayCreator::Input in;
+                in.duration = rand();
+                in.direction = rand() % 10;
+                in.buttonHold = rand() % 32;
+                in.buttonDown = rand() % 32;
+                in.buttonUp = rand() % 32;
+                in.button4 = 0;
+                list->push_back ( in );
+            }
+        }
+
+        for ( int i = 0; i < numInputs / 4; ++i )
+            round.rngstates.push_back ( rand() );
+
+        round.lenp1Inputs = round.p1Inputs.size();
+        round.lenp2Inputs = round.p2Inputs.size();
+        round.lenp3Inputs = round.p3Inputs.size();
+        round.lenp4Inputs = round.p4Inputs.size();
+        round.lenRng = round.rngstates.size();
+
+        char tail[REPLAY_ROUND_TAIL_SIZE];
+        for ( char& c : tail )
+            c = rand();
+        memcpy ( round.nine, tail, sizeof ( tail ) );
+    }
+
+    return rf;
+}
+
+// Element-wise writer, the same way the game lays out the file
+static string referenceDump ( const ReplayCreator::ReplayFile& rf )
+{
+    string out ( ( const char * ) &rf, REPLAY_HEADER_SIZE );
+
+    for ( const ReplayCreator::Round& round : rf.rounds )
+    {
+        out.append ( ( const char * ) &round, REPLAY_ROUND_HEAD_SIZE );
+
+        const vector<ReplayCreator::Input> *inputs[] = { &round.p1Inputs, &round.p2Inputs, &round.p3Inputs, &round.p4Inputs };
+
+        for ( const auto *list : inputs )
+        {
+            const int count = list->size();
+            out.append ( ( const char * ) &count, 4 );
+
+            for ( const ReplayCreator::Input& in : *list )
+            {
+                out += char ( in.duration );
+                out += char ( in.direction );
+                out += char ( in.buttonHold );
+                out += char ( in.buttonDown );
+                out += char ( in.buttonUp );
+                out += char ( in.button4 );
+            }
+        }
+
+        out.append ( ( const char * ) &round.lenRng, 4 );
+        for ( uint32_t rng : round.rngstates )
+            out.append ( ( const char * ) &rng, 4 );
+
+        out.append ( round.nine, REPLAY_ROUND_TAIL_SIZE );
+    }
+
+    return out;
+}
+
+static void expectSameReplay ( const ReplayCreator::ReplayFile& a, const ReplayCreator::ReplayFile& b )
+{
+    EXPECT_EQ ( 0, memcmp ( &a, &b, REPLAY_HEADER_SIZE ) );
+    ASSERT_EQ ( a.rounds.size(), b.rounds.size() );
+
+    for ( size_t i = 0; i < a.rounds.size(); ++i )
+    {
+        EXPECT_EQ ( 0, memcmp ( &a.rounds[i], &b.rounds[i], REPLAY_ROUND_HEAD_SIZE ) );
+        EXPECT_TRUE ( a.rounds[i].p1Inputs == b.rounds[i].p1Inputs );
+        EXPECT_TRUE ( a.rounds[i].p2Inputs == b.rounds[i].p2Inputs );
+        EXPECT_TRUE ( a.rounds[i].p3Inputs == b.rounds[i].p3Inputs );
+        EXPECT_TRUE ( a.rounds[i].p4Inputs == b.rounds[i].p4Inputs );
+        EXPECT_TRUE ( a.rounds[i].rngstates == b.rounds[i].rngstates );
+        EXPECT_EQ ( 0, memcmp ( a.rounds[i].nine, b.rounds[i].nine, REPLAY_ROUND_TAIL_SIZE ) );
+    }
+}
+
+
+TEST ( ReplayCreator, RoundTrip )
+{
+    ReplayCreator rc;
+    ReplayCreator::ReplayFile rf = generateReplay ( 5, 1000, 1 );
+
+    string bytes;
+    rc.dumpToBuffer ( rf, bytes );
+    EXPECT_EQ ( referenceDump ( rf ), bytes );
+
+    ReplayCreator::ReplayFile loaded;
+    EXPECT_TRUE ( rc.loadFromBuffer ( &loaded, bytes.data(), bytes.size() ) );
+    expectSameReplay ( rf, loaded );
+}
+
+TEST ( ReplayCreator, RoundTripFile )
+{
+    ReplayCreator rc;
+    ReplayCreator::ReplayFile rf = generateReplay ( 3, 500, 2 );
+
+    const string fname = "test_replay_roundtrip.rep";
+    rc.dump ( rf, fname.c_str() );
+
+    ReplayCreator::ReplayFile loaded;
+    EXPECT_TRUE ( rc.load ( &loaded, fname.c_str() ) );
+    expectSameReplay ( rf, loaded );
+
+    remove ( fname.c_str() );
+}
+
+TEST ( ReplayCreator, RejectTruncated )
+{
+    ReplayCreator rc;
+    ReplayCreator::ReplayFile rf = generateReplay ( 2, 100, 3 );
+
+    string bytes;
+    rc.dumpToBuffer ( rf, bytes );
+
+    for ( size_t len : { size_t ( 0 ), size_t ( REPLAY_HEADER_SIZE - 1 ), size_t ( REPLAY_HEADER_SIZE + 10 ),
+                         bytes.size() / 2, bytes.size() - 1 } )
+    {
+        ReplayCreator::ReplayFile loaded;
+        EXPECT_FALSE ( rc.loadFromBuffer ( &loaded, bytes.data(), len ) );
+    }
+
+    // Corrupt length field of the first p1 inputs list
+    const int bogus = 0x7FFFFFFF;
+    memcpy ( &bytes [ REPLAY_HEADER_SIZE + REPLAY_ROUND_HEAD_SIZE ], &bogus, 4 );
+
+    ReplayCreator::ReplayFile loaded;
+    EXPECT_FALSE ( rc.loadFromBuffer ( &loaded, bytes.data(), bytes.size() ) );
+}
+
+TEST ( ReplayCreator, LargeReplayPerf )
+{
+    ReplayCreator rc;
+    ReplayCreator::ReplayFile rf = generateReplay ( NUM_LARGE_ROUNDS, NUM_LARGE_INPUTS, 4 );
+
+    auto start = chrono::steady_clock::now();
+    const string reference = referenceDump ( rf );
+    auto refDumpTime = chrono::steady_clock::now() - start;
+
+    string bytes;
+    start = chrono::steady_clock::now();
+    rc.dumpToBuffer ( rf, bytes );
+    auto dumpTime = chrono::steady_clock::now() - start;
+
+    ASSERT_EQ ( reference, bytes );
+
+    ReplayCreator::ReplayFile loaded;
+    start = chrono::steady_clock::now();
+    EXPECT_TRUE ( rc.loadFromBuffer ( &loaded, bytes.data(), bytes.size() ) );
+    auto loadTime = chrono::steady_clock::now() - start;
+
+    expectSameReplay ( rf, loaded );
+
+    typedef chrono::duration<double, milli> ms;
+
+    PRINT ( "%u bytes; element-wise dump %.2f ms; bulk dump %.2f ms; bulk load %.2f ms",
+            ( uint32_t ) bytes.size(), ms ( refDumpTime ).count(), ms ( dumpTime ).count(), ms ( loadTime ).count() );
+}
+
+#endif // NOT RELEASE
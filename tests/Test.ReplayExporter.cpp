@@ -0,0 +1,182 @@
+#ifndef RELEASE
+
+#include "ReplayExporter.hpp"
+#include "StringUtils.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+
+static string readAll ( const string& path )
+{
+    ifstream file ( path.c_str(), ios::binary );
+    stringstream ss;
+    ss << file.rdbuf();
+    return ss.str();
+}
+
+static shared_ptr<ReplayExporter::InputsSnapshot> generateSnapshot ( const string& path, size_t frames )
+{
+    shared_ptr<ReplayExporter::InputsSnapshot> snapshot ( new ReplayExporter::InputsSnapshot() );
+    snapshot->rawPath = path;
+
+    for ( size_t r = 0; r < 3; ++r )
+    {
+        snapshot->rounds.push_back ( {} );
+
+        for ( size_t i = 0; i < frames; ++i )
+            snapshot->rounds.back().push_back ( { uint16_t ( rand() ), uint16_t ( rand() ) } );
+    }
+
+    return snapshot;
+}
+
+
+TEST ( ReplayExporter, RawInputsFormat )
+{
+    shared_ptr<ReplayExporter::InputsSnapshot> snapshot = generateSnapshot ( "", 100 );
+
+    // Same output as the old per-frame sprintf path
+    char buf[64];
+    snprintf ( buf, sizeof ( buf ), "%d\n", int ( snapshot->rounds.size() ) );
+    string expected = buf;
+
+    for ( const auto& round : snapshot->rounds )
+    {
+        snprintf ( buf, sizeof ( buf ), "%d\n", int ( round.size() ) );
+        expected += buf;
+
+        for ( const auto& inputs : round )
+        {
+            snprintf ( buf, sizeof ( buf ), "%04x %04x\n", inputs.first, inputs.second );
+            expected += buf;
+        }
+    }
+
+    string text;
+    ReplayExporter::formatRawInputs ( *snapshot, text );
+    EXPECT_EQ ( expected, text );
+
+    string packed, unpacked;
+    EXPECT_TRUE ( ReplayExporter::packRawInputs ( text, packed ) );
+    EXPECT_LT ( packed.size(), text.size() );
+    EXPECT_TRUE ( ReplayExporter::unpackRawInputs ( packed, unpacked ) );
+    EXPECT_EQ ( text, unpacked );
+
+    EXPECT_FALSE ( ReplayExporter::unpackRawInputs ( text, unpacked ) );
+}
+
+TEST ( ReplayExporter, BackgroundExport )
+{
+    const string rawPath = "test_export.repraw";
+    const string resultsPath = "test_export_results.csv";
+    remove ( resultsPath.c_str() );
+
+    shared_ptr<ReplayExporter::InputsSnapshot> snapshot = generateSnapshot ( rawPath, 5000 );
+
+    string expected;
+    ReplayExporter::formatRawInputs ( *snapshot, expected );
+
+    {
+        ReplayExporter exporter;
+        exporter.exportInputs ( snapshot );
+
+        for ( int i = 0; i < 100; ++i )
+            exporter.exportResult ( resultsPath, format ( "line,%d", i ) );
+
+        exporter.flush();
+
+        ReplayExporter::Status status;
+        size_t numInputs = 0, numResults = 0;
+
+        while ( exporter.popCompleted ( status ) )
+        {
+            EXPECT_TRUE ( status.success );
+
+            if ( status.type == ReplayExporter::Status::Inputs )
+            {
+                EXPECT_EQ ( rawPath, status.path );
+                ++numInputs;
+            }
+            else
+            {
+                EXPECT_EQ ( resultsPath, status.path );
+                ++numResults;
+            }
+        }
+
+        EXPECT_EQ ( 1u, numInputs );
+
+        // Results are batched, so there are at most as many writes as lines
+        EXPECT_GE ( numResults, 1u );
+        EXPECT_LE ( numResults, 100u );
+
+        exporter.compressRaw = true;
+        exporter.exportInputs ( snapshot );
+    }
+
+    EXPECT_EQ ( expected, readAll ( rawPath ) );
+
+    string unpacked;
+    EXPECT_TRUE ( ReplayExporter::unpackRawInputs ( readAll ( rawPath + ".z" ), unpacked ) );
+    EXPECT_EQ ( expected, unpacked );
+
+    string lines;
+    for ( int i = 0; i < 100; ++i )
+        lines += format ( "line,%d\n", i );
+    EXPECT_EQ ( lines, readAll ( resultsPath ) );
+
+    remove ( rawPath.c_str() );
+    remove ( ( rawPath + ".z" ).c_str() );
+    remove ( resultsPath.c_str() );
+}
+
+TEST ( ReplayExporter, DropsStatusesWhenFull )
+{
+    const string resultsPath = "test_export_dropped.csv";
+    remove ( resultsPath.c_str() );
+
+    {
+        ReplayExporter exporter;
+
+        // Flushing after each line makes every line a separate write with its own status, and nothing pops them
+        for ( int i = 0; i < 300; ++i )
+        {
+            exporter.exportResult ( resultsPath, format ( "line,%d", i ) );
+            exporter.flush();
+        }
+
+        EXPECT_EQ ( 300u - 256u, exporter.getNumDropped() );
+
+        ReplayExporter::Status status;
+        size_t numResults = 0;
+
+        while ( exporter.popCompleted ( status ) )
+            ++numResults;
+
+        EXPECT_EQ ( 256u, numResults );
+
+        // There is room again
+        exporter.exportResult ( resultsPath, "last" );
+        exporter.flush();
+
+        EXPECT_TRUE ( exporter.popCompleted ( status ) );
+        EXPECT_EQ ( 300u - 256u, exporter.getNumDropped() );
+    }
+
+    string lines;
+    for ( int i = 0; i < 300; ++i )
+        lines += format ( "line,%d\n", i );
+    EXPECT_EQ ( lines + "last\n", readAll ( resultsPath ) );
+
+    remove ( resultsPath.c_str() );
+}
+
+#endif // NOT RELEASE
@@ -0,0 +1,249 @@
+#ifndef RELEASE
+
+#include "ReplayIndex.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+
+#define STATE_SIZE          ( 4 * 1024 )
+#define NUM_INDICES         ( 3 )
+#define NUM_FRAMES          ( 2000 )
+#define INTERVAL            ( 120 )
+#define NUM_SEEKS           ( 300 )
+
+
+// Same layout as IndexedFrame::value
+static uint64_t indexedFrame ( uint32_t index, uint32_t frame )
+{
+    return ( uint64_t ( index ) << 32 ) | frame;
+}
+
+// Synthetic replay: a deterministic simulation driven by a recorded input stream for each index
+struct Replay
+{
+    vector<vector<uint16_t>> inputs;
+
+    Replay() : inputs ( NUM_INDICES )
+    {
+        for ( auto& stream : inputs )
+            for ( uint32_t i = 0; i < NUM_FRAMES; ++i )
+                stream.push_back ( rand() );
+    }
+
+    // Initial state at the start of each index
+    static vector<char> initial ( uint32_t index )
+    {
+        vector<char> state ( STATE_SIZE );
+        state[0] = index;
+        return state;
+    }
+
+    void step ( vector<char>& state, uint32_t index, uint32_t frame ) const
+    {
+        const uint16_t input = inputs[index][frame];
+
+        for ( size_t i = 0; i < 64; ++i )
+            state [ ( input * 7 + i * 61 ) % STATE_SIZE ] += char ( input >> ( i % 8 ) );
+
+        state [ frame % STATE_SIZE ] ^= char ( index + 1 );
+    }
+};
+
+// Player that tracks the current frame and how many frames were simulated
+struct Player
+{
+    const Replay& replay;
+
+    ReplayIndex& index;
+
+    vector<char> state;
+
+    uint32_t currentIndex = 0, currentFrame = 0, numSimulated = 0;
+
+    // Furthest frame played, the index has keyframes up to here
+    uint64_t furthest = 0;
+
+    Player ( const Replay& replay, ReplayIndex& index )
+        : replay ( replay ), index ( index ), state ( Replay::initial ( 0 ) ) {}
+
+    uint64_t current() const { return indexedFrame ( currentIndex, currentFrame ); }
+
+    // Play one frame, recording keyframes like DllMain does for the saved rollback states
+    void play()
+    {
+        if ( index.shouldRecord ( current() ) )
+            index.record ( current(), state );
+
+        replay.step ( state, currentIndex, currentFrame );
+        ++numSimulated;
+
+        furthest = max ( furthest, current() );
+
+        if ( ++currentFrame == NUM_FRAMES )
+        {
+            ++currentIndex;
+            currentFrame = 0;
+            state = Replay::initial ( currentIndex );
+        }
+    }
+
+    bool seek ( uint32_t targetIndex, uint32_t targetFrame )
+    {
+        const uint64_t target = indexedFrame ( targetIndex, targetFrame );
+
+        uint64_t keyframe = 0;
+
+        switch ( index.plan ( current(), target, keyframe ) )
+        {
+            case ReplayIndex::SeekRestore:
+                if ( !index.restore ( keyframe, state ) )
+                    return false;
+
+                currentIndex = uint32_t ( keyframe >> 32 );
+                currentFrame = uint32_t ( keyframe );
+                break;
+
+            case ReplayIndex::SeekForward:
+                break;
+
+            default:
+                return false;
+        }
+
+        numSimulated = 0;
+
+        while ( current() < target )
+            play();
+
+        return true;
+    }
+};
+
+
+TEST ( ReplayIndex, SeekMatchesPlayback )
+{
+    Replay replay;
+    ReplayIndex index ( INTERVAL );
+    index.clear ( 1 );
+
+    // Play the whole replay once to get the expected states
+    vector<vector<vector<char>>> expected ( NUM_INDICES );
+
+    {
+        ReplayIndex unused ( INTERVAL );
+        Player player ( replay, unused );
+
+        while ( player.currentIndex < NUM_INDICES )
+        {
+            expected[player.currentIndex].push_back ( player.state );
+            player.play();
+        }
+    }
+
+    // The index is built lazily, so only the first half of the replay has keyframes at the start
+    Player player ( replay, index );
+
+    while ( player.currentIndex < NUM_INDICES / 2 + 1 || player.currentFrame < NUM_FRAMES / 2 )
+        player.play();
+
+    for ( int i = 0; i < NUM_SEEKS; ++i )
+    {
+        const uint32_t targetIndex = rand() % NUM_INDICES;
+        const uint32_t targetFrame = rand() % NUM_FRAMES;
+
+        const uint64_t before = player.current();
+        const uint64_t target = indexedFrame ( targetIndex, targetFrame );
+        const bool indexed = ( target <= player.furthest );
+
+        // Seeking backwards without a keyframe in the target index is not possible
+        if ( !player.seek ( targetIndex, targetFrame ) )
+        {
+            EXPECT_LT ( target, before );
+            continue;
+        }
+
+        ASSERT_EQ ( target, player.current() );
+        ASSERT_TRUE ( player.state == expected[targetIndex][targetFrame] );
+
+        // Seeking within the indexed part costs at most one keyframe interval of simulation
+        if ( indexed && ( target < before || ( before >> 32 ) != targetIndex ) )
+        {
+            EXPECT_LE ( player.numSimulated, ( uint32_t ) INTERVAL );
+        }
+    }
+
+    // Stepping back one frame at a time
+    for ( int i = 0; i < 10 && player.currentFrame > 0; ++i )
+    {
+        const uint32_t targetIndex = player.currentIndex, targetFrame = player.currentFrame - 1;
+
+        ASSERT_TRUE ( player.seek ( targetIndex, targetFrame ) );
+        EXPECT_TRUE ( player.state == expected[targetIndex][targetFrame] );
+        EXPECT_LE ( player.numSimulated, ( uint32_t ) INTERVAL );
+    }
+
+    EXPECT_LE ( index.getNumKeyframes(), ( size_t ) NUM_INDICES * ( NUM_FRAMES / INTERVAL + 1 ) );
+}
+
+TEST ( ReplayIndex, SaveLoad )
+{
+    Replay replay;
+    ReplayIndex index ( INTERVAL );
+    index.clear ( 1234 );
+
+    Player player ( replay, index );
+
+    while ( player.currentIndex < NUM_INDICES )
+        player.play();
+
+    const string file = "Test.ReplayIndex.index";
+
+    ASSERT_TRUE ( index.save ( file ) );
+
+    // A different memory layout invalidates the index
+    ReplayIndex other ( INTERVAL );
+    EXPECT_FALSE ( other.load ( file, 4321 ) );
+    EXPECT_EQ ( 0u, other.getNumKeyframes() );
+
+    ASSERT_TRUE ( other.load ( file, 1234 ) );
+    EXPECT_EQ ( index.getNumKeyframes(), other.getNumKeyframes() );
+
+    vector<char> a, b;
+
+    for ( uint32_t i = 0; i < NUM_INDICES; ++i )
+    {
+        for ( uint32_t frame = 0; frame < NUM_FRAMES; frame += INTERVAL )
+        {
+            ASSERT_TRUE ( index.restore ( indexedFrame ( i, frame ), a ) );
+            ASSERT_TRUE ( other.restore ( indexedFrame ( i, frame ), b ) );
+            EXPECT_TRUE ( a == b );
+        }
+    }
+
+    // Truncated files are rejected
+    FILE *fp = fopen ( file.c_str(), "rb" );
+    ASSERT_TRUE ( fp != 0 );
+    vector<char> data ( 1024 * 1024 );
+    data.resize ( fread ( &data[0], 1, data.size(), fp ) );
+    fclose ( fp );
+
+    fp = fopen ( file.c_str(), "wb" );
+    ASSERT_TRUE ( fp != 0 );
+    fwrite ( &data[0], data.size() - 10, 1, fp );
+    fclose ( fp );
+
+    EXPECT_FALSE ( other.load ( file, 1234 ) );
+    EXPECT_EQ ( 0u, other.getNumKeyframes() );
+
+    remove ( file.c_str() );
+}
+
+#endif // NOT RELEASE
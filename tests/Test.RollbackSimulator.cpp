@@ -0,0 +1,153 @@
+#ifndef RELEASE
+
+#include "RollbackSimulator.hpp"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+
+#define NUM_FRAMES          ( 1200 )
+#define DESYNC_FRAME        ( 500 )
+
+
+static uint64_t hashState ( FakeGame& game )
+{
+    MemDumpList list = game.getMemDumpList();
+
+    MemDumpPlan plan;
+    plan.compile ( list );
+
+    vector<char> dump ( plan.totalSize ), slots;
+    vector<uint64_t> hashes ( plan.getNumRegions() + list.slots.size() );
+
+    plan.saveDump ( &dump[0], &hashes[0] );
+
+    for ( size_t i = 0; i < list.slots.size(); ++i )
+        list.slots[i].saveDump ( slots, &hashes [ plan.getNumRegions() + i ] );
+
+    return DesyncDetector::combine ( hashes );
+}
+
+static void stepGame ( FakeGame& game, uint32_t frame )
+{
+    const uint16_t inputs[2] = { uint16_t ( ( frame / 7 ) % 0x40 ), uint16_t ( ( frame / 11 ) % 0x40 ) };
+    game.step ( inputs );
+}
+
+
+TEST ( RollbackSimulator, FakeGameSaveLoad )
+{
+    unique_ptr<FakeGame> gameA ( new FakeGame() ), gameB ( new FakeGame() );
+    FakeGame& a = *gameA, & b = *gameB;
+
+    MemDumpList list = a.getMemDumpList();
+
+    MemDumpPlan plan;
+    plan.compile ( list );
+
+    vector<char> dump ( plan.totalSize ), slots;
+
+    for ( uint32_t frame = 0; frame < 100; ++frame )
+    {
+        stepGame ( a, frame );
+        stepGame ( b, frame );
+    }
+
+    // Same inputs give the same state, even though the camera pointers differ
+    const uint64_t saved = hashState ( a );
+    EXPECT_EQ ( saved, hashState ( b ) );
+
+    plan.saveDump ( &dump[0] );
+
+    for ( const MemDumpSlots& array : list.slots )
+        array.saveDump ( slots );
+
+    for ( uint32_t frame = 100; frame < 200; ++frame )
+        stepGame ( a, frame );
+
+    EXPECT_NE ( saved, hashState ( a ) );
+
+    // Loading restores the state exactly, including the memory behind the pointer and the effect slots
+    plan.loadDump ( &dump[0] );
+
+    const char *slotDump = slots.data();
+
+    for ( const MemDumpSlots& array : list.slots )
+        array.loadDump ( slotDump );
+
+    EXPECT_EQ ( saved, hashState ( a ) );
+
+    slotDump = slots.data();
+
+    for ( const MemDumpSlots& array : list.slots )
+        EXPECT_EQ ( 0u, array.countMismatchedSlots ( slotDump ) );
+}
+
+TEST ( RollbackSimulator, PerfectLink )
+{
+    RollbackSimulator::Config config;
+    config.frames = NUM_FRAMES;
+    config.inputDelay = 4;
+    config.latency = 30;
+    config.jitter = 0;
+    config.loss = 0;
+
+    const RollbackSimulator::Stats stats = RollbackSimulator ( config ).run();
+
+    // Inputs always arrive within the input delay, so nothing is predicted
+    EXPECT_EQ ( uint32_t ( NUM_FRAMES ), stats.frames );
+    EXPECT_EQ ( 0u, stats.rollbacks );
+    EXPECT_EQ ( 0u, stats.packetsLost );
+    EXPECT_FALSE ( stats.desynced );
+    EXPECT_TRUE ( stats.statesMatch );
+}
+
+TEST ( RollbackSimulator, LossyLink )
+{
+    RollbackSimulator::Config config;
+    config.frames = NUM_FRAMES;
+    config.inputDelay = 1;
+    config.latency = 60;
+    config.jitter = 40;
+    config.loss = 0.2;
+
+    const RollbackSimulator::Stats stats = RollbackSimulator ( config ).run();
+
+    EXPECT_EQ ( uint32_t ( NUM_FRAMES ), stats.frames );
+    EXPECT_GT ( stats.rollbacks, 0u );
+    EXPECT_GE ( stats.resimulatedFrames, stats.rollbacks );
+    EXPECT_LE ( stats.maxRollbackDepth, config.maxRollback );
+    EXPECT_EQ ( stats.rollbacks, stats.loads );
+    EXPECT_GT ( stats.packetsLost, 0u );
+
+    // Rolling back and re-running converges on the same state on both sides
+    EXPECT_FALSE ( stats.desynced );
+    EXPECT_TRUE ( stats.statesMatch );
+
+    // Same seed, same run
+    const RollbackSimulator::Stats again = RollbackSimulator ( config ).run();
+
+    EXPECT_EQ ( stats.rollbacks, again.rollbacks );
+    EXPECT_EQ ( stats.resimulatedFrames, again.resimulatedFrames );
+}
+
+TEST ( RollbackSimulator, DetectsDesync )
+{
+    RollbackSimulator::Config config;
+    config.frames = NUM_FRAMES;
+    config.desyncFrame = DESYNC_FRAME;
+
+    const RollbackSimulator::Stats stats = RollbackSimulator ( config ).run();
+
+    // The state saved at the start of the next frame is the first one that differs, in the world region
+    EXPECT_TRUE ( stats.desynced );
+    EXPECT_EQ ( uint64_t ( DESYNC_FRAME + 1 ), stats.desyncFrame );
+    EXPECT_EQ ( 0, stats.desyncRegion );
+    EXPECT_FALSE ( stats.statesMatch );
+}
+
+#endif // NOT RELEASE
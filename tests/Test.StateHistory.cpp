@@ -0,0 +1,256 @@
+#ifndef RELEASE
+
+#include "StateHistory.hpp"
+#include "Logger.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+
+#define FIXED_SIZE          ( 12 * 1024 )
+#define SLOT_SIZE           ( 0x33C )
+#define MAX_SLOTS           ( 64 )
+#define NUM_STATES          ( 1200 )
+#define NUM_RESTORES        ( 500 )
+
+
+// Recorded game states: a fixed block where a few hundred bytes change each frame, followed by the effects in use,
+// which appear and disappear over time so the state size changes.
+struct StateRecorder
+{
+    vector<char> fixed;
+
+    vector<vector<char>> slots;
+
+    StateRecorder() : fixed ( FIXED_SIZE )
+    {
+        for ( char& c : fixed )
+            c = ( rand() % 4 ) ? 0 : rand();
+    }
+
+    vector<char> step ( uint32_t frame )
+    {
+        // Timers, positions and inputs
+        for ( size_t i = 0; i < 0x100; ++i )
+            fixed [ ( i * 37 ) % FIXED_SIZE ] += ( i % 3 ) + 1;
+
+        for ( size_t i = 0; i < 8; ++i )
+            fixed [ rand() % FIXED_SIZE ] = rand();
+
+        // Effects are mostly zero, with a few fields set
+        if ( slots.size() < MAX_SLOTS && frame % 5 == 0 )
+        {
+            slots.push_back ( vector<char> ( SLOT_SIZE ) );
+
+            for ( size_t i = 0; i < SLOT_SIZE; i += 16 )
+                slots.back() [i] = rand() % 4;
+
+            for ( size_t i = 0; i < 16; ++i )
+                slots.back() [ rand() % SLOT_SIZE ] = rand();
+        }
+
+        if ( !slots.empty() && frame % 7 == 0 )
+            slots.erase ( slots.begin() + rand() % slots.size() );
+
+        for ( vector<char>& slot : slots )
+            ++slot[0x10];
+
+        vector<char> state = fixed;
+
+        for ( const vector<char>& slot : slots )
+            state.insert ( state.end(), slot.begin(), slot.end() );
+
+        return state;
+    }
+};
+
+
+TEST ( StateHistory, RestoreMatches )
+{
+    StateRecorder recorder;
+    StateHistory history ( 64 * 1024 * 1024, 30 );
+
+    vector<vector<char>> states;
+
+    for ( uint32_t i = 0; i < NUM_STATES; ++i )
+    {
+        states.push_back ( recorder.step ( i ) );
+
+        vector<char> buffer = history.getBuffer();
+        buffer = states.back();
+
+        // Ids are even so odd ids restore the previous state
+        history.push ( 2 * i + 100, move ( buffer ) );
+    }
+
+    // Restoring before everything is compressed must also work
+    vector<char> state;
+    uint64_t id = 0;
+
+    ASSERT_TRUE ( history.restore ( 2 * ( NUM_STATES - 1 ) + 100, state, id ) );
+    EXPECT_EQ ( 2u * ( NUM_STATES - 1 ) + 100, id );
+    EXPECT_TRUE ( state == states.back() );
+
+    history.flush();
+
+    EXPECT_EQ ( ( size_t ) NUM_STATES, history.getNumStates() );
+    EXPECT_FALSE ( history.restore ( 99, state, id ) );
+
+    for ( int i = 0; i < NUM_RESTORES; ++i )
+    {
+        const uint32_t index = rand() % NUM_STATES;
+
+        ASSERT_TRUE ( history.restore ( 2 * index + 100 + ( i % 2 ), state, id ) );
+        EXPECT_EQ ( 2u * index + 100, id );
+        ASSERT_TRUE ( state == states[index] );
+    }
+
+    // Restoring an older state discards the newer ones, so the next push continues from there
+    history.discardAfter ( 2 * 500 + 100 );
+
+    ASSERT_TRUE ( history.restore ( UINT64_MAX, state, id ) );
+    EXPECT_EQ ( 2u * 500 + 100, id );
+    EXPECT_TRUE ( state == states[500] );
+
+    vector<char> branch = recorder.step ( 12345 );
+    vector<char> buffer = history.getBuffer();
+    buffer = branch;
+    history.push ( 2 * 501 + 100, move ( buffer ) );
+    history.flush();
+
+    ASSERT_TRUE ( history.restore ( UINT64_MAX, state, id ) );
+    EXPECT_EQ ( 2u * 501 + 100, id );
+    EXPECT_TRUE ( state == branch );
+
+    ASSERT_TRUE ( history.restore ( 2 * 250 + 100, state, id ) );
+    EXPECT_TRUE ( state == states[250] );
+
+    history.clear();
+    EXPECT_EQ ( 0u, history.getNumStates() );
+    EXPECT_FALSE ( history.restore ( UINT64_MAX, state, id ) );
+}
+
+TEST ( StateHistory, DiscardNothing )
+{
+    StateRecorder recorder;
+    StateHistory history ( 64 * 1024 * 1024, 30 ), rolledBack ( 64 * 1024 * 1024, 30 );
+
+    for ( uint32_t i = 0; i < NUM_STATES; ++i )
+    {
+        const vector<char> state = recorder.step ( i );
+
+        vector<char> buffer = history.getBuffer();
+        buffer = state;
+        history.push ( i, move ( buffer ) );
+
+        // Every rollback discards the states after the rollback target, which are usually not in the history yet
+        buffer = rolledBack.getBuffer();
+        buffer = state;
+        rolledBack.push ( i, move ( buffer ) );
+        rolledBack.discardAfter ( i + rand() % 8 );
+    }
+
+    history.flush();
+    rolledBack.flush();
+
+    // No states are dropped while they are compressed, and no extra keyframes are started
+    EXPECT_EQ ( ( size_t ) NUM_STATES, rolledBack.getNumStates() );
+    EXPECT_EQ ( history.getCompressedSize(), rolledBack.getCompressedSize() );
+
+    vector<char> state, expected;
+    uint64_t id = 0;
+
+    for ( int i = 0; i < NUM_RESTORES; ++i )
+    {
+        const uint32_t index = rand() % NUM_STATES;
+
+        ASSERT_TRUE ( history.restore ( index, expected, id ) );
+        ASSERT_TRUE ( rolledBack.restore ( index, state, id ) );
+        EXPECT_EQ ( index, id );
+        ASSERT_TRUE ( state == expected );
+    }
+}
+
+TEST ( StateHistory, Budget )
+{
+    StateRecorder recorder;
+    StateHistory history ( 1024 * 1024, 20 );
+
+    vector<vector<char>> states;
+
+    for ( uint32_t i = 0; i < NUM_STATES; ++i )
+    {
+        states.push_back ( recorder.step ( i ) );
+
+        vector<char> buffer = history.getBuffer();
+        buffer = states.back();
+        history.push ( i, move ( buffer ) );
+    }
+
+    history.flush();
+
+    // Whole keyframe groups are dropped from the oldest
+    EXPECT_LE ( history.getCompressedSize(), 1024u * 1024 );
+    EXPECT_LT ( history.getNumStates(), ( size_t ) NUM_STATES );
+    EXPECT_LT ( 0u, history.getNumStates() );
+
+    const uint32_t oldest = NUM_STATES - history.getNumStates();
+
+    vector<char> state;
+    uint64_t id = 0;
+
+    EXPECT_FALSE ( history.restore ( oldest - 1, state, id ) );
+    ASSERT_TRUE ( history.restore ( oldest, state, id ) );
+    EXPECT_EQ ( oldest, id );
+    EXPECT_TRUE ( state == states[oldest] );
+}
+
+TEST ( StateHistory, CompressionPerf )
+{
+    StateRecorder recorder;
+    StateHistory history ( 256 * 1024 * 1024, 60 );
+
+    auto start = chrono::steady_clock::now();
+
+    for ( uint32_t i = 0; i < NUM_STATES; ++i )
+    {
+        vector<char> buffer = history.getBuffer();
+        buffer = recorder.step ( i );
+        history.push ( i, move ( buffer ) );
+    }
+
+    history.flush();
+
+    auto compressTime = chrono::steady_clock::now() - start;
+
+    vector<char> state;
+    uint64_t id = 0;
+    double maxRestore = 0, totalRestore = 0;
+
+    typedef chrono::duration<double, micro> us;
+
+    for ( int i = 0; i < NUM_RESTORES; ++i )
+    {
+        start = chrono::steady_clock::now();
+        ASSERT_TRUE ( history.restore ( rand() % NUM_STATES, state, id ) );
+        const double restoreTime = us ( chrono::steady_clock::now() - start ).count();
+
+        totalRestore += restoreTime;
+        maxRestore = max ( maxRestore, restoreTime );
+    }
+
+    PRINT ( "%u states: %u bytes -> %u bytes, ratio %.1f; compress %.2f us/state; restore avg %.2f us, max %.2f us",
+            ( uint32_t ) history.getNumStates(), ( uint32_t ) history.getUncompressedSize(),
+            ( uint32_t ) history.getCompressedSize(),
+            double ( history.getUncompressedSize() ) / history.getCompressedSize(),
+            us ( compressTime ).count() / NUM_STATES, totalRestore / NUM_RESTORES, maxRestore );
+}
+
+#endif // NOT RELEASE
@@ -42,7 +42,8 @@ using namespace std;
 #define CC_SLOW_TIMER_ADDR          ( ( uint16_t * ) 0x55D208 ) // Slowdown timer
 
 #define CC_GRAPHICS_ARRAY_ADDR      ( ( char * )     0x61E170 )
-#define CC_GRAPHICS_ARRAY_SIZE      ( 4000 * 0x60 )
+#define CC_GRAPHICS_ARRAY_COUNT     ( 4000 )
+#define CC_GRAPHICS_ELEMENT_SIZE    ( 0x60 )
 
 #define CC_GRAPHICS_COUNTER         ( ( uint32_t * ) 0x67BD78 )
 
@@ -196,8 +197,7 @@ static const vector<MemDump> miscAddrs =
     ( uint32_t * ) 0x563864,
     ( uint32_t * ) 0x56414C,
 
-    // Graphical effects
-    { CC_GRAPHICS_ARRAY_ADDR, CC_GRAPHICS_ARRAY_SIZE },
+    // Graphical effects, the array itself is saved as slots
     CC_GRAPHICS_COUNTER,
 
     CC_SUPER_FLASH_PAUSE_ADDR,
@@ -316,13 +316,23 @@ int main ( int argc, char *argv[] )
     allAddrs.append ( playerAddrs, 2 * CC_PLR_STRUCT_SIZE );    // Puppet 1
     allAddrs.append ( playerAddrs, 3 * CC_PLR_STRUCT_SIZE );    // Puppet 2
 
-    for ( size_t i = 0; i < CC_EFFECTS_ARRAY_COUNT; ++i )
-        allAddrs.append ( firstEffect, CC_EFFECT_ELEMENT_SIZE * i );
+    // Only the effects that aren't all zero are saved, the in use flag of an effect isn't known
+    allAddrs.append ( MemDumpSlots ( CC_EFFECTS_ARRAY_ADDR, CC_EFFECT_ELEMENT_SIZE, CC_EFFECTS_ARRAY_COUNT,
+                                     0, 0, firstEffect.ptrs ) );
+
+    // Same for the graphical effects
+    allAddrs.append ( MemDumpSlots ( CC_GRAPHICS_ARRAY_ADDR, CC_GRAPHICS_ELEMENT_SIZE, CC_GRAPHICS_ARRAY_COUNT, 0, 0 ) );
 
     allAddrs.update();
 
     LOG ( "allAddrs.totalSize=%u", allAddrs.totalSize );
 
+    for ( const MemDumpSlots& array : allAddrs.slots )
+    {
+        LOG ( "slots: { 0x%06X, %u x %u bytes }; maxDumpSize=%u",
+              array.addr, array.count, array.slotSize, array.getMaxDumpSize() );
+    }
+
     LOG ( "allAddrs:" );
     for ( const MemDump& mem : allAddrs.addrs )
     {
@@ -350,7 +360,12 @@ int main ( int argc, char *argv[] )
         }
     }
 
-    allAddrs.save ( argv[1] );
+    // The DLL uses the compiled layout in place
+    MemDumpLayout layout;
+    layout.compile ( allAddrs );
+    layout.save ( argv[1] );
+
+    LOG ( "layout: %u ops; %u regions", layout.plan.getNumOps(), layout.plan.getNumRegions() );
 
     Logger::get().deinitialize();
     return 0;
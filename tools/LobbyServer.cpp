@@ -0,0 +1,389 @@
+#include "LobbyList.hpp"
+#include "SocketManager.hpp"
+#include "TimerManager.hpp"
+#include "EventManager.hpp"
+#include "TcpSocket.hpp"
+#include "Timer.hpp"
+#include "Logger.hpp"
+#include "StringUtils.hpp"
+#include "Exceptions.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+
+// Native lobby server, a drop in replacement for the default lobby of scripts/lobbyserver.py.
+// Also has a load generator mode that connects many clients which poll LIST as fast as they get replies,
+// or that subscribe and get the changes pushed to them instead.
+
+
+#define LOG_FILE                "lobbyserver.log"
+
+#define DEFAULT_PORT            ( 3502 )
+
+// Hosts are dropped after 10 minutes like the python server
+#define HOST_EXPIRY             ( 600 * 1000 )
+#define EXPIRY_INTERVAL         ( 5 * 1000 )
+
+#define DEFAULT_MAX_HOSTS       ( 10000 )
+
+#define DEFAULT_LOAD_CLIENTS    ( 1000 )
+#define DEFAULT_LOAD_SECONDS    ( 10 )
+
+// Fraction of load clients that also host
+#define LOAD_HOST_PERCENT       ( 10 )
+
+
+class LobbyServer : public Socket::Owner, public Timer::Owner
+{
+public:
+
+    LobbyServer ( uint16_t port, size_t listLimit, size_t maxHosts )
+        : _list ( listLimit, maxHosts ), _expiryTimer ( this )
+    {
+        _server = TcpSocket::listen ( this, port, true ); // Raw socket
+        _expiryTimer.start ( EXPIRY_INTERVAL );
+
+        PRINT ( "Listening on port %u", _server->address.port );
+    }
+
+private:
+
+    struct Client
+    {
+        SocketPtr socket;
+        uint32_t id;
+    };
+
+    SocketPtr _server;
+
+    // Clients by socket, the id is what the lobby list knows them by
+    unordered_map<Socket *, Client> _clients;
+
+    uint32_t _nextId = 0;
+
+    LobbyList _list;
+
+    Timer _expiryTimer;
+
+    void drop ( Socket *socket )
+    {
+        auto it = _clients.find ( socket );
+
+        if ( it == _clients.end() )
+            return;
+
+        _list.unhost ( it->second.id );
+        _list.unsubscribe ( it->second.id );
+
+        // Keep the socket alive until we return from the socket callback
+        SocketPtr keepAlive = it->second.socket;
+        _clients.erase ( it );
+        keepAlive->disconnect();
+    }
+
+    // Send the changes to every subscriber, once per event so changes that happen together go out in one send
+    void push()
+    {
+        while ( !_list.getPushes().empty() )
+        {
+            const string pushes = _list.getPushes();
+            _list.clearPushes();
+
+            vector<Socket *> failed;
+
+            for ( const auto& kv : _clients )
+            {
+                if ( _list.isSubscribed ( kv.second.id ) && !kv.first->send ( &pushes[0], pushes.size() ) )
+                    failed.push_back ( kv.first );
+            }
+
+            // Dropping a host pushes its removal too
+            for ( Socket *socket : failed )
+                drop ( socket );
+        }
+    }
+
+    void socketAccepted ( Socket *serverSocket ) override
+    {
+        SocketPtr socket = serverSocket->accept ( this );
+
+        if ( !socket )
+            return;
+
+        LOG ( "Connection from %s", socket->address );
+
+        _clients[socket.get()] = { socket, _nextId++ };
+    }
+
+    void socketConnected ( Socket *socket ) override {}
+
+    void socketDisconnected ( Socket *socket ) override
+    {
+        LOG ( "Disconnected %s", socket->address );
+
+        drop ( socket );
+        push();
+    }
+
+    void socketRead ( Socket *socket, const MsgPtr& msg, const IpAddrPort& address ) override {}
+
+    // Each read is one request, the same as the python server
+    void socketRead ( Socket *socket, const char *bytes, size_t len, const IpAddrPort& address ) override
+    {
+        auto it = _clients.find ( socket );
+
+        if ( it == _clients.end() )
+            return;
+
+        const string *response = 0;
+
+        if ( !_list.handle ( it->second.id, socket->address.addr, bytes, len, TimerManager::get().getNow(),
+                             response ) )
+        {
+            LOG ( "Invalid request from %s: '%s'", socket->address, string ( bytes, len ) );
+            drop ( socket );
+            push();
+            return;
+        }
+
+        if ( response && !socket->send ( &( *response ) [0], response->size() ) )
+            drop ( socket );
+
+        push();
+    }
+
+    void timerExpired ( Timer *timer ) override
+    {
+        const size_t count = _list.expire ( TimerManager::get().getNow ( true ), HOST_EXPIRY );
+
+        if ( count )
+            LOG ( "Expired %u hosts", count );
+
+        push();
+
+        LOG ( "%u clients; %u subscribers; %u hosts; %u snapshots; version %llu", _clients.size(),
+              _list.getNumSubscribers(), _list.getNumHosts(), _list.getNumSnapshots(), _list.getVersion() );
+
+        _expiryTimer.start ( EXPIRY_INTERVAL );
+    }
+};
+
+
+// Load generator, each client sends its next request as soon as the previous one is answered.
+// When subscribing, only the hosting clients keep sending requests, hosting again each time.
+class LoadGenerator : public Socket::Owner, public Timer::Owner
+{
+public:
+
+    LoadGenerator ( const IpAddrPort& address, size_t numClients, uint64_t seconds, bool subscribe )
+        : _subscribe ( subscribe ), _clients ( numClients ), _endTimer ( this )
+    {
+        for ( size_t i = 0; i < numClients; ++i )
+        {
+            Client& client = _clients[i];
+            client.index = i;
+            client.socket = TcpSocket::connect ( this, address, true ); // Raw socket
+            client.hosting = ( i % 100 < LOAD_HOST_PERCENT );
+            _sockets[client.socket.get()] = &client;
+        }
+
+        _start = TimerManager::get().getNow ( true );
+        _endTimer.start ( seconds * 1000 );
+    }
+
+    void report() const
+    {
+        const double seconds = ( TimerManager::get().getNow ( true ) - _start ) / 1000.0;
+
+        PRINT ( "%u / %u clients connected; %u disconnected", _numConnected, _clients.size(), _numDisconnected );
+        PRINT ( "%u responses in %.2f s: %.0f responses / s; average latency %.3f ms; max latency %u ms",
+                _numResponses, seconds, _numResponses / seconds,
+                _numResponses ? double ( _totalLatency ) / _numResponses : 0.0, uint32_t ( _maxLatency ) );
+        PRINT ( "%u reads; %.1f KB / s received", _numReads, _numBytes / seconds / 1024 );
+    }
+
+private:
+
+    struct Client
+    {
+        SocketPtr socket;
+
+        size_t index = 0;
+
+        bool hosting = false;
+
+        // Time the last request was sent
+        uint64_t sent = 0;
+    };
+
+    // Subscribed clients only request again after their own HOST is answered, so the changes of the hosting
+    // clients are pushed to everyone
+    const bool _subscribe;
+
+    // Not resized after construction, so the pointers in _sockets stay valid
+    vector<Client> _clients;
+
+    unordered_map<Socket *, Client *> _sockets;
+
+    Timer _endTimer;
+
+    uint64_t _start = 0;
+
+    uint32_t _numConnected = 0, _numDisconnected = 0, _numResponses = 0;
+
+    uint64_t _totalLatency = 0, _maxLatency = 0;
+
+    uint64_t _numReads = 0, _numBytes = 0;
+
+    void host ( Client& client )
+    {
+        request ( client, format ( "HOST,Load%u|:%u", client.index, 10000 + client.index ) );
+    }
+
+    void request ( Client& client, const string& request )
+    {
+        client.sent = TimerManager::get().getNow();
+        client.socket->send ( &request[0], request.size() );
+    }
+
+    void socketAccepted ( Socket *serverSocket ) override {}
+
+    void socketConnected ( Socket *socket ) override
+    {
+        Client& client = *_sockets[socket];
+        ++_numConnected;
+
+        if ( _subscribe )
+            request ( client, LOBBY_SUBSCRIBE_REQUEST );
+        else if ( client.hosting )
+            host ( client );
+        else
+            request ( client, "LIST,none" );
+    }
+
+    void socketDisconnected ( Socket *socket ) override
+    {
+        ++_numDisconnected;
+    }
+
+    void socketRead ( Socket *socket, const MsgPtr& msg, const IpAddrPort& address ) override {}
+
+    void socketRead ( Socket *socket, const char *bytes, size_t len, const IpAddrPort& address ) override
+    {
+        Client& client = *_sockets[socket];
+
+        ++_numReads;
+        _numBytes += len;
+
+        // Subscribers also get pushes, only the snapshot and the HOST responses answer a request
+        if ( _subscribe )
+        {
+            const string data ( bytes, len );
+
+            if ( data.find ( "SNAP\x1f" ) == string::npos && data.find ( "HOST\x1f" ) == string::npos )
+                return;
+        }
+
+        const uint64_t latency = TimerManager::get().getNow ( true ) - client.sent;
+
+        _totalLatency += latency;
+        _maxLatency = max ( _maxLatency, latency );
+        ++_numResponses;
+
+        // Hosting again pushes an update to every subscriber
+        if ( !_subscribe )
+            request ( client, "LIST,none" );
+        else if ( client.hosting )
+            host ( client );
+    }
+
+    void timerExpired ( Timer *timer ) override
+    {
+        EventManager::get().stop();
+    }
+};
+
+
+static void printUsage()
+{
+    PRINT ( "Usage: lobbyserver [options]\n"
+            "  --port N         Port to listen on, defaults to %u\n"
+            "  --limit N        Max entries in a LIST response, defaults to %u\n"
+            "  --max-hosts N    Max number of hosts, 0 for unlimited, defaults to %u\n"
+            "  --load ADDR      Run the load generator against the server at ADDR instead\n"
+            "  --clients N      Number of load generator clients, defaults to %u\n"
+            "  --seconds N      Load generator duration, defaults to %u\n"
+            "  --subscribe      Load generator clients subscribe instead of polling LIST",
+            DEFAULT_PORT, LOBBY_LIST_LIMIT, DEFAULT_MAX_HOSTS, DEFAULT_LOAD_CLIENTS, DEFAULT_LOAD_SECONDS );
+}
+
+
+int main ( int argc, char *argv[] )
+{
+    uint16_t port = DEFAULT_PORT;
+    size_t listLimit = LOBBY_LIST_LIMIT;
+    size_t maxHosts = DEFAULT_MAX_HOSTS;
+    string loadAddress;
+    size_t numClients = DEFAULT_LOAD_CLIENTS;
+    uint64_t seconds = DEFAULT_LOAD_SECONDS;
+    bool subscribe = false;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        const string arg = argv[i];
+
+        if ( arg == "--port" && i + 1 < argc )
+            port = lexical_cast<uint16_t> ( argv[++i] );
+        else if ( arg == "--limit" && i + 1 < argc )
+            listLimit = lexical_cast<size_t> ( argv[++i] );
+        else if ( arg == "--max-hosts" && i + 1 < argc )
+            maxHosts = lexical_cast<size_t> ( argv[++i] );
+        else if ( arg == "--load" && i + 1 < argc )
+            loadAddress = argv[++i];
+        else if ( arg == "--clients" && i + 1 < argc )
+            numClients = lexical_cast<size_t> ( argv[++i] );
+        else if ( arg == "--seconds" && i + 1 < argc )
+            seconds = lexical_cast<uint64_t> ( argv[++i] );
+        else if ( arg == "--subscribe" )
+            subscribe = true;
+        else
+        {
+            printUsage();
+            return -1;
+        }
+    }
+
+    Logger::get().initialize ( LOG_FILE, LOG_LOCAL_TIME );
+    TimerManager::get().initialize();
+    SocketManager::get().initialize();
+
+    try
+    {
+        if ( loadAddress.empty() )
+        {
+            LobbyServer server ( port, listLimit, maxHosts );
+            EventManager::get().start();
+        }
+        else
+        {
+            LoadGenerator generator ( loadAddress, numClients, seconds, subscribe );
+            EventManager::get().start();
+            generator.report();
+        }
+    }
+    catch ( const Exception& exc )
+    {
+        PRINT ( "%s", exc );
+    }
+
+    SocketManager::get().deinitialize();
+    TimerManager::get().deinitialize();
+    Logger::get().deinitialize();
+    return 0;
+}
@@ -0,0 +1,555 @@
+#include "ReplayCreator.hpp"
+#include "StringUtils.hpp"
+#include "Thread.hpp"
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+// Batch replay fixer / analyzer, processes a whole folder of .rep / .repraw files in parallel.
+// Each .rep is matched with the .repraw of the same name, eg foo.rep and foo.repraw.
+
+
+#define FRAMES_PER_SECOND ( 60.0 )
+
+
+struct Options
+{
+    string folder;
+    string compareFolder;
+    string outputFile;
+    size_t numThreads = 0;
+    bool fix = false;
+    bool json = false;
+};
+
+struct RoundStats
+{
+    uint32_t frames = 0;
+    uint32_t p1Inputs = 0, p2Inputs = 0;
+    uint32_t rngStates = 0;
+
+    // Number of different inputs vs the fixed / compared replay, and the first one (-1 if none)
+    uint32_t inputDiffs = 0;
+    int firstInputDiff = -1;
+
+    // First differing RNG state vs the compared replay (-1 if none)
+    int firstRngDiff = -1;
+};
+
+struct FileStats
+{
+    string name;
+    string error;
+    bool hasRep = false, hasRaw = false, fixed = false, compared = false;
+    vector<RoundStats> rounds;
+};
+
+
+static uint32_t sumDurations ( const vector<ReplayCreator::Input>& inputs )
+{
+    uint32_t frames = 0;
+    for ( const ReplayCreator::Input& in : inputs )
+        frames += in.duration;
+    return frames;
+}
+
+static void diffInputs ( const vector<ReplayCreator::Input>& a, const vector<ReplayCreator::Input>& b, RoundStats& stats )
+{
+    const size_t n = max ( a.size(), b.size() );
+
+    for ( size_t i = 0; i < n; ++i )
+    {
+        if ( i < a.size() && i < b.size() && a[i] == b[i] )
+            continue;
+
+        if ( stats.firstInputDiff < 0 )
+            stats.firstInputDiff = i;
+
+        ++stats.inputDiffs;
+    }
+}
+
+static void diffReplays ( const ReplayCreator::ReplayFile& a, const ReplayCreator::ReplayFile& b, FileStats& stats,
+                          bool compareRng )
+{
+    for ( size_t r = 0; r < stats.rounds.size() && r < a.rounds.size() && r < b.rounds.size(); ++r )
+    {
+        RoundStats& round = stats.rounds[r];
+        diffInputs ( a.rounds[r].p1Inputs, b.rounds[r].p1Inputs, round );
+        diffInputs ( a.rounds[r].p2Inputs, b.rounds[r].p2Inputs, round );
+
+        if ( !compareRng )
+            continue;
+
+        const vector<uint32_t>& ra = a.rounds[r].rngstates;
+        const vector<uint32_t>& rb = b.rounds[r].rngstates;
+
+        for ( size_t i = 0; i < max ( ra.size(), rb.size() ); ++i )
+        {
+            if ( i < ra.size() && i < rb.size() && ra[i] == rb[i] )
+                continue;
+
+            round.firstRngDiff = i;
+            break;
+        }
+    }
+}
+
+// Frame counts of a .repraw file, the format written by ReplayExporter
+static bool loadRawRounds ( const string& path, vector<RoundStats>& rounds )
+{
+    ifstream file ( path.c_str() );
+    string line;
+
+    if ( !getline ( file, line ) )
+        return false;
+
+    const int count = lexical_cast<int> ( line, -1 );
+
+    if ( count < 0 )
+        return false;
+
+    for ( int i = 0; i < count; ++i )
+    {
+        if ( !getline ( file, line ) )
+            return false;
+
+        RoundStats round;
+        round.frames = lexical_cast<uint32_t> ( line );
+
+        for ( uint32_t j = 0; j < round.frames; ++j )
+            if ( !getline ( file, line ) )
+                return false;
+
+        rounds.push_back ( round );
+    }
+
+    return true;
+}
+
+static bool fileExists ( const string& path )
+{
+    return access ( path.c_str(), F_OK ) == 0;
+}
+
+static void processFile ( const Options& options, FileStats& stats )
+{
+    const string base = options.folder + "/" + stats.name;
+
+    ReplayCreator creator;
+    ReplayCreator::ReplayFile replay;
+
+    if ( !stats.hasRep )
+    {
+        if ( !loadRawRounds ( base + ".repraw", stats.rounds ) )
+            stats.error = "invalid repraw";
+        return;
+    }
+
+    if ( !creator.load ( &replay, ( base + ".rep" ).c_str() ) )
+    {
+        stats.error = "invalid rep";
+        return;
+    }
+
+    for ( const ReplayCreator::Round& r : replay.rounds )
+    {
+        RoundStats round;
+        round.frames = sumDurations ( r.p1Inputs );
+        round.p1Inputs = r.p1Inputs.size();
+        round.p2Inputs = r.p2Inputs.size();
+        round.rngStates = r.rngstates.size();
+        stats.rounds.push_back ( round );
+    }
+
+    if ( options.fix && stats.hasRaw )
+    {
+        vector<RoundStats> rawRounds;
+
+        if ( !loadRawRounds ( base + ".repraw", rawRounds ) || rawRounds.size() > replay.rounds.size() )
+        {
+            stats.error = "repraw does not match rep";
+            return;
+        }
+
+        ReplayCreator::ReplayFile fixedReplay = replay;
+        creator.fixReplay ( &fixedReplay, ( base + ".repraw" ).c_str(), 0 );
+        creator.dump ( fixedReplay, ( base + ".fixed.rep" ).c_str() );
+
+        diffReplays ( replay, fixedReplay, stats, false );
+        stats.fixed = true;
+        return;
+    }
+
+    if ( !options.compareFolder.empty() )
+    {
+        const string other = options.compareFolder + "/" + stats.name + ".rep";
+
+        if ( !fileExists ( other ) )
+            return;
+
+        ReplayCreator::ReplayFile otherReplay;
+
+        if ( !creator.load ( &otherReplay, other.c_str() ) )
+        {
+            stats.error = "invalid compared rep";
+            return;
+        }
+
+        diffReplays ( replay, otherReplay, stats, true );
+        stats.compared = true;
+    }
+}
+
+
+// Work stealing pool: each worker pops from the back of its own deque, and steals from the front of the others
+class WorkStealingPool
+{
+public:
+
+    WorkStealingPool ( const Options& options, vector<FileStats>& files, size_t numThreads )
+        : _options ( options ), _files ( files ), _queues ( numThreads )
+    {
+        for ( size_t i = 0; i < files.size(); ++i )
+            _queues[i % numThreads].tasks.push_back ( i );
+
+        for ( size_t i = 0; i < numThreads; ++i )
+            _workers.push_back ( shared_ptr<Worker> ( new Worker ( *this, i ) ) );
+    }
+
+    void run()
+    {
+        for ( auto& worker : _workers )
+            worker->start();
+
+        for ( auto& worker : _workers )
+            worker->join();
+    }
+
+private:
+
+    struct Queue
+    {
+        Mutex mutex;
+        deque<size_t> tasks;
+    };
+
+    struct Worker : public Thread
+    {
+        WorkStealingPool& pool;
+        const size_t id;
+
+        Worker ( WorkStealingPool& pool, size_t id ) : pool ( pool ), id ( id ) {}
+
+        void run() override
+        {
+            size_t task;
+
+            while ( pool.next ( id, task ) )
+                processFile ( pool._options, pool._files[task] );
+        }
+    };
+
+    const Options& _options;
+
+    vector<FileStats>& _files;
+
+    vector<Queue> _queues;
+
+    vector<shared_ptr<Worker>> _workers;
+
+    bool next ( size_t id, size_t& task )
+    {
+        {
+            Lock lock ( _queues[id].mutex );
+
+            if ( !_queues[id].tasks.empty() )
+            {
+                task = _queues[id].tasks.back();
+                _queues[id].tasks.pop_back();
+                return true;
+            }
+        }
+
+        // No new tasks are ever added, so one pass over the other queues is enough
+        for ( size_t i = 1; i < _queues.size(); ++i )
+        {
+            Queue& victim = _queues[ ( id + i ) % _queues.size()];
+            Lock lock ( victim.mutex );
+
+            if ( !victim.tasks.empty() )
+            {
+                task = victim.tasks.front();
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+
+        return false;
+    }
+};
+
+
+// Quote a CSV field if it contains a separator, quote or line break, doubling any quotes (RFC 4180)
+static string quoteCsv ( const string& field )
+{
+    if ( field.find_first_of ( ",\"\r\n" ) == string::npos )
+        return field;
+
+    string out = "\"";
+
+    for ( char c : field )
+    {
+        if ( c == '"' )
+            out += '"';
+        out += c;
+    }
+
+    return out + "\"";
+}
+
+// Escape a string for use inside a JSON string literal
+static string escapeJson ( const string& str )
+{
+    string out;
+    out.reserve ( str.size() );
+
+    for ( char c : str )
+    {
+        switch ( c )
+        {
+            case '"':
+                out += "\\\"";
+                break;
+
+            case '\\':
+                out += "\\\\";
+                break;
+
+            case '\n':
+                out += "\\n";
+                break;
+
+            case '\r':
+                out += "\\r";
+                break;
+
+            case '\t':
+                out += "\\t";
+                break;
+
+            default:
+                if ( ( unsigned char ) c < 0x20 )
+                    out += format ( "\\u%04x", ( uint32_t ) ( unsigned char ) c );
+                else
+                    out += c;
+                break;
+        }
+    }
+
+    return out;
+}
+
+static string formatCsv ( const vector<FileStats>& files )
+{
+    string out = "file,round,frames,p1_inputs,p2_inputs,inputs_per_second,rng_states,fixed,compared,"
+                 "input_diffs,first_input_diff,first_rng_diff,error\n";
+
+    for ( const FileStats& file : files )
+    {
+        // Appended as is, since format collapses any %% in a string argument
+        const string name = quoteCsv ( file.name ), error = quoteCsv ( file.error );
+
+        if ( file.rounds.empty() )
+            out += name + ",,,,,,,,,,,," + error + "\n";
+
+        for ( size_t i = 0; i < file.rounds.size(); ++i )
+        {
+            const RoundStats& r = file.rounds[i];
+            const double seconds = r.frames / FRAMES_PER_SECOND;
+
+            out += name + format ( ",%u,%u,%u,%u,%.2f,%u,%u,%u,%u,%d,%d,",
+                                   ( uint32_t ) i, r.frames, r.p1Inputs, r.p2Inputs,
+                                   seconds > 0 ? ( r.p1Inputs + r.p2Inputs ) / seconds : 0.0,
+                                   r.rngStates, file.fixed, file.compared,
+                                   r.inputDiffs, r.firstInputDiff, r.firstRngDiff ) + error + "\n";
+        }
+    }
+
+    return out;
+}
+
+static string formatJson ( const vector<FileStats>& files )
+{
+    string out = "[\n";
+
+    for ( size_t f = 0; f < files.size(); ++f )
+    {
+        const FileStats& file = files[f];
+
+        // Appended as is, since format collapses any %% in a string argument
+        out += "  { \"file\": \"" + escapeJson ( file.name ) + "\", \"fixed\": " + ( file.fixed ? "true" : "false" )
+               + ", \"compared\": " + ( file.compared ? "true" : "false" )
+               + ", \"error\": \"" + escapeJson ( file.error ) + "\", \"rounds\": [";
+
+        for ( size_t i = 0; i < file.rounds.size(); ++i )
+        {
+            const RoundStats& r = file.rounds[i];
+            const double seconds = r.frames / FRAMES_PER_SECOND;
+
+            out += format ( "%s\n    { \"frames\": %u, \"p1Inputs\": %u, \"p2Inputs\": %u, \"inputsPerSecond\": %.2f, "
+                            "\"rngStates\": %u, \"inputDiffs\": %u, \"firstInputDiff\": %d, \"firstRngDiff\": %d }",
+                            i ? "," : "", r.frames, r.p1Inputs, r.p2Inputs,
+                            seconds > 0 ? ( r.p1Inputs + r.p2Inputs ) / seconds : 0.0,
+                            r.rngStates, r.inputDiffs, r.firstInputDiff, r.firstRngDiff );
+        }
+
+        out += format ( "%s] }%s\n", file.rounds.empty() ? "" : "\n  ", f + 1 < files.size() ? "," : "" );
+    }
+
+    return out + "]\n";
+}
+
+static bool endsWith ( const string& str, const string& suffix )
+{
+    return str.size() >= suffix.size() && str.compare ( str.size() - suffix.size(), suffix.size(), suffix ) == 0;
+}
+
+static void printUsage()
+{
+    PRINT ( "Usage: replaytool [options] FOLDER\n"
+            "  --fix            Fix each .rep with the matching .repraw, writes NAME.fixed.rep\n"
+            "  --compare DIR    Diff inputs and RNG states against the .rep of the same name in DIR, not with --fix\n"
+            "  --threads N      Number of worker threads, defaults to the number of CPUs\n"
+            "  --json           Output JSON instead of CSV\n"
+            "  --out FILE       Write the output to FILE instead of stdout" );
+}
+
+
+int main ( int argc, char *argv[] )
+{
+    Options options;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        const string arg = argv[i];
+
+        if ( arg == "--fix" )
+            options.fix = true;
+        else if ( arg == "--json" )
+            options.json = true;
+        else if ( arg == "--compare" && i + 1 < argc )
+            options.compareFolder = argv[++i];
+        else if ( arg == "--threads" && i + 1 < argc )
+            options.numThreads = lexical_cast<size_t> ( argv[++i] );
+        else if ( arg == "--out" && i + 1 < argc )
+            options.outputFile = argv[++i];
+        else if ( options.folder.empty() && arg.compare ( 0, 2, "--" ) != 0 )
+            options.folder = arg;
+        else
+        {
+            printUsage();
+            return -1;
+        }
+    }
+
+    if ( options.folder.empty() )
+    {
+        printUsage();
+        return -1;
+    }
+
+    // Both count their diffs in the same columns, and a fixed replay would be reported without being compared
+    if ( options.fix && !options.compareFolder.empty() )
+    {
+        PRINT ( "--fix and --compare can't be used together" );
+        printUsage();
+        return -1;
+    }
+
+    DIR *dir = opendir ( options.folder.c_str() );
+
+    if ( !dir )
+    {
+        PRINT ( "Failed to open folder: %s", options.folder );
+        return -1;
+    }
+
+    // Group .rep and .repraw files by name
+    vector<FileStats> files;
+    vector<string> names;
+
+    for ( dirent *entry = readdir ( dir ); entry; entry = readdir ( dir ) )
+    {
+        const string name = entry->d_name;
+
+        if ( endsWith ( name, ".fixed.rep" ) )
+            continue;
+
+        if ( endsWith ( name, ".rep" ) )
+            names.push_back ( name.substr ( 0, name.size() - 4 ) + "\x01" );
+        else if ( endsWith ( name, ".repraw" ) )
+            names.push_back ( name.substr ( 0, name.size() - 7 ) + "\x02" );
+    }
+
+    closedir ( dir );
+
+    sort ( names.begin(), names.end() );
+
+    for ( const string& name : names )
+    {
+        const string stem = name.substr ( 0, name.size() - 1 );
+
+        if ( files.empty() || files.back().name != stem )
+        {
+            files.push_back ( FileStats() );
+            files.back().name = stem;
+        }
+
+        if ( name.back() == '\x01' )
+            files.back().hasRep = true;
+        else
+            files.back().hasRaw = true;
+    }
+
+    if ( options.numThreads == 0 )
+        options.numThreads = max ( 1L, sysconf ( _SC_NPROCESSORS_ONLN ) );
+
+    options.numThreads = max ( size_t ( 1 ), min ( options.numThreads, files.size() ) );
+
+    WorkStealingPool pool ( options, files, options.numThreads );
+    pool.run();
+
+    const string output = ( options.json ? formatJson ( files ) : formatCsv ( files ) );
+
+    if ( options.outputFile.empty() )
+    {
+        fwrite ( output.data(), 1, output.size(), stdout );
+        return 0;
+    }
+
+    FILE *file = fopen ( options.outputFile.c_str(), "wb" );
+
+    if ( !file )
+    {
+        PRINT ( "Failed to open output file: %s", options.outputFile );
+        return -1;
+    }
+
+    fwrite ( output.data(), 1, output.size(), file );
+    fclose ( file );
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include "RollbackSimulator.hpp"
+#include "StringUtils.hpp"
+
+#include <string>
+
+using namespace std;
+
+
+// Headless rollback benchmark, runs two simulated peers over a lossy, jittery link and reports how much rollback
+// work was done and what it cost. Runs natively, so it can be used for profiling and in CI.
+
+
+static void printUsage()
+{
+    const RollbackSimulator::Config config;
+
+    PRINT ( "Usage: rollbackbench [options]\n"
+            "  --frames N       Frames played by each peer, defaults to %u\n"
+            "  --delay N        Input delay in frames, defaults to %u\n"
+            "  --latency MS     One way latency, defaults to %.0f\n"
+            "  --jitter MS      Max random extra latency, defaults to %.0f\n"
+            "  --loss F         Fraction of input packets lost, defaults to %.2f\n"
+            "  --seed N         Random seed, defaults to %u\n"
+            "  --desync N       Corrupt the state of one peer at this frame, to check desync detection",
+            config.frames, config.inputDelay, config.latency, config.jitter, config.loss, config.seed );
+}
+
+
+int main ( int argc, char *argv[] )
+{
+    RollbackSimulator::Config config;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        const string arg = argv[i];
+
+        if ( arg == "--frames" && i + 1 < argc )
+            config.frames = lexical_cast<uint32_t> ( argv[++i] );
+        else if ( arg == "--delay" && i + 1 < argc )
+            config.inputDelay = lexical_cast<uint32_t> ( argv[++i] );
+        else if ( arg == "--latency" && i + 1 < argc )
+            config.latency = lexical_cast<double> ( argv[++i] );
+        else if ( arg == "--jitter" && i + 1 < argc )
+            config.jitter = lexical_cast<double> ( argv[++i] );
+        else if ( arg == "--loss" && i + 1 < argc )
+            config.loss = lexical_cast<double> ( argv[++i] );
+        else if ( arg == "--seed" && i + 1 < argc )
+            config.seed = lexical_cast<uint32_t> ( argv[++i] );
+        else if ( arg == "--desync" && i + 1 < argc )
+            config.desyncFrame = lexical_cast<uint32_t> ( argv[++i] );
+        else
+        {
+            printUsage();
+            return -1;
+        }
+    }
+
+    if ( config.frames == 0 )
+    {
+        printUsage();
+        return -1;
+    }
+
+    const RollbackSimulator::Stats stats = RollbackSimulator ( config ).run();
+
+    PRINT ( "%u frames (%.1f s) per peer; delay %u; latency %.0f+%.0f ms; loss %.0f%%; %u / %u packets lost",
+            stats.frames, stats.seconds, config.inputDelay, config.latency, config.jitter, config.loss * 100,
+            stats.packetsLost, stats.packetsSent );
+
+    PRINT ( "%u rollbacks: %.2f rollbacks / s per peer; %u re-simulated frames; average depth %.2f; max depth %u; "
+            "%u stalls",
+            stats.rollbacks, stats.seconds ? stats.rollbacks / stats.seconds / 2 : 0.0, stats.resimulatedFrames,
+            stats.rollbacks ? double ( stats.resimulatedFrames ) / stats.rollbacks : 0.0, stats.maxRollbackDepth,
+            stats.stalls );
+
+    PRINT ( "%u byte states; save %.2f us; load %.2f us; step %.2f us",
+            stats.stateSize, stats.saves ? stats.saveTime / stats.saves : 0.0,
+            stats.loads ? stats.loadTime / stats.loads : 0.0, stats.steps ? stats.stepTime / stats.steps : 0.0 );
+
+    PRINT ( "Rollback depth (frames): %s", stats.rollbackDepths.str() );
+    PRINT ( "Save time (ns): %s", stats.saveTimes.str() );
+    PRINT ( "Load time (ns): %s", stats.loadTimes.str() );
+
+    PRINT ( "%.3f s wall time; %.0f simulated frames / s",
+            stats.wallTime, stats.wallTime ? stats.steps / stats.wallTime : 0.0 );
+
+    if ( stats.desynced )
+    {
+        PRINT ( "Desync detected at frame %u in region %d", uint32_t ( stats.desyncFrame ), stats.desyncRegion );
+    }
+    else
+    {
+        PRINT ( "No desync detected; final states %s", stats.statesMatch ? "match" : "DIFFER" );
+    }
+
+    // Non-zero exit status for CI if the peers diverged without being asked to
+    return ( !config.desyncFrame && ( stats.desynced || !stats.statesMatch ) ) ? 1 : 0;
+}
@@ -0,0 +1,95 @@
+#include "BlockDelta.hpp"
+#include "StringUtils.hpp"
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+// Writes the manifest of an unpacked release folder, so the updater can download only the changed blocks of each
+// file. The folder is uploaded next to the release archive, eg cccaster.v3.1/ next to cccaster.v3.1.zip.
+
+
+static void listFiles ( const string& folder, const string& prefix, vector<string>& files )
+{
+    DIR *dir = opendir ( ( folder + prefix ).c_str() );
+
+    if ( !dir )
+        return;
+
+    for ( dirent *entry = readdir ( dir ); entry; entry = readdir ( dir ) )
+    {
+        const string name = entry->d_name;
+
+        if ( name == "." || name == ".." || prefix + name == UPDATE_MANIFEST_FILE )
+            continue;
+
+        struct stat st;
+
+        if ( stat ( ( folder + prefix + name ).c_str(), &st ) != 0 )
+            continue;
+
+        if ( S_ISDIR ( st.st_mode ) )
+            listFiles ( folder, prefix + name + "/", files );
+        else if ( S_ISREG ( st.st_mode ) )
+            files.push_back ( prefix + name );
+    }
+
+    closedir ( dir );
+}
+
+int main ( int argc, char *argv[] )
+{
+    if ( argc < 2 )
+    {
+        PRINT ( "Usage: updatemanifest FOLDER\n"
+                "  Writes FOLDER/" UPDATE_MANIFEST_FILE " with the hashes of every file in FOLDER" );
+        return -1;
+    }
+
+    string folder = argv[1];
+
+    if ( folder.back() != '/' )
+        folder += '/';
+
+    vector<string> files;
+    listFiles ( folder, "", files );
+    sort ( files.begin(), files.end() );
+
+    UpdateManifest manifest;
+
+    for ( const string& file : files )
+    {
+        ifstream fin ( ( folder + file ).c_str(), ios::binary );
+        stringstream ss;
+        ss << fin.rdbuf();
+
+        if ( !fin.good() )
+        {
+            PRINT ( "Failed to read: %s", folder + file );
+            return -1;
+        }
+
+        manifest.files.push_back ( UpdateManifest::hashData ( file, ss.str() ) );
+    }
+
+    ofstream fout ( ( folder + UPDATE_MANIFEST_FILE ).c_str(), ios::binary );
+    fout << manifest.str();
+    fout.close();
+
+    if ( !fout.good() )
+    {
+        PRINT ( "Failed to write: %s", folder + UPDATE_MANIFEST_FILE );
+        return -1;
+    }
+
+    PRINT ( "%u files; %u bytes", manifest.files.size(), manifest.getTotalSize() );
+    return 0;
+}
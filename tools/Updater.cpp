@@ -10,6 +10,8 @@ using namespace std;
 
 #define UNZIP "cccaster\\unzip.exe -o "
 
+#define COPY_FOLDER "xcopy /E /Y /Q /I "
+
 
 int main ( int argc, char *argv[] )
 {
@@ -57,7 +59,11 @@ int main ( int argc, char *argv[] )
 
     SetCurrentDirectory ( appDir.c_str() );
 
-    system ( ( UNZIP + archive ).c_str() );
+    // A folder holds the files that were patched from block deltas
+    if ( !archive.empty() && ( archive.back() == '\\' || archive.back() == '/' ) )
+        system ( ( COPY_FOLDER "\"" + archive + "*\" ." ).c_str() );
+    else
+        system ( ( UNZIP + archive ).c_str() );
 
     system ( ( "start \"\" " + binary ).c_str() );
 